@@ -10,6 +10,74 @@ UiDriver.registerEventHandler("C_FUN_GET_VALUE", function(msg, data, prevReturn)
     return editor.getValue("\n");
 });
 
+/* Returns a piece of the document, so that large documents can be
+   read without copying them all at once.
+
+   data: {from, length}, in characters. Line breaks count as one.
+   returns: {text, sequence}. The sequence changes whenever the
+            document is modified, see C_FUN_GET_CHANGE_SEQUENCE.
+*/
+UiDriver.registerEventHandler("C_FUN_GET_VALUE_CHUNK", function(msg, data, prevReturn) {
+    var from = editor.posFromIndex(data.from);
+    var to = editor.posFromIndex(data.from + data.length);
+    return {
+        text: editor.getRange(from, to, "\n"),
+        sequence: changeSequence
+    };
+});
+
+/* Replaces ranges of whole lines, leaving the rest of the document
+   and the undo history untouched. All the changes are applied as a
+   single undoable operation.
+
+   data: array of {from, to, lines}, sorted by line. The lines in
+         [from, to) of the current document are replaced by "lines".
+*/
+UiDriver.registerEventHandler("C_CMD_REPLACE_LINES", function(msg, data, prevReturn) {
+    editor.operation(function() {
+        // Go backwards, so that the line numbers of the remaining changes stay valid
+        for (var i = data.length - 1; i >= 0; i--) {
+            var change = data[i];
+            var count = editor.lineCount();
+            var text = change.lines.join("\n");
+            var from, to;
+
+            if (change.to < count) {
+                from = {line: change.from, ch: 0};
+                to = {line: change.to, ch: 0};
+                if (change.lines.length > 0) {
+                    text += "\n";
+                }
+            } else if (change.from < count) {
+                to = {line: count - 1, ch: editor.getLine(count - 1).length};
+                if (change.lines.length > 0 || change.from === 0) {
+                    from = {line: change.from, ch: 0};
+                } else {
+                    // Also remove the line break before the deleted lines
+                    from = {line: change.from - 1, ch: editor.getLine(change.from - 1).length};
+                }
+            } else {
+                // Lines appended to the end of the document
+                from = to = {line: count - 1, ch: editor.getLine(count - 1).length};
+                text = "\n" + text;
+            }
+
+            editor.replaceRange(text, from, to);
+        }
+    });
+});
+
+/* Appends text to the end of the document and scrolls to it.
+   Used to follow files that are growing on disk.
+*/
+UiDriver.registerEventHandler("C_CMD_APPEND_TEXT", function(msg, data, prevReturn) {
+    var last = editor.lastLine();
+    editor.replaceRange(data, {line: last, ch: editor.getLine(last).length});
+
+    last = editor.lastLine();
+    editor.scrollIntoView({line: last, ch: 0});
+});
+
 /* Returns true if the editor is clean, false if
    it's dirty or it's clean but forceDirty = true.
    You'll generally want to use this function instead of
@@ -19,9 +87,20 @@ function isCleanOrForced(generation) {
     return !forceDirty && editor.isClean(generation);
 }
 
+/* data: optional {sequence}, the change sequence (see
+         C_FUN_GET_CHANGE_SEQUENCE) of the content that has been saved.
+         If the document has been modified since then, it stays dirty.
+*/
 UiDriver.registerEventHandler("C_CMD_MARK_CLEAN", function(msg, data, prevReturn) {
     forceDirty = false;
-    changeGeneration = editor.changeGeneration(true);
+    if (data && data.sequence !== undefined && data.sequence !== changeSequence) {
+        // The history generation can't tell: edits merged into the same
+        // history event leave it unchanged. No generation is -1, so the
+        // document stays dirty until it's saved again.
+        changeGeneration = -1;
+    } else {
+        changeGeneration = editor.changeGeneration(true);
+    }
     UiDriver.sendMessage("J_EVT_CLEAN_CHANGED", isCleanOrForced(changeGeneration));
 });
 
@@ -38,6 +117,33 @@ UiDriver.registerEventHandler("C_FUN_GET_HISTORY_GENERATION", function(msg, data
     return editor.getHistoryGeneration();
 });
 
+/*
+    Number of operations that modified the document so far. Unlike the
+    history generation, it changes with every operation, undo included.
+*/
+var changeSequence = 0;
+var changeRecording = false;
+
+UiDriver.registerEventHandler("C_FUN_GET_CHANGE_SEQUENCE", function(msg, data, prevReturn) {
+    return changeSequence;
+});
+
+/*
+    While enabled, the changes made by each operation are sent with
+    J_EVT_CHANGES, so that they can be replayed by C_CMD_APPLY_CHANGES.
+*/
+UiDriver.registerEventHandler("C_CMD_SET_CHANGE_RECORDING", function(msg, data, prevReturn) {
+    changeRecording = data === true;
+});
+
+UiDriver.registerEventHandler("C_CMD_APPLY_CHANGES", function(msg, data, prevReturn) {
+    editor.operation(function() {
+        for (var i = 0; i < data.length; i++) {
+            editor.replaceRange(data[i].text.join("\n"), data[i].from, data[i].to);
+        }
+    });
+});
+
 UiDriver.registerEventHandler("C_CMD_SET_LANGUAGE", function(msg, data, prevReturn) {
     editor.setOption('mode', data);
 
@@ -672,29 +778,111 @@ UiDriver.registerEventHandler("C_CMD_EOL_TO_SPACE", function(msg, data, prevRetu
     editor.setValue(text.replace(/\n/gm," "));
 });
 
-function getDocumentInfo()
+/* Number of characters in the document, as in editor.getValue().length.
+   It's updated on every change, so that it never needs to be computed
+   by going through the whole document.
+*/
+var documentLength = 0;
+
+// The last document information sent to C++, see getDocumentInfo()
+var lastDocumentInfo = null;
+
+/* Returns the number of characters in a list of lines joined by "\n". */
+function joinedLength(lines) {
+    var length = lines.length - 1;
+    for (var i = 0; i < lines.length; i++) {
+        length += lines[i].length;
+    }
+    return length;
+}
+
+function updateDocumentLength(editor, changeObj) {
+    documentLength += joinedLength(changeObj.text) - joinedLength(changeObj.removed);
+}
+
+/* Returns [lines, characters] of the current selections. The cost only
+   depends on the number of selected lines, not on the document size.
+*/
+function getSelectionsInfo() {
+    var lines = 0;
+    var length = 0;
+    var ranges = editor.listSelections();
+
+    for (var i = 0; i < ranges.length; i++) {
+        var from = ranges[i].from();
+        var to = ranges[i].to();
+
+        lines += to.line - from.line + 1;
+
+        if (from.line === to.line) {
+            length += to.ch - from.ch;
+        } else {
+            length += editor.getLine(from.line).length - from.ch + 1 + to.ch;
+            editor.getDoc().iter(from.line + 1, to.line, function(line) {
+                length += line.text.length + 1;
+            });
+        }
+    }
+
+    return [lines, length];
+}
+
+function sameValues(a, b) {
+    return a[0] === b[0] && a[1] === b[1];
+}
+
+/* Returns the cursor position, the size of the selections and the
+   size of the document. If onlyChanges is true, the selections and
+   the size of the document are only included if they changed since
+   the last time they were returned.
+*/
+function getDocumentInfo(onlyChanges)
 {
-    var map = new Object();
-    var selections = editor.getSelection("\n");
     var cursor = editor.getCursor("head");
-    map["cursor"] = [cursor.line, cursor.ch];
-    map["selections"] = [selections.split(/\r\n|\r|\n/).length, selections.length];
-    map["content"] = [editor.lineCount(), editor.getValue().length];
-    return map;
+    var info = {
+        "cursor": [cursor.line, cursor.ch],
+        "selections": getSelectionsInfo(),
+        "content": [editor.lineCount(), documentLength]
+    };
+
+    var previous = lastDocumentInfo;
+    lastDocumentInfo = info;
+
+    if (!onlyChanges || previous === null) {
+        return info;
+    }
+
+    var delta = { "cursor": info["cursor"] };
+    if (!sameValues(info["selections"], previous["selections"])) {
+        delta["selections"] = info["selections"];
+    }
+    if (!sameValues(info["content"], previous["content"])) {
+        delta["content"] = info["content"];
+    }
+    return delta;
 }
 
 /**
 * @brief Replies to the request for document information. 
 */
 UiDriver.registerEventHandler("C_CMD_GET_DOCUMENT_INFO", function(msg, data, prevReturn) {
-    UiDriver.sendMessage("J_EVT_DOCUMENT_INFO", getDocumentInfo());
+    UiDriver.sendMessage("J_EVT_DOCUMENT_INFO", getDocumentInfo(false));
+});
+
+/**
+* @brief Forgets the document information sent so far, e.g. because the
+*        editor is reused for another document: the next cursor activity
+*        sends the complete information again.
+*/
+UiDriver.registerEventHandler("C_CMD_RESET_DOCUMENT_INFO", function(msg, data, prevReturn) {
+    lastDocumentInfo = null;
 });
 
 function onCursorActivity(editor) {
     require(['libs/throttle-debounce/index'], function(thdb) {
         if (!onCursorActivity._throttled) {
             onCursorActivity._throttled = thdb.throttle(50, () => {
-                UiDriver.sendMessage("J_EVT_CURSOR_ACTIVITY", getDocumentInfo());
+                UiDriver.sendMessage("J_EVT_CURSOR_ACTIVITY", getDocumentInfo(true));
             });
         }
         onCursorActivity._throttled();
@@ -753,7 +941,36 @@ $(document).ready(function () {
 
     changeGeneration = editor.changeGeneration(true);
 
+    // Batches of requests only refresh the editor once
+    UiDriver.setBatchRunner(function(run) {
+        editor.operation(run);
+    });
+
+    documentLength = editor.getValue().length;
+
+    editor.on("change", updateDocumentLength);
     editor.on("change", onChange);
+
+    // Not throttled: C++ keeps a copy of the content, which must be
+    // dropped before any later reply gets to it.
+    editor.on("changes", function(cm, changes) {
+        UiDriver.sendMessage("J_EVT_CONTENT_MODIFIED");
+
+        changeSequence++;
+        if (changeRecording) {
+            // Each position refers to the document as left by the previous change
+            UiDriver.sendMessage("J_EVT_CHANGES", {
+                sequence: changeSequence,
+                changes: changes.map(function(change) {
+                    return {
+                        from: { line: change.from.line, ch: change.from.ch },
+                        to: { line: change.to.line, ch: change.to.ch },
+                        text: change.text
+                    };
+                })
+            });
+        }
+    });
     editor.on("cursorActivity", onCursorActivity);
 
     editor.on("focus", function() {
@@ -4,6 +4,37 @@ var UiDriver = new function() {
     var msgQueue = [];
     var cpp_ui_driver = null;
 
+    // Large texts travel through a WebSocket, as binary frames made of a
+    // little-endian uint32 id followed by the text in UTF-16LE. The message
+    // that carries, or whose reply carries, such a text only contains
+    // {bulkText: id}.
+    var BULK_TEXT_MIN_LENGTH = 65536;
+    var bulkSocket = null;
+    var bulkSocketClosed = false;
+    var bulkTexts = {};
+
+    // Ids of the texts lost with the socket that C++ has been asked to resend
+    var resentBulkTexts = {};
+
+    // Requests from C++ that are run in order. Each one can only run
+    // after all the bulk texts that it and the ones before it need.
+    var incomingQueue = [];
+
+    if (_bulkTextUrl !== "") {
+        bulkSocket = new WebSocket(_bulkTextUrl);
+        bulkSocket.binaryType = "arraybuffer";
+        bulkSocket.onmessage = (event) => {
+            var id = new DataView(event.data).getUint32(0, true);
+            bulkTexts[id] = new TextDecoder("utf-16le").decode(new Uint8Array(event.data, 4));
+            runIncomingQueue();
+        };
+        bulkSocket.onclose = () => {
+            // The texts still in flight are lost
+            bulkSocketClosed = true;
+            runIncomingQueue();
+        };
+    }
+
     // Setup the communication channel
     document.addEventListener("DOMContentLoaded", () => {
         new QWebChannel(qt.webChannelTransport, (channel) => {
@@ -15,6 +46,21 @@ var UiDriver = new function() {
                 this.messageReceived(msg, data);
             });
 
+            // Asynchronous requests carry their id separately from the message name
+            channel.objects.cpp_ui_driver.requestReceivedByJs.connect((id, msg, data) => {
+                this.requestReceived(id, msg, data);
+            });
+
+            channel.objects.cpp_ui_driver.requestsReceivedByJs.connect((requests) => {
+                this.requestsReceived(requests);
+            });
+
+            // The texts lost with the bulk socket come back through here
+            channel.objects.cpp_ui_driver.bulkTextResentToJs.connect((id, text) => {
+                bulkTexts[id] = text;
+                runIncomingQueue();
+            });
+
             // Send the queued messages that were sent while the channel wasn't ready yet.
             for (var i = 0; i < msgQueue.length; i++) {
                 this.sendMessage(msgQueue[i][0], msgQueue[i][1]);
@@ -39,6 +85,99 @@ var UiDriver = new function() {
         }
     }
 
+    function isBulkText(data) {
+        return data !== null && typeof data === "object" && data.bulkText !== undefined;
+    }
+
+    function takeBulkText(data) {
+        if (!isBulkText(data))
+            return data;
+
+        var text = bulkTexts[data.bulkText];
+        delete bulkTexts[data.bulkText];
+        delete resentBulkTexts[data.bulkText];
+        return text;
+    }
+
+    function enqueueIncoming(bulkTextIds, run) {
+        incomingQueue.push({ bulkTextIds: bulkTextIds, run: run });
+        runIncomingQueue();
+    }
+
+    function runIncomingQueue() {
+        while (incomingQueue.length > 0) {
+            var missing = incomingQueue[0].bulkTextIds.filter(id => bulkTexts[id] === undefined);
+            if (missing.length > 0) {
+                // Running the request without its text would, for example, empty
+                // the document: once the socket is gone, ask C++ to resend the
+                // text through the channel, and keep waiting for it.
+                if (bulkSocketClosed) {
+                    missing.filter(id => resentBulkTexts[id] === undefined).forEach(id => {
+                        resentBulkTexts[id] = true;
+                        cpp_ui_driver.resendBulkText(id, function(ret) {  });
+                    });
+                }
+                return;
+            }
+
+            incomingQueue.shift().run();
+        }
+    }
+
+    var littleEndian = new Uint8Array(new Uint16Array([1]).buffer)[0] === 1;
+
+    // Builds the frame that carries a text to C++. TextEncoder only
+    // produces UTF-8, which C++ would have to convert back to UTF-16.
+    function encodeBulkText(id, text) {
+        var frame = new ArrayBuffer(4 + text.length * 2);
+        var view = new DataView(frame);
+        view.setUint32(0, id, true);
+
+        if (littleEndian) {
+            var chars = new Uint16Array(frame, 4);
+            for (var i = 0; i < text.length; i++) {
+                chars[i] = text.charCodeAt(i);
+            }
+        } else {
+            for (var i = 0; i < text.length; i++) {
+                view.setUint16(4 + i * 2, text.charCodeAt(i), true);
+            }
+        }
+
+        return frame;
+    }
+
+    // Returns the data to use as the reply to the request with the
+    // specified id, sending it through the WebSocket if it's large.
+    function prepareReply(id, data) {
+        if (data === null || data === undefined)
+            return "";
+
+        if (typeof data === "string" && data.length >= BULK_TEXT_MIN_LENGTH &&
+                bulkSocket !== null && bulkSocket.readyState === WebSocket.OPEN) {
+            bulkSocket.send(encodeBulkText(id, data));
+            return { bulkText: id };
+        }
+
+        return data;
+    }
+
+    // Send the reply to an asynchronous request to C++.
+    // Requests only come through the channel, so it's always ready here.
+    this.sendReply = function(id, data) {
+        cpp_ui_driver.receiveReply(id, prepareReply(id, data), function(ret) {  });
+    }
+
+    // Runs a batch of requests. The editor replaces it in order to run
+    // the whole batch within a single operation.
+    var batchRunner = function(run) {
+        run();
+    }
+
+    this.setBatchRunner = function(runner) {
+        batchRunner = runner;
+    }
+
     this.registerEventHandler = function(msg, handler) {
         if (handlers[msg] === undefined)
             handlers[msg] = [];
@@ -46,50 +185,54 @@ var UiDriver = new function() {
         handlers[msg].push(handler);
     }
 
-    // Invoked whenever we've got an incoming message from C++
-    this.messageReceived = function(msg, data) {
-        // Check if the message is async
-        if (msg.startsWith("[ASYNC_REQUEST]")) {
-            
-            // Async mode
-            var rgx = /^\[ASYNC_REQUEST\](.*)\[ID=(\d+)\]$/g;
-            var match = rgx.exec(msg);
-
-            if (match.length == 3) {
-                var real_msg = match[1];
-                var msg_id = parseInt(match[2]);
-
-                // Only one of the handlers (the last that gets
-                // called) can return a value. So, to each handler
-                // we provide the previous handler's return value.
-                var prevReturn = undefined;
-
-                if (handlers[real_msg] !== undefined) {
-                    handlers[real_msg].forEach(function(handler) {
-                        prevReturn = handler(real_msg, data, prevReturn);
-                    });
-                }
+    function invokeHandlers(msg, data) {
+        // Only one of the handlers (the last that gets
+        // called) can return a value. So, to each handler
+        // we provide the previous handler's return value.
+        var prevReturn = undefined;
 
-                // Send an asynchronous reply
-                this.sendMessage("[ASYNC_REPLY]" + real_msg + "[ID=" + msg_id + "]", prevReturn);
+        var msgHandlers = handlers[msg];
+        if (msgHandlers !== undefined) {
+            for (var i = 0; i < msgHandlers.length; i++) {
+                prevReturn = msgHandlers[i](msg, data, prevReturn);
             }
+        }
 
-        } else {
+        return prevReturn;
+    }
 
-            // Only one of the handlers (the last that gets
-            // called) can return a value. So, to each handler
-            // we provide the previous handler's return value.
-            var prevReturn = undefined;
+    // Invoked whenever we've got an incoming message from C++. It's run after
+    // the requests received before it, even if they're still waiting for a text.
+    this.messageReceived = function(msg, data) {
+        enqueueIncoming([], () => {
+            invokeHandlers(msg, data);
+        });
+    }
 
-            if (handlers[msg] !== undefined) {
-                handlers[msg].forEach(function(handler) {
-                    prevReturn = handler(msg, data, prevReturn);
-                });
-            }
+    // Invoked whenever we've got an incoming asynchronous request from C++
+    this.requestReceived = function(id, msg, data) {
+        enqueueIncoming(isBulkText(data) ? [data.bulkText] : [], () => {
+            this.sendReply(id, invokeHandlers(msg, takeBulkText(data)));
+        });
+    }
 
-            // Send a synchronous reply
-            return prevReturn;
-        }
+    // Invoked whenever we've got a batch of [id, msg, data] requests from C++.
+    // All the replies are sent back together, as [id, data] pairs.
+    this.requestsReceived = function(requests) {
+        var bulkTextIds = requests.filter(r => isBulkText(r[2])).map(r => r[2].bulkText);
+
+        enqueueIncoming(bulkTextIds, () => {
+            var replies = [];
+
+            batchRunner(function() {
+                for (var i = 0; i < requests.length; i++) {
+                    var ret = invokeHandlers(requests[i][1], takeBulkText(requests[i][2]));
+                    replies.push([requests[i][0], prepareReply(requests[i][0], ret)]);
+                }
+            });
+
+            cpp_ui_driver.receiveReplies(replies, function(ret) {  });
+        });
     }
 }
 
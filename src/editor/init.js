@@ -6,6 +6,7 @@
 
 var _initialized = false;
 var _defaultTheme = "";
+var _bulkTextUrl = "";
 
 function addStylesheet(path) {
     var link = document.createElement("link");
@@ -37,6 +38,8 @@ function init()
     }
     
     _defaultTheme = themeName === "" ? "default" : themeName;
+
+    _bulkTextUrl = getParameterByName("bulkTextUrl");
 }
 
 init();
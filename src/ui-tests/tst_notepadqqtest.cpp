@@ -1,8 +1,105 @@
 #include <QString>
+#include <QTemporaryDir>
 #include <QtTest>
+#include "include/EditorNS/snapshotcache.h"
+#include "include/Sessions/editjournalfile.h"
+#include "include/Sessions/persistentcache.h"
+#include "include/Sessions/sessionfile.h"
+#include "include/chunkedfilewriter.h"
+#include "include/encodingmemo.h"
+#include "include/filefollower.h"
+#include "include/filemonitor.h"
+#include "include/linediff.h"
 #include "include/notepadqq.h"
-#include "nqqsettings.cpp"
-#include "notepadqq.cpp"
+
+namespace {
+    // A binary session with a view of two tabs, the second one active
+    std::vector<ViewData> twoTabSession()
+    {
+        std::vector<ViewData> views(1);
+
+        TabData first;
+        first.filePath = "/tmp/first.txt";
+        first.cursorY = 12;
+        first.lastActivated = 1000;
+        views[0].tabs.push_back(first);
+
+        TabData second;
+        second.filePath = "/tmp/second.txt";
+        second.cacheFilePath = "/tmp/cache/second.blob";
+        second.active = true;
+        second.language = "cpp";
+        second.changeSequence = 7;
+        second.lastActivated = 2000;
+        views[0].tabs.push_back(second);
+
+        return views;
+    }
+
+    QByteArray readFile(const QString& path)
+    {
+        QFile file(path);
+        file.open(QIODevice::ReadOnly);
+        return file.readAll();
+    }
+
+    void writeFile(const QString& path, const QByteArray& data)
+    {
+        QFile file(path);
+        file.open(QIODevice::WriteOnly | QIODevice::Truncate);
+        file.write(data);
+    }
+
+    // The index of a binary session of a single view: magic, version, view count,
+    // tab count and active tab, then the offset and size of each record.
+    const int FIRST_RECORD_INDEX = 4 + 2 + 4 + 8;
+
+    // A single view of many tabs, with the active tab in the middle
+    std::vector<ViewData> largeSession(int tabCount)
+    {
+        std::vector<ViewData> views(1);
+        for (int i = 0; i < tabCount; i++) {
+            TabData td;
+            td.filePath = QString("/home/user/projects/notepadqq/src/ui/file%1.cpp").arg(i);
+            td.cacheFilePath = QString("/home/user/.config/Notepadqq/tabCache/%1.blob").arg(i, 40, 16, QChar('0'));
+            td.cursorX = i % 80;
+            td.cursorY = i;
+            td.scrollY = i * 16;
+            td.language = "cpp";
+            td.lastModified = 1000 + i;
+            td.active = i == tabCount / 2;
+            views[0].tabs.push_back(td);
+        }
+        return views;
+    }
+
+    void setIndexEntry(QByteArray& session, int position, quint32 value)
+    {
+        QByteArray bytes;
+        QDataStream stream(&bytes, QIODevice::WriteOnly);
+        stream << value;
+        session.replace(position, bytes.size(), bytes);
+    }
+
+    // A CodeMirror change that inserts a line of text
+    QVariantList insertion(int line, const QString& text)
+    {
+        const QVariantMap position{{"line", line}, {"ch", 0}};
+        return QVariantList{QVariantMap{{"from", position}, {"to", position}, {"text", QStringList{text, ""}}}};
+    }
+
+    // Applies the changes computed by diffLines(), last first so that the line numbers still hold
+    QStringList applyLineChanges(QStringList lines, const std::vector<LineChange>& changes)
+    {
+        for (auto it = changes.rbegin(); it != changes.rend(); ++it) {
+            for (int i = it->from; i < it->to; i++)
+                lines.removeAt(it->from);
+            for (int i = 0; i < it->lines.size(); i++)
+                lines.insert(it->from + i, it->lines[i]);
+        }
+        return lines;
+    }
+}
 
 class NotepadqqTest : public QObject
 {
@@ -13,6 +110,62 @@ public:
 
 private Q_SLOTS:
     void editorPathIsHtml();
+
+    void chunkedWriteSplitsSurrogatePairs();
+    void chunkedWriteWithBom();
+    void chunkedWriteReplacesFileOnCommit();
+    void chunkedWriteKeepsPermissions();
+
+    void encodingMemoRemembersMultiByteEncodings();
+    void encodingMemoForgetsUnicodeEncodings();
+    void encodingMemoDecodesWithMultiByteEncodings();
+    void encodingMemoConfirmsSingleByteEncodings();
+    void encodingMemoCanRejectInput_data();
+    void encodingMemoCanRejectInput();
+
+    void diffLines_data();
+    void diffLines();
+    void diffLinesOfIdenticalTexts();
+    void diffLinesKeepsCommonLines();
+    void diffLinesBoundsEdits();
+
+    void binarySessionRoundTrip();
+    void binarySessionRejectsTruncatedIndex();
+    void binarySessionRejectsImpossibleCounts();
+    void binarySessionRejectsRecordsPastTheEnd();
+    void binarySessionRejectsUnknownVersion();
+    void binarySessionRejectsCutRecord();
+    void binarySessionReadsRecordsWithoutNewFields();
+    void sessionFormatWrite_data();
+    void sessionFormatWrite();
+    void sessionFormatReadActiveTab_data();
+    void sessionFormatReadActiveTab();
+
+    void editJournalReplaysChangesAfterCacheFile();
+    void editJournalStopsAtCutLine();
+    void editJournalWithoutFile();
+
+    void blobRoundTrip();
+    void blobIsStoredOnce();
+    void blobOnlyWithinCache();
+    void blobOfEmptyData();
+    void corruptBlob();
+
+    void snapshotCacheStoresWithinEpoch();
+    void snapshotCacheKeptByReadOnlyRequests();
+    void snapshotCacheDroppedByModifyingRequests();
+    void snapshotCacheRejectsStaleSnapshots();
+    void snapshotCacheIsReadOnly_data();
+    void snapshotCacheIsReadOnly();
+
+    void fileFollowerAppendsText();
+    void fileFollowerKeepsSplitCarriageReturns();
+    void fileFollowerKeepsSplitCharacters();
+    void fileFollowerDetectsTruncation();
+
+    void fileMonitorCoalescesChanges();
+    void fileMonitorNotifiesSameSizeRewrites();
+    void fileMonitorCountsReferences();
 };
 
 NotepadqqTest::NotepadqqTest()
@@ -25,6 +178,750 @@ void NotepadqqTest::editorPathIsHtml()
     QVERIFY(Notepadqq::editorPath().endsWith(".html"));
 }
 
+void NotepadqqTest::chunkedWriteSplitsSurrogatePairs()
+{
+    QTemporaryDir dir;
+    const QString path = dir.filePath("document.txt");
+
+    // U+1F600, cut in two by the end of a chunk
+    const QString emoji = QString::fromUtf8("\xF0\x9F\x98\x80");
+    QCOMPARE(emoji.size(), 2);
+
+    ChunkedFileWriter writer(path, QTextCodec::codecForName("UTF-8"));
+    QVERIFY(writer.open(QByteArray()).isNull());
+    writer.write("abc" + emoji.left(1));
+    writer.write(emoji.mid(1) + "def");
+    QVERIFY(writer.commit().isNull());
+
+    const QByteArray expected = QByteArray("abc") + "\xF0\x9F\x98\x80" + "def";
+    QCOMPARE(readFile(path), expected);
+    QCOMPARE(writer.size(), qint64(expected.size()));
+}
+
+void NotepadqqTest::chunkedWriteWithBom()
+{
+    QTemporaryDir dir;
+
+    // The UTF-8 encoder doesn't generate the BOM: it's written when the file is opened
+    const QString utf8Path = dir.filePath("utf8.txt");
+    ChunkedFileWriter utf8(utf8Path, QTextCodec::codecForName("UTF-8"));
+    QVERIFY(utf8.open(QByteArray("\xEF\xBB\xBF")).isNull());
+    utf8.write("a");
+    utf8.write("b");
+    QVERIFY(utf8.commit().isNull());
+    QCOMPARE(readFile(utf8Path), QByteArray("\xEF\xBB\xBF" "ab"));
+
+    // The UTF-16 encoder does, but only for the first chunk
+    const QString utf16Path = dir.filePath("utf16.txt");
+    ChunkedFileWriter utf16(utf16Path, QTextCodec::codecForName("UTF-16LE"));
+    QVERIFY(utf16.open(QByteArray()).isNull());
+    utf16.write("a");
+    utf16.write("b");
+    QVERIFY(utf16.commit().isNull());
+    QCOMPARE(readFile(utf16Path), QByteArray("\xFF\xFE" "a\0" "b\0", 6));
+    QCOMPARE(utf16.size(), qint64(6));
+}
+
+void NotepadqqTest::chunkedWriteReplacesFileOnCommit()
+{
+    QTemporaryDir dir;
+    const QString path = dir.filePath("document.txt");
+    writeFile(path, "old");
+
+    ChunkedFileWriter writer(path, QTextCodec::codecForName("UTF-8"));
+    QVERIFY(writer.open(QByteArray()).isNull());
+    writer.write("new");
+
+    // Until then, a crash leaves the original untouched
+    QCOMPARE(readFile(path), QByteArray("old"));
+
+    QVERIFY(writer.commit().isNull());
+    QCOMPARE(readFile(path), QByteArray("new"));
+    QCOMPARE(QDir(dir.path()).entryList(QDir::Files), QStringList({"document.txt"}));
+}
+
+void NotepadqqTest::chunkedWriteKeepsPermissions()
+{
+    QTemporaryDir dir;
+    const QString path = dir.filePath("script.sh");
+    writeFile(path, "old");
+
+    const QFileDevice::Permissions permissions = QFileDevice::ReadOwner | QFileDevice::WriteOwner |
+            QFileDevice::ExeOwner | QFileDevice::ReadGroup | QFileDevice::ExeGroup;
+    QVERIFY(QFile::setPermissions(path, permissions));
+    const QFileDevice::Permissions before = QFileInfo(path).permissions();
+
+    ChunkedFileWriter writer(path, QTextCodec::codecForName("UTF-8"));
+    QVERIFY(writer.open(QByteArray()).isNull());
+    writer.write("new");
+    QVERIFY(writer.commit().isNull());
+
+    QCOMPARE(int(QFileInfo(path).permissions()), int(before));
+}
+
+void NotepadqqTest::encodingMemoRemembersMultiByteEncodings()
+{
+    QTextCodec *shiftJis = QTextCodec::codecForName("Shift_JIS");
+    if (shiftJis == nullptr)
+        QSKIP("Shift_JIS is not available");
+
+    EncodingMemo::remember("/memo/japanese", shiftJis);
+    QCOMPARE(EncodingMemo::codecForDirectory("/memo/japanese"), shiftJis);
+    QVERIFY(EncodingMemo::codecForDirectory("/memo/other") == nullptr);
+}
+
+void NotepadqqTest::encodingMemoForgetsUnicodeEncodings()
+{
+    QTextCodec *shiftJis = QTextCodec::codecForName("Shift_JIS");
+    if (shiftJis == nullptr)
+        QSKIP("Shift_JIS is not available");
+
+    // A directory whose files turn out to use another encoding is forgotten
+    const QList<QByteArray> encodings = {"UTF-8", "UTF-16LE", "UTF-32"};
+    for (const QByteArray& encoding : encodings) {
+        EncodingMemo::remember("/memo/mixed", shiftJis);
+        EncodingMemo::remember("/memo/mixed", QTextCodec::codecForName(encoding));
+        QVERIFY2(EncodingMemo::codecForDirectory("/memo/mixed") == nullptr, encoding.constData());
+    }
+
+    // Single-byte encodings are remembered too
+    QTextCodec *latin1 = QTextCodec::codecForName("ISO-8859-1");
+    EncodingMemo::remember("/memo/mixed", latin1);
+    QCOMPARE(EncodingMemo::codecForDirectory("/memo/mixed"), latin1);
+}
+
+void NotepadqqTest::encodingMemoDecodesWithMultiByteEncodings()
+{
+    QTextCodec *shiftJis = QTextCodec::codecForName("Shift_JIS");
+    if (shiftJis == nullptr)
+        QSKIP("Shift_JIS is not available");
+
+    EncodingMemo::remember("/memo/sjis", shiftJis);
+
+    const QString japanese = QString::fromUtf8("\xE6\x97\xA5\xE6\x9C\xAC\xE8\xAA\x9E\n");
+    const QByteArray contents = shiftJis->fromUnicode(japanese);
+    QString text;
+    QCOMPARE(EncodingMemo::decode("/memo/sjis", contents, contents.size(), text), shiftJis);
+    QCOMPARE(text, japanese);
+
+    // An invalid sequence: the encoding must be detected again
+    const QByteArray invalid("\x82\xFF\x82");
+    QVERIFY(EncodingMemo::decode("/memo/sjis", invalid, invalid.size(), text) == nullptr);
+
+    QVERIFY(EncodingMemo::decode("/memo/unknown", contents, contents.size(), text) == nullptr);
+}
+
+void NotepadqqTest::encodingMemoConfirmsSingleByteEncodings()
+{
+    QTextCodec *latin1 = QTextCodec::codecForName("ISO-8859-1");
+    EncodingMemo::remember("/memo/latin1", latin1);
+
+    QString text;
+    const QByteArray french("Un caf\xE9 cr\xE8me, s'il vous pla\xEEt.\n");
+    QCOMPARE(EncodingMemo::decode("/memo/latin1", french, french.size(), text), latin1);
+    QCOMPARE(text, QString::fromUtf8("Un caf\xC3\xA9 cr\xC3\xA8me, s'il vous pla\xC3\xAEt.\n"));
+
+    // Windows-1252 quotes are C1 controls in Latin-1
+    const QByteArray quoted("He said \x93hello\x94.\n");
+    QVERIFY(EncodingMemo::decode("/memo/latin1", quoted, quoted.size(), text) == nullptr);
+
+    // Mostly bytes that aren't ASCII: rather another encoding
+    const QByteArray high("\xE9\xE8\xEA\xEB\xE0 a\n");
+    QVERIFY(EncodingMemo::decode("/memo/latin1", high, high.size(), text) == nullptr);
+}
+
+void NotepadqqTest::encodingMemoCanRejectInput_data()
+{
+    QTest::addColumn<QByteArray>("encoding");
+    QTest::addColumn<bool>("canReject");
+
+    QTest::newRow("Shift_JIS") << QByteArray("Shift_JIS") << true;
+    QTest::newRow("EUC-KR") << QByteArray("EUC-KR") << true;
+    QTest::newRow("UTF-8") << QByteArray("UTF-8") << true;
+    QTest::newRow("ISO-8859-1") << QByteArray("ISO-8859-1") << false;
+    QTest::newRow("UTF-16") << QByteArray("UTF-16") << false;
+    QTest::newRow("UTF-16BE") << QByteArray("UTF-16BE") << false;
+    QTest::newRow("UTF-32LE") << QByteArray("UTF-32LE") << false;
+}
+
+void NotepadqqTest::encodingMemoCanRejectInput()
+{
+    QFETCH(QByteArray, encoding);
+    QFETCH(bool, canReject);
+
+    QTextCodec *codec = QTextCodec::codecForName(encoding);
+    if (codec == nullptr)
+        QSKIP("The encoding is not available");
+
+    QCOMPARE(EncodingMemo::canRejectInput(codec), canReject);
+}
+
+void NotepadqqTest::diffLines_data()
+{
+    QTest::addColumn<QStringList>("oldLines");
+    QTest::addColumn<QStringList>("newLines");
+
+    QTest::newRow("insertion") << QStringList({"a", "b", "c"}) << QStringList({"a", "x", "b", "c"});
+    QTest::newRow("deletion") << QStringList({"a", "b", "c"}) << QStringList({"a", "c"});
+    QTest::newRow("replacement") << QStringList({"a", "b", "c"}) << QStringList({"a", "x", "c"});
+    QTest::newRow("at the start") << QStringList({"a", "b"}) << QStringList({"x", "a", "b"});
+    QTest::newRow("at the end") << QStringList({"a", "b"}) << QStringList({"a", "b", "x"});
+    QTest::newRow("from empty") << QStringList() << QStringList({"a", "b"});
+    QTest::newRow("to empty") << QStringList({"a", "b"}) << QStringList();
+    QTest::newRow("scattered") << QStringList({"a", "b", "c", "d", "e", "f"})
+                               << QStringList({"x", "b", "c", "y", "e", "z", "f"});
+    QTest::newRow("repeated lines") << QStringList({"a", "a", "b", "a"}) << QStringList({"a", "b", "a", "a"});
+}
+
+void NotepadqqTest::diffLines()
+{
+    QFETCH(QStringList, oldLines);
+    QFETCH(QStringList, newLines);
+
+    const std::vector<LineChange> changes = ::diffLines(oldLines, newLines);
+    QCOMPARE(applyLineChanges(oldLines, changes), newLines);
+
+    // Sorted and non-overlapping
+    for (size_t i = 1; i < changes.size(); i++)
+        QVERIFY(changes[i - 1].to <= changes[i].from);
+}
+
+void NotepadqqTest::diffLinesOfIdenticalTexts()
+{
+    const QStringList lines({"a", "b", "c"});
+    QVERIFY(::diffLines(lines, lines).empty());
+}
+
+void NotepadqqTest::diffLinesKeepsCommonLines()
+{
+    // Only the modified line is replaced, not the region around it
+    const std::vector<LineChange> changes = ::diffLines(QStringList({"a", "b", "c", "d", "e"}),
+                                                        QStringList({"a", "b", "x", "d", "e"}));
+    QCOMPARE(int(changes.size()), 1);
+    QCOMPARE(changes[0].from, 2);
+    QCOMPARE(changes[0].to, 3);
+    QCOMPARE(changes[0].lines, QStringList({"x"}));
+}
+
+void NotepadqqTest::diffLinesBoundsEdits()
+{
+    // Too different to be worth a detailed diff: the region is replaced as a whole
+    QStringList oldLines;
+    QStringList newLines;
+    for (int i = 0; i < 1000; i++) {
+        oldLines.append(QString("old %1").arg(i));
+        newLines.append(QString("new %1").arg(i));
+    }
+    oldLines.prepend("common");
+    newLines.prepend("common");
+
+    const std::vector<LineChange> changes = ::diffLines(oldLines, newLines);
+    QCOMPARE(int(changes.size()), 1);
+    QCOMPARE(changes[0].from, 1);
+    QCOMPARE(changes[0].to, 1001);
+    QCOMPARE(applyLineChanges(oldLines, changes), newLines);
+}
+
+void NotepadqqTest::binarySessionRoundTrip()
+{
+    QTemporaryDir dir;
+    const QString path = dir.filePath("session");
+    QVERIFY(Sessions::writeSessionFile(path, twoTabSession(), Sessions::SessionFormat::Binary));
+
+    Sessions::SessionFile session;
+    QVERIFY(session.open(path));
+    QCOMPARE(int(session.views().size()), 1);
+    QCOMPARE(session.views()[0].activeTab, 1);
+    QCOMPARE(int(session.views()[0].records.size()), 2);
+
+    TabData td;
+    QVERIFY(session.readTab(session.views()[0].records[1], td));
+    QCOMPARE(td.filePath, QString("/tmp/second.txt"));
+    QCOMPARE(td.cacheFilePath, QString("/tmp/cache/second.blob"));
+    QCOMPARE(td.language, QString("cpp"));
+    QCOMPARE(td.changeSequence, 7);
+    QCOMPARE(td.lastActivated, qint64(2000));
+    QVERIFY(td.active);
+
+    QVERIFY(session.readTab(session.views()[0].records[0], td));
+    QCOMPARE(td.filePath, QString("/tmp/first.txt"));
+    QCOMPARE(td.cursorY, 12);
+    QVERIFY(!td.active);
+}
+
+void NotepadqqTest::binarySessionRejectsTruncatedIndex()
+{
+    QTemporaryDir dir;
+    const QString path = dir.filePath("session");
+    QVERIFY(Sessions::writeSessionFile(path, twoTabSession(), Sessions::SessionFormat::Binary));
+
+    writeFile(path, readFile(path).left(FIRST_RECORD_INDEX + 4));
+
+    Sessions::SessionFile session;
+    QVERIFY(!session.open(path));
+}
+
+void NotepadqqTest::binarySessionRejectsImpossibleCounts()
+{
+    QTemporaryDir dir;
+    const QString path = dir.filePath("session");
+    QVERIFY(Sessions::writeSessionFile(path, twoTabSession(), Sessions::SessionFormat::Binary));
+
+    // Neither the views nor the tabs would fit in the file
+    QByteArray views = readFile(path);
+    setIndexEntry(views, 4 + 2, 0xFFFFFFFF);
+    writeFile(path, views);
+
+    Sessions::SessionFile viewsSession;
+    QVERIFY(!viewsSession.open(path));
+
+    QByteArray tabs = readFile(path);
+    setIndexEntry(tabs, 4 + 2, 1);
+    setIndexEntry(tabs, 4 + 2 + 4, 0x10000000);
+    writeFile(path, tabs);
+
+    Sessions::SessionFile tabsSession;
+    QVERIFY(!tabsSession.open(path));
+}
+
+void NotepadqqTest::binarySessionRejectsRecordsPastTheEnd()
+{
+    QTemporaryDir dir;
+    const QString path = dir.filePath("session");
+    QVERIFY(Sessions::writeSessionFile(path, twoTabSession(), Sessions::SessionFormat::Binary));
+
+    // The file was cut in the middle of the last record
+    const QByteArray data = readFile(path);
+    writeFile(path, data.left(data.size() - 1));
+
+    Sessions::SessionFile session;
+    QVERIFY(!session.open(path));
+}
+
+void NotepadqqTest::binarySessionRejectsUnknownVersion()
+{
+    QTemporaryDir dir;
+    const QString path = dir.filePath("session");
+    QVERIFY(Sessions::writeSessionFile(path, twoTabSession(), Sessions::SessionFormat::Binary));
+
+    QByteArray data = readFile(path);
+    data[5] = 2;
+    writeFile(path, data);
+
+    Sessions::SessionFile session;
+    QVERIFY(!session.open(path));
+}
+
+void NotepadqqTest::binarySessionRejectsCutRecord()
+{
+    QTemporaryDir dir;
+    const QString path = dir.filePath("session");
+    QVERIFY(Sessions::writeSessionFile(path, twoTabSession(), Sessions::SessionFormat::Binary));
+
+    // The record is within the file, but too short for its fields
+    QByteArray data = readFile(path);
+    setIndexEntry(data, FIRST_RECORD_INDEX + 4, 2);
+    writeFile(path, data);
+
+    Sessions::SessionFile session;
+    QVERIFY(session.open(path));
+
+    TabData td;
+    td.filePath = "unchanged";
+    QVERIFY(!session.readTab(session.views()[0].records[0], td));
+    QCOMPARE(td.filePath, QString("unchanged"));
+}
+
+void NotepadqqTest::binarySessionReadsRecordsWithoutNewFields()
+{
+    QTemporaryDir dir;
+    const QString path = dir.filePath("session");
+    QVERIFY(Sessions::writeSessionFile(path, twoTabSession(), Sessions::SessionFormat::Binary));
+
+    // lastActivated, a qint64, was appended to the records after the first version
+    QByteArray data = readFile(path);
+    QDataStream index(data.mid(FIRST_RECORD_INDEX + 4, 4));
+    quint32 size = 0;
+    index >> size;
+    setIndexEntry(data, FIRST_RECORD_INDEX + 4, size - 8);
+    writeFile(path, data);
+
+    Sessions::SessionFile session;
+    QVERIFY(session.open(path));
+
+    TabData td;
+    QVERIFY(session.readTab(session.views()[0].records[0], td));
+    QCOMPARE(td.filePath, QString("/tmp/first.txt"));
+    QCOMPARE(td.cursorY, 12);
+    QCOMPARE(td.lastActivated, qint64(0));
+}
+
+// XML is the format previous versions write on exit, so it's the baseline
+void NotepadqqTest::sessionFormatWrite_data()
+{
+    QTest::addColumn<bool>("binary");
+    QTest::newRow("XML") << false;
+    QTest::newRow("binary") << true;
+}
+
+void NotepadqqTest::sessionFormatWrite()
+{
+    QFETCH(bool, binary);
+    const Sessions::SessionFormat format = binary ? Sessions::SessionFormat::Binary : Sessions::SessionFormat::Xml;
+
+    QTemporaryDir dir;
+    const std::vector<ViewData> views = largeSession(1000);
+
+    QBENCHMARK {
+        QVERIFY(Sessions::writeSessionFile(dir.filePath("session"), views, format));
+    }
+}
+
+void NotepadqqTest::sessionFormatReadActiveTab_data()
+{
+    sessionFormatWrite_data();
+}
+
+void NotepadqqTest::sessionFormatReadActiveTab()
+{
+    QFETCH(bool, binary);
+    const Sessions::SessionFormat format = binary ? Sessions::SessionFormat::Binary : Sessions::SessionFormat::Xml;
+
+    QTemporaryDir dir;
+    const QString path = dir.filePath("session");
+    QVERIFY(Sessions::writeSessionFile(path, largeSession(1000), format));
+
+    QBENCHMARK {
+        QFile file(path);
+        QVERIFY(file.open(QIODevice::ReadOnly));
+
+        TabData active;
+        if (binary) {
+            BinarySessionReader reader(file);
+            const auto views = reader.readIndex();
+            QCOMPARE(views.size(), size_t(1));
+            QVERIFY(reader.readTab(views[0].records[static_cast<size_t>(views[0].activeTab)], active));
+        } else {
+            // The active tab is only known once the whole file has been parsed
+            SessionReader reader(file);
+            const auto views = reader.readData();
+            QCOMPARE(views.size(), size_t(1));
+            active = views[0].tabs[500];
+        }
+        QVERIFY(active.active);
+    }
+}
+
+void NotepadqqTest::editJournalReplaysChangesAfterCacheFile()
+{
+    QTemporaryDir dir;
+    const QString path = dir.filePath("journal");
+    writeFile(path, EditJournalFile::entry(3, insertion(0, "three")) +
+                    EditJournalFile::entry(4, insertion(1, "four")) +
+                    EditJournalFile::entry(5, insertion(2, "five")));
+
+    // The cache file already contains the changes up to its sequence
+    const QVariantList changes = EditJournalFile::readChanges(path, 3);
+    QCOMPARE(changes.size(), 2);
+
+    const QVariantMap four = changes[0].toMap();
+    QCOMPARE(four.value("from").toMap().value("line").toInt(), 1);
+    QCOMPARE(four.value("text").toStringList(), QStringList({"four", ""}));
+    QCOMPARE(changes[1].toMap().value("text").toStringList(), QStringList({"five", ""}));
+
+    QCOMPARE(EditJournalFile::readChanges(path, 5).size(), 0);
+    QCOMPARE(EditJournalFile::readChanges(path, 0).size(), 3);
+}
+
+void NotepadqqTest::editJournalStopsAtCutLine()
+{
+    QTemporaryDir dir;
+    const QString path = dir.filePath("journal");
+    const QByteArray last = EditJournalFile::entry(2, insertion(1, "two"));
+    writeFile(path, EditJournalFile::entry(1, insertion(0, "one")) + last.left(last.size() / 2));
+
+    const QVariantList changes = EditJournalFile::readChanges(path, 0);
+    QCOMPARE(changes.size(), 1);
+    QCOMPARE(changes[0].toMap().value("text").toStringList(), QStringList({"one", ""}));
+}
+
+void NotepadqqTest::editJournalWithoutFile()
+{
+    QTemporaryDir dir;
+    QVERIFY(EditJournalFile::readChanges(dir.filePath("missing"), 0).isEmpty());
+}
+
+void NotepadqqTest::blobRoundTrip()
+{
+    QTemporaryDir dir;
+    const QByteArray data = QByteArray("Some text\n").repeated(1000);
+
+    const QString path = PersistentCache::storeBlob(QDir(dir.path()), data);
+    QVERIFY(!path.isEmpty());
+    QVERIFY(QFileInfo(path).isAbsolute());
+    QVERIFY(QFileInfo(path).size() < data.size());
+    QCOMPARE(PersistentCache::unpackBlob(readFile(path)), data);
+}
+
+void NotepadqqTest::blobIsStoredOnce()
+{
+    QTemporaryDir dir;
+    const QString path = PersistentCache::storeBlob(QDir(dir.path()), "same");
+    QCOMPARE(PersistentCache::storeBlob(QDir(dir.path()), "same"), path);
+    QVERIFY(PersistentCache::storeBlob(QDir(dir.path()), "other") != path);
+    QCOMPARE(QDir(dir.path()).entryList(QDir::Files).size(), 2);
+}
+
+void NotepadqqTest::blobOnlyWithinCache()
+{
+    QTemporaryDir dir;
+    const QString path = PersistentCache::storeBlob(QDir(dir.path()), "data");
+
+    // A document of the user that happens to have the same suffix
+    QVERIFY(!PersistentCache::isBlob(path));
+
+    QVERIFY(PersistentCache::isBlob(PersistentCache::cacheDirPath() + "/0123.blob"));
+    QVERIFY(PersistentCache::isBlob(PersistentCache::backupDirPath() + "/0123.blob"));
+    QVERIFY(!PersistentCache::isBlob(PersistentCache::cacheDirPath() + "/0123.txt"));
+}
+
+void NotepadqqTest::blobOfEmptyData()
+{
+    QTemporaryDir dir;
+    const QString path = PersistentCache::storeBlob(QDir(dir.path()), QByteArray());
+
+    bool ok = false;
+    QVERIFY(PersistentCache::unpackBlob(readFile(path), &ok).isEmpty());
+    QVERIFY(ok);
+}
+
+void NotepadqqTest::corruptBlob()
+{
+    QTemporaryDir dir;
+    const QString path = PersistentCache::storeBlob(QDir(dir.path()), QByteArray("Some text\n").repeated(1000));
+    const QByteArray blob = readFile(path);
+
+    bool ok = true;
+    QVERIFY(PersistentCache::unpackBlob(blob.left(blob.size() / 2), &ok).isEmpty());
+    QVERIFY(!ok);
+
+    ok = true;
+    PersistentCache::unpackBlob(QByteArray("xy"), &ok);
+    QVERIFY(!ok);
+}
+
+namespace {
+    EditorNS::Snapshot snapshotOf(const QString& text, int changeSequence)
+    {
+        EditorNS::Snapshot snapshot;
+        snapshot.text = text;
+        snapshot.historyGeneration = 1;
+        snapshot.changeSequence = changeSequence;
+        return snapshot;
+    }
+}
+
+void NotepadqqTest::snapshotCacheStoresWithinEpoch()
+{
+    EditorNS::SnapshotCache cache;
+    QVERIFY(!cache.isCached());
+
+    QVERIFY(cache.store(snapshotOf("text", 3), cache.epoch()));
+    QVERIFY(cache.isCached());
+    QCOMPARE(cache.snapshot().text, QString("text"));
+    QCOMPARE(cache.snapshot().changeSequence, 3);
+
+    cache.invalidate();
+    QVERIFY(!cache.isCached());
+    QCOMPARE(cache.snapshot().text, QString());
+}
+
+void NotepadqqTest::snapshotCacheKeptByReadOnlyRequests()
+{
+    EditorNS::SnapshotCache cache;
+    const unsigned int epoch = cache.epoch();
+    cache.store(snapshotOf("text", 3), epoch);
+
+    cache.beforeSending("C_FUN_GET_CURSOR");
+    cache.beforeSending("C_CMD_SET_SELECTION");
+    cache.beforeSending("C_CMD_MARK_CLEAN");
+    QVERIFY(cache.isCached());
+    QCOMPARE(cache.epoch(), epoch);
+}
+
+void NotepadqqTest::snapshotCacheDroppedByModifyingRequests()
+{
+    EditorNS::SnapshotCache cache;
+    cache.store(snapshotOf("text", 3), cache.epoch());
+
+    cache.beforeSending("C_CMD_SET_VALUE");
+    QVERIFY(!cache.isCached());
+
+    // Unknown requests might modify the document too
+    cache.store(snapshotOf("new text", 4), cache.epoch());
+    cache.beforeSending("C_CMD_SOMETHING_NEW");
+    QVERIFY(!cache.isCached());
+}
+
+void NotepadqqTest::snapshotCacheRejectsStaleSnapshots()
+{
+    EditorNS::SnapshotCache cache;
+
+    // The snapshot is requested, then the document is modified before it arrives
+    const unsigned int epoch = cache.epoch();
+    cache.beforeSending("C_CMD_SET_SELECTIONS_TEXT");
+    QVERIFY(!cache.store(snapshotOf("old text", 3), epoch));
+    QVERIFY(!cache.isCached());
+
+    // Same if the modification is notified by the editor
+    const unsigned int nextEpoch = cache.epoch();
+    cache.invalidate();
+    QVERIFY(!cache.store(snapshotOf("old text", 3), nextEpoch));
+    QVERIFY(!cache.isCached());
+
+    QVERIFY(cache.store(snapshotOf("new text", 5), cache.epoch()));
+    QCOMPARE(cache.snapshot().text, QString("new text"));
+}
+
+void NotepadqqTest::snapshotCacheIsReadOnly_data()
+{
+    QTest::addColumn<QString>("request");
+    QTest::addColumn<bool>("readOnly");
+
+    QTest::newRow("get value") << QString("C_FUN_GET_VALUE") << true;
+    QTest::newRow("get value chunk") << QString("C_FUN_GET_VALUE_CHUNK") << true;
+    QTest::newRow("get change sequence") << QString("C_FUN_GET_CHANGE_SEQUENCE") << true;
+    QTest::newRow("set scroll position") << QString("C_CMD_SET_SCROLL_POS") << true;
+    QTest::newRow("set value") << QString("C_CMD_SET_VALUE") << false;
+    QTest::newRow("set selections text") << QString("C_CMD_SET_SELECTIONS_TEXT") << false;
+    QTest::newRow("empty") << QString() << false;
+}
+
+void NotepadqqTest::snapshotCacheIsReadOnly()
+{
+    QFETCH(QString, request);
+    QFETCH(bool, readOnly);
+
+    QCOMPARE(EditorNS::SnapshotCache::isReadOnly(request), readOnly);
+}
+
+void NotepadqqTest::fileFollowerAppendsText()
+{
+    FileFollower follower(QTextCodec::codecForName("UTF-8"), 10);
+
+    QCOMPARE(follower.append("first\r\nsecond\rthird\n"), QString("first\nsecond\nthird\n"));
+    QCOMPARE(follower.offset(), qint64(10 + 20));
+    QCOMPARE(follower.append(QByteArray()), QString());
+    QCOMPARE(follower.offset(), qint64(10 + 20));
+}
+
+void NotepadqqTest::fileFollowerKeepsSplitCarriageReturns()
+{
+    FileFollower follower(QTextCodec::codecForName("UTF-8"), 0);
+
+    // The \r might be followed by a \n: wait for the next read
+    QCOMPARE(follower.append("line\r"), QString("line"));
+    QCOMPARE(follower.append("\nnext"), QString("\nnext"));
+
+    // It isn't: it's a line ending of its own
+    QCOMPARE(follower.append("\r"), QString());
+    QCOMPARE(follower.append("last"), QString("\nlast"));
+    QCOMPARE(follower.offset(), qint64(15));
+}
+
+void NotepadqqTest::fileFollowerKeepsSplitCharacters()
+{
+    FileFollower follower(QTextCodec::codecForName("UTF-8"), 0);
+
+    // U+00E9 is encoded as C3 A9
+    QCOMPARE(follower.append("caf\xC3"), QString("caf"));
+    QCOMPARE(follower.append("\xA9\n"), QString::fromUtf8("\xC3\xA9\n"));
+}
+
+void NotepadqqTest::fileFollowerDetectsTruncation()
+{
+    FileFollower follower(QTextCodec::codecForName("UTF-8"), 100);
+
+    QVERIFY(!follower.isTruncated(100));
+    QVERIFY(!follower.isTruncated(150));
+    QVERIFY(follower.isTruncated(99));
+
+    // The bytes read since count too
+    follower.append("0123456789");
+    QVERIFY(follower.isTruncated(105));
+}
+
+void NotepadqqTest::fileMonitorCoalescesChanges()
+{
+    QTemporaryDir dir;
+    const QString path = dir.filePath("coalesced.txt");
+    writeFile(path, "one");
+
+    FileMonitor& monitor = FileMonitor::getInstance();
+    monitor.addFile(path);
+    QSignalSpy spy(&monitor, &FileMonitor::fileChanged);
+
+    writeFile(path, "two");
+    writeFile(path, "three");
+    writeFile(path, "four");
+
+    QVERIFY(spy.wait(2000));
+    QCOMPARE(spy.count(), 1);
+    QCOMPARE(spy.first().at(0).toString(), path);
+
+    // Longer than the debounce interval: nothing else is notified
+    QTest::qWait(500);
+    QCOMPARE(spy.count(), 1);
+
+    monitor.removeFile(path);
+}
+
+void NotepadqqTest::fileMonitorNotifiesSameSizeRewrites()
+{
+    QTemporaryDir dir;
+    const QString path = dir.filePath("rewritten.txt");
+    writeFile(path, "aaa");
+
+    FileMonitor& monitor = FileMonitor::getInstance();
+    monitor.addFile(path);
+    QSignalSpy spy(&monitor, &FileMonitor::fileChanged);
+
+    // Same size, and most likely within the resolution of the modification time
+    writeFile(path, "bbb");
+    QVERIFY(spy.wait(2000));
+
+    writeFile(path, "ccc");
+    QVERIFY(spy.wait(2000));
+    QCOMPARE(spy.count(), 2);
+
+    monitor.removeFile(path);
+}
+
+void NotepadqqTest::fileMonitorCountsReferences()
+{
+    QTemporaryDir dir;
+    const QString path = dir.filePath("shared.txt");
+    writeFile(path, "one");
+
+    FileMonitor& monitor = FileMonitor::getInstance();
+    monitor.addFile(path);
+    monitor.addFile(path);
+    monitor.removeFile(path);
+    QVERIFY(monitor.isWatched(path));
+
+    QSignalSpy spy(&monitor, &FileMonitor::fileChanged);
+    writeFile(path, "two");
+    QVERIFY(spy.wait(2000));
+    QCOMPARE(spy.count(), 1);
+
+    monitor.removeFile(path);
+    QVERIFY(!monitor.isWatched(path));
+
+    writeFile(path, "three");
+    QVERIFY(!spy.wait(500));
+    QCOMPARE(spy.count(), 1);
+}
+
 QTEST_GUILESS_MAIN(NotepadqqTest)
 
 #include "tst_notepadqqtest.moc"
@@ -4,7 +4,7 @@
 
 QT += testlib
 QT += core gui svg widgets printsupport network webenginewidgets webchannel websockets
-CONFIG += c++11
+CONFIG += c++14
 TEMPLATE = app
 TARGET = ui-tests
 INCLUDEPATH += ../ui/
@@ -12,4 +12,18 @@ INCLUDEPATH += ../ui/
 include(../ui/libs/qtpromise/qtpromise.pri)
 
 # Input
-SOURCES += tst_notepadqqtest.cpp
+SOURCES += tst_notepadqqtest.cpp \
+    ../ui/nqqsettings.cpp \
+    ../ui/notepadqq.cpp \
+    ../ui/chunkedfilewriter.cpp \
+    ../ui/encodingmemo.cpp \
+    ../ui/filefollower.cpp \
+    ../ui/filemonitor.cpp \
+    ../ui/linediff.cpp \
+    ../ui/EditorNS/snapshotcache.cpp \
+    ../ui/Sessions/editjournalfile.cpp \
+    ../ui/Sessions/persistentcache.cpp \
+    ../ui/Sessions/sessionfile.cpp
+
+HEADERS += ../ui/include/notepadqq.h \
+    ../ui/include/filemonitor.h
@@ -0,0 +1,193 @@
+#include "include/EditorNS/bulktextchannel.h"
+
+#include <QDebug>
+#include <QHostAddress>
+#include <QUrlQuery>
+#include <QUuid>
+#include <QWebSocket>
+#include <QtEndian>
+
+#include <cstring>
+
+namespace EditorNS
+{
+
+    namespace {
+        // Size of the id that precedes the text in each frame
+        const int HEADER_SIZE = sizeof(quint32);
+    }
+
+    BulkTextChannel& BulkTextChannel::getInstance()
+    {
+        static BulkTextChannel channel;
+        return channel;
+    }
+
+    BulkTextChannel::BulkTextChannel() :
+        m_server(QStringLiteral("Notepadqq"), QWebSocketServer::NonSecureMode),
+        m_secret(QUuid::createUuid().toString().mid(1, 36))
+    {
+        if (!m_server.listen(QHostAddress::LocalHost)) {
+            qWarning() << "Bulk text channel unavailable:" << m_server.errorString();
+            return;
+        }
+
+        connect(&m_server, &QWebSocketServer::newConnection, this, &BulkTextChannel::on_newConnection);
+    }
+
+    QUrl BulkTextChannel::urlForEditor(quint32 editorId) const
+    {
+        if (!m_server.isListening())
+            return QUrl();
+
+        QUrl url;
+        url.setScheme("ws");
+        url.setHost(QHostAddress(QHostAddress::LocalHost).toString());
+        url.setPort(m_server.serverPort());
+        url.setPath("/" + m_secret);
+
+        QUrlQuery query;
+        query.addQueryItem("editor", QString::number(editorId));
+        url.setQuery(query);
+        return url;
+    }
+
+    bool BulkTextChannel::send(quint32 editorId, quint32 transferId, const QString &text)
+    {
+        QWebSocket *socket = m_sockets.value(editorId);
+        if (socket == nullptr)
+            return false;
+
+        QByteArray frame(HEADER_SIZE + text.size() * 2, Qt::Uninitialized);
+        uchar *data = reinterpret_cast<uchar *>(frame.data());
+        qToLittleEndian(transferId, data);
+
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+        std::memcpy(data + HEADER_SIZE, text.utf16(), text.size() * 2);
+#else
+        const ushort *utf16 = text.utf16();
+        for (int i = 0; i < text.size(); i++) {
+            qToLittleEndian(utf16[i], data + HEADER_SIZE + i * 2);
+        }
+#endif
+
+        // The page asks for the text again if the socket drops after this
+        return socket->isValid() && socket->sendBinaryMessage(frame) == frame.size();
+    }
+
+    QtPromise::QPromise<QString> BulkTextChannel::receive(quint32 editorId, quint32 transferId)
+    {
+        auto received = m_receivedTexts.find(transferId);
+        if (received != m_receivedTexts.end()) {
+            // The text arrived before the message that refers to it
+            QString text = received.value().text;
+            m_receivedTexts.erase(received);
+            return QtPromise::QPromise<QString>::resolve(text);
+        }
+
+        return QtPromise::QPromise<QString>([&](const QtPromise::QPromiseResolve<QString>& resolve,
+                                                const QtPromise::QPromiseReject<QString>& reject) {
+            m_pendingTransfers.emplace(transferId, PendingTransfer{editorId, resolve, reject});
+        });
+    }
+
+    void BulkTextChannel::discard(quint32 editorId, quint32 transferId)
+    {
+        if (m_receivedTexts.remove(transferId) == 0)
+            m_discardedTransfers.insert(transferId, editorId);
+    }
+
+    void BulkTextChannel::on_newConnection()
+    {
+        while (m_server.hasPendingConnections()) {
+            QWebSocket *socket = m_server.nextPendingConnection();
+
+            const QUrl url = socket->requestUrl();
+            bool ok = false;
+            const quint32 editorId = QUrlQuery(url).queryItemValue("editor").toUInt(&ok);
+
+            if (url.path() != "/" + m_secret || !ok || m_sockets.contains(editorId)) {
+                socket->close(QWebSocketProtocol::ClosePolicyViolated);
+                socket->deleteLater();
+                continue;
+            }
+
+            m_sockets.insert(editorId, socket);
+
+            connect(socket, &QWebSocket::binaryMessageReceived, this, [=](const QByteArray &message) {
+                on_binaryMessageReceived(editorId, message);
+            });
+            connect(socket, &QWebSocket::disconnected, this, [=]() {
+                on_disconnected(editorId, socket);
+            });
+        }
+    }
+
+    void BulkTextChannel::on_binaryMessageReceived(quint32 editorId, const QByteArray &message)
+    {
+        if (message.size() < HEADER_SIZE)
+            return;
+
+        const quint32 transferId = qFromLittleEndian<quint32>(reinterpret_cast<const uchar *>(message.constData()));
+
+        if (m_discardedTransfers.remove(transferId) > 0)
+            return;
+
+        const int length = (message.size() - HEADER_SIZE) / 2;
+        const uchar *data = reinterpret_cast<const uchar *>(message.constData()) + HEADER_SIZE;
+
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+        const QString text(reinterpret_cast<const QChar *>(data), length);
+#else
+        QString text(length, Qt::Uninitialized);
+        for (int i = 0; i < length; i++) {
+            text[i] = QChar(qFromLittleEndian<quint16>(data + i * 2));
+        }
+#endif
+
+        auto pending = m_pendingTransfers.find(transferId);
+        if (pending == m_pendingTransfers.end()) {
+            m_receivedTexts.insert(transferId, ReceivedText{editorId, text});
+            return;
+        }
+
+        QtPromise::QPromiseResolve<QString> resolve = pending->second.resolve;
+        m_pendingTransfers.erase(pending);
+        resolve(text);
+    }
+
+    void BulkTextChannel::on_disconnected(quint32 editorId, QWebSocket *socket)
+    {
+        if (m_sockets.value(editorId) == socket)
+            m_sockets.remove(editorId);
+
+        socket->deleteLater();
+
+        // The texts that the page sent won't be asked for anymore
+        for (auto it = m_receivedTexts.begin(); it != m_receivedTexts.end(); ) {
+            if (it->editorId == editorId)
+                it = m_receivedTexts.erase(it);
+            else
+                ++it;
+        }
+
+        for (auto it = m_discardedTransfers.begin(); it != m_discardedTransfers.end(); ) {
+            if (it.value() == editorId)
+                it = m_discardedTransfers.erase(it);
+            else
+                ++it;
+        }
+
+        // The texts that the page was going to send will never arrive
+        for (auto it = m_pendingTransfers.begin(); it != m_pendingTransfers.end(); ) {
+            if (it->second.editorId == editorId) {
+                QtPromise::QPromiseReject<QString> reject = it->second.reject;
+                it = m_pendingTransfers.erase(it);
+                reject(QString());
+            } else {
+                ++it;
+            }
+        }
+    }
+
+}
@@ -1,12 +1,14 @@
 #include "include/EditorNS/editor.h"
 
+#include "include/EditorNS/bulktextchannel.h"
+#include "include/EditorNS/editorpool.h"
 #include "include/notepadqq.h"
 #include "include/nqqsettings.h"
+#include "include/tracer.h"
 
 #include <QDir>
-#include <QEventLoop>
 #include <QMessageBox>
-#include <QRegExp>
+#include <QPointer>
 #include <QRegularExpression>
 #include <QTimer>
 #include <QUrlQuery>
@@ -17,8 +19,6 @@
 namespace EditorNS
 {
 
-    QQueue<QSharedPointer<Editor>> Editor::m_editorBuffer = QQueue<QSharedPointer<Editor>>();
-
     Editor::Editor(QWidget *parent) :
         QWidget(parent)
     {
@@ -34,13 +34,57 @@ namespace EditorNS
         fullConstructor(theme);
     }
 
-    void Editor::fullConstructor(const Theme &theme)
+    Editor::Editor(const Theme &theme, bool deferred, QWidget *parent) :
+        QWidget(parent)
+    {
+        fullConstructor(theme, deferred);
+    }
+
+    void Editor::fullConstructor(const Theme &theme, bool deferred)
     {
+        Tracer::Span span("Create editor");
+
+        static quint32 bulkTextIdentifier = 0;
+        m_bulkTextId = ++bulkTextIdentifier;
+
         m_jsToCppProxy = new JsToCppProxy(this);
         connect(m_jsToCppProxy,
                 &JsToCppProxy::messageReceived,
                 this,
                 &Editor::on_proxyMessageReceived);
+        connect(m_jsToCppProxy,
+                &JsToCppProxy::replyReceived,
+                this,
+                &Editor::on_proxyReplyReceived);
+        connect(m_jsToCppProxy,
+                &JsToCppProxy::bulkTextResendRequested,
+                this,
+                &Editor::on_proxyBulkTextResendRequested);
+
+        m_layout = new QVBoxLayout(this);
+        m_layout->setContentsMargins(0, 0, 0, 0);
+        m_layout->setSpacing(0);
+        setLayout(m_layout);
+
+        m_deferred = deferred;
+        if (m_deferred) {
+            m_webView = nullptr;
+            m_deferredTheme = theme;
+        } else {
+            createPage(theme);
+        }
+
+        // Queued until the page is loaded
+        setLanguage(nullptr);
+        // TODO Display a message if a javascript error gets triggered.
+        // Right now, if there's an error in the javascript code, we
+        // get stuck waiting a J_EVT_READY that will never come.
+    }
+
+    void Editor::createPage(const Theme &theme)
+    {
+        // Until J_EVT_READY is received
+        Tracer::beginAsync("Load editor page", this);
 
         m_webView = new CustomQWebView(this);
 
@@ -48,6 +92,10 @@ namespace EditorNS
         query.addQueryItem("themePath", theme.path);
         query.addQueryItem("themeName", theme.name);
 
+        const QUrl bulkTextUrl = BulkTextChannel::getInstance().urlForEditor(m_bulkTextId);
+        if (bulkTextUrl.isValid())
+            query.addQueryItem("bulkTextUrl", bulkTextUrl.toString());
+
         QUrl url = QUrl("file://" + Notepadqq::editorPath());
         url.setQuery(query);
 
@@ -73,98 +121,127 @@ namespace EditorNS
         #endif
         pageSettings->setAttribute(QWebEngineSettings::JavascriptCanAccessClipboard, true);
 
-        m_layout = new QVBoxLayout(this);
-        m_layout->setContentsMargins(0, 0, 0, 0);
-        m_layout->setSpacing(0);
         m_layout->addWidget(m_webView, 1);
-        setLayout(m_layout);
 
         connect(m_webView, &CustomQWebView::mouseWheel, this, &Editor::mouseWheel);
         connect(m_webView, &CustomQWebView::urlsDropped, this, &Editor::urlsDropped);
         connect(m_webView, &CustomQWebView::gotFocus, this, &Editor::gotFocus);
-        setLanguage(nullptr);
-        // TODO Display a message if a javascript error gets triggered.
-        // Right now, if there's an error in the javascript code, we
-        // get stuck waiting a J_EVT_READY that will never come.
     }
 
-    QSharedPointer<Editor> Editor::getNewEditor(QWidget *parent)
+    QSharedPointer<Editor> Editor::getDeferredEditor(QWidget *parent)
     {
-        QSharedPointer<Editor> out;
+        const QString themeName = NqqSettings::getInstance().Appearance.getColorScheme();
+        return EditorPool::getInstance().adopt(new Editor(themeFromName(themeName), true, parent));
+    }
 
-        if (m_editorBuffer.length() == 0) {
-            addEditorToBuffer(1);
-            out = QSharedPointer<Editor>::create();
-        } else if (m_editorBuffer.length() == 1) {
-            addEditorToBuffer(1);
-            out = m_editorBuffer.dequeue();
-        } else {
-            out = m_editorBuffer.dequeue();
+    bool Editor::isDeferred() const
+    {
+        return m_deferred;
+    }
+
+    void Editor::setDeferredLoader(const std::function<void()> &loader)
+    {
+        m_deferredLoader = loader;
+    }
+
+    void Editor::setDeferredValueReader(const std::function<QPromise<QString>()> &reader)
+    {
+        m_deferredValueReader = reader;
+    }
+
+    void Editor::loadDeferred()
+    {
+        if (!m_deferred)
+            return;
+
+        m_deferred = false;
+        createPage(m_deferredTheme);
+        m_webView->setZoomFactor(m_deferredZoomFactor);
+
+        if (m_deferredLoader) {
+            const std::function<void()> loader = m_deferredLoader;
+            m_deferredLoader = nullptr;
+            m_deferredValueReader = nullptr;
+            loader();
         }
+    }
+
+    void Editor::showEvent(QShowEvent *event)
+    {
+        QWidget::showEvent(event);
 
+        // The loader waits for the page: don't run it within the event
+        if (m_deferred)
+            QTimer::singleShot(0, this, &Editor::loadDeferred);
+    }
+
+    QSharedPointer<Editor> Editor::getNewEditor(QWidget *parent)
+    {
+        QSharedPointer<Editor> out = EditorPool::getInstance().acquire();
         out->setParent(parent);
         return out;
     }
 
     void Editor::addEditorToBuffer(const int howMany)
     {
-        for (int i = 0; i < howMany; i++)
-            m_editorBuffer.enqueue(QSharedPointer<Editor>::create());
+        EditorPool::getInstance().warm(howMany);
     }
 
     void Editor::invalidateEditorBuffer()
     {
-        m_editorBuffer.clear();
+        EditorPool::getInstance().clear();
     }
 
-    void Editor::waitAsyncLoad()
+    void Editor::resetForReuse()
     {
-        if (!m_loaded) {
-            QEventLoop loop;
-            connect(this, &Editor::editorReady, &loop, &QEventLoop::quit);
-            // Block until a J_EVT_READY message is received
-            loop.exec();
+        // The banners were about the previous document
+        for (int i = m_layout->count() - 1; i >= 0; i--) {
+            QWidget *banner = m_layout->itemAt(i)->widget();
+            if (banner != nullptr && banner != m_webView) {
+                m_layout->removeWidget(banner);
+                banner->deleteLater();
+            }
         }
+
+        m_filePath = QUrl();
+        m_tabName.clear();
+        m_fileOnDiskChanged = false;
+        m_lastActivated = 0;
+        m_endOfLineSequence = "\n";
+        m_codec = QTextCodec::codecForName("UTF-8");
+        m_bom = false;
+        m_customIndentationMode = false;
+        m_documentInfo.clear();
+        isLoading = false;
+
+        beginTransaction();
+        setChangeRecordingEnabled(false);
+        asyncSendMessageWithResultP("C_CMD_SET_VALUE", QString());
+        asyncSendMessageWithResultP("C_CMD_CLEAR_HISTORY");
+        asyncSendMessageWithResultP("C_CMD_RESET_DOCUMENT_INFO");
+        markClean();
+
+        // Apply the indentation of the language again, even if it didn't change
+        m_currentLanguage = nullptr;
+        setLanguage(nullptr);
+        endTransaction();
     }
 
     void Editor::on_proxyMessageReceived(QString msg, QVariant data)
     {
+        // Handled right away, in order with the replies: any snapshot that
+        // is received after this message was read after the modification.
+        if (msg == "J_EVT_CONTENT_MODIFIED") {
+            m_snapshotCache.invalidate();
+            return;
+        }
+
         QTimer::singleShot(0, [msg,data,this]{
 
             emit messageReceived(msg, data);
 
-            if (msg.startsWith("[ASYNC_REPLY]")) {
-                QRegExp rgx("\\[ID=(\\d+)\\]$");
-
-                if(rgx.indexIn(msg) == -1)
-                    return;
-
-                if (rgx.captureCount() != 1)
-                    return;
-
-                unsigned int id = rgx.capturedTexts()[1].toInt();
-
-                // Look into the list of callbacks
-                for (auto it = this->asyncReplies.begin(); it != this->asyncReplies.end(); ++it) {
-                    if (it->id == id) {
-                        AsyncReply r = *it;
-                        if (r.value) {
-                            r.value->set_value(data);
-                        }
-                        this->asyncReplies.erase(it);
-
-                        if (r.callback != nullptr) {
-                            QTimer::singleShot(0, [r,data]{ r.callback(data); });
-                        }
-
-                        emit asyncReplyReceived(r.id, r.message, data);
-
-                        break;
-                    }
-                }
-
-
-            } else if(msg == "J_EVT_READY") {
+            if(msg == "J_EVT_READY") {
+                Tracer::endAsync("Load editor page", this);
                 m_loaded = true;
                 emit editorReady();
             } else if(msg == "J_EVT_CONTENT_CHANGED")
@@ -172,21 +249,74 @@ namespace EditorNS
             else if(msg == "J_EVT_CLEAN_CHANGED")
                 emit cleanChanged(data.toBool());
             else if (msg == "J_EVT_CURSOR_ACTIVITY") {
-                emit cursorActivity(data.toMap());
+                emit cursorActivity(updateDocumentInfo(data.toMap()));
             } else if (msg == "J_EVT_DOCUMENT_INFO") {
-                emit documentInfoRequested(data.toMap());
+                emit documentInfoRequested(updateDocumentInfo(data.toMap()));
+            } else if (msg == "J_EVT_CHANGES") {
+                const QVariantMap changes = data.toMap();
+                emit changesRecorded(changes.value("sequence").toInt(), changes.value("changes").toList());
             }
         });
     }
 
+    QVariantMap Editor::updateDocumentInfo(const QVariantMap &changes)
+    {
+        for (auto it = changes.constBegin(); it != changes.constEnd(); ++it) {
+            m_documentInfo.insert(it.key(), it.value());
+        }
+        return m_documentInfo;
+    }
+
+    void Editor::on_proxyReplyReceived(unsigned int id, QVariant data)
+    {
+        const bool isBulkText = data.type() == QVariant::Map && data.toMap().contains("bulkText");
+
+        auto it = m_pendingReplies.find(id);
+        if (it == m_pendingReplies.end()) {
+            // Nobody is going to claim the text
+            if (isBulkText)
+                BulkTextChannel::getInstance().discard(m_bulkTextId, id);
+            return;
+        }
+
+        // No need to defer this: QtPromise already invokes the
+        // handlers of the promise from the event loop.
+        const PendingReply reply = it->second;
+        m_pendingReplies.erase(it);
+
+        if (isBulkText) {
+            // The text is travelling through the BulkTextChannel. If it's lost,
+            // an empty text would be taken for the content of the document.
+            BulkTextChannel::getInstance().receive(m_bulkTextId, id)
+                    .then([=](const QString &text) { reply.resolve(QVariant(text)); })
+                    .fail([=]() { reply.reject(QString("The text sent by the editor has been lost")); });
+            return;
+        }
+
+        reply.resolve(data);
+    }
+
+    void Editor::on_proxyBulkTextResendRequested(unsigned int id)
+    {
+        auto it = m_pendingReplies.find(id);
+        if (it == m_pendingReplies.end() || it->second.bulkText.isNull())
+            return;
+
+        const QString text = it->second.bulkText;
+        it->second.bulkText = QString();
+        emit m_jsToCppProxy->bulkTextResentToJs(id, text);
+    }
+
     void Editor::setFocus()
     {
-        m_webView->setFocus();
+        if (m_webView)
+            m_webView->setFocus();
     }
 
     void Editor::clearFocus()
     {
-        m_webView->clearFocus();
+        if (m_webView)
+            m_webView->clearFocus();
     }
 
     /**
@@ -224,34 +354,52 @@ namespace EditorNS
 
     QPromise<bool> Editor::isCleanP()
     {
+        if (m_deferred)
+            return QPromise<bool>::resolve(true);
+
         return asyncSendMessageWithResultP("C_FUN_IS_CLEAN", QVariant(0))
                 .then([](QVariant v){ return v.toBool(); });
     }
 
-    bool Editor::isClean()
+    QPromise<void> Editor::markClean()
     {
-        QVariant data(0); // avoid crash on Mac OS X, see issue #702
-        return asyncSendMessageWithResult("C_FUN_IS_CLEAN", data).get().toBool();
+        return asyncSendMessageWithResultP("C_CMD_MARK_CLEAN").then([](){});
     }
 
-    QPromise<void> Editor::markClean()
+    QPromise<void> Editor::markClean(int changeSequence)
     {
-        return asyncSendMessageWithResultP("C_CMD_MARK_CLEAN").then([](){})
-                .wait(); // FIXME Remove
+        return asyncSendMessageWithResultP("C_CMD_MARK_CLEAN", QVariantMap{{"sequence", changeSequence}}).then([](){});
     }
 
     QPromise<void> Editor::markDirty()
     {
-        return asyncSendMessageWithResultP("C_CMD_MARK_DIRTY").then([](){})
-                .wait(); // FIXME Remove
+        return asyncSendMessageWithResultP("C_CMD_MARK_DIRTY").then([](){});
     }
 
     QPromise<int> Editor::getHistoryGeneration()
     {
+        if (m_deferred)
+            return QPromise<int>::resolve(0);
+
+        if (m_snapshotCache.isCached())
+            return QPromise<int>::resolve(m_snapshotCache.snapshot().historyGeneration);
+
         return asyncSendMessageWithResultP("C_FUN_GET_HISTORY_GENERATION")
                 .then([](QVariant v){return v.toInt();});
     }
 
+    QPromise<int> Editor::getChangeSequence()
+    {
+        if (m_deferred)
+            return QPromise<int>::resolve(0);
+
+        if (m_snapshotCache.isCached())
+            return QPromise<int>::resolve(m_snapshotCache.snapshot().changeSequence);
+
+        return asyncSendMessageWithResultP("C_FUN_GET_CHANGE_SEQUENCE")
+                .then([](QVariant v){return v.toInt();});
+    }
+
     void Editor::setLanguage(const Language* lang)
     {
         if (lang == nullptr) {
@@ -314,15 +462,6 @@ namespace EditorNS
                                            QVariantMap{{"useTabs", useTabs}, {"size", size}}).then([](){});
     }
 
-    Editor::IndentationMode Editor::indentationMode()
-    {
-        QVariantMap indent = asyncSendMessageWithResult("C_FUN_GET_INDENTATION_MODE").get().toMap();
-        IndentationMode out;
-        out.useTabs = indent.value("useTabs", true).toBool();
-        out.size = indent.value("size", 4).toInt();
-        return out;
-    }
-
     QPromise<Editor::IndentationMode> Editor::indentationModeP()
     {
         return asyncSendMessageWithResultP("C_FUN_GET_INDENTATION_MODE").then([](QVariant result){
@@ -368,13 +507,55 @@ namespace EditorNS
         if (lang != nullptr) {
             setLanguage(lang);
         }
-        return asyncSendMessageWithResultP("C_CMD_SET_VALUE", value).then([](){})
-                .wait(); // FIXME Remove
+        return asyncSendMessageWithResultP("C_CMD_SET_VALUE", value).then([](){});
     }
 
-    QString Editor::value()
+    QPromise<QString> Editor::valueP()
     {
-        return asyncSendMessageWithResult("C_FUN_GET_VALUE").get().toString();
+        return snapshot().then([](const Snapshot &snapshot){ return snapshot.text; });
+    }
+
+    QPromise<Editor::Snapshot> Editor::snapshot()
+    {
+        if (m_snapshotCache.isCached())
+            return QPromise<Snapshot>::resolve(m_snapshotCache.snapshot());
+
+        const unsigned int epoch = m_snapshotCache.epoch();
+
+        // All the requests are run by the same batch, so nothing can modify
+        // the document in between.
+        beginTransaction();
+        QVector<QPromise<QVariant>> results {
+            asyncSendMessageWithResultP("C_FUN_GET_HISTORY_GENERATION"),
+            asyncSendMessageWithResultP("C_FUN_GET_VALUE"),
+            asyncSendMessageWithResultP("C_FUN_GET_CHANGE_SEQUENCE")
+        };
+        endTransaction();
+
+        return QtPromise::all(results).then([=](const QVector<QVariant> &values){
+            const Snapshot snapshot { values[1].toString(), values[0].toInt(), values[2].toInt() };
+
+            // A deferred document is read again instead of being kept in memory
+            if (!m_deferred)
+                m_snapshotCache.store(snapshot, epoch);
+
+            return snapshot;
+        });
+    }
+
+    bool Editor::isSnapshotCached() const
+    {
+        return m_snapshotCache.isCached();
+    }
+
+    void Editor::setChangeRecordingEnabled(bool enabled)
+    {
+        asyncSendMessageWithResultP("C_CMD_SET_CHANGE_RECORDING", enabled);
+    }
+
+    void Editor::applyChanges(const QVariantList &changes)
+    {
+        asyncSendMessageWithResultP("C_CMD_APPLY_CHANGES", changes);
     }
 
     bool Editor::fileOnDiskChanged() const
@@ -387,14 +568,33 @@ namespace EditorNS
         m_fileOnDiskChanged = fileOnDiskChanged;
     }
 
+    qint64 Editor::lastActivated() const
+    {
+        return m_lastActivated;
+    }
+
+    void Editor::setLastActivated(qint64 lastActivated)
+    {
+        m_lastActivated = lastActivated;
+    }
+
     void Editor::sendMessage(const QString msg, const QVariant data)
     {
 #ifdef QT_DEBUG
         qDebug() << "Legacy message " << msg << " sent.";
 #endif
-        waitAsyncLoad();
+        if (m_transactionDepth > 0) {
+            // Keep the message in order with the rest of the batch
+            asyncSendMessageWithResultP(msg, data);
+            return;
+        }
+
+        m_snapshotCache.beforeSending(msg);
+        loadDeferred();
 
-        emit m_jsToCppProxy->messageReceivedByJs(msg, data);
+        deliverWhenLoaded([=](){
+            emit m_jsToCppProxy->messageReceivedByJs(msg, data);
+        });
     }
 
     void Editor::sendMessage(const QString msg)
@@ -406,83 +606,118 @@ namespace EditorNS
 
     QPromise<QVariant> Editor::asyncSendMessageWithResultP(const QString msg, const QVariant data)
     {
-        unsigned int currentMsgIdentifier = ++messageIdentifier;
+        if (m_deferred && msg.startsWith("C_FUN_")) {
+            // A deferred document hasn't been modified: what's known about it without
+            // loading it is enough to answer the most frequent queries, e.g. of the
+            // backups and of searches.
+            if (msg == "C_FUN_GET_HISTORY_GENERATION" || msg == "C_FUN_GET_CHANGE_SEQUENCE")
+                return QPromise<QVariant>::resolve(QVariant(0));
+            if (msg == "C_FUN_IS_CLEAN")
+                return QPromise<QVariant>::resolve(QVariant(true));
+            if (msg == "C_FUN_GET_VALUE" && m_deferredValueReader)
+                return readDeferredValue();
+
+            // Whoever asks for information is going to wait for it
+            loadDeferred();
+        }
+
+        const unsigned int id = ++messageIdentifier;
+
+        m_snapshotCache.beforeSending(msg);
 
         QPromise<QVariant> resultPromise = QPromise<QVariant>([&](
                                                               const QPromiseResolve<QVariant>& resolve,
-                                                              const QPromiseReject<QVariant>& /* reject */) {
+                                                              const QPromiseReject<QVariant>& reject) {
+            m_pendingReplies.emplace(id, PendingReply{resolve, reject});
+        });
 
-            auto conn = std::make_shared<QMetaObject::Connection>();
-            *conn = QObject::connect(this, &Editor::asyncReplyReceived, this, [=](unsigned int id, QString, QVariant data){
-                if (id == currentMsgIdentifier) {
-                    QObject::disconnect(*conn);
-                    resolve(data);
-                }
+        QVariant payload = data;
+        if (data.type() == QVariant::String) {
+            const QString text = data.toString();
+            if (text.length() >= BulkTextChannel::MIN_LENGTH &&
+                    BulkTextChannel::getInstance().send(m_bulkTextId, id, text)) {
+                payload = QVariantMap{{"bulkText", id}};
+                // JavaScript asks for it again if the channel drops before it arrives
+                m_pendingReplies.at(id).bulkText = text;
+            }
+        }
+
+        if (m_transactionDepth > 0) {
+            // Sent by endTransaction()
+            m_transactionRequests.append(QVariant(QVariantList{id, msg, payload}));
+        } else {
+            deliverWhenLoaded([=](){
+                emit m_jsToCppProxy->requestReceivedByJs(id, msg, payload);
             });
+        }
 
-        });
+        return resultPromise;
+    }
 
-        // FIXME We can probably remove this->asyncReplies after we've converted everything
-        AsyncReply asyncmsg;
-        asyncmsg.id = currentMsgIdentifier;
-        asyncmsg.message = msg;
-        asyncmsg.value = nullptr;
-        asyncmsg.callback = nullptr;
-        this->asyncReplies.push_back((asyncmsg));
+    QPromise<QVariant> Editor::readDeferredValue()
+    {
+        QPointer<Editor> self(this);
+        return m_deferredValueReader().then([](const QString &value) {
+            return QVariant(value);
+        }).fail([=]() {
+            if (!self)
+                return QPromise<QVariant>::reject(QString("The editor has been closed"));
 
-        QString message_id = "[ASYNC_REQUEST]" + msg + "[ID=" + QString::number(currentMsgIdentifier) + "]";
+            // Let the editor read the file itself
+            self->loadDeferred();
+            return self->asyncSendMessageWithResultP("C_FUN_GET_VALUE");
+        });
+    }
 
+    void Editor::deliverWhenLoaded(const std::function<void()> &deliver)
+    {
         if (m_loaded) {
             // Send it right now
-            emit m_jsToCppProxy->messageReceivedByJs(message_id, data);
+            deliver();
         } else {
             // Send it as soon as the editor becomes ready
             auto conn = std::make_shared<QMetaObject::Connection>();
             *conn = QObject::connect(this, &Editor::editorReady, this, [=](){
                 QObject::disconnect(*conn);
                 m_loaded = true;
-                emit m_jsToCppProxy->messageReceivedByJs(message_id, data);
+                deliver();
             });
         }
-
-        return resultPromise;
     }
 
-    QPromise<QVariant> Editor::asyncSendMessageWithResultP(const QString msg)
+    void Editor::beginTransaction()
     {
-        return this->asyncSendMessageWithResultP(msg, 0);
+        m_transactionDepth++;
     }
 
-    std::shared_future<QVariant> Editor::asyncSendMessageWithResult(const QString msg, const QVariant data, std::function<void(QVariant)> callback)
+    void Editor::endTransaction()
     {
-        unsigned int currentMsgIdentifier = ++messageIdentifier;
-
-        std::shared_ptr<std::promise<QVariant>> resultPromise = std::make_shared<std::promise<QVariant>>();
-
-        AsyncReply asyncmsg;
-        asyncmsg.id = currentMsgIdentifier;
-        asyncmsg.message = msg;
-        asyncmsg.value = resultPromise;
-        asyncmsg.callback = callback;
-        this->asyncReplies.push_back((asyncmsg));
-
-        QString message_id = "[ASYNC_REQUEST]" + msg + "[ID=" + QString::number(currentMsgIdentifier) + "]";
+        Q_ASSERT(m_transactionDepth > 0);
+        if (--m_transactionDepth > 0 || m_transactionRequests.isEmpty())
+            return;
 
-        this->sendMessage(message_id, data);
+        const QVariantList requests = m_transactionRequests;
+        m_transactionRequests.clear();
 
-        std::shared_future<QVariant> fut = resultPromise->get_future().share();
+        deliverWhenLoaded([=](){
+            emit m_jsToCppProxy->requestsReceivedByJs(requests);
+        });
+    }
 
-        while (fut.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
-            QCoreApplication::processEvents(QEventLoop::AllEvents);
-            QCoreApplication::sendPostedEvents(nullptr, QEvent::DeferredDelete);
-        }
+    Editor::Transaction::Transaction(QSharedPointer<Editor> editor) :
+        m_editor(editor)
+    {
+        m_editor->beginTransaction();
+    }
 
-        return fut;
+    Editor::Transaction::~Transaction()
+    {
+        m_editor->endTransaction();
     }
 
-    std::shared_future<QVariant> Editor::asyncSendMessageWithResult(const QString msg, std::function<void(QVariant)> callback)
+    QPromise<QVariant> Editor::asyncSendMessageWithResultP(const QString msg)
     {
-        return this->asyncSendMessageWithResult(msg, 0, callback);
+        return this->asyncSendMessageWithResultP(msg, 0);
     }
 
     void Editor::setZoomFactor(const qreal &factor)
@@ -491,12 +726,15 @@ namespace EditorNS
         if (normFact > 14) normFact = 14;
         else if (normFact < 0.10) normFact = 0.10;
 
-        m_webView->setZoomFactor(normFact);
+        if (m_webView)
+            m_webView->setZoomFactor(normFact);
+        else
+            m_deferredZoomFactor = normFact;
     }
 
     qreal Editor::zoomFactor() const
     {
-        return m_webView->zoomFactor();
+        return m_webView ? m_webView->zoomFactor() : m_deferredZoomFactor;
     }
 
     void Editor::setSelectionsText(const QStringList &texts, SelectMode mode)
@@ -573,12 +811,6 @@ namespace EditorNS
         asyncSendMessageWithResultP("C_CMD_GET_DOCUMENT_INFO");
     }
 
-    QPair<int, int> Editor::cursorPosition()
-    {
-        QList<QVariant> cursor = asyncSendMessageWithResult("C_FUN_GET_CURSOR").get().toList();
-        return {cursor[0].toInt(), cursor[1].toInt()};
-    }
-
     void Editor::setCursorPosition(const int line, const int column)
     {
         asyncSendMessageWithResultP("C_CMD_SET_CURSOR", QList<QVariant>{line, column});
@@ -600,10 +832,12 @@ namespace EditorNS
         asyncSendMessageWithResultP("C_CMD_SET_SELECTION", QVariant(arg));
     }
 
-    QPair<int, int> Editor::scrollPosition()
+    QPromise<QPair<int, int>> Editor::scrollPositionP()
     {
-        QVariantList scroll = asyncSendMessageWithResult("C_FUN_GET_SCROLL_POS").get().toList();
-        return {scroll[0].toInt(), scroll[1].toInt()};
+        return asyncSendMessageWithResultP("C_FUN_GET_SCROLL_POS").then([](QVariant v){
+            QVariantList scroll = v.toList();
+            return QPair<int, int>(scroll[0].toInt(), scroll[1].toInt());
+        });
     }
 
     void Editor::setScrollPosition(const int left, const int top)
@@ -691,26 +925,28 @@ namespace EditorNS
         sendMessage("C_CMD_SET_THEME", QVariantMap{{"name",theme.name},{"path",theme.path}});
     }
 
-    QList<Editor::Selection> Editor::selections()
+    QPromise<QList<Editor::Selection>> Editor::selectionsP()
     {
-        QList<Selection> out;
+        return asyncSendMessageWithResultP("C_FUN_GET_SELECTIONS").then([](QVariant v){
+            QList<Selection> out;
 
-        QList<QVariant> sels = asyncSendMessageWithResult("C_FUN_GET_SELECTIONS").get().toList();
-        for (int i = 0; i < sels.length(); i++) {
-            QVariantMap selMap = sels[i].toMap();
-            QVariantMap from = selMap.value("anchor").toMap();
-            QVariantMap to = selMap.value("head").toMap();
+            QList<QVariant> sels = v.toList();
+            for (int i = 0; i < sels.length(); i++) {
+                QVariantMap selMap = sels[i].toMap();
+                QVariantMap from = selMap.value("anchor").toMap();
+                QVariantMap to = selMap.value("head").toMap();
 
-            Selection sel;
-            sel.from.line = from.value("line").toInt();
-            sel.from.column = from.value("ch").toInt();
-            sel.to.line = to.value("line").toInt();
-            sel.to.column = to.value("ch").toInt();
+                Selection sel;
+                sel.from.line = from.value("line").toInt();
+                sel.from.column = from.value("ch").toInt();
+                sel.to.line = to.value("line").toInt();
+                sel.to.column = to.value("ch").toInt();
 
-            out.append(sel);
-        }
+                out.append(sel);
+            }
 
-        return out;
+            return out;
+        });
     }
 
     QPromise<QStringList> Editor::selectedTexts()
@@ -754,6 +990,8 @@ namespace EditorNS
         // 3. Set C_CMD_DISPLAY_PRINT_STYLE to hide UI elements like the gutter.
 
 #if QT_VERSION >= QT_VERSION_CHECK(5,8,0)
+        loadDeferred();
+
         QColor prevBackgroundColor = m_webView->page()->backgroundColor();
         QString prevStylesheet = m_webView->styleSheet();
 
@@ -784,6 +1022,8 @@ namespace EditorNS
             [&](const QPromiseResolve<QByteArray>& resolve, const QPromiseReject<QByteArray>& reject) {
 
 #if QT_VERSION >= QT_VERSION_CHECK(5, 8, 0)
+                loadDeferred();
+
                 QColor prevBackgroundColor = m_webView->page()->backgroundColor();
                 QString prevStylesheet = m_webView->styleSheet();
 
@@ -791,25 +1031,25 @@ namespace EditorNS
                 setTheme(themeFromName("default"));
                 m_webView->page()->setBackgroundColor(Qt::transparent);
                 m_webView->setStyleSheet("background-color: white");
-                asyncSendMessageWithResultP("C_CMD_DISPLAY_PRINT_STYLE").wait();
-
-                m_webView->page()->printToPdf(
-                    [=](const QByteArray& data) {
-                        QTimer::singleShot(0, [=]() {
-                            asyncSendMessageWithResultP("C_CMD_DISPLAY_NORMAL_STYLE").wait();
-                            m_webView->setStyleSheet(prevStylesheet);
-                            m_webView->page()->setBackgroundColor(prevBackgroundColor);
-                            setTheme(themeFromName(NqqSettings::getInstance().Appearance.getColorScheme()));
-                            this->setLineWrap(NqqSettings::getInstance().General.getWordWrap());
-                        });
-
-                        if (data.isEmpty() || data.isNull()) {
-                            reject(QByteArray());
-                        } else {
-                            resolve(data);
-                        }
-                    },
-                    pageLayout);
+                asyncSendMessageWithResultP("C_CMD_DISPLAY_PRINT_STYLE").finally([=]() {
+                    m_webView->page()->printToPdf(
+                        [=](const QByteArray& data) {
+                            QTimer::singleShot(0, [=]() {
+                                asyncSendMessageWithResultP("C_CMD_DISPLAY_NORMAL_STYLE");
+                                m_webView->setStyleSheet(prevStylesheet);
+                                m_webView->page()->setBackgroundColor(prevBackgroundColor);
+                                setTheme(themeFromName(NqqSettings::getInstance().Appearance.getColorScheme()));
+                                this->setLineWrap(NqqSettings::getInstance().General.getWordWrap());
+                            });
+
+                            if (data.isEmpty() || data.isNull()) {
+                                reject(QByteArray());
+                            } else {
+                                resolve(data);
+                            }
+                        },
+                        pageLayout);
+                });
 
 #else
                 reject(QByteArray());
@@ -0,0 +1,206 @@
+#include "include/EditorNS/editorpool.h"
+
+#include <QThread>
+
+#include <algorithm>
+#include <memory>
+
+namespace EditorNS
+{
+
+    namespace {
+        // Bounds of the number of spare editors
+        const int MIN_SIZE = 1;
+        const int MAX_SIZE = 6;
+
+        // Only the editors requested within this time (msec) count
+        const int RATE_WINDOW = 30000;
+
+        // Time (msec) without requests before creating new editors
+        const int IDLE_DELAY = 500;
+
+        // The editors dropped by the destructor of the pool are destroyed
+        bool s_poolDestroyed = false;
+    }
+
+    EditorPool& EditorPool::getInstance()
+    {
+        static EditorPool pool;
+        return pool;
+    }
+
+    EditorPool::EditorPool()
+    {
+        m_clock.start();
+
+        m_idleTimer.setSingleShot(true);
+        connect(&m_idleTimer, &QTimer::timeout, this, &EditorPool::adjustSize);
+    }
+
+    EditorPool::~EditorPool()
+    {
+        s_poolDestroyed = true;
+    }
+
+    QSharedPointer<Editor> EditorPool::acquire()
+    {
+        const qint64 now = m_clock.elapsed();
+        m_requestTimes.enqueue(now);
+        m_statistics.requests++;
+
+        QSharedPointer<Editor> editor;
+
+        // Prefer the editors that already finished loading
+        auto loaded = std::find_if(m_editors.begin(), m_editors.end(), [](const QSharedPointer<Editor> &e) {
+            return e->m_loaded;
+        });
+
+        if (loaded != m_editors.end()) {
+            editor = *loaded;
+            m_editors.erase(loaded);
+            m_statistics.hits++;
+        } else if (!m_editors.isEmpty()) {
+            editor = m_editors.dequeue();
+        } else {
+            editor = adopt(new Editor());
+        }
+
+        measureReadyLatency(editor, now);
+        scheduleWarming();
+
+        return editor;
+    }
+
+    void EditorPool::recycle(QSharedPointer<Editor> editor)
+    {
+        // The editor may still be used by an extension, a search or a pending save:
+        // it's only reset by release(), when the last reference is dropped.
+        editor->m_returnedToPool = true;
+    }
+
+    QSharedPointer<Editor> EditorPool::adopt(Editor *editor)
+    {
+        return QSharedPointer<Editor>(editor, &EditorPool::release);
+    }
+
+    void EditorPool::release(Editor *editor)
+    {
+        const bool sameThread = editor->thread() == QThread::currentThread();
+
+        if (!s_poolDestroyed && sameThread && editor->m_returnedToPool) {
+            EditorPool &pool = getInstance();
+            editor->m_returnedToPool = false;
+
+            // An editor that is still loading is no faster than a new one
+            if (editor->m_loaded && !editor->m_deferred && pool.m_editors.size() < pool.targetSize()) {
+                // The weak references to the previous document are gone with the old reference count
+                QSharedPointer<Editor> reused = pool.adopt(editor);
+                reused->resetForReuse();
+                pool.m_editors.enqueue(reused);
+                pool.m_statistics.recycled++;
+                return;
+            }
+        }
+
+        if (sameThread)
+            delete editor;
+        else
+            editor->deleteLater();
+    }
+
+    void EditorPool::warm(int howMany)
+    {
+        for (int i = 0; i < howMany; i++)
+            m_editors.enqueue(adopt(new Editor()));
+    }
+
+    void EditorPool::clear()
+    {
+        m_idleTimer.stop();
+        m_editors.clear();
+    }
+
+    const EditorPool::Statistics& EditorPool::statistics() const
+    {
+        return m_statistics;
+    }
+
+    QString EditorPool::statisticsReport() const
+    {
+        const qint64 averageLatency = m_statistics.requests > 0 ?
+                    m_statistics.totalReadyLatency / m_statistics.requests : 0;
+
+        return QString("Editor pool: %1 editors requested, %2 already loaded, %3 recycled. "
+                       "%4 msec on average until ready, first one ready after %5 msec")
+                .arg(m_statistics.requests)
+                .arg(m_statistics.hits)
+                .arg(m_statistics.recycled)
+                .arg(averageLatency)
+                .arg(m_statistics.firstReadyLatency);
+    }
+
+    int EditorPool::targetSize()
+    {
+        const qint64 now = m_clock.elapsed();
+        while (!m_requestTimes.isEmpty() && now - m_requestTimes.head() > RATE_WINDOW)
+            m_requestTimes.dequeue();
+
+        return qBound(MIN_SIZE, m_requestTimes.size(), MAX_SIZE);
+    }
+
+    void EditorPool::measureReadyLatency(QSharedPointer<Editor> editor, qint64 requestTime)
+    {
+        auto record = [this, requestTime]() {
+            const qint64 now = m_clock.elapsed();
+            m_statistics.totalReadyLatency += now - requestTime;
+            if (m_statistics.firstReadyLatency == -1)
+                m_statistics.firstReadyLatency = now;
+        };
+
+        if (editor->m_loaded) {
+            record();
+            return;
+        }
+
+        auto conn = std::make_shared<QMetaObject::Connection>();
+        *conn = connect(editor.data(), &Editor::editorReady, this, [=]() {
+            QObject::disconnect(*conn);
+            record();
+        });
+    }
+
+    void EditorPool::scheduleWarming()
+    {
+        // Wait for the application to calm down: when many editors are
+        // requested at once, e.g. by a session, don't compete with them.
+        m_idleTimer.start(IDLE_DELAY);
+    }
+
+    void EditorPool::adjustSize()
+    {
+        const int target = targetSize();
+
+        // Fewer editors are being opened now: free some memory
+        while (m_editors.size() > target)
+            m_editors.removeLast();
+
+        if (m_editors.size() < target) {
+            // Load one editor at a time. The next one is created as soon
+            // as this one is ready.
+            const bool loading = std::any_of(m_editors.begin(), m_editors.end(), [](const QSharedPointer<Editor> &e) {
+                return !e->m_loaded;
+            });
+
+            if (!loading) {
+                QSharedPointer<Editor> editor = adopt(new Editor());
+                connect(editor.data(), &Editor::editorReady, this, &EditorPool::scheduleWarming);
+                m_editors.enqueue(editor);
+            }
+        }
+
+        // Check again once the current requests are too old to count
+        if (m_editors.size() > MIN_SIZE)
+            m_idleTimer.start(RATE_WINDOW);
+    }
+
+}
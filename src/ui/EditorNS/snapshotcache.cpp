@@ -0,0 +1,52 @@
+#include "include/EditorNS/snapshotcache.h"
+
+#include <QSet>
+
+namespace EditorNS
+{
+
+    namespace {
+        // Requests that never modify the content of the document
+        const QSet<QString> READ_ONLY_REQUESTS {
+            "C_FUN_GET_VALUE", "C_FUN_GET_VALUE_CHUNK", "C_FUN_GET_HISTORY_GENERATION",
+            "C_FUN_GET_CHANGE_SEQUENCE", "C_CMD_SET_CHANGE_RECORDING",
+            "C_FUN_IS_CLEAN", "C_CMD_MARK_CLEAN", "C_CMD_MARK_DIRTY",
+            "C_FUN_GET_CURSOR", "C_FUN_GET_SELECTIONS", "C_FUN_GET_SELECTIONS_TEXT",
+            "C_FUN_GET_SCROLL_POS", "C_FUN_GET_INDENTATION_MODE", "C_FUN_GET_LINE_COUNT",
+            "C_FUN_GET_TEXT_LENGTH", "C_FUN_GET_CURRENT_WORD", "C_CMD_GET_DOCUMENT_INFO",
+            "C_CMD_SET_CURSOR", "C_CMD_SET_SELECTION", "C_CMD_SET_SCROLL_POS",
+            "C_FUN_DETECT_INDENTATION_MODE",
+        };
+    }
+
+    bool SnapshotCache::isReadOnly(const QString &request)
+    {
+        return READ_ONLY_REQUESTS.contains(request);
+    }
+
+    bool SnapshotCache::store(const Snapshot &snapshot, unsigned int epoch)
+    {
+        if (epoch != m_epoch)
+            return false;
+
+        m_snapshot = snapshot;
+        m_cached = true;
+        return true;
+    }
+
+    void SnapshotCache::invalidate()
+    {
+        m_epoch++;
+        m_cached = false;
+        m_snapshot = Snapshot();
+    }
+
+    void SnapshotCache::beforeSending(const QString &request)
+    {
+        // Until JavaScript runs the request, the cached snapshot would not
+        // reflect its effects.
+        if (!isReadOnly(request))
+            invalidate();
+    }
+
+}
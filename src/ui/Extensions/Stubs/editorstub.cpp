@@ -1,5 +1,7 @@
 #include "include/Extensions/Stubs/editorstub.h"
 
+#include "include/globals.h"
+
 namespace Extensions {
     namespace Stubs {
 
@@ -31,7 +33,22 @@ namespace Extensions {
 
         NQQ_DEFINE_EXTENSION_METHOD(EditorStub, value, )
         {
-            return StubReturnValue(editor()->value());
+            bool ok;
+            const auto result = waitFor(editor()->valueP(), &ok);
+            if (!ok)
+                return StubReturnValue(ErrorCode::OBJECT_DEALLOCATED);
+
+            return StubReturnValue(result);
+        }
+
+        NQQ_DEFINE_EXTENSION_METHOD(EditorStub, isClean, )
+        {
+            bool ok;
+            const auto result = waitFor(editor()->isCleanP(), &ok);
+            if (!ok)
+                return StubReturnValue(ErrorCode::OBJECT_DEALLOCATED);
+
+            return StubReturnValue(result);
         }
 
         NQQ_DEFINE_EXTENSION_METHOD(EditorStub, setSelectionsText, args)
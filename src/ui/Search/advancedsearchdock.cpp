@@ -583,9 +583,10 @@ void AdvancedSearchDock::startReplace()
             // The editor might not be open anymore. Try to find it first
             if(!tec->tabWidgetFromEditor(ed)) continue;
 
-            QString content = ed->value();
-            FileReplacer::replaceAll(res, content, replaceText);
-            ed->setValue(content);
+            ed->valueP().then([ed, res, replaceText](QString content){
+                FileReplacer::replaceAll(res, content, replaceText);
+                ed->setValue(content);
+            });
         }
         return;
     } else if (scope == SearchConfig::ScopeFileSystem) {
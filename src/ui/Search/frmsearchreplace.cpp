@@ -7,6 +7,7 @@
 
 #include <QCompleter>
 #include <QFileDialog>
+#include <QLayout>
 #include <QLineEdit>
 #include <QMessageBox>
 #include <QThread>
@@ -164,7 +165,7 @@ void frmSearchReplace::replace(QString string, QString replacement, SearchHelper
     }
 }
 
-int frmSearchReplace::replaceAll(QString string, QString replacement, SearchHelpers::SearchMode searchMode, SearchHelpers::SearchOptions searchOptions) {
+QPromise<int> frmSearchReplace::replaceAll(QString string, QString replacement, SearchHelpers::SearchMode searchMode, SearchHelpers::SearchOptions searchOptions) {
     QString rawSearch = SearchString::format(string, searchMode, searchOptions);
     if (searchMode == SearchHelpers::SearchMode::SpecialChars) {
             replacement = SearchString::unescape(replacement);
@@ -175,18 +176,18 @@ int frmSearchReplace::replaceAll(QString string, QString replacement, SearchHelp
     data.append(regexModifiersFromSearchOptions(searchOptions));
     data.append(replacement);
 		data.append(QString::number(static_cast<int>(searchMode)));
-    QVariant count = currentEditor()->asyncSendMessageWithResult("C_FUN_REPLACE_ALL", QVariant::fromValue(data)).get();
-    return count.toInt();
+    return currentEditor()->asyncSendMessageWithResultP("C_FUN_REPLACE_ALL", QVariant::fromValue(data))
+            .then([](QVariant count){ return count.toInt(); });
 }
 
-int frmSearchReplace::selectAll(QString string, SearchHelpers::SearchMode searchMode, SearchHelpers::SearchOptions searchOptions) {
+QPromise<int> frmSearchReplace::selectAll(QString string, SearchHelpers::SearchMode searchMode, SearchHelpers::SearchOptions searchOptions) {
     QString rawSearch = SearchString::format(string, searchMode, searchOptions);
 
     QList<QVariant> data = QList<QVariant>();
     data.append(rawSearch);
     data.append(regexModifiersFromSearchOptions(searchOptions));
-    QVariant count = currentEditor()->asyncSendMessageWithResult("C_FUN_SEARCH_SELECT_ALL", QVariant::fromValue(data)).get();
-    return count.toInt();
+    return currentEditor()->asyncSendMessageWithResultP("C_FUN_SEARCH_SELECT_ALL", QVariant::fromValue(data))
+            .then([](QVariant count){ return count.toInt(); });
 }
 
 SearchHelpers::SearchMode frmSearchReplace::searchModeFromUI()
@@ -267,31 +268,33 @@ void frmSearchReplace::on_btnReplacePrev_clicked()
 
 void frmSearchReplace::on_btnReplaceAll_clicked()
 {
-    int n = this->replaceAll(ui->cmbSearch->currentText(),
-                             ui->cmbReplace->currentText(),
-                             searchModeFromUI(),
-                             searchOptionsFromUI());
+    this->replaceAll(ui->cmbSearch->currentText(),
+                     ui->cmbReplace->currentText(),
+                     searchModeFromUI(),
+                     searchOptionsFromUI())
+    .then([this](int n){
+        QMessageBox::information(this, tr("Replace all"), tr("%1 occurrences have been replaced.").arg(n));
+    });
 
     addToSearchHistory(ui->cmbSearch->currentText());
     addToReplaceHistory(ui->cmbReplace->currentText());
-
-    QMessageBox::information(this, tr("Replace all"), tr("%1 occurrences have been replaced.").arg(n));
 }
 
 void frmSearchReplace::on_btnSelectAll_clicked()
 {
-    int count = this->selectAll(ui->cmbSearch->currentText(),
-                                searchModeFromUI(),
-                                searchOptionsFromUI());
+    this->selectAll(ui->cmbSearch->currentText(),
+                    searchModeFromUI(),
+                    searchOptionsFromUI())
+    .then([this](int count){
+        if (count == 0) {
+            QMessageBox::information(this, tr("Select all"), tr("No results found"));
+        } else {
+            // Focus on main window
+            this->m_topEditorContainer->activateWindow();
+        }
+    });
 
     addToSearchHistory(ui->cmbSearch->currentText());
-
-    if (count == 0) {
-        QMessageBox::information(this, tr("Select all"), tr("No results found"));
-    } else {
-        // Focus on main window
-        this->m_topEditorContainer->activateWindow();
-    }
 }
 
 void frmSearchReplace::on_actionReplace_toggled(bool on)
@@ -319,8 +322,10 @@ void frmSearchReplace::manualSizeAdjust()
     int curX = geometry().x();
     int curY = geometry().y();
 
-    QApplication::processEvents();
-    QApplication::processEvents();
+    // Apply the widgets that have just been shown or hidden to the
+    // minimum size right away, instead of processing the pending events.
+    if (layout())
+        layout()->activate();
     setGeometry(curX, curY, width(), 0);
 
     setFixedSize(width(), height());
@@ -373,13 +378,14 @@ void frmSearchReplace::on_searchStringEdited(const QString &/*text*/)
         if (ui->actionFind->isChecked()) {
             auto editor = currentEditor();
 
-            QList<Editor::Selection> selections = editor->selections();
-            if (selections.length() > 0) {
-                editor->setCursorPosition(
-                            std::min(selections[0].from, selections[0].to));
-            }
+            editor->selectionsP().then([this, editor](const QList<Editor::Selection> &selections){
+                if (selections.length() > 0) {
+                    editor->setCursorPosition(
+                                std::min(selections[0].from, selections[0].to));
+                }
 
-            findFromUI(true);
+                findFromUI(true);
+            });
         }
     }
 
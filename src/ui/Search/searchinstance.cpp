@@ -9,6 +9,7 @@
 #include <QHeaderView>
 #include <QMenu>
 #include <QPainter>
+#include <QPointer>
 #include <QStyledItemDelegate>
 #include <QTextDocument>
 
@@ -204,28 +205,52 @@ SearchInstance::SearchInstance(const SearchConfig& config)
         else
             editorsToSearch = tec->getOpenEditors();
 
-        if (config.searchMode == SearchConfig::ModePlainText ||
-            config.searchMode == SearchConfig::ModePlainTextSpecialChars) {
-            for (auto ed : editorsToSearch) {
-                DocResult dr = FileSearcher::searchPlainText(config, ed->value());
-                dr.docType = DocResult::TypeDocument;
-                dr.fileName = tec->tabWidgetFromEditor(ed)->tabTextFromEditor(ed);
-                dr.editor = ed;
-                if (!dr.results.empty())
-                    m_searchResult.results.push_back(dr);
+        // Request the contents of all the editors at once, then search them together.
+        QVector<QPromise<QString>> valuePromises;
+        for (auto ed : editorsToSearch)
+            valuePromises.append(ed->valueP());
+
+        QPointer<SearchInstance> self(this);
+        QPointer<TopEditorContainer> container(tec);
+        QtPromise::all(valuePromises).then([=](const QVector<QString>& values) {
+            if (!self)
+                return;
+
+            if (!container) { // The window has been closed
+                self->onSearchCompleted();
+                return;
             }
-        } else if (config.searchMode == SearchConfig::ModeRegex) {
-            QRegularExpression regex = FileSearcher::createRegexFromConfig(config);
-            for (auto ed : editorsToSearch) {
-                DocResult dr = FileSearcher::searchRegExp(regex, ed->value());
+
+            QRegularExpression regex;
+            if (config.searchMode == SearchConfig::ModeRegex)
+                regex = FileSearcher::createRegexFromConfig(config);
+
+            for (int i = 0; i < values.size(); i++) {
+                const auto& ed = editorsToSearch[i];
+                EditorTabWidget* tabWidget = container->tabWidgetFromEditor(ed);
+                if (!tabWidget) // Closed in the meantime
+                    continue;
+
+                DocResult dr;
+                if (config.searchMode == SearchConfig::ModePlainText ||
+                    config.searchMode == SearchConfig::ModePlainTextSpecialChars) {
+                    dr = FileSearcher::searchPlainText(config, values[i]);
+                } else if (config.searchMode == SearchConfig::ModeRegex) {
+                    dr = FileSearcher::searchRegExp(regex, values[i]);
+                }
+
                 dr.docType = DocResult::TypeDocument;
-                dr.fileName = tec->tabWidgetFromEditor(ed)->tabTextFromEditor(ed);
+                dr.fileName = tabWidget->tabTextFromEditor(ed);
                 dr.editor = ed;
                 if (!dr.results.empty())
-                    m_searchResult.results.push_back(dr);
+                    self->m_searchResult.results.push_back(dr);
             }
-        }
-        onSearchCompleted();
+            self->onSearchCompleted();
+        }).fail([=]() {
+            // An editor has been closed while being read
+            if (self)
+                self->onSearchCompleted();
+        });
     } else if (config.searchScope == SearchConfig::ScopeFileSystem) {
         QTreeWidgetItem* toplevelitem = new QTreeWidgetItem(treeWidget);
         toplevelitem->setText(0, tr("Calculating..."));
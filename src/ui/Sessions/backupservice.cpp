@@ -1,92 +1,180 @@
 #include "include/Sessions/backupservice.h"
 
+#include "include/Sessions/editjournal.h"
 #include "include/Sessions/persistentcache.h"
 #include "include/Sessions/sessions.h"
+#include "include/docengine.h"
+#include "include/globals.h"
 #include "include/mainwindow.h"
 
 #include <QApplication>
+#include <QtConcurrent/QtConcurrentRun>
 
+#include <algorithm>
 #include <set>
 
 QTimer BackupService::s_autosaveTimer;
 bool BackupService::s_autosaveEnabled = false;
 std::set<BackupService::WindowData> BackupService::s_backupWindowData;
+std::map<MainWindow*, Sessions::CacheIndex> BackupService::s_cacheIndexes;
+bool BackupService::s_backupRunning = false;
+int BackupService::s_backupEpoch = 0;
+QFuture<void> BackupService::s_pendingWrite;
+int BackupService::s_pendingRestores = 0;
 
 void BackupService::executeBackup() {
-    const auto& backupPath = PersistentCache::backupDirPath();
+    // A backup completes asynchronously: don't start another one in the meantime.
+    // Restored windows may still be loading documents from the previous backup.
+    if (s_backupRunning || s_pendingRestores > 0)
+        return;
 
-    std::set<WindowData> newData, savedData, temp;
+    s_backupRunning = true;
+    const int epoch = s_backupEpoch;
+
+    // Ask every editor of every window for its change sequence at once.
+    QVector<QPromise<WindowData>> windowsP;
 
-    // Fill newData with up-to-date window data
     for (const auto& wnd : MainWindow::instances()) {
-        WindowData wd;
-        wd.ptr = wnd;
-        wnd->topEditorContainer()->forEachEditor([&wd](int,int,EditorTabWidget*,QSharedPointer<Editor> ed) {
-            int gen = -1;
-            ed->getHistoryGeneration().wait().tap([&](int value){gen = value;});
-            wd.editors.push_back( std::make_pair(ed, gen) );
+        std::vector<QSharedPointer<Editor>> editors;
+        QVector<QPromise<int>> sequencesP;
+
+        wnd->topEditorContainer()->forEachEditor([&](int,int,EditorTabWidget*,QSharedPointer<Editor> ed) {
+            editors.push_back(ed);
+            sequencesP.append(ed->getChangeSequence());
             return true;
         });
-        newData.insert(std::move(wd));
+
+        windowsP.append(QtPromise::all(sequencesP).then([wnd, editors](const QVector<int>& sequences) {
+            WindowData wd;
+            wd.ptr = wnd;
+            for (int i = 0; i < sequences.size(); i++)
+                wd.editors.push_back( std::make_pair(editors[static_cast<size_t>(i)], sequences[i]) );
+            return wd;
+        }));
     }
 
-    // Find all closed windows and remove their backups
+    QtPromise::all(windowsP).then([epoch](const QVector<WindowData>& windows) {
+        if (epoch != s_backupEpoch)
+            return QPromise<void>::resolve();
+
+        return writeBackups(std::set<WindowData>(windows.begin(), windows.end()));
+    }).finally([]() {
+        s_backupRunning = false;
+    });
+}
+
+QPromise<void> BackupService::writeBackups(std::set<WindowData> newData)
+{
+    const int epoch = s_backupEpoch;
+    const QList<MainWindow*> openWindows = MainWindow::instances();
+
+    // Windows closed while we were waiting for their editors count as closed
+    for (auto it = newData.begin(); it != newData.end(); ) {
+        if (openWindows.contains(it->ptr))
+            ++it;
+        else
+            it = newData.erase(it);
+    }
+
+    std::set<WindowData> temp;
+
+    // Find all closed windows, their backups will be removed
     std::set_difference(s_backupWindowData.begin(), s_backupWindowData.end(),
                         newData.begin(), newData.end(),
                         std::inserter(temp, temp.end()));
 
+    QStringList closedWindowPaths;
     for (const auto& item : temp) {
-        const auto ptrToInt = reinterpret_cast<uintptr_t>(item.ptr);
-        const QString cachePath = backupPath + QString("/window_%1").arg(ptrToInt);
-        QDir(cachePath).removeRecursively();
+        closedWindowPaths.append(windowBackupPath(item.ptr));
+
+        for (const auto& cached : s_cacheIndexes[item.ptr])
+            EditJournal::getInstance().stop(cached.first);
+        s_cacheIndexes.erase(item.ptr);
     }
 
-    // Find all newly created windows and create their backups
-    temp.clear();
-    std::set_difference(newData.begin(), newData.end(),
-                        s_backupWindowData.begin(), s_backupWindowData.end(),
-                        std::inserter(temp, temp.end()));
+    // Find all newly created windows, and all persisting windows whose contents changed.
+    // If oldItem and newItem are fully equal, their contents need not be backed up.
+    std::set<WindowData> savedData;
+    std::vector<WindowData> changedData;
 
-    for (const auto& item : temp) {
-        // If writeBackup() fails we don't mark this window as saved. Another attempt at saving will be made
-        // next time executeBackup() runs.
-        if (writeBackup(item.ptr))
-            savedData.insert(item);
+    for (const auto& newItem : newData) {
+        const auto oldItem = s_backupWindowData.find(newItem);
+
+        if (oldItem != s_backupWindowData.end() && oldItem->isFullyEqual(newItem))
+            savedData.insert(newItem);
+        else
+            changedData.push_back(newItem);
     }
 
-    // Find all persisting windows and re-check whether to save them
-    temp.clear();
-    std::set_intersection(s_backupWindowData.begin(), s_backupWindowData.end(),
-                          newData.begin(), newData.end(),
-                          std::inserter(temp, temp.end()));
+    QVector<QPromise<std::shared_ptr<Sessions::SessionSnapshot>>> sessionsP;
+    QStringList sessionPaths;
 
-    for (const auto& oldItem : temp) { // oldItem is always from the first set (s_backupWindowData)
-        const auto& newItem = *newData.find(oldItem);
+    for (const auto& item : changedData) {
+        const QString cachePath = windowBackupPath(item.ptr);
+        sessionsP.append(Sessions::collectSession(item.ptr->topEditorContainer(), cachePath, s_cacheIndexes[item.ptr],
+                                                  &EditJournal::getInstance()));
+        sessionPaths.append(cachePath + "/window.bin");
+    }
 
-        // If oldItem and newItem are fully equal, their contents haven't changed and need not be backed up...
-        if (oldItem.isFullyEqual(newItem)) {
-            savedData.insert(newItem);
-            continue;
-        }
+    return QtPromise::all(sessionsP).then([=](const QVector<std::shared_ptr<Sessions::SessionSnapshot>>& sessions) {
+        if (epoch != s_backupEpoch)
+            return QPromise<void>::resolve();
 
-        // ...otherwise we attempt saving the backup
-        if (writeBackup(newItem.ptr))
-            savedData.insert(newItem);
+        auto results = std::make_shared<std::vector<std::pair<bool, Sessions::CacheIndex>>>(sessions.size());
+
+        // The editors are no longer needed: encode and write everything on the I/O threads.
+        s_pendingWrite = QtConcurrent::run(DocEngine::ioThreadPool(), [=]() {
+            for (const QString& path : closedWindowPaths)
+                QDir(path).removeRecursively();
+
+            for (int i = 0; i < sessions.size(); i++) {
+                auto& result = (*results)[static_cast<size_t>(i)];
+                result.first = Sessions::writeSession(*sessions[i], sessionPaths[i], &result.second,
+                                                      Sessions::SessionFormat::Binary);
+            }
+        });
+
+        return QtPromise::resolve(s_pendingWrite).then([=]() {
+            if (epoch != s_backupEpoch)
+                return;
+
+            std::set<WindowData> backedUpData = savedData;
+
+            for (size_t i = 0; i < changedData.size(); i++) {
+                // If writing failed we don't mark this window as saved. Another attempt at saving will be made
+                // next time executeBackup() runs.
+                if ((*results)[i].first) {
+                    backedUpData.insert(changedData[i]);
+                    updateJournals(s_cacheIndexes[changedData[i].ptr], (*results)[i].second);
+                    s_cacheIndexes[changedData[i].ptr] = std::move((*results)[i].second);
+                }
+            }
+
+            s_backupWindowData = backedUpData;
+        });
+    });
+}
+
+void BackupService::updateJournals(const Sessions::CacheIndex& oldIndex, const Sessions::CacheIndex& newIndex)
+{
+    EditJournal& journal = EditJournal::getInstance();
+
+    // The documents that are no longer in the backup, e.g. because they've been saved
+    for (const auto& cached : oldIndex) {
+        if (newIndex.find(cached.first) == newIndex.end())
+            journal.stop(cached.first);
     }
 
-    s_backupWindowData = savedData;
+    // From now on, the changes go into the journals of the new cache files
+    for (const auto& cached : newIndex)
+        journal.setCacheFile(cached.first, cached.second.cacheFilePath, cached.second.changeSequence);
 }
 
-bool BackupService::writeBackup(MainWindow* wnd)
+QString BackupService::windowBackupPath(MainWindow* wnd)
 {
-    // Save this MainWindow as a session inside the autosave path.
     // MainWindow's address is used to have a unique path name.
-    const auto& backupPath = PersistentCache::backupDirPath();
     const auto ptrToInt = reinterpret_cast<uintptr_t>(wnd);
-    const QString cachePath = backupPath + QString("/window_%1").arg(ptrToInt);
-    const QString sessPath = backupPath + QString("/window_%1/window.xml").arg(ptrToInt);
-
-    return Sessions::saveSession(wnd->getDocEngine(), wnd->topEditorContainer(), sessPath, cachePath);
+    return PersistentCache::backupDirPath() + QString("/window_%1").arg(ptrToInt);
 }
 
 bool BackupService::restoreFromBackup()
@@ -112,11 +200,23 @@ bool BackupService::restoreFromBackup()
         return false;
 
     for (const auto& dirInfo : dirs) {
-        const auto sessPath = dirInfo.filePath() + "/window.xml";
+        // Backups written by previous versions are XML
+        auto sessPath = dirInfo.filePath() + "/window.bin";
+        if (!QFileInfo::exists(sessPath))
+            sessPath = dirInfo.filePath() + "/window.xml";
 
         MainWindow* wnd = new MainWindow(QStringList(), nullptr);
-        Sessions::loadSession(wnd->getDocEngine(), wnd->topEditorContainer(), sessPath);
-        wnd->show();
+        s_pendingRestores++;
+
+        Sessions::readSession(sessPath).then([wnd](std::shared_ptr<Sessions::SessionFile> session) {
+            if (!session)
+                return QPromise<void>::resolve();
+
+            return Sessions::restoreSession(wnd->getDocEngine(), wnd->topEditorContainer(), *session);
+        }).finally([wnd]() {
+            s_pendingRestores--;
+            wnd->show();
+        });
     }
 
     return true;
@@ -169,6 +269,12 @@ void BackupService::disableAutosave()
 
 void BackupService::clearBackupData()
 {
+    // A backup being written must not recreate the directory afterwards,
+    // and the ones still collecting their data must not be written at all.
+    s_backupEpoch++;
+    s_pendingWrite.waitForFinished();
+    EditJournal::getInstance().clear();
+
     const auto& backupPath = PersistentCache::backupDirPath();
     QDir backupDir(backupPath);
 
@@ -176,6 +282,31 @@ void BackupService::clearBackupData()
         backupDir.removeRecursively();
 
     s_backupWindowData.clear();
+    s_cacheIndexes.clear();
+}
+
+void BackupService::forgetEditor(const EditorNS::Editor* editor)
+{
+    EditJournal::getInstance().stop(editor);
+
+    for (auto& cacheIndex : s_cacheIndexes)
+        cacheIndex.second.erase(editor);
+
+    // The windows that had this editor are written again by the next backup
+    for (auto it = s_backupWindowData.begin(); it != s_backupWindowData.end(); ) {
+        const bool hadEditor = std::any_of(it->editors.begin(), it->editors.end(), [editor](const std::pair<QSharedPointer<EditorNS::Editor>, int>& e) {
+            return e.first.data() == editor;
+        });
+
+        if (hadEditor)
+            it = s_backupWindowData.erase(it);
+        else
+            ++it;
+    }
+
+    // A backup being collected would put the editor back into the cache indexes
+    if (s_backupRunning)
+        s_backupEpoch++;
 }
 
 void BackupService::pause()
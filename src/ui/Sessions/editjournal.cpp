@@ -0,0 +1,170 @@
+#include "include/Sessions/editjournal.h"
+
+#include "include/EditorNS/editor.h"
+#include "include/Sessions/editjournalfile.h"
+
+#include <QFile>
+#include <QtConcurrent/QtConcurrentRun>
+
+using namespace EditorNS;
+
+namespace {
+    // Time (msec) the changes are kept in memory before being written
+    const int FLUSH_DELAY = 250;
+
+    // Size of a journal above which writing a new cache file is cheaper
+    // than replaying the journal
+    const qint64 MAX_SIZE = 1024 * 1024;
+}
+
+EditJournal& EditJournal::getInstance()
+{
+    static EditJournal journal;
+    return journal;
+}
+
+EditJournal::EditJournal()
+{
+    m_writer.setMaxThreadCount(1);
+
+    m_flushTimer.setSingleShot(true);
+    m_flushTimer.setInterval(FLUSH_DELAY);
+    connect(&m_flushTimer, &QTimer::timeout, this, &EditJournal::flush);
+}
+
+QString EditJournal::journalPath(const QString &cacheFilePath, const Editor *editor)
+{
+    // Identical documents share their cache file, but not their journal
+    return QString("%1.%2.journal").arg(cacheFilePath).arg(reinterpret_cast<quintptr>(editor), 0, 16);
+}
+
+void EditJournal::record(QSharedPointer<Editor> editor)
+{
+    auto journal = m_journals.find(editor.data());
+    if (journal != m_journals.end() && journal->editor.toStrongRef() == editor)
+        return;
+
+    Journal newJournal;
+    newJournal.editor = editor;
+    m_journals.insert(editor.data(), newJournal);
+
+    connect(editor.data(), &Editor::changesRecorded, this, &EditJournal::on_changesRecorded, Qt::UniqueConnection);
+    connect(editor.data(), &QObject::destroyed, this, &EditJournal::on_editorDestroyed, Qt::UniqueConnection);
+    editor->setChangeRecordingEnabled(true);
+}
+
+void EditJournal::setCacheFile(const Editor *editor, const QString &cacheFilePath, int changeSequence)
+{
+    auto journal = m_journals.find(editor);
+    if (journal == m_journals.end())
+        return;
+
+    const bool failed = journal->writeFailed && *journal->writeFailed;
+    if (journal->cacheFilePath == cacheFilePath && journal->changeSequence == changeSequence && !failed)
+        return;
+
+    // The new journal starts with the changes that the cache file misses
+    journal->cacheFilePath = cacheFilePath;
+    journal->journalFilePath = journalPath(cacheFilePath, editor);
+    journal->changeSequence = changeSequence;
+    journal->writtenEntries = 0;
+    journal->size = 0;
+    journal->writeFailed = std::make_shared<std::atomic_bool>(false);
+
+    QList<Entry> entries;
+    for (const Entry &entry : journal->entries) {
+        if (entry.sequence > changeSequence) {
+            entries.append(entry);
+            journal->size += entry.line.size();
+        }
+    }
+    journal->entries = entries;
+
+    if (!m_flushTimer.isActive())
+        m_flushTimer.start();
+}
+
+bool EditJournal::covers(const Editor *editor, const QString &cacheFilePath) const
+{
+    auto journal = m_journals.find(editor);
+    return journal != m_journals.end()
+            && journal->cacheFilePath == cacheFilePath
+            && journal->size <= MAX_SIZE
+            && journal->writeFailed && !*journal->writeFailed;
+}
+
+void EditJournal::stop(const Editor *editor)
+{
+    auto journal = m_journals.find(editor);
+    if (journal == m_journals.end())
+        return;
+
+    if (QSharedPointer<Editor> e = journal->editor.toStrongRef())
+        e->setChangeRecordingEnabled(false);
+
+    m_journals.erase(journal);
+}
+
+void EditJournal::clear()
+{
+    for (const Journal &journal : m_journals) {
+        if (QSharedPointer<Editor> e = journal.editor.toStrongRef())
+            e->setChangeRecordingEnabled(false);
+    }
+
+    m_journals.clear();
+    m_flushTimer.stop();
+    m_writer.waitForDone();
+}
+
+void EditJournal::flush()
+{
+    for (Journal &journal : m_journals) {
+        if (journal.cacheFilePath.isEmpty() || journal.writtenEntries == journal.entries.size())
+            continue;
+
+        // The journal misses changes anyway: covers() lets the next backup write a cache file
+        if (*journal.writeFailed)
+            continue;
+
+        QByteArray data;
+        for (int i = journal.writtenEntries; i < journal.entries.size(); i++)
+            data.append(journal.entries[i].line);
+
+        // A journal is written from scratch when its cache file changes
+        const QIODevice::OpenMode mode = journal.writtenEntries == 0 ?
+                    QIODevice::WriteOnly | QIODevice::Truncate :
+                    QIODevice::WriteOnly | QIODevice::Append;
+        const QString path = journal.journalFilePath;
+        const std::shared_ptr<std::atomic_bool> failed = journal.writeFailed;
+
+        QtConcurrent::run(&m_writer, [path, mode, data, failed]() {
+            // Fails if the backup has been removed in the meantime, or the disk is full
+            QFile file(path);
+            if (!file.open(mode) || file.write(data) != data.size() || !file.flush())
+                *failed = true;
+        });
+
+        journal.writtenEntries = journal.entries.size();
+    }
+}
+
+void EditJournal::on_changesRecorded(int changeSequence, const QVariantList &changes)
+{
+    auto journal = m_journals.find(sender());
+    if (journal == m_journals.end())
+        return;
+
+    const QByteArray line = EditJournalFile::entry(changeSequence, changes);
+    journal->entries.append(Entry{changeSequence, line});
+    journal->size += line.size();
+
+    // Until its first cache file is written, there is no journal to write to
+    if (!journal->cacheFilePath.isEmpty() && !m_flushTimer.isActive())
+        m_flushTimer.start();
+}
+
+void EditJournal::on_editorDestroyed(QObject *editor)
+{
+    m_journals.remove(editor);
+}
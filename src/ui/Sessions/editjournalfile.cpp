@@ -0,0 +1,41 @@
+#include "include/Sessions/editjournalfile.h"
+
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+QByteArray EditJournalFile::entry(int changeSequence, const QVariantList &changes)
+{
+    QJsonObject entry;
+    entry.insert("sequence", changeSequence);
+    entry.insert("changes", QJsonArray::fromVariantList(changes));
+
+    return QJsonDocument(entry).toJson(QJsonDocument::Compact) + "\n";
+}
+
+QVariantList EditJournalFile::readChanges(const QString &journalFilePath, int changeSequence)
+{
+    QVariantList changes;
+
+    QFile file(journalFilePath);
+    if (!file.open(QIODevice::ReadOnly))
+        return changes;
+
+    while (!file.atEnd()) {
+        QJsonParseError error;
+        const QJsonDocument line = QJsonDocument::fromJson(file.readLine(), &error);
+
+        // The last line may have been cut by a crash
+        if (error.error != QJsonParseError::NoError)
+            break;
+
+        const QJsonObject entry = line.object();
+        if (entry.value("sequence").toInt() <= changeSequence)
+            continue;
+
+        changes.append(entry.value("changes").toArray().toVariantList());
+    }
+
+    return changes;
+}
@@ -2,7 +2,24 @@
 
 #include "include/notepadqq.h"
 
+#include <QCryptographicHash>
+#include <QSaveFile>
+#include <QtEndian>
+
+namespace {
+    const QString BLOB_SUFFIX = "blob";
+
+    // Compressing fast matters more than compressing well: the blobs are
+    // written while the user works.
+    const int BLOB_COMPRESSION_LEVEL = 1;
+}
+
 QString PersistentCache::cacheSessionPath() {
+    static QString cachePath = QFileInfo(QSettings().fileName()).dir().absolutePath().append("/session.bin");
+    return cachePath;
+}
+
+QString PersistentCache::legacyCacheSessionPath() {
     static QString cachePath = QFileInfo(QSettings().fileName()).dir().absolutePath().append("/session.xml");
     return cachePath;
 }
@@ -17,6 +34,11 @@ QString PersistentCache::backupDirPath() {
     return path;
 }
 
+QString PersistentCache::workspacesDirPath() {
+    static QString path = QFileInfo(QSettings().fileName()).dir().absolutePath().append("/workspaces");
+    return path;
+}
+
 QUrl PersistentCache::createValidCacheName(const QDir& parent, const QString &fileName)
 {
     QUrl cacheFile;
@@ -33,3 +55,54 @@ QUrl PersistentCache::createValidCacheName(const QDir& parent, const QString &fi
     // with loading the files later.
     return QUrl::fromLocalFile(fileInfo.absoluteFilePath());
 }
+
+QString PersistentCache::storeBlob(const QDir& parent, const QByteArray& data)
+{
+    const QString hash = QString::fromLatin1(QCryptographicHash::hash(data, QCryptographicHash::Sha1).toHex());
+
+    // Make sure an absolute file path is returned, otherwise there could be problems
+    // with loading the files later.
+    const QString blobPath = parent.absoluteFilePath(hash + "." + BLOB_SUFFIX);
+
+    if (QFileInfo::exists(blobPath))
+        return blobPath;
+
+    // An existing blob must always be complete: write it atomically.
+    QSaveFile file(blobPath);
+
+    if (!file.open(QIODevice::WriteOnly))
+        return QString();
+
+    file.write(qCompress(data, BLOB_COMPRESSION_LEVEL));
+
+    if (!file.commit())
+        return QString();
+
+    return blobPath;
+}
+
+bool PersistentCache::isBlob(const QString& filePath)
+{
+    const QFileInfo fileInfo(filePath);
+
+    if (fileInfo.suffix() != BLOB_SUFFIX)
+        return false;
+
+    // Don't mistake a document of the user for a blob
+    const QString path = fileInfo.absoluteFilePath();
+    return path.startsWith(cacheDirPath() + "/") || path.startsWith(backupDirPath() + "/") ||
+            path.startsWith(workspacesDirPath() + "/");
+}
+
+QByteArray PersistentCache::unpackBlob(const QByteArray& blob, bool *ok)
+{
+    const QByteArray data = qUncompress(blob);
+
+    // qUncompress() returns an empty array on errors. The data is preceded
+    // by its size, which tells them apart from an empty document.
+    if (ok)
+        *ok = !data.isEmpty() ||
+              (blob.size() >= 4 && qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(blob.constData())) == 0);
+
+    return data;
+}
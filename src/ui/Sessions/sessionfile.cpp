@@ -0,0 +1,435 @@
+#include "include/Sessions/sessionfile.h"
+
+#include <QDataStream>
+#include <QObject>
+#include <QSaveFile>
+
+/* Session XML structure:
+ *
+ * <Notepadqq>
+ *      <View>
+ *          <Tab filePath="xxx" .../>
+ *          <Tab filePath="xxx" .../>
+ *      </View>
+ *      <View>
+ *          ...
+ *      </View>
+ *      ...
+ * <Notepadqq>
+ *
+ *
+ * All currently available attributes for <Tab>:
+ * -> string filePath - path to the file if it exists
+ * -> string cacheFilePath - path to the cache file if it exists. Cache files are compressed blobs
+ *                           named after the hash of their content (see PersistentCache::storeBlob).
+ * -> int scrollX - horizontal scroll position
+ * -> int scrollY - vertical scroll position
+ * -> string language - the display language of the document.
+ * -> long int lastModified - optional, last modification date (in msecs since epoch) of the file point to in filePath
+ * -> int active - optional, value is "1" if this tab is the open one in the tabview, otherwise "0".
+ * -> int changeSequence - optional, the change sequence of the document in cacheFilePath. The changes
+ *                         recorded in its journal after this one are replayed.
+ * -> string journalFilePath - optional, path to the EditJournal of the document.
+ * -> long int lastActivated - optional, last time (in msecs since epoch) the tab was made the current one.
+ *
+ *
+ * Binary session structure (QDataStream, big endian), used for the sessions Notepadqq
+ * writes for itself. The index comes first, so that a record can be read without
+ * reading the records before it:
+ *
+ * "NQQS"                   - magic
+ * quint16 version          - BINARY_SESSION_VERSION
+ * quint32 viewCount
+ * viewCount times:
+ *     quint32 tabCount
+ *     qint32 activeTab     - index of the active tab of the view, -1 if none
+ * for each tab of each view:
+ *     quint32 offset       - position of the record of the tab from the start of the file
+ *     quint32 size         - size of the record
+ * the records, one per tab:
+ *     filePath, cacheFilePath, cursorX, cursorY, scrollX, scrollY, active, language,
+ *     lastModified, customIndent, useTabs, tabSize, changeSequence, journalFilePath,
+ *     lastActivated (optional)
+ *
+ * Readers ignore the end of a record they don't know about, so new fields can be appended
+ * to the records without changing the version.
+ *
+ * */
+
+namespace {
+    const QByteArray BINARY_SESSION_MAGIC = "NQQS";
+    const quint16 BINARY_SESSION_VERSION = 1;
+    const QDataStream::Version BINARY_SESSION_STREAM_VERSION = QDataStream::Qt_5_0;
+}
+
+std::vector<ViewData> SessionReader::readData(bool* outSuccess) {
+    std::vector<ViewData> result;
+
+    if (m_reader.readNextStartElement()) {
+        if (m_reader.name() == "Notepadqq") {
+            result = readViewData();
+        }
+        else
+            m_reader.raiseError(QObject::tr("Error reading session file"));
+    };
+
+    if (outSuccess != nullptr)
+        *outSuccess = !m_reader.error();
+
+    return result;
+}
+
+QString SessionReader::getError(){
+    return m_reader.errorString();
+}
+
+std::vector<ViewData> SessionReader::readViewData() {
+    std::vector<ViewData> result;
+
+    while (m_reader.readNextStartElement()) {
+        if (m_reader.name() == "View") {
+            ViewData vd;
+            vd.tabs = readTabData();
+            result.push_back(vd);
+        }
+        else
+            m_reader.skipCurrentElement();
+    }
+
+
+    return result;
+}
+
+std::vector<TabData> SessionReader::readTabData() {
+    std::vector<TabData> result;
+
+    while (m_reader.readNextStartElement()) {
+        if (m_reader.name() == "Tab") {
+            const QXmlStreamAttributes& attrs = m_reader.attributes();
+
+            TabData td;
+            td.filePath = attrs.value("filePath").toString();
+            td.cacheFilePath = attrs.value("cacheFilePath").toString();
+            td.cursorX = attrs.value("cursorX").toInt();
+            td.cursorY = attrs.value("cursorY").toInt();
+            td.scrollX = attrs.value("scrollX").toInt();
+            td.scrollY = attrs.value("scrollY").toInt();
+            td.language = attrs.value("language").toString();
+            td.lastModified = attrs.value("lastModified").toLongLong();
+            td.active = attrs.value("active").toInt() != 0;
+            td.customIndent = attrs.value("customIndent").toInt() != 0;
+            td.useTabs = attrs.value("useTabs").toInt() != 0;
+            td.tabSize = attrs.value("tabSize").toInt();
+            td.changeSequence = attrs.value("changeSequence").toInt();
+            td.journalFilePath = attrs.value("journalFilePath").toString();
+            td.lastActivated = attrs.value("lastActivated").toLongLong();
+
+            result.push_back(td);
+
+            m_reader.readElementText();
+        }
+        else
+            m_reader.skipCurrentElement();
+    }
+
+    return result;
+}
+
+SessionWriter::SessionWriter(QIODevice& destination)
+    : m_writer(&destination)
+{
+    m_writer.setAutoFormatting(true);
+
+    m_writer.writeStartDocument();
+    m_writer.writeStartElement("Notepadqq");
+}
+
+SessionWriter::~SessionWriter(){
+    m_writer.writeEndElement();
+    m_writer.writeEndDocument();
+}
+
+void SessionWriter::addViewData(const ViewData& vd){
+    if (vd.tabs.empty())
+        return;
+
+    m_writer.writeStartElement("View");
+
+    for (auto&& tab : vd.tabs)
+        addTabData(tab);
+
+    m_writer.writeEndElement();
+}
+
+void SessionWriter::addTabData(const TabData& td){
+    m_writer.writeStartElement("Tab");
+
+    QXmlStreamAttributes attrs;
+    attrs.push_back(QXmlStreamAttribute("filePath", td.filePath));
+    attrs.push_back(QXmlStreamAttribute("cacheFilePath", td.cacheFilePath));
+    attrs.push_back(QXmlStreamAttribute("cursorX", QString::number(td.cursorX)));
+    attrs.push_back(QXmlStreamAttribute("cursorY", QString::number(td.cursorY)));
+    attrs.push_back(QXmlStreamAttribute("scrollX", QString::number(td.scrollX)));
+    attrs.push_back(QXmlStreamAttribute("scrollY", QString::number(td.scrollY)));
+
+    // A few attributes aren't often used, so we'll only write them into the file if they're
+    // set to a non-default value as to not clutter up the xml file.
+    if (!td.language.isEmpty())
+        attrs.push_back(QXmlStreamAttribute("language", td.language));
+
+    if (td.lastModified != 0)
+        attrs.push_back(QXmlStreamAttribute("lastModified", QString::number(td.lastModified)));
+
+    if (td.active)
+        attrs.push_back(QXmlStreamAttribute("active", "1"));
+
+    if (td.changeSequence != 0)
+        attrs.push_back(QXmlStreamAttribute("changeSequence", QString::number(td.changeSequence)));
+
+    if (!td.journalFilePath.isEmpty())
+        attrs.push_back(QXmlStreamAttribute("journalFilePath", td.journalFilePath));
+
+    if (td.lastActivated != 0)
+        attrs.push_back(QXmlStreamAttribute("lastActivated", QString::number(td.lastActivated)));
+
+    if (td.customIndent) {
+        attrs.push_back(QXmlStreamAttribute("customIndent", "1"));
+        attrs.push_back(QXmlStreamAttribute("useTabs", td.useTabs ? "1" : "0"));
+        attrs.push_back(QXmlStreamAttribute("tabSize", QString::number(td.tabSize)));
+    }
+
+    m_writer.writeAttributes(attrs);
+
+    m_writer.writeEndElement();
+}
+
+bool BinarySessionReader::isBinarySession(QFile& input) {
+    return input.peek(BINARY_SESSION_MAGIC.size()) == BINARY_SESSION_MAGIC;
+}
+
+std::vector<BinarySessionReader::ViewIndex> BinarySessionReader::readIndex() {
+    std::vector<ViewIndex> result;
+
+    QDataStream stream(&m_input);
+    stream.setVersion(BINARY_SESSION_STREAM_VERSION);
+
+    if (m_input.read(BINARY_SESSION_MAGIC.size()) != BINARY_SESSION_MAGIC)
+        return result;
+
+    quint16 version = 0;
+    quint32 viewCount = 0;
+    stream >> version >> viewCount;
+
+    // Each view and each tab takes 8 bytes of index: don't trust counts that can't fit in the file.
+    const qint64 fileSize = m_input.size();
+    if (stream.status() != QDataStream::Ok || version != BINARY_SESSION_VERSION ||
+            static_cast<qint64>(viewCount) * 8 > fileSize)
+        return result;
+
+    result.resize(viewCount);
+    std::vector<quint32> tabCounts(viewCount);
+    qint64 totalTabs = 0;
+
+    for (quint32 i = 0; i < viewCount; i++) {
+        qint32 activeTab = -1;
+        stream >> tabCounts[i] >> activeTab;
+        result[i].activeTab = activeTab;
+        totalTabs += tabCounts[i];
+    }
+
+    if (stream.status() != QDataStream::Ok || totalTabs * 8 > fileSize)
+        return std::vector<ViewIndex>();
+
+    for (quint32 i = 0; i < viewCount; i++) {
+        result[i].records.resize(tabCounts[i]);
+
+        for (auto& record : result[i].records) {
+            stream >> record.first >> record.second;
+
+            if (record.first + static_cast<qint64>(record.second) > fileSize)
+                return std::vector<ViewIndex>();
+        }
+    }
+
+    if (stream.status() != QDataStream::Ok)
+        return std::vector<ViewIndex>();
+
+    return result;
+}
+
+bool BinarySessionReader::readTab(const std::pair<quint32, quint32>& record, TabData& outTab) {
+    if (!m_input.seek(record.first))
+        return false;
+
+    const QByteArray data = m_input.read(record.second);
+    QDataStream stream(data);
+    stream.setVersion(BINARY_SESSION_STREAM_VERSION);
+
+    TabData td;
+    stream >> td.filePath >> td.cacheFilePath
+           >> td.cursorX >> td.cursorY >> td.scrollX >> td.scrollY
+           >> td.active >> td.language >> td.lastModified
+           >> td.customIndent >> td.useTabs >> td.tabSize
+           >> td.changeSequence >> td.journalFilePath;
+
+    if (stream.status() != QDataStream::Ok)
+        return false;
+
+    // Added after the first version of the format
+    if (!stream.atEnd())
+        stream >> td.lastActivated;
+
+    outTab = td;
+    return true;
+}
+
+void BinarySessionWriter::addViewData(const ViewData& vd) {
+    if (vd.tabs.empty())
+        return;
+
+    m_activeTabs.push_back(-1);
+    m_records.push_back(std::vector<QByteArray>());
+
+    for (const TabData& td : vd.tabs) {
+        if (td.active && m_activeTabs.back() == -1)
+            m_activeTabs.back() = static_cast<int>(m_records.back().size());
+
+        QByteArray record;
+        QDataStream stream(&record, QIODevice::WriteOnly);
+        stream.setVersion(BINARY_SESSION_STREAM_VERSION);
+
+        stream << td.filePath << td.cacheFilePath
+               << td.cursorX << td.cursorY << td.scrollX << td.scrollY
+               << td.active << td.language << td.lastModified
+               << td.customIndent << td.useTabs << td.tabSize
+               << td.changeSequence << td.journalFilePath
+               << td.lastActivated;
+
+        m_records.back().push_back(record);
+    }
+}
+
+BinarySessionWriter::~BinarySessionWriter() {
+    QDataStream stream(&m_destination);
+    stream.setVersion(BINARY_SESSION_STREAM_VERSION);
+
+    size_t tabCount = 0;
+    for (const auto& view : m_records)
+        tabCount += view.size();
+
+    // magic, version, view count, then 8 bytes per view and per tab
+    quint32 offset = static_cast<quint32>(BINARY_SESSION_MAGIC.size() + 2 + 4 + (m_records.size() + tabCount) * 8);
+
+    m_destination.write(BINARY_SESSION_MAGIC);
+    stream << BINARY_SESSION_VERSION << static_cast<quint32>(m_records.size());
+
+    for (size_t i = 0; i < m_records.size(); i++)
+        stream << static_cast<quint32>(m_records[i].size()) << static_cast<qint32>(m_activeTabs[i]);
+
+    for (const auto& view : m_records) {
+        for (const QByteArray& record : view) {
+            stream << offset << static_cast<quint32>(record.size());
+            offset += static_cast<quint32>(record.size());
+        }
+    }
+
+    for (const auto& view : m_records) {
+        for (const QByteArray& record : view)
+            m_destination.write(record);
+    }
+}
+
+namespace Sessions {
+
+bool SessionFile::open(const QString& sessionPath) {
+    m_file.reset(new QFile(sessionPath));
+    m_file->open(QIODevice::ReadOnly);
+
+    if (!m_file->isOpen())
+        return false;
+
+    if (BinarySessionReader::isBinarySession(*m_file)) {
+        m_binaryReader.reset(new BinarySessionReader(*m_file));
+        m_views = m_binaryReader->readIndex();
+        return !m_views.empty();
+    }
+
+    SessionReader reader(*m_file);
+
+    bool success = false;
+    m_tabs = reader.readData(&success);
+    m_file.reset();
+
+    if (!success)
+        return false;
+
+    for (quint32 i = 0; i < m_tabs.size(); i++) {
+        BinarySessionReader::ViewIndex view;
+
+        for (quint32 j = 0; j < m_tabs[i].tabs.size(); j++) {
+            if (m_tabs[i].tabs[j].active && view.activeTab == -1)
+                view.activeTab = static_cast<int>(j);
+            view.records.push_back(std::make_pair(i, j));
+        }
+
+        m_views.push_back(view);
+    }
+
+    return !m_views.empty();
+}
+
+void SessionFile::readAll() {
+    if (!m_binaryReader)
+        return;
+
+    m_tabs.resize(m_views.size());
+
+    for (quint32 i = 0; i < m_views.size(); i++) {
+        auto& records = m_views[i].records;
+
+        for (quint32 j = 0; j < records.size(); j++) {
+            // A record that can't be read is restored as a tab without any file, i.e. not at all.
+            TabData td;
+            m_binaryReader->readTab(records[j], td);
+            m_tabs[i].tabs.push_back(td);
+            records[j] = std::make_pair(i, j);
+        }
+    }
+
+    m_binaryReader.reset();
+    m_file.reset();
+}
+
+bool SessionFile::readTab(const std::pair<quint32, quint32>& record, TabData& outTab) {
+    if (m_binaryReader)
+        return m_binaryReader->readTab(record, outTab);
+
+    outTab = m_tabs[record.first].tabs[record.second];
+    return true;
+}
+
+bool writeSessionFile(const QString& sessionPath, const std::vector<ViewData>& viewData, SessionFormat format)
+{
+    // The previous session file is only replaced once the new one is complete
+    QSaveFile file(sessionPath);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    // The writers complete the file when they're destroyed
+    if (format == SessionFormat::Binary) {
+        BinarySessionWriter sessionWriter(file);
+
+        for (const auto& view : viewData)
+            sessionWriter.addViewData(view);
+    } else {
+        SessionWriter sessionWriter(file);
+
+        for (const auto& view : viewData)
+            sessionWriter.addViewData(view);
+    }
+
+    // Fails if any of the writes failed
+    return file.commit();
+}
+
+} // namespace Sessions
@@ -0,0 +1,122 @@
+#include "include/Sessions/sessionprefetcher.h"
+
+#include "include/docengine.h"
+#include "include/editortabwidget.h"
+#include "include/topeditorcontainer.h"
+
+#include <QFileInfo>
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <functional>
+#include <tuple>
+#include <vector>
+
+namespace {
+    // Number of documents kept in memory ahead of being shown
+    const int MAX_PREFETCHED = 4;
+
+    // Larger files are read when they're shown, as usual
+    const qint64 MAX_FILE_SIZE = 4 * 1024 * 1024;
+
+    // Time (msec) to wait for the tabs to settle before updating the ranking
+    const int UPDATE_DELAY = 200;
+}
+
+void SessionPrefetcher::start(TopEditorContainer* editorContainer)
+{
+    SessionPrefetcher* prefetcher = editorContainer->findChild<SessionPrefetcher*>(QString(), Qt::FindDirectChildrenOnly);
+
+    if (prefetcher == nullptr)
+        prefetcher = new SessionPrefetcher(editorContainer);
+
+    prefetcher->m_updateTimer.start();
+}
+
+void SessionPrefetcher::stop(TopEditorContainer* editorContainer)
+{
+    delete editorContainer->findChild<SessionPrefetcher*>(QString(), Qt::FindDirectChildrenOnly);
+}
+
+SessionPrefetcher::SessionPrefetcher(TopEditorContainer* editorContainer)
+    : QObject(editorContainer),
+      m_editorContainer(editorContainer)
+{
+    m_updateTimer.setSingleShot(true);
+    m_updateTimer.setInterval(UPDATE_DELAY);
+    connect(&m_updateTimer, &QTimer::timeout, this, &SessionPrefetcher::update);
+
+    // Showing a tab loads its document, and changes the tabs most likely to be shown next
+    connect(m_editorContainer, &TopEditorContainer::currentTabChanged, &m_updateTimer, [this]() {
+        m_updateTimer.start();
+    });
+}
+
+SessionPrefetcher::~SessionPrefetcher()
+{
+    for (const QString& filePath : m_prefetched)
+        DocEngine::discardPrefetchedDocument(filePath);
+}
+
+void SessionPrefetcher::update()
+{
+    struct Candidate {
+        QString filePath;
+        int score;
+        int distance;
+    };
+
+    std::vector<Candidate> candidates;
+    bool hasDeferredTabs = false;
+
+    for (int i = 0; i < m_editorContainer->count(); i++) {
+        EditorTabWidget* tabWidget = m_editorContainer->tabWidget(i);
+        const int currentIndex = tabWidget->currentIndex();
+
+        std::vector<std::pair<qint64, int>> activations; // Last activation and index of the deferred tabs
+        for (int j = 0; j < tabWidget->count(); j++) {
+            const auto editor = tabWidget->editor(j);
+            if (j != currentIndex && editor->isDeferred() && editor->filePath().isLocalFile())
+                activations.push_back(std::make_pair(editor->lastActivated(), j));
+        }
+
+        hasDeferredTabs |= !activations.empty();
+
+        // The most recently activated tabs come first. The ones that never were activated
+        // are only ranked by their distance.
+        std::sort(activations.begin(), activations.end(), std::greater<std::pair<qint64, int>>());
+
+        for (size_t k = 0; k < activations.size(); k++) {
+            const int index = activations[k].second;
+            const QFileInfo fileInfo(tabWidget->editor(index)->filePath().toLocalFile());
+
+            if (!fileInfo.isFile() || fileInfo.size() > MAX_FILE_SIZE)
+                continue;
+
+            const int recency = activations[k].first > 0 ? static_cast<int>(k) + 1 : INT_MAX;
+            const int distance = std::abs(index - currentIndex);
+            candidates.push_back(Candidate{fileInfo.absoluteFilePath(), std::min(recency, distance), distance});
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+        return std::tie(a.score, a.distance) < std::tie(b.score, b.distance);
+    });
+
+    QSet<QString> wanted;
+    for (size_t k = 0; k < candidates.size() && wanted.size() < MAX_PREFETCHED; k++)
+        wanted.insert(candidates[k].filePath);
+
+    // The documents that have been loaded are no longer prefetched anyway
+    for (const QString& filePath : m_prefetched - wanted)
+        DocEngine::discardPrefetchedDocument(filePath);
+
+    for (const QString& filePath : wanted - m_prefetched)
+        DocEngine::prefetchDocument(filePath);
+
+    m_prefetched = wanted;
+
+    if (!hasDeferredTabs)
+        deleteLater();
+}
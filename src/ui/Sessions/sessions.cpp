@@ -1,387 +1,526 @@
 #include "include/Sessions/sessions.h"
 
+#include "include/Sessions/editjournal.h"
+#include "include/Sessions/editjournalfile.h"
 #include "include/Sessions/persistentcache.h"
+#include "include/Sessions/sessionfile.h"
+#include "include/Sessions/sessionprefetcher.h"
 #include "include/docengine.h"
+#include "include/globals.h"
 #include "include/topeditorcontainer.h"
+#include "include/tracer.h"
 
 #include <QDateTime>
 #include <QFile>
 #include <QFileInfo>
-#include <QXmlStreamReader>
-#include <QXmlStreamWriter>
+#include <QHash>
+#include <QSet>
+#include <QTabBar>
+#include <QtConcurrent/QtConcurrentRun>
 
+#include <functional>
 #include <vector>
 
-
-/* Session XML structure:
- *
- * <Notepadqq>
- *      <View>
- *          <Tab filePath="xxx" .../>
- *          <Tab filePath="xxx" .../>
- *      </View>
- *      <View>
- *          ...
- *      </View>
- *      ...
- * <Notepadqq>
- *
- *
- * All currently available attributes for <Tab>:
- * -> string filePath - path to the file if it exists
- * -> string cacheFilePath - path to the cache file if it exists
- * -> int scrollX - horizontal scroll position
- * -> int scrollY - vertical scroll position
- * -> string language - the display language of the document.
- * -> long int lastModified - optional, last modification date (in msecs since epoch) of the file point to in filePath
- * -> int active - optional, value is "1" if this tab is the open one in the tabview, otherwise "0".
- *
- * */
+// The format of the session files is described in sessionfile.cpp.
 
 // Some shorthand names
 constexpr int ALL_MAXIMUM_PRIORITY = DocEngine::DocumentLoader::ALL_MAXIMUM_PRIORITY;
 constexpr int ALL_MINIMUM_PRIORITY = DocEngine::DocumentLoader::ALL_MINIMUM_PRIORITY;
 
-struct TabData {
-    QString filePath;
-    QString cacheFilePath;
-    int cursorX = 0;
-    int cursorY = 0;
-    int scrollX = 0;
-    int scrollY = 0;
-    bool active = false;
-    QString language;
-    qint64 lastModified = 0;
-    bool customIndent = false;
-    bool useTabs = false;
-    int tabSize = 0; 
-};
+namespace {
+    // The restored tabs whose document hasn't been read yet. Until then, their
+    // data is saved back as it was loaded.
+    QHash<const Editor*, TabData> deferredTabs;
+}
+
+namespace Sessions {
+
+struct SessionSnapshot {
+    struct Tab {
+        bool included = false; // False if the tab is not part of the session
+        TabData data;
+        bool fileOnDiskChanged = false;
+        bool journaled = false; // The changes after the cache file are recorded by the EditJournal
+
+        // Where the cache file comes from
+        const Editor* editor = nullptr;
+
+        // Only set if the document must be written to a new cache file
+        bool mustWrite = false;
+        QString text;
+        QString endOfLineSequence;
+        QTextCodec* codec = nullptr;
+        bool bom = false;
+    };
 
-struct ViewData {
-    std::vector<TabData> tabs;
+    QString cacheDirPath;
+    std::vector<std::vector<Tab>> views;
 };
 
-/**
- * @brief Provides a convenience class to read session .xml files.
- */
-class SessionReader {
-public:
+bool saveSession(TopEditorContainer* editorContainer, QString sessionPath, SessionFormat format,
+                 QString cacheDirPath, CacheIndex* cacheIndex)
+{
+    // Modified documents are stored as blobs, which collectSession() and writeSession() take care of.
+    if (!cacheDirPath.isEmpty()) {
+        CacheIndex newCacheIndex;
+        const auto session = waitFor(collectSession(editorContainer, cacheDirPath,
+                                                    cacheIndex != nullptr ? *cacheIndex : CacheIndex()));
+        return session && writeSession(*session, sessionPath, cacheIndex != nullptr ? cacheIndex : &newCacheIndex, format);
+    }
 
-    SessionReader(QFile& input)
-        : m_reader(&input) { }
+    std::vector<ViewData> viewData;
 
-    /**
-     * @brief Completely read the session data
-     * @param outSuccess pass a pointer to bool here to be informed about whether
-     *        the reading process has encountered any errors.
-     * @return The data read from the session file.
-     */
-    std::vector<ViewData> readData(bool* outSuccess=nullptr);
+    //Loop through all tabwidgets and their tabs
+    const int tabWidgetsCount = editorContainer->count();
+    for (int i = 0; i < tabWidgetsCount; i++) {
+        EditorTabWidget *tabWidget = editorContainer->tabWidget(i);
+        const int tabCount = tabWidget->count();
 
-    QString getError();
+        viewData.push_back( ViewData() );
+        ViewData& currentViewData = viewData.back();
 
-private:
+        for (int j = 0; j < tabCount; j++) {
+            auto editor = tabWidget->editor(j);
 
-    /**
-     * @brief Helper functions to read specific parts of the xml structure
-     */
-    std::vector<ViewData> readViewData();
-    std::vector<TabData> readTabData();
+            if (editor->isDeferred() && deferredTabs.contains(editor.data())) {
+                // The document was never shown: save it without loading it.
+                TabData td = deferredTabs.value(editor.data());
+                td.active = tabWidget->currentEditor() == editor;
 
-    QXmlStreamReader m_reader;
-};
+                currentViewData.tabs.push_back( td );
+                continue;
+            }
 
+            if (editor->filePath().isEmpty())
+                continue; // Don't save temporary files if we're not caching tabs
 
-/**
- * @brief Provides a convenience class to write session .xml files.
- *
- * Note that a SessionWriter object must be successfully destroyed
- * in order to complete the writing process. (Aka the destructor must
- * be called)
- */
-class SessionWriter {
-public:
+            // Send all the requests at once, so that we only wait for a single round-trip.
+            auto indentationModeP = editor->indentationModeP();
+            auto cursorPositionP = editor->cursorPositionP();
+            auto scrollPositionP = editor->scrollPositionP();
 
-    SessionWriter(QFile& destination);
+            // An editor that doesn't answer would be saved with made-up values
+            bool indentOk, cursorOk, scrollOk;
+            Editor::IndentationMode indentInfo = waitFor(indentationModeP, &indentOk);
 
-    ~SessionWriter();
+            TabData td;
+            td.filePath = editor->filePath().toLocalFile();
 
-    /**
-     * @brief Write ViewData to the session file. ViewData is the representation of a
-     *        TabWidget and its tabs.
-     *
-     * @param The ViewData to be written.
-     */
-    void addViewData(const ViewData& vd);
+            // Finally save other misc information about the tab.
+            const auto cursorPos = waitFor(cursorPositionP, &cursorOk);
+            const auto scrollPos = waitFor(scrollPositionP, &scrollOk);
+            if (!indentOk || !cursorOk || !scrollOk)
+                return false;
 
+            td.cursorX = cursorPos.first;
+            td.cursorY = cursorPos.second;
+            td.scrollX = scrollPos.first;
+            td.scrollY = scrollPos.second;
+            td.active = tabWidget->currentEditor() == editor;
+            td.lastActivated = editor->lastActivated();
+            td.language = editor->getLanguage()->id;
+            
+            // Cache the custom indentation state of the file
+            if (editor->isUsingCustomIndentationMode()) {
+                td.customIndent = true;
+                td.useTabs = indentInfo.useTabs;
+                td.tabSize = indentInfo.size;
+            }
 
-private:
-    /**
-     * @brief Helper function to write specific parts of the xml structure
-     */
-    void addTabData(const TabData& td);
+            currentViewData.tabs.push_back( td );
 
-    QXmlStreamWriter m_writer;
-};
+        } // end for
+    } // end for
 
-std::vector<ViewData> SessionReader::readData(bool* outSuccess) {
-    std::vector<ViewData> result;
+    // Write all information to a session file
+    return writeSessionFile(sessionPath, viewData, format);
+}
 
-    if (m_reader.readNextStartElement()) {
-        if (m_reader.name() == "Notepadqq") {
-            result = readViewData();
-        }
-        else
-            m_reader.raiseError(QObject::tr("Error reading session file"));
-    };
+QPromise<std::shared_ptr<SessionSnapshot>> collectSession(TopEditorContainer* editorContainer, QString cacheDirPath,
+                                                          const CacheIndex& cacheIndex, EditJournal* journal)
+{
+    auto session = std::make_shared<SessionSnapshot>();
+    session->cacheDirPath = cacheDirPath;
 
-    if (outSuccess != nullptr)
-        *outSuccess = !m_reader.error();
+    // Shared by all the requests below instead of being copied into each of them
+    const auto previousIndex = std::make_shared<const CacheIndex>(cacheIndex);
 
-    return result;
-}
+    QVector<QPromise<void>> requests;
 
-QString SessionReader::getError(){
-    return m_reader.errorString();
-}
+    // The tabs are filled in as the editors answer, so make room for all of them first:
+    // their addresses mustn't change.
+    const int tabWidgetsCount = editorContainer->count();
+    session->views.resize(tabWidgetsCount);
+    for (int i = 0; i < tabWidgetsCount; i++)
+        session->views[i].resize(editorContainer->tabWidget(i)->count());
 
-std::vector<ViewData> SessionReader::readViewData() {
-    std::vector<ViewData> result;
+    for (int i = 0; i < tabWidgetsCount; i++) {
+        EditorTabWidget *tabWidget = editorContainer->tabWidget(i);
+        const int tabCount = tabWidget->count();
 
-    while (m_reader.readNextStartElement()) {
-        if (m_reader.name() == "View") {
-            ViewData vd;
-            vd.tabs = readTabData();
-            result.push_back(vd);
-        }
-        else
-            m_reader.skipCurrentElement();
-    }
+        for (int j = 0; j < tabCount; j++) {
+            auto editor = tabWidget->editor(j);
+            SessionSnapshot::Tab& tab = session->views[i][j];
 
+            tab.editor = editor.data();
+            tab.fileOnDiskChanged = editor->fileOnDiskChanged();
 
-    return result;
-}
+            if (editor->isDeferred() && deferredTabs.contains(editor.data())) {
+                // The document was never shown: save it without loading it.
+                tab.included = true;
+                tab.data = deferredTabs.value(editor.data());
+                tab.data.active = tabWidget->currentEditor() == editor;
+                continue;
+            }
 
-std::vector<TabData> SessionReader::readTabData() {
-    std::vector<TabData> result;
+            const bool isOrphan = editor->filePath().isEmpty();
+
+            tab.data.filePath = !isOrphan ? editor->filePath().toLocalFile() : "";
+            tab.data.active = tabWidget->currentEditor() == editor;
+            tab.data.lastActivated = editor->lastActivated();
+            tab.data.language = editor->getLanguage()->id;
+            tab.endOfLineSequence = editor->endOfLineSequence();
+            tab.codec = editor->codec();
+            tab.bom = editor->bom();
+
+            // Send all the requests at once, and don't wait for any of them.
+            auto isCleanP = editor->isCleanP();
+            auto changeSequenceP = editor->getChangeSequence();
+            auto indentationModeP = editor->indentationModeP();
+            auto cursorPositionP = editor->cursorPositionP();
+            auto scrollPositionP = editor->scrollPositionP();
+
+            const bool customIndent = editor->isUsingCustomIndentationMode();
+
+            requests.append(isCleanP.then([=](bool isClean) {
+                return changeSequenceP.then([=](int changeSequence) {
+                    SessionSnapshot::Tab& collected = session->views[i][j];
+
+                    // Clean orphans have nothing worth saving.
+                    collected.included = !isClean || !isOrphan;
+
+                    if (isClean)
+                        return QPromise<void>::resolve();
+
+                    const auto cached = previousIndex->find(editor.data());
+                    if (cached != previousIndex->end() &&
+                            (cached->second.changeSequence == changeSequence ||
+                             (journal != nullptr && journal->covers(editor.data(), cached->second.cacheFilePath)))) {
+                        // The cache file is still up to date, or its journal holds the rest.
+                        collected.data.cacheFilePath = cached->second.cacheFilePath;
+                        collected.data.changeSequence = cached->second.changeSequence;
+                        collected.journaled = journal != nullptr;
+                        return QPromise<void>::resolve();
+                    }
 
-    while (m_reader.readNextStartElement()) {
-        if (m_reader.name() == "Tab") {
-            const QXmlStreamAttributes& attrs = m_reader.attributes();
+                    // Record the changes that will follow the content we're about to read.
+                    if (journal != nullptr) {
+                        journal->record(editor);
+                        collected.journaled = true;
+                    }
 
-            TabData td;
-            td.filePath = attrs.value("filePath").toString();
-            td.cacheFilePath = attrs.value("cacheFilePath").toString();
-            td.cursorX = attrs.value("cursorX").toInt();
-            td.cursorY = attrs.value("cursorY").toInt();
-            td.scrollX = attrs.value("scrollX").toInt();
-            td.scrollY = attrs.value("scrollY").toInt();
-            td.language = attrs.value("language").toString();
-            td.lastModified = attrs.value("lastModified").toLongLong();
-            td.active = attrs.value("active").toInt() != 0;
-            td.customIndent = attrs.value("customIndent").toInt() != 0;
-            td.useTabs = attrs.value("useTabs").toInt() != 0;
-            td.tabSize = attrs.value("tabSize").toInt();
-
-            result.push_back(td);
-
-            m_reader.readElementText();
+                    return editor->snapshot().then([=](const Editor::Snapshot& snapshot) {
+                        SessionSnapshot::Tab& collected = session->views[i][j];
+                        collected.mustWrite = true;
+                        collected.text = snapshot.text;
+                        collected.data.changeSequence = snapshot.changeSequence;
+                    });
+                });
+            }));
+
+            requests.append(indentationModeP.then([=](const Editor::IndentationMode& indentInfo) {
+                // Cache the custom indentation state of the file
+                if (customIndent) {
+                    TabData& td = session->views[i][j].data;
+                    td.customIndent = true;
+                    td.useTabs = indentInfo.useTabs;
+                    td.tabSize = indentInfo.size;
+                }
+            }));
+
+            requests.append(cursorPositionP.then([=](const QPair<int, int>& cursorPos) {
+                TabData& td = session->views[i][j].data;
+                td.cursorX = cursorPos.first;
+                td.cursorY = cursorPos.second;
+            }));
+
+            requests.append(scrollPositionP.then([=](const QPair<int, int>& scrollPos) {
+                TabData& td = session->views[i][j].data;
+                td.scrollX = scrollPos.first;
+                td.scrollY = scrollPos.second;
+            }));
         }
-        else
-            m_reader.skipCurrentElement();
     }
 
-    return result;
+    return QtPromise::all(requests).then([session]() {
+        return session;
+    });
 }
 
-SessionWriter::SessionWriter(QFile& destination)
-    : m_writer(&destination)
+bool writeSession(const SessionSnapshot& session, QString sessionPath, CacheIndex* cacheIndex, SessionFormat format)
 {
-    m_writer.setAutoFormatting(true);
+    // Keep the files of the documents that didn't change.
+    QDir cacheDir(session.cacheDirPath);
 
-    m_writer.writeStartDocument();
-    m_writer.writeStartElement("Notepadqq");
-}
+    if (!cacheDir.mkpath(session.cacheDirPath))
+        return false;
 
-SessionWriter::~SessionWriter(){
-    m_writer.writeEndElement();
-    m_writer.writeEndDocument();
-}
+    CacheIndex newCacheIndex;
+    QSet<QString> usedFiles;
+    std::vector<ViewData> viewData;
 
-void SessionWriter::addViewData(const ViewData& vd){
-    if (vd.tabs.empty())
-        return;
+    usedFiles.insert(QFileInfo(sessionPath).absoluteFilePath());
 
-    m_writer.writeStartElement("View");
+    for (const auto& view : session.views) {
+        viewData.push_back( ViewData() );
+        ViewData& currentViewData = viewData.back();
 
-    for (auto&& tab : vd.tabs)
-        addTabData(tab);
+        for (const auto& tab : view) {
+            if (!tab.included)
+                continue;
 
-    m_writer.writeEndElement();
-}
+            TabData td = tab.data;
+
+            if (tab.mustWrite) {
+                // The blob is named after its content: identical documents share it, and the
+                // previous blob of this document stays valid until the new session file is written.
+                const QByteArray data = DocEngine::encodeText(tab.text, tab.endOfLineSequence, tab.codec, tab.bom);
+                td.cacheFilePath = PersistentCache::storeBlob(cacheDir, data);
+
+                if (td.cacheFilePath.isEmpty())
+                    return false;
+            }
 
-void SessionWriter::addTabData(const TabData& td){
-    m_writer.writeStartElement("Tab");
+            if (!td.cacheFilePath.isEmpty()) {
+                newCacheIndex[tab.editor] = CachedDocument{td.cacheFilePath, td.changeSequence};
+                usedFiles.insert(QFileInfo(td.cacheFilePath).absoluteFilePath());
 
-    QXmlStreamAttributes attrs;
-    attrs.push_back(QXmlStreamAttribute("filePath", td.filePath));
-    attrs.push_back(QXmlStreamAttribute("cacheFilePath", td.cacheFilePath));
-    attrs.push_back(QXmlStreamAttribute("cursorX", QString::number(td.cursorX)));
-    attrs.push_back(QXmlStreamAttribute("cursorY", QString::number(td.cursorY)));
-    attrs.push_back(QXmlStreamAttribute("scrollX", QString::number(td.scrollX)));
-    attrs.push_back(QXmlStreamAttribute("scrollY", QString::number(td.scrollY)));
+                if (tab.journaled) {
+                    td.journalFilePath = EditJournal::journalPath(td.cacheFilePath, tab.editor);
+                    usedFiles.insert(QFileInfo(td.journalFilePath).absoluteFilePath());
+                }
+            }
 
-    // A few attributes aren't often used, so we'll only write them into the file if they're
-    // set to a non-default value as to not clutter up the xml file.
-    if (!td.language.isEmpty())
-        attrs.push_back(QXmlStreamAttribute("language", td.language));
+            // If there's a file opened in the tab we want to inform the user whether the file's
+            // contents have changed since Nqq was last opened. As a special case, if the file
+            // has *already* changed we set the modification time to 1 so we always trigger the warning.
+            if (!td.filePath.isEmpty()) {
+                if (tab.fileOnDiskChanged)
+                    td.lastModified = 1;
+                else
+                    td.lastModified = QFileInfo(td.filePath).lastModified().toMSecsSinceEpoch();
+            }
 
-    if (td.lastModified != 0)
-        attrs.push_back(QXmlStreamAttribute("lastModified", QString::number(td.lastModified)));
+            currentViewData.tabs.push_back( td );
+        }
+    }
 
-    if (td.active)
-        attrs.push_back(QXmlStreamAttribute("active", "1"));
+    // Write all information to a session file
+    if (!writeSessionFile(sessionPath, viewData, format))
+        return false;
 
-    if (td.customIndent) {
-        attrs.push_back(QXmlStreamAttribute("customIndent", "1"));
-        attrs.push_back(QXmlStreamAttribute("useTabs", td.useTabs ? "1" : "0"));
-        attrs.push_back(QXmlStreamAttribute("tabSize", QString::number(td.tabSize)));
+    // Delete the files of the documents that have been closed, saved, or modified again.
+    // Only now: until the new session file is in place, the previous one still uses them.
+    for (const QFileInfo& fileInfo : cacheDir.entryInfoList(QDir::Files)) {
+        if (!usedFiles.contains(fileInfo.absoluteFilePath()))
+            QFile::remove(fileInfo.absoluteFilePath());
     }
 
-    m_writer.writeAttributes(attrs);
+    if (cacheIndex != nullptr)
+        *cacheIndex = std::move(newCacheIndex);
 
-    m_writer.writeEndElement();
+    return true;
 }
 
-namespace Sessions {
+using RestoredTab = std::pair<QSharedPointer<Editor>, QPromise<QSharedPointer<Editor>>>;
 
-bool saveSession(DocEngine* docEngine, TopEditorContainer* editorContainer, QString sessionPath, QString cacheDirPath)
+/**
+ * @brief Restores a tab of a session at the end of the specified tab widget.
+ * @return The editor of the new tab, or nullptr if its document couldn't be found,
+ *         and a promise resolved once the document has been loaded.
+ */
+static RestoredTab restoreTab(DocEngine* docEngine, TopEditorContainer* editorContainer,
+                              EditorTabWidget* tabW, const TabData& tab)
 {
-    const bool cacheModifiedFiles = !cacheDirPath.isEmpty();
+    const RestoredTab notRestored(nullptr, QPromise<QSharedPointer<Editor>>::resolve(QSharedPointer<Editor>()));
 
-    QDir cacheDir;
+    const QFileInfo fileInfo(tab.filePath);
+    const bool fileExists = fileInfo.exists();
+    const bool cacheFileExists = QFileInfo(tab.cacheFilePath).exists();
 
-    // Clear the cache directory by deleting and recreating it.
-    if (cacheModifiedFiles) {
-        cacheDir = QDir(cacheDirPath);
+    const QUrl fileUrl = QUrl::fromLocalFile(tab.filePath);
+    const QUrl cacheFileUrl = QUrl::fromLocalFile(tab.cacheFilePath);
 
-        bool success = false;
+    // This is the file to load the document from
+    const QUrl& loadUrl = cacheFileExists ? cacheFileUrl : fileUrl;
 
-        if (cacheDir.exists())
-            success = cacheDir.removeRecursively();
+    if (!fileExists && !cacheFileExists)
+        return notRestored;
 
-        success |= cacheDir.mkpath(cacheDirPath);
+    // Documents in background tabs are only read once they're shown. Cached
+    // documents are read right away since the cache is cleared by saveSession().
+    const bool deferred = !tab.active && !cacheFileExists;
 
-        if(!success)
-            return false;
-    }
+    auto loadedDocs = docEngine->getDocumentLoader()
+        .setUrl(loadUrl)
+        .setTabWidget(tabW)
+        .setRememberLastDir(false)
+        .setFileSizeWarning(DocEngine::FileSizeActionYesToAll)
+        .setPriorityIdx(tab.active ? ALL_MAXIMUM_PRIORITY : ALL_MINIMUM_PRIORITY)
+        .setDeferred(deferred)
+        .setManualEditorInitialization([=](QSharedPointer<Editor> editor, const QUrl& url) {
 
-    std::vector<ViewData> viewData;
+            deferredTabs.remove(editor.data());
 
-    //Loop through all tabwidgets and their tabs
-    const int tabWidgetsCount = editorContainer->count();
-    for (int i = 0; i < tabWidgetsCount; i++) {
-        EditorTabWidget *tabWidget = editorContainer->tabWidget(i);
-        const int tabCount = tabWidget->count();
+            // Restore the state of the tab with a single message
+            Editor::Transaction transaction(editor);
 
-        viewData.push_back( ViewData() );
-        ViewData& currentViewData = viewData.back();
+            // Deferred tabs may have been moved before being loaded
+            EditorTabWidget *tabWidget = deferred ? editorContainer->tabWidgetFromEditor(editor) : tabW;
+            int idx = tabWidget->indexOf(editor);
 
-        for (int j = 0; j < tabCount; j++) {
-            auto editor = tabWidget->editor(j);
-            bool isClean = editor->isClean();
-            bool isOrphan = editor->filePath().isEmpty();
-            Editor::IndentationMode indentInfo = editor->indentationMode();
-
-            if (isOrphan && !cacheModifiedFiles)
-                continue; // Don't save temporary files if we're not caching tabs
+            editor->setCursorPosition(tab.cursorX, tab.cursorY);
+            editor->setScrollPosition(tab.scrollX, tab.scrollY);
 
-            TabData td;
+            if (tab.customIndent) {
+                editor->setCustomIndentationMode(tab.useTabs, tab.tabSize);
+            }
 
-            if (!isClean && cacheModifiedFiles) {
-                // Tab is dirty, meaning it needs to be cached.
-                QUrl cacheFilePath = PersistentCache::createValidCacheName(cacheDir, tabWidget->tabText(j));
+            // DocEngine sets the editor's fileName to loadUrl since this is where the file
+            // was loaded from. Since loadUrl could point to a cached file we reset it here.
+            if (cacheFileExists) {
+                // Replay the changes made after the cache file was written, if any
+                const QVariantList changes = EditJournalFile::readChanges(tab.journalFilePath, tab.changeSequence);
+                if (!changes.isEmpty())
+                    editor->applyChanges(changes);
 
-                td.cacheFilePath = cacheFilePath.toLocalFile();
+                editor->markDirty();
+                editor->setLanguageFromFilePath();
+            }
 
-                if (!docEngine->write(cacheFilePath, editor)) {
-                    return false;
-                }
-            } else if (isOrphan) {
-                // Since we didn't cache the file and it is an orphan, we won't save it in the session.
-                continue;
+            if (tab.filePath.isEmpty()) {
+                QString tabText = tabWidget->tabText(idx);
+                editor->setFilePath(QUrl());
+                tabWidget->setTabText(idx, tabText);
+            } else {
+                editor->setFilePath(fileUrl);
+                if (fileExists)
+                    docEngine->monitorDocument(editor);
             }
-            // Else tab is an openened unmodified file, we don't have to do anything special.
 
-            td.filePath = !isOrphan ? editor->filePath().toLocalFile() : "";
+            // If we're loading an existing file from cache we want to inform the user whether
+            // the file has changed since Nqq was last closed. For this we can compare the
+            // file's last modification date.
+            if (fileExists && cacheFileExists && tab.lastModified != 0) {
+                auto lastModified = fileInfo.lastModified().toMSecsSinceEpoch();
 
-            // Finally save other misc information about the tab.
-            const auto& cursorPos = editor->cursorPosition();
-            const auto& scrollPos = editor->scrollPosition();
-            td.cursorX = cursorPos.first;
-            td.cursorY = cursorPos.second;
-            td.scrollX = scrollPos.first;
-            td.scrollY = scrollPos.second;
-            td.active = tabWidget->currentEditor() == editor;
-            td.language = editor->getLanguage()->id;
-            
-            // Cache the custom indentation state of the file
-            if (editor->isUsingCustomIndentationMode()) {
-                td.customIndent = true;
-                td.useTabs = indentInfo.useTabs;
-                td.tabSize = indentInfo.size;
+                if (lastModified > tab.lastModified) {
+                    editor->setFileOnDiskChanged(true);
+                }
             }
-            // If we're caching and there's a file opened in the tab we want to inform the
-            // user whether the file's contents have changed since Nqq was last opened.
-            // For this we save and later compare the modification date.
-            if (!isOrphan && cacheModifiedFiles) {
-                // As a special case, if the file has *already* changed we set the modification
-                // time to 1 so we always trigger the warning.
-                if (editor->fileOnDiskChanged())
-                    td.lastModified = 1;
-                else
-                    td.lastModified = QFileInfo(td.filePath).lastModified().toMSecsSinceEpoch();
+
+            // If the orig. file does not exist but *should* exist, we inform the user of its removal.
+            if (!fileExists && !fileUrl.isEmpty()) {
+                editor->setFileOnDiskChanged(true);
+                emit docEngine->fileOnDiskChanged(tabWidget, idx, true);
             }
 
-            currentViewData.tabs.push_back( td );
+            if (!tab.language.isEmpty()) editor->setLanguage(tab.language);
 
-        } // end for
-    } // end for
+            // loadDocuments() explicitly calls setFocus() so we'll have to undo that.
+            // Deferred tabs are being shown by the user instead, so they keep it.
+            if (!deferred)
+                editor->clearFocus();
 
-    // Write all information to a session file
-    QFile file(sessionPath);
-    file.open(QIODevice::WriteOnly);
+            if (tab.active) {
+                // We need to trigger a final call to MainWindow::refreshEditorUiInfo to display the correct info
+                // on start-up. The easiest way is to emit a cleanChanged() event.
+                editor->isCleanP().then([=](bool isClean){ emit editor->cleanChanged(isClean); });
+            }
 
-    if (!file.isOpen())
-        return false;
+        })
+        .executeInBackground();
 
-    SessionWriter sessionWriter(file);
+    if (loadedDocs.length() == 0) {
+        // For some reason it hasn't been loaded
+        return notRestored;
+    }
 
-    for (const auto& view : viewData)
-        sessionWriter.addViewData(view);
+    // We need to set the correct title as soon as possible, otherwise
+    // the UI will jump around changing the width of the tabs while they
+    // are loading.
+    auto loadingEditor = loadedDocs.first().first;
 
-    return true;
+    // Adding the tab may have made it the current one
+    loadingEditor->setLastActivated(tab.lastActivated);
+
+    if (loadingEditor->isDeferred()) {
+        const Editor *key = loadingEditor.data();
+        deferredTabs.insert(key, tab);
+        QObject::connect(loadingEditor.data(), &QObject::destroyed, [key]() {
+            deferredTabs.remove(key);
+        });
+    }
+    QString tabText;
+    if (tab.filePath.isEmpty()) {
+        tabText = docEngine->getNewDocumentName();
+    } else {
+        tabText = tabW->generateTabTitleForUrl(QUrl(tab.filePath));
+    }
+    tabW->setTabText(loadingEditor.data(), tabText);
+
+    return loadedDocs.first();
 }
 
 void loadSession(DocEngine* docEngine, TopEditorContainer* editorContainer, QString sessionPath)
 {
-    QFile file(sessionPath);
-    file.open(QIODevice::ReadOnly);
+    Tracer::Span span("Load session");
+
+    SessionFile session;
 
-    if (!file.isOpen())
+    if (!session.open(sessionPath))
         return;
 
-    SessionReader reader(file);
+    restoreSession(docEngine, editorContainer, session);
+}
+
+QPromise<std::shared_ptr<SessionFile>> readSession(QString sessionPath)
+{
+    return QtPromise::resolve(QtConcurrent::run(DocEngine::ioThreadPool(), [sessionPath]() {
+        Tracer::Span span("Read session");
+        auto session = std::make_shared<SessionFile>();
+
+        if (!session->open(sessionPath))
+            return std::shared_ptr<SessionFile>();
+
+        session->readAll();
+
+        // Start decoding the documents that restoreTab() loads right away: the cached
+        // ones and the active ones. The others are deferred until they're shown.
+        for (const auto& view : session->views()) {
+            for (const auto& record : view.records) {
+                TabData tab;
+                session->readTab(record, tab);
+
+                if (QFileInfo::exists(tab.cacheFilePath))
+                    DocEngine::prefetchDocument(tab.cacheFilePath);
+                else if (tab.active && QFileInfo::exists(tab.filePath))
+                    DocEngine::prefetchDocument(tab.filePath);
+            }
+        }
+
+        return session;
+    }));
+}
 
-    bool success = false;
-    const auto& views = reader.readData(&success);
+QPromise<void> restoreSession(DocEngine* docEngine, TopEditorContainer* editorContainer, SessionFile& session)
+{
+    Tracer::Span span("Restore session");
 
-    if (!success || views.empty()) {
-        return;
-    }
+    QVector<QPromise<QSharedPointer<Editor>>> activeTabsLoaded;
 
     int viewCounter = 0;
-    for (const auto& view : views) {
+    for (const auto& view : session.views()) {
         // Each new view must be created if it does not yet exist.
         EditorTabWidget* tabW = editorContainer->tabWidget(viewCounter);
         QSharedPointer<Editor> activeEditor;
@@ -391,107 +530,38 @@ void loadSession(DocEngine* docEngine, TopEditorContainer* editorContainer, QStr
 
         viewCounter++;
 
-        for (const TabData& tab : view.tabs) {
-            const QFileInfo fileInfo(tab.filePath);
-            const bool fileExists = fileInfo.exists();
-            const bool cacheFileExists = QFileInfo(tab.cacheFilePath).exists();
-
-            const QUrl fileUrl = QUrl::fromLocalFile(tab.filePath);
-            const QUrl cacheFileUrl = QUrl::fromLocalFile(tab.cacheFilePath);
-
-            // This is the file to load the document from
-            const QUrl& loadUrl = cacheFileExists ? cacheFileUrl : fileUrl;
+        // Read and restore the active tab first: it gets the first editor that's ready,
+        // and is moved to its place once the other tabs are there.
+        const int activeTab = view.activeTab >= 0 && static_cast<size_t>(view.activeTab) < view.records.size() ?
+                    view.activeTab : -1;
+        QSharedPointer<Editor> editorBeforeActive;
+
+        if (activeTab >= 0) {
+            TabData tab;
+            if (session.readTab(view.records[static_cast<size_t>(activeTab)], tab)) {
+                const RestoredTab restored = restoreTab(docEngine, editorContainer, tabW, tab);
+                activeEditor = restored.first;
+                activeTabsLoaded.append(restored.second);
+            }
+        }
 
-            if (!fileExists && !cacheFileExists)
+        for (size_t i = 0; i < view.records.size(); i++) {
+            if (static_cast<int>(i) == activeTab)
                 continue;
 
-            auto loadedDocs = docEngine->getDocumentLoader()
-                .setUrl(loadUrl)
-                .setTabWidget(tabW)
-                .setRememberLastDir(false)
-                .setFileSizeWarning(DocEngine::FileSizeActionYesToAll)
-                .setPriorityIdx(tab.active ? ALL_MAXIMUM_PRIORITY : ALL_MINIMUM_PRIORITY)
-                .setManualEditorInitialization([=](QSharedPointer<Editor> editor, const QUrl& url) {
-
-                    int idx = tabW->indexOf(editor);
-
-                    editor->setCursorPosition(tab.cursorX, tab.cursorY);
-                    editor->setScrollPosition(tab.scrollX, tab.scrollY);
-
-                    if (tab.customIndent) {
-                        editor->setCustomIndentationMode(tab.useTabs, tab.tabSize);
-                    }
-
-                    // DocEngine sets the editor's fileName to loadUrl since this is where the file
-                    // was loaded from. Since loadUrl could point to a cached file we reset it here.
-                    if (cacheFileExists) {
-                        editor->markDirty();
-                        editor->setLanguageFromFilePath();
-                    }
-
-                    if (tab.filePath.isEmpty()) {
-                        QString tabText = tabW->tabText(idx);
-                        editor->setFilePath(QUrl());
-                        tabW->setTabText(idx, tabText);
-                    } else {
-                        editor->setFilePath(fileUrl);
-                        if (fileExists)
-                            docEngine->monitorDocument(editor);
-                    }
-
-                    // If we're loading an existing file from cache we want to inform the user whether
-                    // the file has changed since Nqq was last closed. For this we can compare the
-                    // file's last modification date.
-                    if (fileExists && cacheFileExists && tab.lastModified != 0) {
-                        auto lastModified = fileInfo.lastModified().toMSecsSinceEpoch();
-
-                        if (lastModified > tab.lastModified) {
-                            editor->setFileOnDiskChanged(true);
-                        }
-                    }
-
-                    // If the orig. file does not exist but *should* exist, we inform the user of its removal.
-                    if (!fileExists && !fileUrl.isEmpty()) {
-                        editor->setFileOnDiskChanged(true);
-                        emit docEngine->fileOnDiskChanged(tabW, idx, true);
-                    }
-
-                    if (!tab.language.isEmpty()) editor->setLanguage(tab.language);
-
-                    // loadDocuments() explicitly calls setFocus() so we'll have to undo that.
-                    editor->clearFocus();
-
-                    if (tab.active) {
-                        // We need to trigger a final call to MainWindow::refreshEditorUiInfo to display the correct info
-                        // on start-up. The easiest way is to emit a cleanChanged() event.
-                        editor->isCleanP().then([=](bool isClean){ emit editor->cleanChanged(isClean); });
-                    }
-
-                })
-                .executeInBackground();
-
-            if (loadedDocs.length() == 0) {
-                // For some reason it hasn't been loaded
+            TabData tab;
+            if (!session.readTab(view.records[i], tab))
                 continue;
-            }
 
-            // We need to set the correct title as soon as possible, otherwise
-            // the UI will jump around changing the width of the tabs while they
-            // are loading.
-            auto loadingEditor = loadedDocs.first().first;
-            QString tabText;
-            if (tab.filePath.isEmpty()) {
-                tabText = docEngine->getNewDocumentName();
-            } else {
-                tabText = tabW->generateTabTitleForUrl(QUrl(tab.filePath));
-            }
-            tabW->setTabText(loadingEditor.data(), tabText);
+            auto editor = restoreTab(docEngine, editorContainer, tabW, tab).first;
 
-            if (tab.active) {
-                activeEditor = loadingEditor;
-            }
+            if (editor && static_cast<int>(i) < activeTab)
+                editorBeforeActive = editor;
+        }
 
-        } // end for
+        if (activeEditor && editorBeforeActive) {
+            tabW->tabBar()->moveTab(tabW->indexOf(activeEditor), tabW->indexOf(editorBeforeActive));
+        }
 
         // In case a new tabwidget was created but no tabs were actually added to it,
         // we'll attempt to re-use the widget for the next view.
@@ -503,9 +573,12 @@ void loadSession(DocEngine* docEngine, TopEditorContainer* editorContainer, QStr
 
     } // end for
 
+    // Resolved once the active tab of every view has been loaded
+    const auto loaded = QtPromise::all(activeTabsLoaded).then([]() {});
+
     // Stop if we haven't added any views at all, otherwise we have to clean up after ourselves.
     if (viewCounter <= 0)
-        return;
+        return loaded;
 
     // Give focus to the first tab widget
     EditorTabWidget* firstTabW = editorContainer->tabWidget(0);
@@ -515,6 +588,11 @@ void loadSession(DocEngine* docEngine, TopEditorContainer* editorContainer, QStr
     // If the last tabwidget still has no tabs in it at this point, we'll have to delete it.
     EditorTabWidget* lastTabW = editorContainer->tabWidget( editorContainer->count() -1);
     lastTabW->deleteIfEmpty();
+
+    // Get the background tabs most likely to be shown next ready in advance
+    SessionPrefetcher::start(editorContainer);
+
+    return loaded;
 }
 
 } // namespace Sessions
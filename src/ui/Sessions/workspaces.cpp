@@ -0,0 +1,206 @@
+#include "include/Sessions/workspaces.h"
+
+#include "include/EditorNS/editor.h"
+#include "include/Sessions/persistentcache.h"
+#include "include/Sessions/sessionprefetcher.h"
+#include "include/Sessions/sessions.h"
+#include "include/globals.h"
+#include "include/topeditorcontainer.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QtConcurrent/QtConcurrentRun>
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+using namespace EditorNS;
+
+namespace {
+    const QString SESSION_FILE_NAME = "session.bin";
+    const QString NAME_FILE_NAME = "name";
+
+    // The blobs have their own directory: writeSession() deletes the other files of it
+    const QString BLOBS_DIR_NAME = "blobs";
+
+    // Total size of the documents kept in memory by the suspended workspaces
+    const qint64 MAX_RETAINED_SIZE = 64 * 1024 * 1024;
+}
+
+QList<QPair<QString, qint64>> Workspaces::s_retainedDocuments;
+qint64 Workspaces::s_retainedSize = 0;
+
+QString Workspaces::defaultWorkspace()
+{
+    return QStringLiteral("Default");
+}
+
+QStringList Workspaces::suspendedWorkspaces()
+{
+    QStringList names;
+
+    const QDir workspacesDir(PersistentCache::workspacesDirPath());
+    for (const QFileInfo& dirInfo : workspacesDir.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        const QDir dir(dirInfo.absoluteFilePath());
+        if (!dir.exists(SESSION_FILE_NAME))
+            continue;
+
+        QFile nameFile(dir.absoluteFilePath(NAME_FILE_NAME));
+        if (nameFile.open(QIODevice::ReadOnly))
+            names.append(QString::fromUtf8(nameFile.readAll()));
+    }
+
+    names.sort(Qt::CaseInsensitive);
+    return names;
+}
+
+bool Workspaces::isValidName(const QString& name)
+{
+    return !name.trimmed().isEmpty() && name == name.trimmed();
+}
+
+QPromise<bool> Workspaces::suspend(TopEditorContainer* editorContainer, const QString& name)
+{
+    // The documents prefetched for the background tabs won't be shown anymore
+    SessionPrefetcher::stop(editorContainer);
+
+    const QString blobsDirPath = workspaceDirPath(name) + "/" + BLOBS_DIR_NAME;
+
+    // Ask all the editors for their state at once: the session, and the content of the
+    // unmodified documents worth keeping in memory.
+    auto sessionP = Sessions::collectSession(editorContainer, blobsDirPath, Sessions::CacheIndex());
+
+    std::vector<QSharedPointer<Editor>> loadedEditors;
+    for (const auto& editor : editorContainer->getOpenEditors()) {
+        // Background tabs that were never shown have nothing in memory yet
+        if (!editor->isDeferred() && editor->filePath().isLocalFile() && !editor->fileOnDiskChanged())
+            loadedEditors.push_back(editor);
+    }
+
+    // The most recently activated tabs are the most likely to be shown again
+    std::sort(loadedEditors.begin(), loadedEditors.end(), [](const QSharedPointer<Editor>& a, const QSharedPointer<Editor>& b) {
+        return a->lastActivated() > b->lastActivated();
+    });
+
+    QVector<QPromise<void>> retained;
+    qint64 retainedSize = 0;
+
+    for (const auto& editor : loadedEditors) {
+        const QString filePath = editor->filePath().toLocalFile();
+
+        // Each character takes two bytes in memory
+        retainedSize += QFileInfo(filePath).size() * 2;
+        if (retainedSize > MAX_RETAINED_SIZE)
+            break;
+
+        const QString endOfLineSequence = editor->endOfLineSequence();
+        QTextCodec* codec = editor->codec();
+        const bool bom = editor->bom();
+
+        retained.append(editor->isCleanP().then([=](bool isClean) {
+            if (!isClean)
+                return QPromise<void>::resolve();
+
+            return editor->snapshot().then([=](const Editor::Snapshot& snapshot) {
+                // Rebuild what reading the file gives, so that the format is detected again
+                DocEngine::DecodedText decoded;
+                decoded.text = snapshot.text;
+                if (endOfLineSequence != "\n")
+                    decoded.text.replace("\n", endOfLineSequence);
+                decoded.codec = codec;
+                decoded.bom = bom;
+
+                retainDocument(filePath, decoded);
+            });
+        }));
+    }
+
+    return QtPromise::all(retained).fail([]() {
+        // The documents that couldn't be retained are read again on resume
+    }).then([=]() {
+        return sessionP;
+    }).then([=](const std::shared_ptr<Sessions::SessionSnapshot>& session) {
+        if (!session)
+            return QPromise<bool>::resolve(false);
+
+        // The session doesn't need the editors anymore
+        return QtPromise::resolve(QtConcurrent::run(DocEngine::ioThreadPool(), [=]() {
+            return writeWorkspace(*session, name);
+        }));
+    }).fail([]() {
+        return false;
+    });
+}
+
+bool Workspaces::writeWorkspace(const Sessions::SessionSnapshot& session, const QString& name)
+{
+    const QDir dir(workspaceDirPath(name));
+    if (!dir.mkpath("."))
+        return false;
+
+    // The name goes first: a workspace is only listed once its session file exists
+    QSaveFile nameFile(dir.absoluteFilePath(NAME_FILE_NAME));
+    if (!nameFile.open(QIODevice::WriteOnly))
+        return false;
+
+    nameFile.write(name.toUtf8());
+    if (!nameFile.commit())
+        return false;
+
+    return Sessions::writeSession(session, sessionPath(name), nullptr, Sessions::SessionFormat::Binary);
+}
+
+void Workspaces::resume(DocEngine* docEngine, TopEditorContainer* editorContainer, const QString& name)
+{
+    const QString path = sessionPath(name);
+
+    // The files of the workspace are kept: the modified documents are written
+    // again only if they change before the workspace is suspended again.
+    if (QFileInfo::exists(path))
+        Sessions::loadSession(docEngine, editorContainer, path);
+}
+
+bool Workspaces::remove(const QString& name)
+{
+    return QDir(workspaceDirPath(name)).removeRecursively();
+}
+
+QString Workspaces::workspaceDirPath(const QString& name)
+{
+    const QByteArray hash = QCryptographicHash::hash(name.toUtf8(), QCryptographicHash::Sha1).toHex();
+    return PersistentCache::workspacesDirPath() + "/" + QString::fromLatin1(hash);
+}
+
+QString Workspaces::sessionPath(const QString& name)
+{
+    return workspaceDirPath(name) + "/" + SESSION_FILE_NAME;
+}
+
+void Workspaces::retainDocument(const QString& filePath, const DocEngine::DecodedText& decoded)
+{
+    const QString path = QFileInfo(filePath).absoluteFilePath();
+    const qint64 size = decoded.text.size() * 2;
+
+    // A document retained again becomes the most recent one
+    for (int i = 0; i < s_retainedDocuments.size(); i++) {
+        if (s_retainedDocuments[i].first == path) {
+            s_retainedSize -= s_retainedDocuments[i].second;
+            s_retainedDocuments.removeAt(i);
+            break;
+        }
+    }
+
+    DocEngine::retainDocument(path, decoded);
+    s_retainedDocuments.append(qMakePair(path, size));
+    s_retainedSize += size;
+
+    while (s_retainedSize > MAX_RETAINED_SIZE && !s_retainedDocuments.isEmpty()) {
+        const auto oldest = s_retainedDocuments.takeFirst();
+        s_retainedSize -= oldest.second;
+        DocEngine::discardPrefetchedDocument(oldest.first);
+    }
+}
@@ -0,0 +1,84 @@
+#include "include/chunkedfilewriter.h"
+
+#include <QDebug>
+#include <QFileInfo>
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+FileOwnership fileOwnership(const QString &fileName)
+{
+    const QFileInfo fileInfo(fileName);
+
+    FileOwnership ownership;
+    ownership.exists = fileInfo.exists();
+    if (ownership.exists) {
+        // The "User" flags only describe what we can do with the file
+        ownership.permissions = fileInfo.permissions() &
+                ~(QFileDevice::ReadUser | QFileDevice::WriteUser | QFileDevice::ExeUser);
+        ownership.ownerId = fileInfo.ownerId();
+        ownership.groupId = fileInfo.groupId();
+    }
+
+    return ownership;
+}
+
+void restoreFileOwnership(const QString &fileName, const FileOwnership &ownership)
+{
+    if (!ownership.exists)
+        return;
+
+    const QFileInfo fileInfo(fileName);
+    const QFileDevice::Permissions permissions = fileInfo.permissions() &
+            ~(QFileDevice::ReadUser | QFileDevice::WriteUser | QFileDevice::ExeUser);
+
+    if (permissions != ownership.permissions)
+        QFile::setPermissions(fileName, ownership.permissions);
+
+#ifdef Q_OS_UNIX
+    if (fileInfo.ownerId() != ownership.ownerId || fileInfo.groupId() != ownership.groupId) {
+        const QByteArray path = QFile::encodeName(fileName);
+        if (chown(path.constData(), ownership.ownerId, ownership.groupId) != 0 &&
+                chown(path.constData(), static_cast<uid_t>(-1), ownership.groupId) != 0)
+            qWarning() << "Can't restore the owner of" << fileName;
+    }
+#endif
+}
+
+ChunkedFileWriter::ChunkedFileWriter(const QString &fileName, QTextCodec *codec) :
+    m_file(fileName),
+    m_encoder(codec->makeEncoder())
+{ }
+
+QString ChunkedFileWriter::open(const QByteArray &bom)
+{
+    m_ownership = fileOwnership(m_file.fileName());
+
+    // Without write permission on the directory the temporary file
+    // can't be created: overwrite the file in place like we used to.
+    m_file.setDirectWriteFallback(true);
+
+    if (!m_file.open(QIODevice::WriteOnly))
+        return m_file.errorString();
+
+    m_size = m_file.write(bom);
+    return QString();
+}
+
+void ChunkedFileWriter::write(const QString &text)
+{
+    // The encoder keeps its state between chunks, e.g. the first half of
+    // a surrogate pair and whether the BOM has already been generated.
+    m_size += m_file.write(m_encoder->fromUnicode(text));
+}
+
+QString ChunkedFileWriter::commit()
+{
+    // commit() also fails if any of the writes did
+    if (!m_file.commit())
+        return m_file.errorString();
+
+    restoreFileOwnership(m_file.fileName(), m_ownership);
+    return QString();
+}
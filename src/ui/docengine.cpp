@@ -1,33 +1,219 @@
 #include "include/docengine.h"
 
+#include "include/EditorNS/editorpool.h"
+#include "include/Sessions/backupservice.h"
 #include "include/Sessions/persistentcache.h"
+#include "include/chunkedfilewriter.h"
+#include "include/encodingmemo.h"
+#include "include/filemonitor.h"
 #include "include/globals.h"
 #include "include/iconprovider.h"
+#include "include/linediff.h"
 #include "include/mainwindow.h"
 #include "include/notepadqq.h"
 #include "include/nqqsettings.h"
 
 #include <QCoreApplication>
+#include <QDateTime>
+#include <QDebug>
+#include <QEventLoop>
 #include <QFileInfo>
+#include <QFutureInterface>
+#include <QFutureWatcher>
+#include <QHash>
 #include <QMessageBox>
+#include <QMutex>
+#include <QProcess>
 #include <QPushButton>
+#include <QSaveFile>
 #include <QTextCodec>
 #include <QTextStream>
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrentRun>
 
 #include <algorithm>
+#include <cstring>
+#include <memory>
 #include <uchardet.h>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Only the first 64 kilobytes of a file are used to detect its encoding
+constexpr int ENCODING_DETECTION_SIZE = 65536;
+
+// Number of characters requested to the editor at a time while saving
+constexpr int WRITE_CHUNK_SIZE = 1024 * 1024;
+
+// Documents being read and decoded in advance, by absolute file path. See DocEngine::prefetchDocument().
+// The size and modification time of the file tell whether it changed since.
+struct PrefetchedDocument {
+    QFuture<DocEngine::DecodedText> decoded;
+    qint64 size;
+    QDateTime lastModified;
+};
+QMutex s_prefetchedDocumentsMutex;
+QHash<QString, PrefetchedDocument> s_prefetchedDocuments;
+
+/**
+ * @brief Owns a uchardet detector so that each thread can keep reusing
+ *        the same one instead of allocating a new one for every file.
+ */
+struct EncodingDetector {
+    uchardet_t handle = uchardet_new();
+    ~EncodingDetector() { uchardet_delete(handle); }
+};
+
+/**
+ * @brief Returns the number of leading bytes of data that are 7-bit ASCII,
+ *        checking 16 (or 8) bytes at a time.
+ */
+int asciiPrefixLength(const char *data, int size)
+{
+    int i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= size; i += 16) {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        if (_mm_movemask_epi8(chunk) != 0)
+            break;
+    }
+#else
+    for (; i + 8 <= size; i += 8) {
+        quint64 chunk;
+        std::memcpy(&chunk, data + i, sizeof(chunk));
+        if ((chunk & Q_UINT64_C(0x8080808080808080)) != 0)
+            break;
+    }
+#endif
+    while (i < size && (static_cast<unsigned char>(data[i]) & 0x80) == 0)
+        i++;
+
+    return i;
+}
+
+/**
+ * @brief Waits for a future while still processing the events of the
+ *        UI, without spinning.
+ */
+template <typename T>
+T waitForFuture(const QFuture<T> &future)
+{
+    QFutureWatcher<T> watcher;
+    QEventLoop loop;
+    QObject::connect(&watcher, &QFutureWatcher<T>::finished, &loop, &QEventLoop::quit);
+    watcher.setFuture(future);
+
+    if (!future.isFinished())
+        loop.exec();
+
+    return future.result();
+}
+
+/**
+ * @brief The state of DocEngine::writeAtomically() while the document is
+ *        received from the editor one chunk at a time.
+ */
+struct ChunkedWrite {
+    QSharedPointer<Editor> editor;
+    QString endOfLineSequence;
+    std::shared_ptr<ChunkedFileWriter> file;
+    QPromise<void> written = QPromise<void>::resolve(); // Settled once the chunks received so far have been written
+    int firstSequence = -1;
+};
+
+QString editorReadError()
+{
+    return DocEngine::tr("The content of the document could not be read from the editor.");
+}
+
+QPromise<QVariant> requestChunk(const QSharedPointer<Editor> &editor, int from)
+{
+    return editor->asyncSendMessageWithResultP("C_FUN_GET_VALUE_CHUNK",
+                                               QVariantMap{{"from", from}, {"length", WRITE_CHUNK_SIZE}})
+            .fail([]() { return QPromise<QVariant>::reject(editorReadError()); });
+}
+
+/**
+ * @brief Writes the chunk that starts at "from" once it's received, and so on
+ *        until the end of the document. The next chunk is requested before the
+ *        current one is written, so that the editor prepares it meanwhile.
+ * @return A promise resolved with the change sequence of the document, or with
+ *         -1 if it has been modified in the meantime. It's rejected with the
+ *         error message if the document couldn't be written.
+ */
+QPromise<int> writeChunks(const std::shared_ptr<ChunkedWrite> &state, int from, const QPromise<QVariant> &chunkP)
+{
+    return chunkP.then([=](const QVariant &reply) {
+        // Don't bother with the rest of the document if the file couldn't be written
+        if (state->written.isRejected())
+            return state->written.then([]() { return -1; });
+
+        const QVariantMap chunk = reply.toMap();
+
+        // An unanswered request would look like the end of the document
+        if (!chunk.contains("text"))
+            return QPromise<int>::reject(editorReadError());
+
+        QString text = chunk.value("text").toString();
+
+        // Unlike the history generation, the change sequence also
+        // changes with the edits that are merged into the last one.
+        const int sequence = chunk.value("sequence").toInt();
+
+        if (state->firstSequence == -1) {
+            state->firstSequence = sequence;
+        } else if (sequence != state->firstSequence) {
+            // Don't start over while the I/O thread is still using the file
+            return state->written.then([]() { return -1; }).fail([]() { return -1; });
+        }
+
+        const int next = from + text.length();
+        const bool last = text.length() < WRITE_CHUNK_SIZE;
+
+        const QPromise<QVariant> nextChunkP = last ? QPromise<QVariant>::resolve(QVariant())
+                                                   : requestChunk(state->editor, next);
+
+        if (state->endOfLineSequence != "\n")
+            text.replace("\n", state->endOfLineSequence);
+
+        const std::shared_ptr<ChunkedFileWriter> file = state->file;
+        state->written = state->written.then([=]() {
+            return QtPromise::resolve(QtConcurrent::run(DocEngine::ioThreadPool(), [=]() {
+                file->write(text);
+            }));
+        });
+
+        if (!last)
+            return writeChunks(state, next, nextChunkP);
+
+        return state->written.then([=]() {
+            return QtPromise::resolve(QtConcurrent::run(DocEngine::ioThreadPool(), [=]() {
+                return file->commit();
+            }));
+        }).then([=](const QString &error) {
+            return error.isNull() ? QPromise<int>::resolve(state->firstSequence)
+                                  : QPromise<int>::reject(error);
+        });
+    });
+}
+
+} // namespace
 
 DocEngine::DocEngine(TopEditorContainer *topEditorContainer, QObject *parent) :
     QObject(parent),
-    m_topEditorContainer(topEditorContainer),
-    m_fsWatcher(new QFileSystemWatcher(this))
+    m_topEditorContainer(topEditorContainer)
 {
-    connect(m_fsWatcher, &QFileSystemWatcher::fileChanged, this, &DocEngine::documentChanged);
+    connect(&FileMonitor::getInstance(), &FileMonitor::fileChanged, this, &DocEngine::documentChanged);
 }
 
 DocEngine::~DocEngine()
 {
-    delete m_fsWatcher;
+    for (const QString &fileName : m_monitoredFiles)
+        FileMonitor::getInstance().removeFile(fileName);
 }
 
 int DocEngine::addNewDocument(QString name, bool setFocus, EditorTabWidget *tabWidget)
@@ -57,12 +243,29 @@ DocEngine::DecodedText DocEngine::readToString(QFile *file, QTextCodec *codec, b
         return decoded;
     }
 
+    QByteArray contents = file->readAll();
+    const qint64 size = contents.size();
+
+    // Documents cached by a session are stored compressed
+    if (PersistentCache::isBlob(file->fileName())) {
+        bool ok;
+        contents = PersistentCache::unpackBlob(contents, &ok);
+
+        // Restoring the tab empty would silently lose the document
+        if (!ok) {
+            file->close();
+            decoded.error = true;
+            return decoded;
+        }
+    }
+
     if (codec == nullptr) {
-        decoded = decodeText(file->readAll());
+        decoded = decodeText(contents, QFileInfo(*file).absolutePath());
     } else {
-        decoded = decodeText(file->readAll(), codec, bom);
+        decoded = decodeText(contents, codec, bom);
     }
 
+    decoded.size = size;
     file->close();
 
     return decoded;
@@ -74,6 +277,42 @@ QPromise<void> DocEngine::read(QFile *file, QSharedPointer<Editor> editor)
 }
 
 QPromise<void> DocEngine::read(QFile *file, QSharedPointer<Editor> editor, QTextCodec *codec, bool bom)
+{
+    if(!editor)
+        return QPromise<void>::reject(0);
+
+    // Use the prefetched document, if any and if the file didn't change since,
+    // unless a specific encoding is requested
+    QFuture<DecodedText> prefetched;
+    bool isPrefetched = false;
+
+    if (codec == nullptr) {
+        const QFileInfo fileInfo(*file);
+        QMutexLocker locker(&s_prefetchedDocumentsMutex);
+        auto it = s_prefetchedDocuments.find(fileInfo.absoluteFilePath());
+        if (it != s_prefetchedDocuments.end()) {
+            if (it->size == fileInfo.size() && it->lastModified == fileInfo.lastModified()) {
+                prefetched = it->decoded;
+                isPrefetched = true;
+            }
+            s_prefetchedDocuments.erase(it);
+        }
+    }
+
+    DecodedText decoded = isPrefetched ? waitForFuture(prefetched) : readToString(file, codec, bom);
+
+    if (decoded.error)
+        return QPromise<void>::reject(0);
+
+    setEditorFormat(editor, decoded);
+
+    return editor->setValue(decoded.text)
+            .then([=](){ return editor->asyncSendMessageWithResultP("C_CMD_CLEAR_HISTORY"); })
+            .then([=](){ return editor->markClean(); })
+            .then([=](){});
+}
+
+QPromise<void> DocEngine::reload(QFile *file, QSharedPointer<Editor> editor, QTextCodec *codec, bool bom)
 {
     if(!editor)
         return QPromise<void>::reject(0);
@@ -83,6 +322,28 @@ QPromise<void> DocEngine::read(QFile *file, QSharedPointer<Editor> editor, QText
     if (decoded.error)
         return QPromise<void>::reject(0);
 
+    setEditorFormat(editor, decoded);
+
+    if (m_followedDocuments.contains(editor.data()))
+        resetFollowState(editor, decoded.size);
+
+    // The editor always uses \n internally
+    const QStringList newLines = decoded.text.replace("\r\n", "\n").replace('\r', '\n').split('\n');
+
+    return editor->valueP()
+            .then([=](const QString &value){
+                QVariantList changes;
+                for (const LineChange& c : diffLines(value.split('\n'), newLines)) {
+                    changes.append(QVariantMap{{"from", c.from}, {"to", c.to}, {"lines", c.lines}});
+                }
+                return editor->asyncSendMessageWithResultP("C_CMD_REPLACE_LINES", changes);
+            })
+            .then([=](){ return editor->markClean(); })
+            .then([=](){});
+}
+
+void DocEngine::setEditorFormat(QSharedPointer<Editor> editor, const DecodedText &decoded)
+{
     editor->setCodec(decoded.codec);
     editor->setBom(decoded.bom);
 
@@ -92,11 +353,6 @@ QPromise<void> DocEngine::read(QFile *file, QSharedPointer<Editor> editor, QText
         editor->setEndOfLineSequence("\n");
     else if (decoded.text.indexOf("\r") != -1)
         editor->setEndOfLineSequence("\r");
-
-    return editor->setValue(decoded.text)
-            .then([=](){ return editor->asyncSendMessageWithResultP("C_CMD_CLEAR_HISTORY"); })
-            .then([=](){ return editor->markClean(); })
-            .then([=](){});
 }
 
 int showFileSizeDialog(const QString docName, long long fileSize, bool multipleFiles) {
@@ -218,6 +474,8 @@ QList<std::pair<QSharedPointer<Editor>, QPromise<QSharedPointer<Editor>>>> DocEn
         if (isAlreadyOpen) {
             tabWidget = m_topEditorContainer->tabWidget(openPos.first);
             tabIndex = openPos.second;
+        } else if (docLoader.deferred) {
+            tabIndex = tabWidget->addDeferredEditorTab(fi.fileName());
         } else {
             tabIndex = tabWidget->addEditorTab(false, fi.fileName());
         }
@@ -225,18 +483,25 @@ QList<std::pair<QSharedPointer<Editor>, QPromise<QSharedPointer<Editor>>>> DocEn
         auto editor = tabWidget->editor(tabIndex);
         editor->isLoading = true;
 
+        const bool deferred = editor->isDeferred();
+        if (deferred) {
+            // Until it's read, the document must already be found by its path
+            editor->setFilePath(url);
+            tabWidget->setTabToolTip(tabIndex, fi.absoluteFilePath());
+        }
+
         // Once we are here, we can NOT remove the tab we've just added
 
         // If there was only a new empty tab opened, remove it
         if (tabWidget->count() == 2) {
             auto victim = tabWidget->editor(0);
-            if (!victim->isLoading && victim->filePath().isEmpty() && victim->isClean()) {
+            if (!victim->isLoading && victim->filePath().isEmpty() && waitFor(victim->isCleanP())) {
                 tabWidget->removeTab(0);
                 tabIndex--;
             }
         }
 
-        if (isFirstDocument) {
+        if (isFirstDocument && !deferred) {
             isFirstDocument = false;
             tabWidget->setCurrentIndex(tabIndex);
             tabWidget->editor(tabIndex)->setFocus();
@@ -257,19 +522,24 @@ QList<std::pair<QSharedPointer<Editor>, QPromise<QSharedPointer<Editor>>>> DocEn
                 Q_ASSERT(false); // Should never get here
             }
 
-            QTimer::singleShot(delay_ms, [=]()
+            auto load = [=]()
             {
                 // In case of a reload, save cursor, scroll position, language
                 QPair<int, int> scrollPosition;
                 QPair<int, int> cursorPosition;
                 const EditorNS::Language* language;
+                bool isClean = true;
                 if (isAlreadyOpen) {
-                    scrollPosition = editor->scrollPosition();
-                    cursorPosition = editor->cursorPosition();
+                    auto scrollPositionP = editor->scrollPositionP();
+                    auto cursorPositionP = editor->cursorPositionP();
+                    auto isCleanP = editor->isCleanP();
+                    scrollPosition = waitFor(scrollPositionP);
+                    cursorPosition = waitFor(cursorPositionP);
+                    isClean = waitFor(isCleanP);
                     language = editor->getLanguage();
                 }
 
-                if (isAlreadyOpen && reloadAction == DocEngine::ReloadActionAsk && !editor->isClean()) {
+                if (isAlreadyOpen && reloadAction == DocEngine::ReloadActionAsk && !isClean) {
                     EditorTabWidget *tabW = static_cast<EditorTabWidget *>
                                             (m_topEditorContainer->widget(openPos.first));
                     tabW->setCurrentIndex(openPos.second);
@@ -282,8 +552,13 @@ QList<std::pair<QSharedPointer<Editor>, QPromise<QSharedPointer<Editor>>>> DocEn
                 }
 
                 QFile file(localFileName);
+                // An open document is reloaded incrementally, keeping its undo history
+                auto readFile = [&]() {
+                    return isAlreadyOpen ? this->reload(&file, editor, codec, bom) : this->read(&file, editor, codec, bom);
+                };
                 if (file.exists()) {
-                    QPromise<void> readResult = this->read(&file, editor, codec, bom).wait();
+                    QPromise<void> readResult = readFile();
+                    waitFor(readResult);
 
                     while (readResult.isRejected()) {
                         // Handle error
@@ -297,7 +572,8 @@ QList<std::pair<QSharedPointer<Editor>, QPromise<QSharedPointer<Editor>>>> DocEn
                         int ret = msgBox.exec();
                         if(ret == QMessageBox::Retry) {
                             // Retry
-                            readResult = this->read(&file, editor, codec, bom).wait();
+                            readResult = readFile();
+                            waitFor(readResult);
                         } else if(ret == QMessageBox::Ignore) {
                             //tabWidget->removeTab(tabIndex);
                             //reject(QSharedPointer<Editor>());
@@ -330,9 +606,14 @@ QList<std::pair<QSharedPointer<Editor>, QPromise<QSharedPointer<Editor>>>> DocEn
 
                 } else {
 
+                    // A deferred document is read long after its tab was added: the tab
+                    // may have been moved in the meantime.
+                    auto* currentTabWidget = deferred ? m_topEditorContainer->tabWidgetFromEditor(editor) : tabWidget;
+                    const int currentTabIndex = deferred ? currentTabWidget->indexOf(editor) : tabIndex;
+
                     if (docLoader.manualEditorInitialization == nullptr) {
                         editor->setFilePath(url);
-                        tabWidget->setTabToolTip(tabIndex, fi.absoluteFilePath());
+                        currentTabWidget->setTabToolTip(currentTabIndex, fi.absoluteFilePath());
                         editor->setLanguageFromFilePath();
 
                         this->monitorDocument(editor);
@@ -340,11 +621,31 @@ QList<std::pair<QSharedPointer<Editor>, QPromise<QSharedPointer<Editor>>>> DocEn
                         docLoader.manualEditorInitialization(editor, fileNames[i]);
                     }
 
-                    emit this->documentLoaded(tabWidget, tabIndex, false, rememberLastSelectedDir);
+                    emit this->documentLoaded(currentTabWidget, currentTabIndex, false, rememberLastSelectedDir);
                 }
 
                 resolve(editor);
-            });
+            };
+
+            if (deferred) {
+                editor->setDeferredLoader(load);
+
+                // Until then, the document is the file as it's on disk
+                editor->setDeferredValueReader([=]() {
+                    return QtPromise::resolve(QtConcurrent::run(ioThreadPool(), [=]() {
+                        QFile file(localFileName);
+                        return readToString(&file, codec, bom);
+                    })).then([](DecodedText decoded) {
+                        if (decoded.error)
+                            return QPromise<QString>::reject(QString("Can't read the file"));
+
+                        // The editor always uses \n internally
+                        return QPromise<QString>::resolve(decoded.text.replace("\r\n", "\n").replace('\r', '\n'));
+                    });
+                });
+            } else {
+                QTimer::singleShot(delay_ms, load);
+            }
 
         }).then([](QSharedPointer<Editor> editor){
             editor->isLoading = false;
@@ -452,13 +753,18 @@ QPromise<void> DocEngine::loadDocuments(const DocEngine::DocumentLoader& docLoad
         QPair<int, int> scrollPosition;
         QPair<int, int> cursorPosition;
         const EditorNS::Language* language;
+        bool isClean = true;
         if (isAlreadyOpen) {
-            scrollPosition = editor->scrollPosition();
-            cursorPosition = editor->cursorPosition();
+            auto scrollPositionP = editor->scrollPositionP();
+            auto cursorPositionP = editor->cursorPositionP();
+            auto isCleanP = editor->isCleanP();
+            scrollPosition = waitFor(scrollPositionP);
+            cursorPosition = waitFor(cursorPositionP);
+            isClean = waitFor(isCleanP);
             language = editor->getLanguage();
         }
 
-        if (isAlreadyOpen && reloadAction == DocEngine::ReloadActionAsk && !editor->isClean()) {
+        if (isAlreadyOpen && reloadAction == DocEngine::ReloadActionAsk && !isClean) {
             EditorTabWidget *tabW = static_cast<EditorTabWidget *>
                                     (m_topEditorContainer->widget(openPos.first));
             tabW->setCurrentIndex(openPos.second);
@@ -469,8 +775,13 @@ QPromise<void> DocEngine::loadDocuments(const DocEngine::DocumentLoader& docLoad
         }
 
         QFile file(localFileName);
+        // An open document is reloaded incrementally, keeping its undo history
+        auto readFile = [&]() {
+            return isAlreadyOpen ? this->reload(&file, editor, codec, bom) : this->read(&file, editor, codec, bom);
+        };
         if (file.exists()) {
-            QPromise<void> readResult = this->read(&file, editor, codec, bom).wait(); // FIXME To async!
+            QPromise<void> readResult = readFile();
+            waitFor(readResult);
 
             while (readResult.isRejected()) {
                 // Handle error
@@ -487,7 +798,8 @@ QPromise<void> DocEngine::loadDocuments(const DocEngine::DocumentLoader& docLoad
                     return _break;
                 } else if(ret == QMessageBox::Retry) {
                     // Retry
-                    readResult = this->read(&file, editor, codec, bom).wait(); // FIXME To async!
+                    readResult = readFile();
+                    waitFor(readResult);
                 } else if(ret == QMessageBox::Ignore) {
                     tabWidget->removeTab(tabIndex);
                     return _continue;
@@ -514,7 +826,7 @@ QPromise<void> DocEngine::loadDocuments(const DocEngine::DocumentLoader& docLoad
         // If there was only a new empty tab opened, remove it
         if (tabWidget->count() == 2) {
             auto victim = tabWidget->editor(0);
-            if (victim->filePath().isEmpty() && victim->isClean()) {
+            if (victim->filePath().isEmpty() && waitFor(victim->isCleanP())) {
                 tabWidget->removeTab(0);
                 tabIndex--;
             }
@@ -622,12 +934,17 @@ QPromise<void> DocEngine::loadDocuments(const DocEngine::DocumentLoader& docLoad
         // In case of a reload, save cursor and scroll position
         QPair<int, int> scrollPosition;
         QPair<int, int> cursorPosition;
+        bool isClean = true;
         if (isAlreadyOpen) {
-            scrollPosition = editor->scrollPosition();
-            cursorPosition = editor->cursorPosition();
+            auto scrollPositionP = editor->scrollPositionP();
+            auto cursorPositionP = editor->cursorPositionP();
+            auto isCleanP = editor->isCleanP();
+            scrollPosition = waitFor(scrollPositionP);
+            cursorPosition = waitFor(cursorPositionP);
+            isClean = waitFor(isCleanP);
         }
 
-        if (isAlreadyOpen && reloadAction == DocEngine::ReloadActionAsk && !editor->isClean()) {
+        if (isAlreadyOpen && reloadAction == DocEngine::ReloadActionAsk && !isClean) {
             EditorTabWidget *tabW = static_cast<EditorTabWidget *>
                                     (m_topEditorContainer->widget(openPos.first));
             tabW->setCurrentIndex(openPos.second);
@@ -682,7 +999,7 @@ QPromise<void> DocEngine::loadDocuments(const DocEngine::DocumentLoader& docLoad
         // If there was only a new empty tab opened, remove it
         if (tabWidget->count() == 2) {
             Editor *victim = tabWidget->editor(0);
-            if (victim->filePath().isEmpty() && victim->isClean()) {
+            if (victim->filePath().isEmpty() && waitFor(victim->isCleanP())) {
                 tabWidget->removeTab(0);
                 tabIndex--;
             }
@@ -760,24 +1077,7 @@ bool DocEngine::writeFromString(QIODevice *io, const DecodedText &write)
         return false;
 
     QByteArray data = write.codec->fromUnicode(write.text);
-
-    // Some codecs always put the BOM (e.g. UTF-16BE).
-    // Others don't (e.g. UTF-8) so we have to manually
-    // write it, if the BOM is required.
-    QByteArray manualBom;
-    if (write.bom) {
-        // We can't write the BOM using QTextStream.setGenerateByteOrderMark(),
-        // because we would need to open the QIODevice as Text (QIODevice::Text),
-        // but if we do, QTextStream will replace any newline character with
-        // the OS representation (and we want to be free to use *whatever*
-        // line ending we want).
-        // So we generate the BOM here, and then
-        // we prepend it to the output of our QIODevice.
-
-        if (write.codec->mibEnum() == MIB_UTF_8) { // UTF-8
-            manualBom = getBomForCodec(write.codec);
-        }
-    }
+    QByteArray manualBom = write.bom ? getManualBom(write.codec) : QByteArray();
 
     if (!manualBom.isEmpty() && io->write(manualBom) == -1) {
         io->close();
@@ -794,56 +1094,291 @@ bool DocEngine::writeFromString(QIODevice *io, const DecodedText &write)
     return true;
 }
 
-bool DocEngine::write(QIODevice *io, QSharedPointer<Editor> editor)
+QByteArray DocEngine::getManualBom(QTextCodec *codec)
 {
-    DecodedText info;
-    info.text = editor->value()
-            .replace("\n", editor->endOfLineSequence());
+    // Some codecs always put the BOM (e.g. UTF-16BE).
+    // Others don't (e.g. UTF-8) so we have to manually
+    // write it, if the BOM is required.
+    //
+    // We can't write the BOM using QTextStream.setGenerateByteOrderMark(),
+    // because we would need to open the QIODevice as Text (QIODevice::Text),
+    // but if we do, QTextStream will replace any newline character with
+    // the OS representation (and we want to be free to use *whatever*
+    // line ending we want).
+    // So we generate the BOM here, and then
+    // we prepend it to the output of our QIODevice.
+    if (codec->mibEnum() == MIB_UTF_8) { // UTF-8
+        return getBomForCodec(codec);
+    }
 
-    info.codec = editor->codec();
-    info.bom = editor->bom();
+    return QByteArray();
+}
 
-    return writeFromString(io, info);
+QPromise<DocEngine::WrittenDocument> DocEngine::writeAtomically(const QString &fileName, QSharedPointer<Editor> editor)
+{
+    // No need to read the document again
+    if (editor->isSnapshotCached())
+        return writeSnapshotAtomically(fileName, editor);
+
+    QTextCodec *codec = editor->codec();
+    const QString eol = editor->endOfLineSequence();
+    const bool bom = editor->bom();
+
+    // The document is converted, encoded and written one chunk at a time,
+    // while the editor prepares the next chunk.
+    auto state = std::make_shared<ChunkedWrite>();
+    state->editor = editor;
+    state->endOfLineSequence = eol;
+    state->file = std::make_shared<ChunkedFileWriter>(fileName, codec);
+
+    const std::shared_ptr<ChunkedFileWriter> file = state->file;
+    const QByteArray manualBom = bom ? getManualBom(codec) : QByteArray();
+    state->written = QtPromise::resolve(QtConcurrent::run(ioThreadPool(), [=]() {
+        return file->open(manualBom);
+    })).then([](const QString &error) {
+        return error.isNull() ? QPromise<void>::resolve() : QPromise<void>::reject(error);
+    });
+
+    return writeChunks(state, 0, requestChunk(editor, 0)).then([=](int sequence) {
+        // The document has been modified while we were reading it. Starting over
+        // could go on for as long as the user keeps typing: read it all at once.
+        if (sequence == -1)
+            return writeSnapshotAtomically(fileName, editor);
+
+        WrittenDocument document;
+        document.changeSequence = sequence;
+        document.size = file->size();
+        return QPromise<WrittenDocument>::resolve(document);
+    });
 }
 
-bool DocEngine::write(QUrl outFileName, QSharedPointer<Editor> editor)
+QPromise<DocEngine::WrittenDocument> DocEngine::writeSnapshotAtomically(const QString &fileName, QSharedPointer<Editor> editor)
 {
-    QFile file(outFileName.toLocalFile());
-    bool result = write(&file, editor);
-    file.close();
+    QTextCodec *codec = editor->codec();
+    const QString eol = editor->endOfLineSequence();
+    const bool bom = editor->bom();
+
+    return editor->snapshot().fail([]() {
+        return QPromise<Editor::Snapshot>::reject(editorReadError());
+    }).then([=](const Editor::Snapshot &snapshot) {
+        QFuture<QPair<QString, qint64>> written = QtConcurrent::run(ioThreadPool(), [=]() {
+            const QByteArray data = encodeText(snapshot.text, eol, codec, bom);
+            return qMakePair(writeFileAtomically(fileName, data), static_cast<qint64>(data.size()));
+        });
+
+        return QtPromise::resolve(written).then([=](const QPair<QString, qint64> &result) {
+            if (!result.first.isNull())
+                return QPromise<WrittenDocument>::reject(result.first);
 
-    return result;
+            WrittenDocument document;
+            document.changeSequence = snapshot.changeSequence;
+            document.size = result.second;
+            return QPromise<WrittenDocument>::resolve(document);
+        });
+    });
 }
 
-void DocEngine::reinterpretEncoding(QSharedPointer<Editor> editor, QTextCodec *codec, bool bom)
+QString DocEngine::writeFileAtomically(const QString &fileName, const QByteArray &data)
 {
-    QPair<int, int> scrollPosition = editor->scrollPosition();
-    QPair<int, int> cursorPosition = editor->cursorPosition();
+    // QSaveFile writes to a temporary file in the same directory, then
+    // commit() flushes it to disk and renames it over the target. A crash
+    // in the middle leaves the original untouched. The new file then gets
+    // the permissions and the owner of the original one.
+    const FileOwnership ownership = fileOwnership(fileName);
+    QSaveFile file(fileName);
+
+    // Without write permission on the directory the temporary file
+    // can't be created: overwrite the file in place like we used to.
+    file.setDirectWriteFallback(true);
+
+    if (!file.open(QIODevice::WriteOnly))
+        return file.errorString();
+
+    file.write(data);
+
+    // commit() also fails if any of the writes did
+    if (!file.commit())
+        return file.errorString();
+
+    restoreFileOwnership(fileName, ownership);
+    return QString();
+}
+
+void DocEngine::prefetchDocument(const QString &fileName)
+{
+    const QFileInfo fileInfo(fileName);
+    const QString path = fileInfo.absoluteFilePath();
+
+    {
+        // The document may already be in memory, e.g. retained by retainDocument()
+        QMutexLocker locker(&s_prefetchedDocumentsMutex);
+        auto it = s_prefetchedDocuments.constFind(path);
+        if (it != s_prefetchedDocuments.constEnd() &&
+                it->size == fileInfo.size() && it->lastModified == fileInfo.lastModified())
+            return;
+    }
+
+    PrefetchedDocument document;
+    document.size = fileInfo.size();
+    document.lastModified = fileInfo.lastModified();
+    document.decoded = QtConcurrent::run(ioThreadPool(), [path]() {
+        QFile file(path);
+        return readToString(&file);
+    });
+
+    QMutexLocker locker(&s_prefetchedDocumentsMutex);
+    s_prefetchedDocuments.insert(path, document);
+}
+
+void DocEngine::retainDocument(const QString &fileName, const DecodedText &decoded)
+{
+    const QFileInfo fileInfo(fileName);
+
+    PrefetchedDocument document;
+    document.size = fileInfo.size();
+    document.lastModified = fileInfo.lastModified();
+
+    QFutureInterface<DecodedText> result;
+    result.reportStarted();
+    result.reportFinished(&decoded);
+    document.decoded = result.future();
+
+    QMutexLocker locker(&s_prefetchedDocumentsMutex);
+    s_prefetchedDocuments.insert(fileInfo.absoluteFilePath(), document);
+}
+
+void DocEngine::discardPrefetchedDocument(const QString &fileName)
+{
+    QMutexLocker locker(&s_prefetchedDocumentsMutex);
+    s_prefetchedDocuments.remove(QFileInfo(fileName).absoluteFilePath());
+}
+
+QThreadPool* DocEngine::ioThreadPool()
+{
+    static QThreadPool pool;
+    return &pool;
+}
+
+QByteArray DocEngine::encodeText(QString text, const QString &endOfLineSequence, QTextCodec *codec, bool bom)
+{
+    if (endOfLineSequence != "\n")
+        text.replace("\n", endOfLineSequence);
+
+    QByteArray data = bom ? getManualBom(codec) : QByteArray();
+    data.append(codec->fromUnicode(text));
+    return data;
+}
+
+QPromise<QStringList> DocEngine::saveDocumentsInBackground(const QList<QSharedPointer<Editor>> &editors)
+{
+    QVector<QPromise<QString>> results;
+
+    for (const QSharedPointer<Editor> &editor : editors) {
+        const QString fileName = editor->filePath().toLocalFile();
+        const QString eol = editor->endOfLineSequence();
+        QTextCodec *codec = editor->codec();
+        const bool bom = editor->bom();
+
+        unmonitorDocument(editor);
+        if (EditorTabWidget *tabW = m_topEditorContainer->tabWidgetFromEditor(editor))
+            tabW->setSavingIcon(tabW->indexOf(editor.data()));
+
+        // Called once the document has been written, or couldn't be. Returns the
+        // error to report, if any.
+        auto finish = [=](const QString &error, const WrittenDocument &written) {
+            EditorTabWidget *tabWidget = m_topEditorContainer->tabWidgetFromEditor(editor);
+
+            // The tab may have been closed meanwhile: the editor belongs to nobody anymore
+            if (tabWidget == nullptr)
+                return error.isNull() ? QString() : QString("%1: %2").arg(fileName, error);
 
+            const int tab = tabWidget->indexOf(editor.data());
+
+            if (error.isNull()) {
+                editor->markClean(written.changeSequence);
+                editor->setFileOnDiskChanged(false);
+
+                if (m_followedDocuments.contains(editor.data()))
+                    resetFollowState(editor, written.size);
+            }
+
+            tabWidget->setSavedIcon(tab, error.isNull());
+            monitorDocument(editor);
+
+            if (!error.isNull())
+                return QString("%1: %2").arg(fileName, error);
+
+            emit documentSaved(tabWidget, tab);
+            return QString();
+        };
+
+        // All the requests are sent right away: the editors answer while
+        // the first documents are already being written.
+        QPromise<QString> result = editor->snapshot().then([=](const Editor::Snapshot &snapshot) {
+            const QString text = snapshot.text;
+            const int sequence = snapshot.changeSequence;
+
+            QFuture<QPair<QString, qint64>> written = QtConcurrent::run(ioThreadPool(), [=]() {
+                const QByteArray data = encodeText(text, eol, codec, bom);
+                return qMakePair(writeFileAtomically(fileName, data), static_cast<qint64>(data.size()));
+            });
+
+            return QtPromise::resolve(written).then([=](const QPair<QString, qint64> &result) {
+                WrittenDocument document;
+                document.changeSequence = sequence;
+                document.size = result.second;
+                return finish(result.first, document);
+            });
+        }).fail([=]() {
+            // Don't leave the tab looking like it's still being saved
+            return finish(tr("The document could not be saved."), WrittenDocument());
+        });
+
+        results.append(result);
+    }
+
+    return QtPromise::all(results).then([](const QVector<QString> &errors) {
+        QStringList failed;
+        for (const QString &error : errors) {
+            if (!error.isNull())
+                failed.append(error);
+        }
+        return failed;
+    });
+}
+
+QPromise<void> DocEngine::reinterpretEncoding(QSharedPointer<Editor> editor, QTextCodec *codec, bool bom)
+{
     QTextCodec *oldCodec = editor->codec();
-    QByteArray data = oldCodec->fromUnicode(editor->value());
-    editor->setValue(codec->toUnicode(data));
     editor->setCodec(codec);
     editor->setBom(bom);
 
-    editor->setScrollPosition(scrollPosition);
-    editor->setCursorPosition(cursorPosition);
+    auto scrollPositionP = editor->scrollPositionP();
+    auto cursorPositionP = editor->cursorPositionP();
+
+    return editor->valueP().then([=](const QString &value){
+        QByteArray data = oldCodec->fromUnicode(value);
+        editor->setValue(codec->toUnicode(data));
+
+        return QtPromise::all(QVector<QPromise<QPair<int, int>>>{scrollPositionP, cursorPositionP});
+    }).then([editor](const QVector<QPair<int, int>> &positions){
+        editor->setScrollPosition(positions[0]);
+        editor->setCursorPosition(positions[1]);
+    });
 }
 
 void DocEngine::monitorDocument(const QString &fileName)
 {
-    if(m_fsWatcher &&
-            !fileName.isEmpty() &&
-            !m_fsWatcher->files().contains(fileName)) {
-
-        m_fsWatcher->addPath(fileName);
+    if (!fileName.isEmpty() && !m_monitoredFiles.contains(fileName)) {
+        m_monitoredFiles.insert(fileName);
+        FileMonitor::getInstance().addFile(fileName);
     }
 }
 
 void DocEngine::unmonitorDocument(const QString &fileName)
 {
-    if(m_fsWatcher && !fileName.isEmpty()) {
-        m_fsWatcher->removePath(fileName);
+    if (m_monitoredFiles.remove(fileName)) {
+        FileMonitor::getInstance().removeFile(fileName);
     }
 }
 
@@ -874,41 +1409,91 @@ QString DocEngine::getAvailableSudoProgram() const
     return sudoProgram;
 }
 
-bool DocEngine::trySudoSave(QString sudoProgram, QUrl outFileName, QSharedPointer<Editor> editor)
+QPromise<DocEngine::WrittenDocument> DocEngine::trySudoSave(QString sudoProgram, QUrl outFileName, QSharedPointer<Editor> editor)
 {
     if(sudoProgram.isEmpty())
-        return false;
+        return QPromise<WrittenDocument>::reject(tr("No graphical sudo program is available."));
 
     QString filePath = PersistentCache::createValidCacheName(
                 PersistentCache::cacheDirPath(),
                 outFileName.fileName() )
             .toLocalFile();
 
-    QFile file(filePath);
-    if (!write(&file, editor))
-        return false;
+    return writeAtomically(filePath, editor).then([=](const WrittenDocument &written) {
+        QString sudoBinaryName = QFileInfo(sudoProgram).baseName();
+        QStringList arguments;
+        if (sudoBinaryName == "kdesu") {
+            arguments = QStringList({"--noignorebutton", "-n", "-c"});
+        } else if (sudoBinaryName == "gksu") {
+            arguments = QStringList({"-S",
+                "-m",
+                tr("Notepadqq asks permission to overwrite the following file:\n\n%1").arg(outFileName.toLocalFile())});
+        }
+        arguments.append({"cp", filePath, outFileName.toLocalFile()});
+
+        // The user might take a while to type the password: the UI keeps running meanwhile
+        return QPromise<WrittenDocument>([=](const QPromiseResolve<WrittenDocument>& resolve,
+                                             const QPromiseReject<WrittenDocument>& reject) {
+            QProcess *p = new QProcess(this);
+
+            connect(p, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+                    this, [=](int exitCode, QProcess::ExitStatus exitStatus) {
+                QFile::remove(filePath);
+                p->deleteLater();
+
+                if (exitStatus == QProcess::NormalExit && exitCode == 0)
+                    resolve(written);
+                else
+                    reject(tr("%1 could not overwrite the file.").arg(sudoBinaryName));
+            });
 
-    QString sudoBinaryName = QFileInfo(sudoProgram).baseName();
-    QStringList arguments;
-    if (sudoBinaryName == "kdesu") {
-        arguments = QStringList({"--noignorebutton", "-n", "-c"});
-    } else if (sudoBinaryName == "gksu") {
-        arguments = QStringList({"-S",
-            "-m",
-            tr("Notepadqq asks permission to overwrite the following file:\n\n%1").arg(outFileName.toLocalFile())});
-    }
-    arguments.append({"cp", filePath, outFileName.toLocalFile()});
+            connect(p, static_cast<void (QProcess::*)(QProcess::ProcessError)>(&QProcess::error),
+                    this, [=](QProcess::ProcessError error) {
+                // Otherwise finished() follows
+                if (error != QProcess::FailedToStart)
+                    return;
 
-    QProcess p;
-    p.start(sudoProgram, arguments);
+                QFile::remove(filePath);
+                p->deleteLater();
+                reject(p->errorString());
+            });
 
-    p.waitForFinished(-1);
-    file.remove();
+            p->start(sudoProgram, arguments);
+        });
+    });
+}
+
+QPromise<DocEngine::WrittenDocument> DocEngine::writeOrAskToRetry(const QUrl &outFileName, QSharedPointer<Editor> editor,
+                                                                   const QPromise<WrittenDocument> &written)
+{
+    return written.fail([=](const QString &error) {
+        const QString fileName = outFileName.toLocalFile();
+        const QString sudoProgram = getAvailableSudoProgram();
 
-    return p.exitCode() == 0;
+        // Handle error
+        QMessageBox msgBox;
+        msgBox.setWindowTitle(QCoreApplication::applicationName());
+        msgBox.setText(tr("Error trying to write to \"%1\"").arg(fileName));
+        msgBox.setDetailedText(error);
+        msgBox.addButton(tr("Abort"), QMessageBox::RejectRole);
+        auto retry = msgBox.addButton(tr("Retry"), QMessageBox::AcceptRole);
+        auto retryRoot = sudoProgram.isEmpty() ?
+                    nullptr : msgBox.addButton(tr("Retry as Root"), QMessageBox::AcceptRole);
+
+        msgBox.exec();
+        auto clicked = msgBox.clickedButton();
+
+        if (clicked == retry) {
+            return writeOrAskToRetry(outFileName, editor, writeAtomically(fileName, editor));
+        } else if (retryRoot != nullptr && clicked == retryRoot) {
+            return writeOrAskToRetry(outFileName, editor, trySudoSave(sudoProgram, outFileName, editor));
+        }
+
+        return QPromise<WrittenDocument>::reject(DocEngine::saveFileResult_Canceled);
+    });
 }
 
-int DocEngine::saveDocument(EditorTabWidget *tabWidget, int tab, QUrl outFileName, bool copy)
+QPromise<int> DocEngine::saveDocument(EditorTabWidget *tabWidget, int tab, QUrl outFileName, bool copy)
 {
     QSharedPointer<Editor> editor = tabWidget->editor(tab);
 
@@ -918,44 +1503,27 @@ int DocEngine::saveDocument(EditorTabWidget *tabWidget, int tab, QUrl outFileNam
     if (outFileName.isEmpty())
         outFileName = editor->filePath();
 
-    if (outFileName.isLocalFile()) {
-        QFile file(outFileName.toLocalFile());
+    if (!outFileName.isLocalFile()) {
+        // FIXME ERROR
+        QMessageBox msgBox;
+        msgBox.setWindowTitle(QCoreApplication::applicationName());
+        msgBox.setText(tr("Protocol not supported for file \"%1\".").arg(outFileName.toDisplayString()));
+        msgBox.exec();
 
-        do
-        {
-            if (write(&file, editor)) {
-                break;
-            } else {
-                QString sudoProgram = getAvailableSudoProgram();
+        return QPromise<int>::resolve(DocEngine::saveFileResult_Canceled);
+    }
 
-                // Handle error
-                QMessageBox msgBox;
-                msgBox.setWindowTitle(QCoreApplication::applicationName());
-                msgBox.setText(tr("Error trying to write to \"%1\"").arg(file.fileName()));
-                msgBox.setDetailedText(file.errorString());
-                auto abort = msgBox.addButton(tr("Abort"), QMessageBox::RejectRole);
-                auto retry = msgBox.addButton(tr("Retry"), QMessageBox::AcceptRole);
-                auto retryRoot = sudoProgram.isEmpty() ?
-                            nullptr : msgBox.addButton(tr("Retry as Root"), QMessageBox::AcceptRole);
-
-                msgBox.exec();
-                auto clicked = msgBox.clickedButton();
-
-                if (clicked == abort) {
-                   monitorDocument(editor);
-                   return DocEngine::saveFileResult_Canceled;
-                } else if (clicked == retry) {
-                    continue;
-                } else if (clicked == retryRoot) {
-                    if (trySudoSave(sudoProgram, outFileName, editor))
-                        break;
-                    else {
-                        continue;
-                    }
-                }
-            }
+    const QString fileName = outFileName.toLocalFile();
 
-        } while (1);
+    // Show that the document is being saved: the UI keeps running meanwhile
+    const QIcon oldIcon = tabWidget->tabIcon(tab);
+    tabWidget->setSavingIcon(tab);
+
+    return writeOrAskToRetry(outFileName, editor, writeAtomically(fileName, editor)).then([=](const WrittenDocument &written) {
+        // Tabs might have been moved or closed while saving
+        EditorTabWidget *savedTabWidget = m_topEditorContainer->tabWidgetFromEditor(editor);
+        if (savedTabWidget == nullptr)
+            return static_cast<int>(DocEngine::saveFileResult_Saved);
 
         // Update the file name if necessary.
         if (!copy) {
@@ -963,11 +1531,15 @@ int DocEngine::saveDocument(EditorTabWidget *tabWidget, int tab, QUrl outFileNam
                 editor->setFilePath(outFileName);
                 editor->setLanguageFromFilePath();
             }
-            editor->markClean();
+            // If the user typed something while we were writing, it stays dirty
+            editor->markClean(written.changeSequence);
             editor->setFileOnDiskChanged(false);
+
+            if (m_followedDocuments.contains(editor.data()))
+                resetFollowState(editor, written.size);
         }
 
-        file.close();
+        restoreTabIcon(savedTabWidget, editor, copy ? oldIcon : IconProvider::fromTheme("document-saved"));
 
 #ifdef Q_OS_MACX
         // On macOS we need to give it a little bit of time, otherwise we get the
@@ -977,25 +1549,35 @@ int DocEngine::saveDocument(EditorTabWidget *tabWidget, int tab, QUrl outFileNam
         monitorDocument(editor);
 #endif
 
-        if (!copy) {
-            emit documentSaved(tabWidget, tab);
+        const int savedTab = savedTabWidget->indexOf(editor.data());
+        if (!copy && savedTab != -1) {
+            emit documentSaved(savedTabWidget, savedTab);
         }
 
-        return DocEngine::saveFileResult_Saved;
+        return static_cast<int>(DocEngine::saveFileResult_Saved);
+    }).fail([=]() {
+        if (EditorTabWidget *savedTabWidget = m_topEditorContainer->tabWidgetFromEditor(editor)) {
+            restoreTabIcon(savedTabWidget, editor, oldIcon);
+            monitorDocument(editor);
+        }
 
-    } else {
-        // FIXME ERROR
-        QMessageBox msgBox;
-        msgBox.setWindowTitle(QCoreApplication::applicationName());
-        msgBox.setText(tr("Protocol not supported for file \"%1\".").arg(outFileName.toDisplayString()));
-        msgBox.exec();
+        return static_cast<int>(DocEngine::saveFileResult_Canceled);
+    });
+}
 
-        return DocEngine::saveFileResult_Canceled;
-    }
+void DocEngine::restoreTabIcon(EditorTabWidget *tabWidget, QSharedPointer<Editor> editor, const QIcon &icon)
+{
+    const int tab = tabWidget->indexOf(editor.data());
+    if (tab != -1)
+        tabWidget->setTabIcon(tab, icon);
 }
 
 void DocEngine::documentChanged(QString fileName)
 {
+    // The FileMonitor notifies every DocEngine
+    if (!m_monitoredFiles.contains(fileName))
+        return;
+
     unmonitorDocument(fileName);
 
     QPair<int, int> pos = findOpenEditorByUrl(QUrl::fromLocalFile(fileName));
@@ -1003,6 +1585,9 @@ void DocEngine::documentChanged(QString fileName)
         QFile file(fileName);
         EditorTabWidget *tabWidget = m_topEditorContainer->tabWidget(pos.first);
 
+        if (followDocument(tabWidget, pos.second))
+            return;
+
         auto editor = tabWidget->editor(pos.second);
         editor->markDirty();
         editor->setFileOnDiskChanged(true);
@@ -1014,11 +1599,18 @@ void DocEngine::closeDocument(EditorTabWidget *tabWidget, int tab)
 {
     auto editor = tabWidget->editor(tab);
     unmonitorDocument(editor);
+    m_followedDocuments.remove(editor.data());
+
+    // The journal and the backup know the editor by its address, which the next tab may reuse
+    BackupService::forgetEditor(editor.data());
 
     // Disconnect ALL slots ever connected to this editor's signals, also outside of this class
     editor->disconnect();
 
     tabWidget->removeTab(tab);
+
+    // Loading a new editor is expensive: keep this one for the next tab
+    EditorPool::getInstance().recycle(editor);
 }
 
 void DocEngine::monitorDocument(Editor *editor)
@@ -1043,10 +1635,152 @@ void DocEngine::unmonitorDocument(QSharedPointer<Editor> editor)
 
 bool DocEngine::isMonitored(Editor *editor)
 {
-    return m_fsWatcher->files().contains(editor->filePath().toLocalFile());
+    return m_monitoredFiles.contains(editor->filePath().toLocalFile());
+}
+
+void DocEngine::setFollowed(EditorTabWidget *tabWidget, int tab, bool follow)
+{
+    auto editor = tabWidget->editor(tab);
+
+    if (!follow) {
+        m_followedDocuments.remove(editor.data());
+        return;
+    }
+
+    if (!editor->filePath().isLocalFile() || m_followedDocuments.contains(editor.data()))
+        return;
+
+    m_followedDocuments.insert(editor.data(), FileFollower());
+
+    if (editor->fileOnDiskChanged()) {
+        // The editor is out of sync with the file: reload it first.
+        // reload() then starts following from the end of the file.
+        getDocumentLoader()
+                .setUrl(editor->filePath())
+                .setTabWidget(tabWidget)
+                .setTextCodec(editor->codec())
+                .setBOM(editor->bom())
+                .setReloadAction(ReloadActionDo)
+                .execute();
+    } else {
+        // The editor is in sync with the file: it holds all of its bytes
+        resetFollowState(editor, QFileInfo(editor->filePath().toLocalFile()).size());
+        monitorDocument(editor);
+    }
+}
+
+bool DocEngine::isFollowed(Editor *editor) const
+{
+    return m_followedDocuments.contains(editor);
 }
 
-DocEngine::DecodedText DocEngine::decodeText(const QByteArray &contents)
+void DocEngine::resetFollowState(QSharedPointer<Editor> editor, qint64 offset)
+{
+    m_followedDocuments[editor.data()] = FileFollower(editor->codec(), offset);
+}
+
+bool DocEngine::followDocument(EditorTabWidget *tabWidget, int tab)
+{
+    auto editor = tabWidget->editor(tab);
+
+    auto it = m_followedDocuments.find(editor.data());
+    if (it == m_followedDocuments.end())
+        return false;
+
+    QFile file(editor->filePath().toLocalFile());
+    if (!file.exists()) {
+        m_followedDocuments.erase(it);
+        return false;
+    }
+
+    FileFollower &follower = it.value();
+
+    if (follower.isTruncated(file.size())) {
+        // Truncated (e.g. a rotated log): the editor content can't be trusted anymore.
+        getDocumentLoader()
+                .setUrl(editor->filePath())
+                .setTabWidget(tabWidget)
+                .setTextCodec(editor->codec())
+                .setBOM(editor->bom())
+                .setReloadAction(ReloadActionDo)
+                .execute();
+        return true;
+    }
+
+    if (!file.open(QFile::ReadOnly) || !file.seek(follower.offset())) {
+        m_followedDocuments.erase(it);
+        return false;
+    }
+
+    const QString text = follower.append(file.readAll());
+    file.close();
+
+    monitorDocument(editor);
+
+    if (text.isEmpty())
+        return true;
+
+    editor->isCleanP().then([=](bool wasClean){
+        return editor->asyncSendMessageWithResultP("C_CMD_APPEND_TEXT", text).then([=](){
+            // Don't hide the user's own unsaved changes
+            if (wasClean)
+                return editor->asyncSendMessageWithResultP("C_CMD_MARK_CLEAN");
+            return QPromise<QVariant>::resolve(QVariant());
+        });
+    });
+
+    return true;
+}
+
+bool DocEngine::isValidUtf8(const char *data, int size)
+{
+    const auto *bytes = reinterpret_cast<const unsigned char *>(data);
+    int i = 0;
+
+    while (i < size) {
+        // Skip whole runs of ASCII characters at once
+        i += asciiPrefixLength(data + i, size - i);
+        if (i >= size)
+            break;
+
+        // Determine the sequence length and the valid range of the second
+        // byte. The narrower ranges reject overlong encodings, UTF-16
+        // surrogates and code points above U+10FFFF.
+        const unsigned char lead = bytes[i];
+        unsigned char min = 0x80;
+        unsigned char max = 0xBF;
+        int length;
+        if (lead >= 0xC2 && lead <= 0xDF) {
+            length = 2;
+        } else if (lead >= 0xE0 && lead <= 0xEF) {
+            length = 3;
+            if (lead == 0xE0) min = 0xA0;
+            else if (lead == 0xED) max = 0x9F;
+        } else if (lead >= 0xF0 && lead <= 0xF4) {
+            length = 4;
+            if (lead == 0xF0) min = 0x90;
+            else if (lead == 0xF4) max = 0x8F;
+        } else {
+            return false;
+        }
+
+        for (int k = 1; k < length; k++) {
+            if (i + k >= size)
+                return true; // Sequence cut by the end of the buffer
+
+            const unsigned char c = bytes[i + k];
+            const bool valid = (k == 1) ? (c >= min && c <= max) : ((c & 0xC0) == 0x80);
+            if (!valid)
+                return false;
+        }
+
+        i += length;
+    }
+
+    return true;
+}
+
+DocEngine::DecodedText DocEngine::decodeText(const QByteArray &contents, const QString &directory)
 {
     // Search for a BOM mark
     QTextCodec *bomCodec = QTextCodec::codecForUtfText(contents, nullptr);
@@ -1054,17 +1788,44 @@ DocEngine::DecodedText DocEngine::decodeText(const QByteArray &contents)
         return decodeText(contents, bomCodec, true);
     }
 
-    QTextCodec* codec = nullptr;
+    const int detectionSize = std::min(contents.size(), ENCODING_DETECTION_SIZE);
 
-    // Limit decoding to the first 64 kilobytes
-    size_t detectionSize = static_cast<size_t>(std::min(contents.size(), 65536));
+    DecodedText bestDecodedText;
+    bestDecodedText.bom = false;
+
+    // Fast path: the vast majority of files are ASCII or UTF-8, which can be
+    // validated much faster than uchardet can guess an encoding.
+    // Note that ASCII is reported as UTF-8 on purpose, see issue #904.
+    if (isValidUtf8(contents.constData(), detectionSize)) {
+        QTextCodec *utf8 = QTextCodec::codecForMib(MIB_UTF_8);
+        QTextCodec::ConverterState state;
+        bestDecodedText.text = utf8->toUnicode(contents.constData(), contents.size(), &state);
+
+        // Invalid sequences past the detection prefix are handed to uchardet like before.
+        if (state.invalidChars == 0 && state.remainingChars == 0) {
+            bestDecodedText.codec = utf8;
+            return bestDecodedText;
+        }
+    }
+
+    // Files of the same directory usually share their encoding: if the one
+    // detected last time fits this file, skip uchardet.
+    if (!directory.isEmpty()) {
+        QTextCodec *remembered = EncodingMemo::decode(directory, contents, detectionSize, bestDecodedText.text);
+        if (remembered) {
+            bestDecodedText.codec = remembered;
+            return bestDecodedText;
+        }
+    }
+
+    QTextCodec* codec = nullptr;
 
     // Use uchardet to try and detect file encoding if no BOM was found
-    uchardet_t encodingDetector = uchardet_new();
-    if (uchardet_handle_data(encodingDetector, contents.data(), detectionSize) == 0) {
-        uchardet_data_end(encodingDetector);
-        codec = QTextCodec::codecForName(uchardet_get_charset(encodingDetector));
-        uchardet_delete(encodingDetector);
+    static thread_local EncodingDetector detector;
+    uchardet_reset(detector.handle);
+    if (uchardet_handle_data(detector.handle, contents.data(), static_cast<size_t>(detectionSize)) == 0) {
+        uchardet_data_end(detector.handle);
+        codec = QTextCodec::codecForName(uchardet_get_charset(detector.handle));
     }
 
     // Fallback to UTF-8 if for some reason uchardet fails
@@ -1081,10 +1842,11 @@ DocEngine::DecodedText DocEngine::decodeText(const QByteArray &contents)
         codec = QTextCodec::codecForName("UTF-8");
     }
 
-    DecodedText bestDecodedText;
+    if (!directory.isEmpty())
+        EncodingMemo::remember(directory, codec);
+
     bestDecodedText.codec = codec;
     bestDecodedText.text = codec->toUnicode(contents);
-    bestDecodedText.bom = false;
 
     return bestDecodedText;
 }
@@ -3,6 +3,7 @@
 #include "include/iconprovider.h"
 
 #include <QApplication>
+#include <QDateTime>
 #include <QFileInfo>
 #include <QTabBar>
 
@@ -50,6 +51,11 @@ int EditorTabWidget::addEditorTab(bool setFocus, const QString &title)
     return this->rawAddEditorTab(setFocus, title, 0, 0);
 }
 
+int EditorTabWidget::addDeferredEditorTab(const QString &title)
+{
+    return this->rawAddEditorTab(false, title, 0, 0, true);
+}
+
 void EditorTabWidget::connectEditorSignals(Editor *editor)
 {
     connect(editor, &Editor::cleanChanged,
@@ -126,7 +132,8 @@ int EditorTabWidget::transferEditorTab(bool setFocus, EditorTabWidget *source, i
  *        tab gets moved to another container. Use connectEditorSignals()
  *        and disconnectEditorSignals() methods instead.
  */
-int EditorTabWidget::rawAddEditorTab(const bool setFocus, const QString &title, EditorTabWidget *source, const int sourceTabIndex)
+int EditorTabWidget::rawAddEditorTab(const bool setFocus, const QString &title, EditorTabWidget *source, const int sourceTabIndex,
+                                     const bool deferred)
 {
 #ifdef QT_DEBUG
     QElapsedTimer __aet_timer;
@@ -144,7 +151,7 @@ int EditorTabWidget::rawAddEditorTab(const bool setFocus, const QString &title,
     QString oldTooltip;
 
     if (create) {
-        editor = Editor::getNewEditor(this);
+        editor = deferred ? Editor::getDeferredEditor(this) : Editor::getNewEditor(this);
     } else {
         editor = source->editor(sourceTabIndex);
 
@@ -290,6 +297,11 @@ void EditorTabWidget::setSavedIcon(int index, bool saved)
         this->setTabIcon(index, IconProvider::fromTheme("document-unsaved"));
 }
 
+void EditorTabWidget::setSavingIcon(int index)
+{
+    this->setTabIcon(index, IconProvider::fromTheme("document-save"));
+}
+
 void EditorTabWidget::setTabBarHidden(bool yes)
 {
     tabBar()->setHidden(yes);
@@ -379,4 +391,7 @@ void EditorTabWidget::on_currentTabChanged(int index)
         m_formerTabIndex = m_mostRecentTabIndex;
         m_mostRecentTabIndex = index;
     }
+
+    if (index >= 0)
+        editor(index)->setLastActivated(QDateTime::currentMSecsSinceEpoch());
 }
@@ -0,0 +1,108 @@
+#include "include/encodingmemo.h"
+
+#include "include/notepadqq.h"
+
+#include <QHash>
+#include <QMutex>
+
+#include <algorithm>
+
+namespace {
+    const int MAX_REMEMBERED_DIRECTORIES = 256;
+
+    // A larger share of bytes that aren't ASCII rather means another
+    // encoding, e.g. a multi-byte one, or a binary file.
+    const int MAX_HIGH_BYTES_PERCENT = 25;
+
+    QMutex s_mutex;
+    QHash<QString, QByteArray> s_directoryEncoding;
+}
+
+QTextCodec* EncodingMemo::codecForDirectory(const QString& directory)
+{
+    QByteArray name;
+    {
+        QMutexLocker locker(&s_mutex);
+        name = s_directoryEncoding.value(directory);
+    }
+
+    return name.isEmpty() ? nullptr : QTextCodec::codecForName(name);
+}
+
+QTextCodec* EncodingMemo::decode(const QString& directory, const QByteArray& contents, int detectionSize,
+                                 QString& outText)
+{
+    QTextCodec *codec = codecForDirectory(directory);
+    if (codec == nullptr)
+        return nullptr;
+
+    QTextCodec::ConverterState state;
+    outText = codec->toUnicode(contents.constData(), contents.size(), &state);
+
+    if (canRejectInput(codec))
+        return state.invalidChars == 0 ? codec : nullptr;
+
+    return looksLikeSingleByteText(contents, detectionSize, outText) ? codec : nullptr;
+}
+
+void EncodingMemo::remember(const QString& directory, QTextCodec* codec)
+{
+    // UTF-16BE, UTF-16LE, UTF-16, UTF-32, UTF-32BE and UTF-32LE
+    bool worthRemembering = codec->mibEnum() != MIB_UTF_8;
+    switch (codec->mibEnum()) {
+    case 1013: case 1014: case 1015: case 1017: case 1018: case 1019:
+        worthRemembering = false;
+    }
+
+    QMutexLocker locker(&s_mutex);
+    if (!worthRemembering) {
+        s_directoryEncoding.remove(directory);
+        return;
+    }
+
+    if (s_directoryEncoding.size() >= MAX_REMEMBERED_DIRECTORIES)
+        s_directoryEncoding.clear();
+    s_directoryEncoding.insert(directory, codec->name());
+}
+
+bool EncodingMemo::canRejectInput(QTextCodec* codec)
+{
+    // UTF-16BE, UTF-16LE, UTF-16, UTF-32, UTF-32BE and UTF-32LE
+    switch (codec->mibEnum()) {
+    case 1013: case 1014: case 1015: case 1017: case 1018: case 1019:
+        return false;
+    }
+
+    static const QByteArray highBytes = []() {
+        QByteArray bytes;
+        for (int b = 0x80; b <= 0xFF; b++)
+            bytes.append(static_cast<char>(b));
+        return bytes;
+    }();
+
+    QTextCodec::ConverterState state;
+    const QString text = codec->toUnicode(highBytes.constData(), highBytes.size(), &state);
+
+    return state.invalidChars > 0 || state.remainingChars > 0 || text.size() != highBytes.size();
+}
+
+bool EncodingMemo::looksLikeSingleByteText(const QByteArray& contents, int detectionSize, const QString& text)
+{
+    const int size = std::min(detectionSize, contents.size());
+
+    int highBytes = 0;
+    for (int i = 0; i < size; i++) {
+        if (static_cast<uchar>(contents[i]) >= 0x80)
+            highBytes++;
+    }
+
+    if (highBytes * 100 > size * MAX_HIGH_BYTES_PERCENT)
+        return false;
+
+    for (const QChar c : text) {
+        if ((c.unicode() >= 0x80 && c.unicode() <= 0x9F) || c == QChar::ReplacementCharacter)
+            return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,24 @@
+#include "include/filefollower.h"
+
+FileFollower::FileFollower(QTextCodec *codec, qint64 offset) :
+    m_offset(offset),
+    m_decoder(codec->makeDecoder(QTextCodec::IgnoreHeader))
+{
+}
+
+QString FileFollower::append(const QByteArray &data)
+{
+    m_offset += data.size();
+
+    QString text = m_decoder->toUnicode(data);
+    if (m_pendingCarriageReturn)
+        text.prepend('\r');
+
+    // A \r at the end might be the first half of a \r\n
+    m_pendingCarriageReturn = text.endsWith('\r');
+    if (m_pendingCarriageReturn)
+        text.chop(1);
+
+    // The editor always uses \n internally
+    return text.replace("\r\n", "\n").replace('\r', '\n');
+}
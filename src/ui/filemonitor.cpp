@@ -0,0 +1,314 @@
+#include "include/filemonitor.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+
+#ifdef Q_OS_LINUX
+#include <QSocketNotifier>
+
+#include <cerrno>
+#include <cstring>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+#ifdef Q_OS_LINUX
+// Events of a directory watch that can mean that one of its files changed.
+// The file name is reported along with the event.
+constexpr uint32_t DIRECTORY_EVENTS = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE |
+                                      IN_MOVED_FROM | IN_MOVED_TO |
+                                      IN_CREATE | IN_DELETE |
+                                      IN_DELETE_SELF | IN_MOVE_SELF;
+
+// Events of a file that surely mean that its content changed
+constexpr uint32_t CONTENT_EVENTS = IN_MODIFY | IN_CLOSE_WRITE |
+                                    IN_MOVED_FROM | IN_MOVED_TO |
+                                    IN_CREATE | IN_DELETE;
+#endif
+
+} // namespace
+
+bool FileMonitor::FileStamp::operator==(const FileStamp &other) const
+{
+    return exists == other.exists &&
+           size == other.size &&
+           lastModified == other.lastModified;
+}
+
+FileMonitor& FileMonitor::getInstance()
+{
+    // Owned by the application, so that its timer and notifier don't outlive it
+    static FileMonitor *monitor = new FileMonitor(QCoreApplication::instance());
+    return *monitor;
+}
+
+FileMonitor::FileMonitor(QObject *parent)
+    : QObject(parent)
+{
+    m_debounceTimer.setSingleShot(true);
+    m_debounceTimer.setInterval(DEBOUNCE_INTERVAL);
+    connect(&m_debounceTimer, &QTimer::timeout, this, &FileMonitor::checkPendingFiles);
+
+#ifdef Q_OS_LINUX
+    m_inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotifyFd >= 0) {
+        m_inotifyNotifier = new QSocketNotifier(m_inotifyFd, QSocketNotifier::Read, this);
+        connect(m_inotifyNotifier, &QSocketNotifier::activated, this, &FileMonitor::readInotifyEvents);
+    } else {
+        qWarning() << "FileMonitor: inotify is not available:" << strerror(errno);
+    }
+#endif
+}
+
+FileMonitor::~FileMonitor()
+{
+#ifdef Q_OS_LINUX
+    if (m_inotifyFd >= 0) {
+        delete m_inotifyNotifier;
+        close(m_inotifyFd);
+    }
+#endif
+}
+
+FileMonitor::FileStamp FileMonitor::stampOf(const QString &filePath)
+{
+    FileStamp stamp;
+    QFileInfo fi(filePath);
+
+    stamp.exists = fi.exists();
+    if (stamp.exists) {
+        stamp.size = fi.size();
+        stamp.lastModified = fi.lastModified();
+    }
+
+    return stamp;
+}
+
+void FileMonitor::addFile(const QString &filePath)
+{
+    if (filePath.isEmpty())
+        return;
+
+    // The other references may not have been notified of a pending change yet:
+    // only the first one sets the reference state.
+    auto it = m_files.find(filePath);
+    if (it != m_files.end()) {
+        it.value().refCount++;
+        return;
+    }
+
+    // Drop the events still queued for the file, e.g. the ones of the save that
+    // it's added back after: they happened before the reference state.
+    readInotifyEvents();
+
+    WatchedFile &file = m_files[filePath];
+    file.refCount = 1;
+    file.stamp = stampOf(filePath);
+
+    QFileInfo fi(filePath);
+    const QString directory = fi.absolutePath();
+
+    if (watchDirectory(directory))
+        m_directories[directory].insert(fi.fileName(), filePath);
+    else
+        watchWithFallback(filePath);
+}
+
+void FileMonitor::removeFile(const QString &filePath)
+{
+    auto it = m_files.find(filePath);
+    if (it == m_files.end())
+        return;
+
+    if (--it.value().refCount > 0)
+        return;
+
+    m_files.erase(it);
+    m_pendingFiles.remove(filePath);
+
+    if (m_fallbackFiles.remove(filePath)) {
+        m_fsWatcher->removePath(filePath);
+        return;
+    }
+
+    QFileInfo fi(filePath);
+    const QString directory = fi.absolutePath();
+    auto dir = m_directories.find(directory);
+    if (dir == m_directories.end())
+        return;
+
+    dir.value().remove(fi.fileName());
+    if (dir.value().isEmpty()) {
+        m_directories.erase(dir);
+        unwatchDirectory(directory);
+    }
+}
+
+bool FileMonitor::isWatched(const QString &filePath) const
+{
+    return m_files.contains(filePath);
+}
+
+bool FileMonitor::watchDirectory(const QString &directory)
+{
+#ifdef Q_OS_LINUX
+    if (m_directoryWatches.contains(directory))
+        return true;
+
+    if (m_inotifyFd < 0)
+        return false;
+
+    const int wd = inotify_add_watch(m_inotifyFd, QFile::encodeName(directory).constData(), DIRECTORY_EVENTS);
+    if (wd < 0) {
+        // E.g. ENOSPC: the limit of inotify watches has been reached
+        qWarning() << "FileMonitor: can't watch" << directory << ":" << strerror(errno);
+        return false;
+    }
+
+    m_watchDescriptors.insert(wd, directory);
+    m_directoryWatches.insert(directory, wd);
+    return true;
+#else
+    Q_UNUSED(directory);
+    return false;
+#endif
+}
+
+void FileMonitor::unwatchDirectory(const QString &directory)
+{
+#ifdef Q_OS_LINUX
+    auto it = m_directoryWatches.find(directory);
+    if (it == m_directoryWatches.end())
+        return;
+
+    inotify_rm_watch(m_inotifyFd, it.value());
+    m_watchDescriptors.remove(it.value());
+    m_directoryWatches.erase(it);
+#else
+    Q_UNUSED(directory);
+#endif
+}
+
+void FileMonitor::readInotifyEvents()
+{
+#ifdef Q_OS_LINUX
+    alignas(struct inotify_event) char buffer[4096];
+
+    ssize_t length;
+    while ((length = read(m_inotifyFd, buffer, sizeof(buffer))) > 0) {
+        const char *ptr = buffer;
+        while (ptr < buffer + length) {
+            const auto *event = reinterpret_cast<const struct inotify_event *>(ptr);
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                // Events have been dropped: check every file
+                for (auto it = m_files.constBegin(); it != m_files.constEnd(); ++it)
+                    scheduleCheck(it.key(), false);
+                continue;
+            }
+
+            const QString directory = m_watchDescriptors.value(event->wd);
+            if (directory.isNull())
+                continue;
+
+            const auto files = m_directories.value(directory);
+
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                // The directory itself is gone: so are all of its files.
+                for (const QString &filePath : files)
+                    scheduleCheck(filePath, true);
+
+                // The watch would follow the directory to its new path, while
+                // the files are known by the old one. IN_IGNORED follows.
+                if (event->mask & IN_MOVE_SELF)
+                    inotify_rm_watch(m_inotifyFd, event->wd);
+
+                if (event->mask & IN_IGNORED) {
+                    m_watchDescriptors.remove(event->wd);
+                    m_directoryWatches.remove(directory);
+
+                    // Watch the directory that may have taken its place, if any.
+                    // Otherwise its files are watched one by one from now on.
+                    if (!watchDirectory(directory)) {
+                        m_directories.remove(directory);
+                        for (const QString &filePath : files)
+                            watchWithFallback(filePath);
+                    }
+                }
+                continue;
+            }
+
+            if (event->len > 0) {
+                const QString filePath = files.value(QFile::decodeName(event->name));
+                if (!filePath.isNull())
+                    scheduleCheck(filePath, event->mask & CONTENT_EVENTS);
+            }
+        }
+    }
+#endif
+}
+
+QFileSystemWatcher *FileMonitor::fallbackWatcher()
+{
+    if (m_fsWatcher == nullptr) {
+        m_fsWatcher = new QFileSystemWatcher(this);
+        connect(m_fsWatcher, &QFileSystemWatcher::fileChanged, this, [this](const QString &filePath) {
+            scheduleCheck(filePath, true);
+        });
+    }
+
+    return m_fsWatcher;
+}
+
+void FileMonitor::watchWithFallback(const QString &filePath)
+{
+    m_fallbackFiles.insert(filePath);
+
+    // Fails if the file has been removed: QFileSystemWatcher can only watch existing files
+    fallbackWatcher()->addPath(filePath);
+}
+
+void FileMonitor::scheduleCheck(const QString &filePath, bool changed)
+{
+    if (!m_files.contains(filePath))
+        return;
+
+    bool &pendingChanged = m_pendingFiles[filePath];
+    pendingChanged = pendingChanged || changed;
+
+    // Don't restart an active timer: a file that is written continuously
+    // must still be notified every DEBOUNCE_INTERVAL.
+    if (!m_debounceTimer.isActive())
+        m_debounceTimer.start();
+}
+
+void FileMonitor::checkPendingFiles()
+{
+    const QHash<QString, bool> pending = m_pendingFiles;
+    m_pendingFiles.clear();
+
+    for (auto p = pending.constBegin(); p != pending.constEnd(); ++p) {
+        const QString &filePath = p.key();
+        auto it = m_files.find(filePath);
+        if (it == m_files.end())
+            continue;
+
+        const FileStamp stamp = stampOf(filePath);
+        if (!p.value() && stamp == it.value().stamp)
+            continue;
+
+        it.value().stamp = stamp;
+
+        // QFileSystemWatcher stops watching files that get replaced.
+        // Adding a path that is already watched does nothing.
+        if (stamp.exists && m_fallbackFiles.contains(filePath))
+            m_fsWatcher->addPath(filePath);
+
+        emit fileChanged(filePath);
+    }
+}
@@ -29,6 +29,18 @@ void printerrln(QString string)
     printerr(string + "\n");
 }
 
+void waitFor(const QPromise<void> &promise, bool *ok)
+{
+    bool fulfilled = false;
+    QEventLoop loop;
+    promise.then([&fulfilled]{ fulfilled = true; })
+           .finally([&loop]{ loop.quit(); });
+    loop.exec();
+
+    if (ok)
+        *ok = fulfilled;
+}
+
 QPromise<PForResult::Enum> pFor(int start, int end, std::function<QPromise<PForResult::Enum>(int, QPromise<PForResult::Enum>, QPromise<PForResult::Enum>)> iteration) {
     QPromise<PForResult::Enum> p = QPromise<PForResult::Enum>::resolve(PForResult::Continue);
 
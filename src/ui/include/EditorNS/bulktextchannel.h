@@ -0,0 +1,102 @@
+#ifndef BULKTEXTCHANNEL_H
+#define BULKTEXTCHANNEL_H
+
+#include <QHash>
+#include <QObject>
+#include <QString>
+#include <QUrl>
+#include <QWebSocketServer>
+#include <QtPromise>
+
+#include <unordered_map>
+
+class QWebSocket;
+
+namespace EditorNS
+{
+
+    /**
+     * @brief A side channel used to transfer large texts between the
+     *        Editors and their javascript counterpart.
+     *
+     * The QWebChannel serializes everything as JSON, which means escaping
+     * the whole text and converting it back and forth between UTF-16 and
+     * UTF-8. Here, each editor page connects to a local WebSocket server
+     * and texts travel, in both directions, as binary frames made of
+     * [id: uint32 LE][text: UTF-16LE]: neither side has to convert them.
+     *
+     * The id is the one of the QWebChannel request that carries (or whose
+     * reply carries) the text. That message only contains {bulkText: id}.
+     *
+     * The server only listens on the loopback interface, and only accepts
+     * connections to a random path that is only known to the editors.
+     */
+    class BulkTextChannel : public QObject
+    {
+        Q_OBJECT
+    public:
+        static BulkTextChannel& getInstance();
+
+        /**
+         * @brief Texts shorter than this are not worth a side transfer.
+         */
+        static const int MIN_LENGTH = 64 * 1024;
+
+        /**
+         * @brief Returns the url that the page of an editor must connect to,
+         *        or an empty url if the channel isn't available.
+         */
+        QUrl urlForEditor(quint32 editorId) const;
+
+        /**
+         * @brief Sends a text to the page of an editor.
+         * @return false if the page is not connected, or the text couldn't be
+         *         sent. The text must then be sent through the QWebChannel.
+         *         If the connection drops after the text has been sent, the
+         *         page asks for it again through the QWebChannel.
+         */
+        bool send(quint32 editorId, quint32 transferId, const QString &text);
+
+        /**
+         * @brief Returns the text that the page of an editor sent with the
+         *        given id. The promise is rejected if the page disconnects
+         *        before sending it.
+         */
+        QtPromise::QPromise<QString> receive(quint32 editorId, quint32 transferId);
+
+        /**
+         * @brief Drops the text that the page of an editor sent, or is going to
+         *        send, with the given id, because nobody is going to receive() it.
+         */
+        void discard(quint32 editorId, quint32 transferId);
+
+    private:
+        struct PendingTransfer {
+            quint32 editorId;
+            QtPromise::QPromiseResolve<QString> resolve;
+            QtPromise::QPromiseReject<QString> reject;
+        };
+
+        struct ReceivedText {
+            quint32 editorId;
+            QString text;
+        };
+
+        QWebSocketServer m_server;
+        QString m_secret;
+        QHash<quint32, QWebSocket*> m_sockets; // Editor id -> connection
+        QHash<quint32, ReceivedText> m_receivedTexts; // Transfer id -> text nobody asked for yet
+        QHash<quint32, quint32> m_discardedTransfers; // Transfer id -> editor id, for the texts still to come
+        std::unordered_map<quint32, PendingTransfer> m_pendingTransfers;
+
+        BulkTextChannel();
+        BulkTextChannel& operator=(BulkTextChannel&) = delete;
+
+        void on_newConnection();
+        void on_binaryMessageReceived(quint32 editorId, const QByteArray &message);
+        void on_disconnected(quint32 editorId, QWebSocket *socket);
+    };
+
+}
+
+#endif // BULKTEXTCHANNEL_H
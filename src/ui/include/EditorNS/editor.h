@@ -3,9 +3,9 @@
 
 #include "include/EditorNS/customqwebview.h"
 #include "include/EditorNS/languageservice.h"
+#include "include/EditorNS/snapshotcache.h"
 
 #include <QObject>
-#include <QQueue>
 #include <QTextCodec>
 #include <QVBoxLayout>
 #include <QVariant>
@@ -14,7 +14,7 @@
 #include <QPrinter>
 
 #include <functional>
-#include <future>
+#include <unordered_map>
 
 class EditorTabWidget;
 
@@ -42,6 +42,16 @@ namespace EditorNS
         JsToCppProxy(QObject *parent) : QObject(parent) { }
 
         Q_INVOKABLE void receiveMessage(QString msg, QVariant data) { emit messageReceived(msg, data); }
+        Q_INVOKABLE void receiveReply(unsigned int id, QVariant data) { emit replyReceived(id, data); }
+        Q_INVOKABLE void receiveReplies(QVariantList replies)
+        {
+            for (const QVariant &reply : replies) {
+                const QVariantList fields = reply.toList();
+                if (fields.size() == 2)
+                    emit replyReceived(fields[0].toUInt(), fields[1]);
+            }
+        }
+        Q_INVOKABLE void resendBulkText(unsigned int id) { emit bulkTextResendRequested(id); }
 
     signals:
         /**
@@ -51,7 +61,36 @@ namespace EditorNS
              */
         void messageReceived(QString msg, QVariant data);
 
+        /**
+             * @brief JavaScript replied to an asynchronous request.
+             * @param id Identifier of the request
+             * @param data Value returned by the request handlers
+             */
+        void replyReceived(unsigned int id, QVariant data);
+
+        /**
+             * @brief JavaScript lost the text of the request with the given id
+             *        with the BulkTextChannel, and is waiting for it to be
+             *        resent through bulkTextResentToJs().
+             */
+        void bulkTextResendRequested(unsigned int id);
+
         void messageReceivedByJs(QString msg, QVariant data);
+
+        /**
+             * @brief Sends an asynchronous request to JavaScript. The reply will
+             *        come back through receiveReply() with the same id.
+             */
+        void requestReceivedByJs(unsigned int id, QString msg, QVariant data);
+
+        /**
+             * @brief Sends a batch of asynchronous requests to JavaScript, as a list
+             *        of [id, msg, data] lists. The replies will come back together
+             *        through receiveReplies(), as a list of [id, data] lists.
+             */
+        void requestsReceivedByJs(QVariantList requests);
+
+        void bulkTextResentToJs(unsigned int id, QString text);
     };
 
 
@@ -86,11 +125,44 @@ namespace EditorNS
         explicit Editor(QWidget *parent = nullptr);
 
         /**
-             * @brief Efficiently returns a new Editor object from an internal buffer.
+             * @brief Efficiently returns a new Editor object from the EditorPool.
              * @return
              */
         static QSharedPointer<Editor> getNewEditor(QWidget *parent = nullptr);
 
+        /**
+             * @brief Returns a new Editor that doesn't load its page until it's
+             *        first shown, or until someone asks it for some information
+             *        (i.e. sends it a C_FUN_* request). Until then, commands are
+             *        queued and the editor stands for a clean document.
+             */
+        static QSharedPointer<Editor> getDeferredEditor(QWidget *parent = nullptr);
+
+        /**
+             * @brief Returns true if the page of this editor hasn't been loaded yet.
+             */
+        bool isDeferred() const;
+
+        /**
+             * @brief Sets a function that fills a deferred editor with its document.
+             *        It's called synchronously as soon as the page gets created,
+             *        before any other request is sent to it.
+             */
+        void setDeferredLoader(const std::function<void()> &loader);
+
+        /**
+             * @brief Sets a function that reads the document of a deferred editor
+             *        from its file. While the editor is deferred, it's used to
+             *        answer the requests for its content without loading it.
+             */
+        void setDeferredValueReader(const std::function<QPromise<QString>()> &reader);
+
+        /**
+             * @brief Creates the page of a deferred editor and runs its loader.
+             *        Does nothing if the editor is not deferred.
+             */
+        void loadDeferred();
+
         static void invalidateEditorBuffer();
 
         struct Cursor {
@@ -128,6 +200,29 @@ namespace EditorNS
             int size;
         };
 
+        using Snapshot = EditorNS::Snapshot;
+
+        /**
+             * @brief Batches the requests sent to an Editor during its lifetime.
+             *
+             * The requests are delivered to javascript as a single message when
+             * the Transaction is destroyed, and they are executed within a single
+             * CodeMirror operation, so the editor is only refreshed once. Replies
+             * are delivered as usual, after the whole batch has been executed.
+             *
+             * Transactions can be nested: the batch is sent when the outermost
+             * one ends.
+             */
+        class Transaction {
+        public:
+            explicit Transaction(QSharedPointer<Editor> editor);
+            ~Transaction();
+
+        private:
+            Q_DISABLE_COPY(Transaction)
+            QSharedPointer<Editor> m_editor;
+        };
+
         /**
          * @brief Just a flag that is used for marking editors that are still loading,
          * meaning for example that the Editor has been created but we still need
@@ -175,6 +270,13 @@ namespace EditorNS
         Q_INVOKABLE bool fileOnDiskChanged() const;
         Q_INVOKABLE void setFileOnDiskChanged(bool fileOnDiskChanged);
 
+        /**
+             * @brief Time (msecs since epoch) the tab of this editor was last
+             *        made the current one, or 0 if it never was.
+             */
+        qint64 lastActivated() const;
+        void setLastActivated(qint64 lastActivated);
+
         enum class SelectMode {
             Before,
             After,
@@ -187,8 +289,15 @@ namespace EditorNS
 
         // Lower-level message wrappers:
         QPromise<bool> isCleanP();
-        Q_INVOKABLE bool isClean();
         Q_INVOKABLE QPromise<void> markClean();
+
+        /**
+         * @brief Marks the editor as clean at the specified change sequence,
+         *        i.e. the sequence of the content that has been saved (see
+         *        Snapshot::changeSequence). If the content has changed since
+         *        then, the editor stays dirty.
+         */
+        QPromise<void> markClean(int changeSequence);
         Q_INVOKABLE QPromise<void> markDirty();
 
         /**
@@ -197,6 +306,13 @@ namespace EditorNS
          */
         Q_INVOKABLE QPromise<int> getHistoryGeneration();
 
+        /**
+         * @brief Returns the change sequence of the editor (see Snapshot). Unlike the
+         *        history generation, it changes with every edit, so it tells whether
+         *        the content is still the same as when it was last read.
+         */
+        QPromise<int> getChangeSequence();
+
         /**
          * @brief Set the language to use for the editor.
          *        It automatically adjusts tab settings from
@@ -208,7 +324,32 @@ namespace EditorNS
         Q_INVOKABLE void setLanguageFromFilePath(const QString& filePath);
         Q_INVOKABLE void setLanguageFromFilePath();
         Q_INVOKABLE QPromise<void> setValue(const QString &value);
-        Q_INVOKABLE QString value();
+        QPromise<QString> valueP();
+
+        /**
+         * @brief Returns the content of the editor and its history generation.
+         *        As long as the document doesn't change, the content is only
+         *        read from JavaScript once and then served from memory.
+         */
+        QPromise<Snapshot> snapshot();
+
+        /**
+         * @brief Returns true if snapshot() can be served from memory.
+         */
+        bool isSnapshotCached() const;
+
+        /**
+         * @brief Starts or stops recording the changes made to the document.
+         *        While enabled, every CodeMirror operation that modifies the
+         *        document emits changesRecorded().
+         */
+        void setChangeRecordingEnabled(bool enabled);
+
+        /**
+         * @brief Replays changes recorded by changesRecorded(), in order.
+         * @param changes List of {from: {line, ch}, to: {line, ch}, text: [lines]} maps
+         */
+        void applyChanges(const QVariantList &changes);
 
         /**
          * @brief Set custom indentation settings which may be different
@@ -240,7 +381,6 @@ namespace EditorNS
          * @brief Get the current cursor position
          * @return a <line, column> pair.
          */
-        QPair<int, int> cursorPosition();
         QPromise<QPair<int, int>> cursorPositionP();
         void setCursorPosition(const int line, const int column);
         void setCursorPosition(const QPair<int, int> &position);
@@ -256,7 +396,7 @@ namespace EditorNS
          * @brief Get the current scroll position
          * @return a <left, top> pair.
          */
-        QPair<int, int> scrollPosition();
+        QPromise<QPair<int, int>> scrollPositionP();
         void setScrollPosition(const int left, const int top);
         void setScrollPosition(const QPair<int, int> &position);
         QString endOfLineSequence() const;
@@ -296,7 +436,7 @@ namespace EditorNS
         void setTheme(Theme theme);
         static Editor::Theme themeFromName(QString name);
 
-        QList<Selection> selections();
+        QPromise<QList<Selection>> selectionsP();
 
         /**
          * @brief Returns the currently selected texts.
@@ -313,7 +453,6 @@ namespace EditorNS
          *         significative only if the second element ("found") is true.
          */
         QPromise<std::pair<IndentationMode, bool>> detectDocumentIndentation();
-        Editor::IndentationMode indentationMode();
         QPromise<IndentationMode> indentationModeP();
 
         QPromise<QString> getCurrentWord();
@@ -324,47 +463,103 @@ namespace EditorNS
 
     private:
         friend class ::EditorTabWidget;
+        friend class EditorPool;
 
-        struct AsyncReply {
-            unsigned int id;
-            QString message;
-            std::shared_ptr<std::promise<QVariant>> value;
-            std::function<void (QVariant)> callback;
+        struct PendingReply {
+            QPromiseResolve<QVariant> resolve;
+            QPromiseReject<QVariant> reject;
+            QString bulkText; // Sent through the BulkTextChannel, in case it's lost
         };
 
-        std::list<AsyncReply> asyncReplies;
+        // Requests sent to JavaScript that are still waiting for a reply, by id.
+        std::unordered_map<unsigned int, PendingReply> m_pendingReplies;
+
+        // Identifies this editor on the BulkTextChannel.
+        quint32 m_bulkTextId = 0;
+
+        // The last snapshot read from JavaScript, until the document gets
+        // modified or we send a request that may modify it.
+        SnapshotCache m_snapshotCache;
+
+        // Requests collected by the current Transaction, as [id, msg, data] lists.
+        QVariantList m_transactionRequests;
+        int m_transactionDepth = 0;
+
+        void beginTransaction();
+        void endTransaction();
+
+        /**
+             * @brief Calls the function right away if the editor is loaded, or as
+             *        soon as it becomes ready otherwise.
+             */
+        void deliverWhenLoaded(const std::function<void()> &deliver);
+
+        /**
+             * @brief Answers C_FUN_GET_VALUE for a deferred editor with its deferred value
+             *        reader, or loads the editor if the file can't be read.
+             */
+        QPromise<QVariant> readDeferredValue();
 
         // These functions should only be used by EditorTabWidget to manage the tab's title. This works around
         // KDE's habit to automatically modify QTabWidget's tab titles to insert shortcut sequences (like &1).
         QString tabName() const;
         void setTabName(const QString& name);
 
-        static QQueue<QSharedPointer<Editor>> m_editorBuffer;
         QVBoxLayout *m_layout;
         CustomQWebView *m_webView;
         JsToCppProxy *m_jsToCppProxy;
         QUrl m_filePath = QUrl();
         QString m_tabName;
         bool m_fileOnDiskChanged = false;
+        qint64 m_lastActivated = 0;
         bool m_loaded = false;
+        bool m_returnedToPool = false; // See EditorPool::recycle()
         QString m_endOfLineSequence = "\n";
         QTextCodec *m_codec = QTextCodec::codecForName("UTF-8");
         bool m_bom = false;
         bool m_customIndentationMode = false;
         const Language* m_currentLanguage = nullptr;
-        inline void waitAsyncLoad();
+        QVariantMap m_documentInfo;
+
+        /**
+             * @brief The editor only sends the parts of the document information
+             *        (cursor, selections, content size) that changed since the last
+             *        time: merges them into the information received so far.
+             * @return The complete, up-to-date document information.
+             */
+        QVariantMap updateDocumentInfo(const QVariantMap &changes);
 
-        void fullConstructor(const Theme &theme);
+        // State of the editors whose page hasn't been created yet
+        bool m_deferred = false;
+        Theme m_deferredTheme;
+        std::function<void()> m_deferredLoader;
+        std::function<QPromise<QString>()> m_deferredValueReader;
+        qreal m_deferredZoomFactor = 1;
+
+        Editor(const Theme &theme, bool deferred, QWidget *parent);
+
+        void fullConstructor(const Theme &theme, bool deferred = false);
+        void createPage(const Theme &theme);
+
+        /**
+             * @brief Brings a loaded editor back to the state of a new one,
+             *        so that the EditorPool can use it for another document.
+             */
+        void resetForReuse();
 
         QPromise<void> setIndentationMode(const bool useTabs, const int size);
         QPromise<void> setIndentationMode(const Language*);
 
+    protected:
+        void showEvent(QShowEvent *event) override;
+
     private slots:
         void on_proxyMessageReceived(QString msg, QVariant data);
+        void on_proxyReplyReceived(unsigned int id, QVariant data);
+        void on_proxyBulkTextResendRequested(unsigned int id);
 
     signals:
         void messageReceived(QString msg, QVariant data);
-        void asyncReplyReceived(unsigned int id, QString msg, QVariant data);
         void gotFocus();
         void mouseWheel(QWheelEvent *ev);
         void urlsDropped(QList<QUrl> urls);
@@ -377,6 +572,15 @@ namespace EditorNS
         void cleanChanged(bool isClean);
         void fileNameChanged(const QUrl &oldFileName, const QUrl &newFileName);
 
+        /**
+             * @brief The document has been modified while the change recording
+             *        is enabled.
+             * @param changeSequence Number of operations that modified the document
+             *        so far, including this one. See Snapshot::changeSequence.
+             * @param changes The changes made by the operation, see applyChanges().
+             */
+        void changesRecorded(int changeSequence, QVariantList changes);
+
         /**
              * @brief The editor finished loading. There should be
              *        no need to use this signal outside this class.
@@ -396,19 +600,6 @@ namespace EditorNS
         QPromise<QVariant> asyncSendMessageWithResultP(const QString msg, const QVariant data);
         QPromise<QVariant> asyncSendMessageWithResultP(const QString msg);
 
-        /**
-         * @brief asyncSendMessageWithResult
-         * @param msg
-         * @param data
-         * @param callback When set, the result is returned asynchronously via the provided function.
-         *                 If set, you should NOT use the return value of this method.
-         * @return
-         */
-        // [[deprecated]]
-        std::shared_future<QVariant> asyncSendMessageWithResult(const QString msg, const QVariant data, std::function<void(QVariant)> callback = nullptr);
-        // [[deprecated]]
-        std::shared_future<QVariant> asyncSendMessageWithResult(const QString msg, std::function<void(QVariant)> callback = nullptr);
-
         /**
          * @brief Print the editor. As of Qt 5.11, it produces low-quality, non-vector graphics with big dimension.
          * @param printer
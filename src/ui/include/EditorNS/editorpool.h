@@ -0,0 +1,98 @@
+#ifndef EDITORPOOL_H
+#define EDITORPOOL_H
+
+#include "include/EditorNS/editor.h"
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QQueue>
+#include <QSharedPointer>
+#include <QTimer>
+
+namespace EditorNS
+{
+
+    /**
+     * @brief Keeps a few Editors loaded in advance, so that opening a tab
+     *        doesn't have to wait for a new page to load.
+     *
+     * The number of spare editors follows the number of editors that were
+     * requested recently, within a limit that keeps the memory in check.
+     * They are created one at a time, when the application is idle.
+     * The editors of closed tabs are reset and kept instead of being
+     * destroyed, as long as the pool has room for them. An editor is only
+     * reused once nothing references it anymore, e.g. an extension or a
+     * save still in progress.
+     */
+    class EditorPool : public QObject
+    {
+        Q_OBJECT
+    public:
+        static EditorPool& getInstance();
+
+        struct Statistics {
+            int requests = 0;
+            int hits = 0;         // Served by an editor that was already loaded
+            int recycled = 0;     // Editors of closed tabs that were kept
+            qint64 totalReadyLatency = 0; // From the request until the editor is ready, in msec
+            qint64 firstReadyLatency = -1; // From the creation of the pool, in msec
+        };
+
+        /**
+         * @brief Returns an editor, taking it from the pool if possible.
+         */
+        QSharedPointer<Editor> acquire();
+
+        /**
+         * @brief Gives back the editor of a closed tab. Once its last reference
+         *        is dropped, the editor is reset and kept for later use, or
+         *        destroyed if the pool is full.
+         */
+        void recycle(QSharedPointer<Editor> editor);
+
+        /**
+         * @brief Takes ownership of an editor that wasn't created by the pool,
+         *        so that it can be recycled too.
+         */
+        QSharedPointer<Editor> adopt(Editor *editor);
+
+        /**
+         * @brief Creates the specified number of editors right away.
+         */
+        void warm(int howMany);
+
+        /**
+         * @brief Drops all the spare editors, e.g. because the theme they
+         *        were created with is no longer valid.
+         */
+        void clear();
+
+        const Statistics& statistics() const;
+        QString statisticsReport() const;
+
+    private:
+        QQueue<QSharedPointer<Editor>> m_editors;
+        QQueue<qint64> m_requestTimes;
+        QElapsedTimer m_clock;
+        QTimer m_idleTimer;
+        Statistics m_statistics;
+
+        EditorPool();
+        ~EditorPool();
+        EditorPool& operator=(EditorPool&) = delete;
+
+        /**
+         * @brief Deleter of the editors: called when the last reference to an
+         *        editor is dropped.
+         */
+        static void release(Editor *editor);
+
+        int targetSize();
+        void measureReadyLatency(QSharedPointer<Editor> editor, qint64 requestTime);
+        void scheduleWarming();
+        void adjustSize();
+    };
+
+}
+
+#endif // EDITORPOOL_H
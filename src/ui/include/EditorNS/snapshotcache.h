@@ -0,0 +1,76 @@
+#ifndef SNAPSHOTCACHE_H
+#define SNAPSHOTCACHE_H
+
+#include <QString>
+
+namespace EditorNS
+{
+
+    /**
+     * @brief The content of an editor, along with the history
+     *        generation and the change sequence it belongs to.
+     */
+    struct Snapshot {
+        QString text;
+        int historyGeneration = 0;
+        int changeSequence = 0;
+    };
+
+    /**
+     * @brief The last snapshot read from an editor, kept until the document
+     *        may have been modified.
+     *
+     * Each modification, and each request sent to the editor that may modify
+     * the document, starts a new epoch. A snapshot is only kept if no epoch
+     * started since it has been requested: otherwise it may miss the effects
+     * of a request that JavaScript ran before reading it.
+     */
+    class SnapshotCache
+    {
+    public:
+        /**
+         * @brief Returns true if the request never modifies the content of the document.
+         */
+        static bool isReadOnly(const QString &request);
+
+        bool isCached() const { return m_cached; }
+
+        /**
+         * @brief The cached snapshot. Only valid if isCached().
+         */
+        const Snapshot &snapshot() const { return m_snapshot; }
+
+        /**
+         * @brief The current epoch, to be passed to store() along with the
+         *        snapshot requested now.
+         */
+        unsigned int epoch() const { return m_epoch; }
+
+        /**
+         * @brief Keeps a snapshot that has been requested during the given epoch,
+         *        unless another one has started since.
+         * @return Whether the snapshot has been kept.
+         */
+        bool store(const Snapshot &snapshot, unsigned int epoch);
+
+        /**
+         * @brief Drops the cached snapshot and starts a new epoch, e.g. because
+         *        the document has been modified.
+         */
+        void invalidate();
+
+        /**
+         * @brief To be called before sending a request to the editor: invalidates
+         *        the snapshot unless the request is read-only.
+         */
+        void beforeSending(const QString &request);
+
+    private:
+        Snapshot m_snapshot;
+        bool m_cached = false;
+        unsigned int m_epoch = 0;
+    };
+
+}
+
+#endif // SNAPSHOTCACHE_H
@@ -99,7 +99,7 @@ private:
     * @param `searchMode`:    Search mode to use.
     * @param `searchOptions`: Search options to use.
     */
-    int replaceAll(QString string, QString replacement, SearchHelpers::SearchMode searchMode, SearchHelpers::SearchOptions searchOptions);
+    QPromise<int> replaceAll(QString string, QString replacement, SearchHelpers::SearchMode searchMode, SearchHelpers::SearchOptions searchOptions);
    /**
     * @brief Select all instances of `string` within the current document.
     * @param `string`:        The string to search for.
@@ -107,7 +107,7 @@ private:
     * @param `forward`:       Direction in which to search.
     * @param `searchOptions`: Search options to use.
     */
-    int selectAll(QString string, SearchHelpers::SearchMode searchMode, SearchHelpers::SearchOptions searchOptions);
+    QPromise<int> selectAll(QString string, SearchHelpers::SearchMode searchMode, SearchHelpers::SearchOptions searchOptions);
    /**
     * @brief Sets the current tab.
     * @param `tab`: The tab to be set to.
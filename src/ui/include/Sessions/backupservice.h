@@ -1,11 +1,16 @@
 #ifndef AUTOSAVE_H
 #define AUTOSAVE_H
 
+#include "include/Sessions/sessions.h"
+
+#include <QFuture>
 #include <QString>
 #include <QTimer>
+#include <QtPromise>
 
 #include <QSharedPointer>
 
+#include <map>
 #include <set>
 #include <tuple>
 
@@ -18,13 +23,16 @@ class MainWindow;
  * @brief The BackupService class handles automatic saving of currently open windows, tabs, and documents.
  *        When this system is used, clearBackupData() should be called at program shutdown.
  *        If, on program start, there is backup data to be found, the system will assume an improper shutdown.
+ *        Between two backups, the changes made to the modified documents are recorded by the EditJournal.
  */
 class BackupService {
 public:
 
     /**
      * @brief restoreFromAutosave Reads the autosave sessions and recreates
-     *        all windows and their tabs.
+     *        all windows and their tabs. The windows are created right away, but
+     *        their sessions are read concurrently, and each window is shown once
+     *        its active tabs have been loaded.
      */
     static bool restoreFromBackup();
 
@@ -46,6 +54,13 @@ public:
 
     static void clearBackupData();
 
+    /**
+     * @brief forgetEditor Drops everything the backups know about the editor of a closed tab:
+     *        its journal and its cache files. Must be called before the editor is reused for
+     *        another document, since both are found by its address.
+     */
+    static void forgetEditor(const EditorNS::Editor* editor);
+
     /**
      * @brief Pause the timer, if it is running.
      */
@@ -64,9 +79,9 @@ private:
     static bool s_autosaveEnabled;
 
     /**
-     * @brief The WindowData struct contains a list Editor*'s and the history generation
+     * @brief The WindowData struct contains a list Editor*'s and their change sequence
      *        at the time of the last autosave. With every new autosave this data will be
-     *        compared to the MainWindow's current list of Editor*'s and their history gens
+     *        compared to the MainWindow's current list of Editor*'s and their change sequences
      *        to determine whether the MainWindow has changed since the last save.
      */
     struct WindowData {
@@ -86,16 +101,57 @@ private:
     static std::set<WindowData> s_backupWindowData;
 
     /**
-     * @brief executeAutosave Updates the data inside s_autosaveData and executes saveSession
-     *        for every open MainWindow that needs it.
+     * @brief s_cacheIndexes contains, for each MainWindow, the cache files written by
+     *        its last backup. Only the documents that changed since then are written again.
+     */
+    static std::map<MainWindow*, Sessions::CacheIndex> s_cacheIndexes;
+
+    /**
+     * @brief s_backupRunning is true from the moment a backup starts until it's been written.
+     */
+    static bool s_backupRunning;
+
+    /**
+     * @brief s_backupEpoch is incremented when the backup data is cleared. The backups started
+     *        before that are dropped.
+     */
+    static int s_backupEpoch;
+
+    /**
+     * @brief s_pendingWrite is the backup being written on the I/O threads, if any.
+     */
+    static QFuture<void> s_pendingWrite;
+
+    /**
+     * @brief s_pendingRestores is the number of windows still being restored from a backup.
+     *        Their backup must not be replaced until then.
+     */
+    static int s_pendingRestores;
+
+    /**
+     * @brief executeAutosave Updates the data inside s_autosaveData and writes a backup
+     *        of every open MainWindow that needs it. It doesn't block: the editors are
+     *        queried all at once, and the files are written on a background thread.
      */
     static void executeBackup();
 
     /**
-     * @brief writeBackup Writes a backup of the given MainWindow into a unique location inside the backupCache
-     * @return True if the backup was created successfully
+     * @brief writeBackups Collects the sessions of the MainWindows that changed since their last
+     *        backup, then writes them into their unique location inside the backupCache along with
+     *        removing the backups of the closed windows.
+     * @param newData The up-to-date data of all the open windows.
+     */
+    static QtPromise::QPromise<void> writeBackups(std::set<WindowData> newData);
+
+    /**
+     * @brief updateJournals Makes the EditJournal follow the cache files of a new backup of a window.
+     */
+    static void updateJournals(const Sessions::CacheIndex& oldIndex, const Sessions::CacheIndex& newIndex);
+
+    /**
+     * @brief windowBackupPath Returns the unique location of the backup of the given MainWindow.
      */
-    static bool writeBackup(MainWindow* wnd);
+    static QString windowBackupPath(MainWindow* wnd);
 };
 
 /**
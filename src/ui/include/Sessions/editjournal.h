@@ -0,0 +1,113 @@
+#ifndef EDITJOURNAL_H
+#define EDITJOURNAL_H
+
+#include <QHash>
+#include <QObject>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <QTimer>
+#include <QVariantList>
+#include <QWeakPointer>
+
+#include <atomic>
+#include <memory>
+
+namespace EditorNS {
+class Editor;
+}
+
+/**
+ * @brief Records the changes made to the backed up documents, so that the
+ *        work done since their last backup can be recovered after a crash.
+ *
+ * Each modified document of a backup has a cache file, which holds its
+ * content at a given change sequence (see EditorNS::Editor::Snapshot).
+ * The changes made to the editor after that are appended to a journal next
+ * to the cache file, one line of JSON per CodeMirror operation:
+ *     {"sequence": N, "changes": [{"from": ..., "to": ..., "text": [...]}]}
+ * (see EditJournalFile, which also reads them back).
+ *
+ * The journal is written within a fraction of a second of each edit, on a
+ * background thread, so the I/O follows the typing instead of the size of
+ * the documents. Once a journal grows too large, the next backup writes a
+ * new cache file instead, and the journal starts over from there.
+ */
+class EditJournal : public QObject
+{
+    Q_OBJECT
+public:
+    static EditJournal& getInstance();
+
+    /**
+     * @brief Returns the path of the journal of an editor whose content
+     *        has been written to a cache file.
+     */
+    static QString journalPath(const QString &cacheFilePath, const EditorNS::Editor *editor);
+
+    /**
+     * @brief Starts recording the changes of an editor. Must be called before
+     *        its content is read for a new cache file, so that no change
+     *        is missed in between.
+     */
+    void record(QSharedPointer<EditorNS::Editor> editor);
+
+    /**
+     * @brief Sets the cache file that has been written for an editor. The
+     *        changes it already contains are dropped, the others are
+     *        written to a new journal.
+     */
+    void setCacheFile(const EditorNS::Editor *editor, const QString &cacheFilePath, int changeSequence);
+
+    /**
+     * @brief Returns true if the journal of the cache file holds all the changes
+     *        made to the editor since the file was written, and is still small
+     *        enough to be worth replaying. That's not the case if it couldn't
+     *        be written.
+     */
+    bool covers(const EditorNS::Editor *editor, const QString &cacheFilePath) const;
+
+    /**
+     * @brief Stops recording the changes of an editor, e.g. because its
+     *        document is no longer backed up.
+     */
+    void stop(const EditorNS::Editor *editor);
+
+    /**
+     * @brief Stops recording the changes of all the editors, and waits for
+     *        the pending writes to finish.
+     */
+    void clear();
+
+private:
+    struct Entry {
+        int sequence;
+        QByteArray line;
+    };
+
+    struct Journal {
+        QWeakPointer<EditorNS::Editor> editor;
+        QString cacheFilePath; // Empty until the first cache file is written
+        QString journalFilePath;
+        int changeSequence = 0;
+        QList<Entry> entries; // All the changes since the cache file
+        int writtenEntries = 0;
+        qint64 size = 0;
+
+        // Set by the writer thread if the journal file couldn't be written:
+        // it then misses changes until the next cache file.
+        std::shared_ptr<std::atomic_bool> writeFailed;
+    };
+
+    QHash<const QObject*, Journal> m_journals;
+    QThreadPool m_writer; // A single thread, so that the appends stay in order
+    QTimer m_flushTimer;
+
+    EditJournal();
+    EditJournal& operator=(EditJournal&) = delete;
+
+    void flush();
+    void on_changesRecorded(int changeSequence, const QVariantList &changes);
+    void on_editorDestroyed(QObject *editor);
+};
+
+#endif // EDITJOURNAL_H
@@ -0,0 +1,31 @@
+#ifndef EDITJOURNALFILE_H
+#define EDITJOURNALFILE_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVariantList>
+
+/**
+ * @brief The format of the journals written by EditJournal: one line of JSON per
+ *        CodeMirror operation, {"sequence": N, "changes": [...]}.
+ */
+class EditJournalFile {
+public:
+
+    /**
+     * @brief Returns the line of a journal that records an operation.
+     */
+    static QByteArray entry(int changeSequence, const QVariantList &changes);
+
+    /**
+     * @brief Reads the changes recorded in a journal.
+     * @param changeSequence The change sequence of the cache file: older
+     *        changes are already part of it.
+     * @return The changes to replay with EditorNS::Editor::applyChanges().
+     *         If the journal was cut by a crash, the changes up to the
+     *         last complete line.
+     */
+    static QVariantList readChanges(const QString &journalFilePath, int changeSequence);
+};
+
+#endif // EDITJOURNALFILE_H
@@ -9,9 +9,16 @@ public:
     /**
      * @brief Returns the path to where the session file is/should be located
      *        that contains all tabs when the main Notepadqq instance is closed.
+     *        The session is saved in the binary format (see Sessions::SessionFormat).
      */
     static QString cacheSessionPath();
 
+    /**
+     * @brief Returns the path to where previous versions saved the session file
+     *        as XML, so that it can still be restored once.
+     */
+    static QString legacyCacheSessionPath();
+
     /**
      * @brief Returns the path to the directory that contains the tab cache.
      */
@@ -22,6 +29,12 @@ public:
     */
     static QString backupDirPath();
 
+    /**
+     * @brief Returns the path to the directory that contains the suspended workspaces
+     *        (see Workspaces).
+     */
+    static QString workspacesDirPath();
+
     /**
      * @brief Generates a QUrl to a file within the a directory.
      * @param parent The parent directory for the file.
@@ -29,6 +42,29 @@ public:
      * @return QUrl to a location within the the directory, file guaranteed not to exist yet.
      */
     static QUrl createValidCacheName(const QDir& parent, const QString& fileName);
+
+    /**
+     * @brief Stores data as a blob within a directory. Blobs are compressed and named
+     *        after the hash of their content, so identical data is only stored once:
+     *        if the blob already exists, nothing is written. Safe to call from any thread.
+     * @param parent The parent directory for the blob.
+     * @param data The data to store.
+     * @return The absolute path of the blob, or an empty string if it couldn't be written.
+     */
+    static QString storeBlob(const QDir& parent, const QByteArray& data);
+
+    /**
+     * @brief Returns true if the file is a blob written by storeBlob() within
+     *        the tab cache, the backup cache, or a workspace.
+     */
+    static bool isBlob(const QString& filePath);
+
+    /**
+     * @brief Returns the data of a blob written by storeBlob(), given the
+     *        contents of its file.
+     * @param ok If not null, set to false if the blob is corrupt, e.g. truncated.
+     */
+    static QByteArray unpackBlob(const QByteArray& blob, bool *ok = nullptr);
 };
 
 #endif // PERSISTENTCACHE_H
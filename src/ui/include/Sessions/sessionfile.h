@@ -0,0 +1,223 @@
+#ifndef SESSIONFILE_H
+#define SESSIONFILE_H
+
+#include "include/Sessions/sessions.h"
+
+#include <QFile>
+#include <QIODevice>
+#include <QString>
+#include <QXmlStreamReader>
+#include <QXmlStreamWriter>
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief The state of a tab, as stored in a session file.
+ */
+struct TabData {
+    QString filePath;
+    QString cacheFilePath;
+    int cursorX = 0;
+    int cursorY = 0;
+    int scrollX = 0;
+    int scrollY = 0;
+    bool active = false;
+    QString language;
+    qint64 lastModified = 0;
+    bool customIndent = false;
+    bool useTabs = false;
+    int tabSize = 0; 
+    int changeSequence = 0;
+    QString journalFilePath;
+    qint64 lastActivated = 0;
+};
+
+/**
+ * @brief The tabs of a view, i.e. a tab widget, as stored in a session file.
+ */
+struct ViewData {
+    std::vector<TabData> tabs;
+};
+
+/**
+ * @brief Provides a convenience class to read session .xml files.
+ */
+class SessionReader {
+public:
+
+    SessionReader(QFile& input)
+        : m_reader(&input) { }
+
+    /**
+     * @brief Completely read the session data
+     * @param outSuccess pass a pointer to bool here to be informed about whether
+     *        the reading process has encountered any errors.
+     * @return The data read from the session file.
+     */
+    std::vector<ViewData> readData(bool* outSuccess=nullptr);
+
+    QString getError();
+
+private:
+
+    /**
+     * @brief Helper functions to read specific parts of the xml structure
+     */
+    std::vector<ViewData> readViewData();
+    std::vector<TabData> readTabData();
+
+    QXmlStreamReader m_reader;
+};
+
+
+/**
+ * @brief Provides a convenience class to write session .xml files.
+ *
+ * Note that a SessionWriter object must be successfully destroyed
+ * in order to complete the writing process. (Aka the destructor must
+ * be called)
+ */
+class SessionWriter {
+public:
+
+    SessionWriter(QIODevice& destination);
+
+    ~SessionWriter();
+
+    /**
+     * @brief Write ViewData to the session file. ViewData is the representation of a
+     *        TabWidget and its tabs.
+     *
+     * @param The ViewData to be written.
+     */
+    void addViewData(const ViewData& vd);
+
+
+private:
+    /**
+     * @brief Helper function to write specific parts of the xml structure
+     */
+    void addTabData(const TabData& td);
+
+    QXmlStreamWriter m_writer;
+};
+
+/**
+ * @brief Provides a convenience class to read binary session files.
+ *
+ * Only the index at the start of the file is read by readIndex(): the record of
+ * a tab is read when it's requested, so the active tabs can be restored before
+ * the others are even read.
+ */
+class BinarySessionReader {
+public:
+
+    struct ViewIndex {
+        int activeTab = -1;
+        std::vector<std::pair<quint32, quint32>> records; // Offset and size of each tab
+    };
+
+    BinarySessionReader(QFile& input)
+        : m_input(input) { }
+
+    /**
+     * @brief Returns true if the file starts like a binary session file.
+     */
+    static bool isBinarySession(QFile& input);
+
+    /**
+     * @brief Reads the index of the session file.
+     * @return The views of the session, or an empty vector if the file is invalid.
+     */
+    std::vector<ViewIndex> readIndex();
+
+    /**
+     * @brief Reads the record of a tab.
+     * @return Whether the record has been read successfully.
+     */
+    bool readTab(const std::pair<quint32, quint32>& record, TabData& outTab);
+
+private:
+    QFile& m_input;
+};
+
+
+/**
+ * @brief Provides a convenience class to write binary session files.
+ *
+ * As with SessionWriter, the object must be destroyed to complete the
+ * writing process: the index can only be written once all the records are known.
+ */
+class BinarySessionWriter {
+public:
+
+    BinarySessionWriter(QIODevice& destination)
+        : m_destination(destination) { }
+
+    ~BinarySessionWriter();
+
+    /**
+     * @brief Write ViewData to the session file. ViewData is the representation of a
+     *        TabWidget and its tabs.
+     *
+     * @param The ViewData to be written.
+     */
+    void addViewData(const ViewData& vd);
+
+private:
+    QIODevice& m_destination;
+    std::vector<int> m_activeTabs;
+    std::vector<std::vector<QByteArray>> m_records;
+};
+
+namespace Sessions {
+
+/**
+ * @brief A session file of either format. Its tabs are read through the index of its views:
+ *        the records of binary sessions are only read when they're needed, unless readAll()
+ *        is called.
+ */
+class SessionFile {
+public:
+
+    /**
+     * @brief Opens a session file. Binary sessions only have their index read,
+     *        XML sessions are parsed completely.
+     * @return Whether the file is a valid session with at least one view.
+     */
+    bool open(const QString& sessionPath);
+
+    /**
+     * @brief Reads all the remaining records and closes the file, so that the
+     *        session can be passed to another thread.
+     */
+    void readAll();
+
+    const std::vector<BinarySessionReader::ViewIndex>& views() const { return m_views; }
+
+    /**
+     * @brief Reads the record of a tab, as found in views().
+     */
+    bool readTab(const std::pair<quint32, quint32>& record, TabData& outTab);
+
+private:
+    std::unique_ptr<QFile> m_file;
+    std::unique_ptr<BinarySessionReader> m_binaryReader; // Only set while records are read from the file
+
+    std::vector<BinarySessionReader::ViewIndex> m_views;
+
+    // The tabs of the session once they've been read. The records are then their view and tab indices.
+    std::vector<ViewData> m_tabs;
+};
+
+/**
+ * @brief Writes the views of a session to a session file in the specified format.
+ * @return Whether the whole file has been written.
+ */
+bool writeSessionFile(const QString& sessionPath, const std::vector<ViewData>& viewData, SessionFormat format);
+
+} // namespace Sessions
+
+#endif // SESSIONFILE_H
@@ -0,0 +1,55 @@
+#ifndef SESSIONPREFETCHER_H
+#define SESSIONPREFETCHER_H
+
+#include <QObject>
+#include <QSet>
+#include <QTimer>
+
+class EditorTabWidget;
+class TopEditorContainer;
+
+/**
+ * @brief Reads and decodes in advance the documents of the restored background
+ *        tabs that are likely to be shown next, so that switching to them is
+ *        instant even though they're only loaded once shown (see
+ *        EditorNS::Editor::getDeferredEditor()).
+ *
+ * The tabs of each view are ranked by how recently they were last activated,
+ * and by their distance from the current tab of the view. Only the few best
+ * ranked documents are kept in memory: the ranking is updated whenever the
+ * current tab changes. The prefetcher deletes itself once all the tabs of the
+ * window have been loaded.
+ */
+class SessionPrefetcher : public QObject
+{
+    Q_OBJECT
+public:
+    /**
+     * @brief Starts prefetching the documents of the tabs of a window. If the
+     *        window already has a prefetcher, it's updated instead.
+     */
+    static void start(TopEditorContainer* editorContainer);
+
+    /**
+     * @brief Stops prefetching the documents of the tabs of a window, and frees
+     *        the ones that have been prefetched, e.g. because the tabs are closed.
+     */
+    static void stop(TopEditorContainer* editorContainer);
+
+    ~SessionPrefetcher();
+
+private:
+    TopEditorContainer* m_editorContainer;
+    QSet<QString> m_prefetched; // Absolute file paths
+    QTimer m_updateTimer;
+
+    explicit SessionPrefetcher(TopEditorContainer* editorContainer);
+
+    /**
+     * @brief Prefetches the documents that are now the most likely to be shown
+     *        next, and discards the ones that no longer are.
+     */
+    void update();
+};
+
+#endif // SESSIONPREFETCHER_H
@@ -2,32 +2,126 @@
 #define SESSIONS_H
 
 #include <QString>
+#include <QtPromise>
+
+#include <map>
+#include <memory>
 
 class DocEngine;
+class EditJournal;
 class TopEditorContainer;
 
+namespace EditorNS {
+class Editor;
+}
+
 namespace Sessions {
 
 /**
- * @brief Saves a session as an XML file
- * @param docEngine The DocEngine that will be used to save all tabs to disk.
+ * @brief A cache file written by saveSession(), along with the change sequence of
+ *        the document at the time it was written.
+ */
+struct CachedDocument {
+    QString cacheFilePath;
+    int changeSequence;
+};
+
+/**
+ * @brief The cache files of the last saveSession() call, by editor.
+ */
+using CacheIndex = std::map<const EditorNS::Editor*, CachedDocument>;
+
+/**
+ * @brief The formats of session files. XML is meant for the sessions that are exported
+ *        and imported by the user. The binary format, meant for the sessions Notepadqq
+ *        writes for itself, starts with an index, so that the active tabs can be restored
+ *        before the other tabs are read. loadSession() reads both.
+ */
+enum class SessionFormat {
+    Xml,
+    Binary
+};
+
+/**
+ * @brief Saves a session to a file
  * @param editorContainer The TopEditorContainer whose views and tabs will be saved.
- * @param sessionPath Path to where the XML file should be created.
- * @param cacheDirPath Path to the directory where modified files will be written to. If
- *        left empty, no files will be cached. All prior files inside the cache directory
- *        will be deleted.
+ * @param sessionPath Path to where the session file should be created.
+ * @param format The format of the session file: Binary for the session that is
+ *        restored on startup, Xml for the sessions that the user saves.
+ * @param cacheDirPath Path to the directory where modified files will be written to, as
+ *        compressed blobs named after their content. If left empty, no files will be cached.
+ *        The files of the cache directory that are no longer used are deleted.
+ * @param cacheIndex If specified, the session is saved incrementally: only the modified
+ *        documents whose change sequence differs from the one in the index are written
+ *        again. The index is then updated. It must only be used with the same cacheDirPath.
+ * @return Whether the save has been successful.
+ */
+bool saveSession(TopEditorContainer* editorContainer, QString sessionPath, SessionFormat format,
+                 QString cacheDirPath=QString(), CacheIndex* cacheIndex=nullptr);
+
+/**
+ * @brief The state of all the tabs of a session, collected by collectSession().
+ */
+struct SessionSnapshot;
+
+/**
+ * @brief Collects the state of all the tabs of a session without blocking: the requests
+ *        are sent to all the editors at once. The content of a modified document is only
+ *        requested if its change sequence differs from the one in the cache index.
+ * @param editorContainer The TopEditorContainer whose views and tabs will be collected.
+ * @param cacheDirPath Path to the directory where modified files will be written to.
+ * @param cacheIndex The cache files written by the last save of this session, if any.
+ * @param journal If specified, the changes made to the modified documents after their cache
+ *        file has been read are recorded in it, and the documents whose journal covers the
+ *        changes made since their cache file keep it even if it's not up to date anymore.
+ * @return A promise resolved with the session, ready to be written by writeSession().
+ */
+QtPromise::QPromise<std::shared_ptr<SessionSnapshot>> collectSession(TopEditorContainer* editorContainer, QString cacheDirPath,
+                                                                     const CacheIndex& cacheIndex, EditJournal* journal=nullptr);
+
+/**
+ * @brief Writes a session collected by collectSession(): the modified documents, then the
+ *        session file, then deletes the files of the cache directory that are no longer used,
+ *        journals of the remaining cache files excepted.
+ *        It doesn't involve any editor, so it's safe to call from any thread.
+ * @param cacheIndex If not null, receives the cache files of the session.
+ * @param format The format of the session file.
  * @return Whether the save has been successful.
  */
-bool saveSession(DocEngine* docEngine, TopEditorContainer* editorContainer, QString sessionPath, QString cacheDirPath=QString());
+bool writeSession(const SessionSnapshot& session, QString sessionPath, CacheIndex* cacheIndex, SessionFormat format);
 
 /**
- * @brief Loads a session XML file and restores all its tabs in the specified window.
+ * @brief Loads a session file, in any of the SessionFormats, and restores all its tabs in
+ *        the specified window. The active tabs are restored first. The changes recorded in
+ *        the journals of the cache files are replayed. The documents of the background tabs
+ *        are read once shown, or in advance if they're likely to be shown next
+ *        (see SessionPrefetcher).
  * @param docEngine The DocEngine used to load all files.
  * @param editorContainer The TopEditorContainer which will receive all newly crated Tabs.
- * @param sessionPath Path to where the XML file is located.
+ * @param sessionPath Path to where the session file is located.
  */
 void loadSession(DocEngine* docEngine, TopEditorContainer* editorContainer, QString sessionPath);
 
+/**
+ * @brief A session file read by readSession().
+ */
+class SessionFile;
+
+/**
+ * @brief Reads a session file on the I/O thread pool, and starts decoding the documents
+ *        that will be loaded as soon as it's restored (see DocEngine::prefetchDocument()).
+ *        Many sessions can be read concurrently.
+ * @return A promise resolved with the session, or with nullptr if it isn't valid.
+ */
+QtPromise::QPromise<std::shared_ptr<SessionFile>> readSession(QString sessionPath);
+
+/**
+ * @brief Restores all the tabs of a session read by readSession() in the specified window,
+ *        as loadSession() does.
+ * @return A promise resolved once the active tabs have been loaded.
+ */
+QtPromise::QPromise<void> restoreSession(DocEngine* docEngine, TopEditorContainer* editorContainer, SessionFile& session);
+
 } // namespace Autosave
 
 #endif // SESSIONS_H
@@ -0,0 +1,101 @@
+#ifndef WORKSPACES_H
+#define WORKSPACES_H
+
+#include "include/docengine.h"
+
+#include <QtPromise>
+
+#include <QList>
+#include <QPair>
+#include <QString>
+#include <QStringList>
+
+class TopEditorContainer;
+
+namespace Sessions {
+struct SessionSnapshot;
+}
+
+/**
+ * @brief Named sets of tabs that a window can switch between.
+ *
+ * A window works on one workspace at a time. Switching to another one suspends
+ * it: its session is written to the directory of the workspace in the binary
+ * format, along with its modified documents as blobs in a subdirectory (see
+ * Sessions::writeSession()).
+ * Resuming it restores the session like at startup, so only the active tabs are
+ * loaded right away.
+ *
+ * The unmodified documents that are loaded when a workspace is suspended are
+ * kept in memory, within a limit, so that resuming it doesn't read and decode
+ * them again unless their file has changed in the meantime (see
+ * DocEngine::retainDocument()).
+ */
+class Workspaces {
+public:
+
+    /**
+     * @brief Returns the name of the workspace the first window starts with.
+     */
+    static QString defaultWorkspace();
+
+    /**
+     * @brief Returns the names of the workspaces that have been suspended, sorted.
+     */
+    static QStringList suspendedWorkspaces();
+
+    /**
+     * @brief Returns true if the name can be given to a workspace.
+     */
+    static bool isValidName(const QString& name);
+
+    /**
+     * @brief Suspends the workspace of a window: writes its session, and keeps the
+     *        documents of its unmodified tabs in memory. The tabs are left open.
+     *        It doesn't block: the editors are asked for their state all at once,
+     *        and the files are written on the I/O threads.
+     * @return A promise resolved with whether the session has been written.
+     */
+    static QtPromise::QPromise<bool> suspend(TopEditorContainer* editorContainer, const QString& name);
+
+    /**
+     * @brief Restores the tabs of a suspended workspace in a window, next to the
+     *        existing ones. Does nothing if the workspace has never been suspended.
+     */
+    static void resume(DocEngine* docEngine, TopEditorContainer* editorContainer, const QString& name);
+
+    /**
+     * @brief Deletes the session and the blobs of a suspended workspace.
+     */
+    static bool remove(const QString& name);
+
+private:
+    /**
+     * @brief s_retainedDocuments contains the documents kept in memory by suspend(), least
+     *        recently retained first, along with their size in bytes.
+     */
+    static QList<QPair<QString, qint64>> s_retainedDocuments;
+    static qint64 s_retainedSize;
+
+    /**
+     * @brief workspaceDirPath Returns the directory of a workspace. It's named after the
+     *        hash of the name of the workspace, which is stored inside it.
+     */
+    static QString workspaceDirPath(const QString& name);
+
+    static QString sessionPath(const QString& name);
+
+    /**
+     * @brief writeWorkspace Writes the name and the session of a workspace. Safe to call
+     *        from any thread.
+     */
+    static bool writeWorkspace(const Sessions::SessionSnapshot& session, const QString& name);
+
+    /**
+     * @brief retainDocument Keeps a document in memory, freeing the least recently retained
+     *        ones if they don't fit anymore.
+     */
+    static void retainDocument(const QString& filePath, const DocEngine::DecodedText& decoded);
+};
+
+#endif // WORKSPACES_H
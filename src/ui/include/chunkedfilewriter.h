@@ -0,0 +1,66 @@
+#ifndef CHUNKEDFILEWRITER_H
+#define CHUNKEDFILEWRITER_H
+
+#include <QFileDevice>
+#include <QSaveFile>
+#include <QScopedPointer>
+#include <QString>
+#include <QTextCodec>
+
+/**
+ * @brief The permissions and the owner of a file. They belong to the original
+ *        file, so they're lost when QSaveFile renames its temporary file over it.
+ */
+struct FileOwnership {
+    bool exists = false;
+    QFileDevice::Permissions permissions;
+    uint ownerId = 0;
+    uint groupId = 0;
+};
+
+FileOwnership fileOwnership(const QString &fileName);
+
+/**
+ * @brief Gives the permissions and the owner of the file it replaced back to a
+ *        file that has just been written. Only root can change the owner: anyone
+ *        else can still keep the group, if they belong to it.
+ */
+void restoreFileOwnership(const QString &fileName, const FileOwnership &ownership);
+
+/**
+ * @brief A file that is written atomically one chunk of text at a time, as the
+ *        chunks are received from the editor. The chunks are encoded and written
+ *        on the I/O thread pool, each one after the previous one: only one thread
+ *        uses the file at a time.
+ */
+class ChunkedFileWriter
+{
+public:
+    ChunkedFileWriter(const QString &fileName, QTextCodec *codec);
+
+    /**
+     * @brief Opens the file and writes the BOM, if not empty.
+     * @return The error message, or a null string.
+     */
+    QString open(const QByteArray &bom);
+
+    void write(const QString &text);
+
+    // Number of bytes written so far
+    qint64 size() const { return m_size; }
+
+    /**
+     * @brief Replaces the file with what has been written, keeping its
+     *        permissions and its owner.
+     * @return The error message, or a null string.
+     */
+    QString commit();
+
+private:
+    QSaveFile m_file;
+    FileOwnership m_ownership;
+    QScopedPointer<QTextEncoder> m_encoder;
+    qint64 m_size = 0;
+};
+
+#endif // CHUNKEDFILEWRITER_H
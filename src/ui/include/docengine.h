@@ -2,13 +2,17 @@
 #define DOCENGINE_H
 
 #include "editortabwidget.h"
+#include "filefollower.h"
 #include "topeditorcontainer.h"
 
 #include <QFile>
-#include <QFileSystemWatcher>
+#include <QHash>
 #include <QObject>
+#include <QSet>
 #include <QUrl>
 
+class QThreadPool;
+
 /**
  * @brief Provides methods for managing documents
  *
@@ -27,6 +31,15 @@ public:
         QTextCodec *codec = nullptr;
         bool bom = false;
         bool error = false;
+        qint64 size = 0; // Number of bytes read from the file
+    };
+
+    /**
+     * @brief What writeAtomically() has written.
+     */
+    struct WrittenDocument {
+        int changeSequence = 0; // Change sequence of the content that has been written
+        qint64 size = 0;        // Number of bytes written
     };
 
     enum FileSizeAction {
@@ -75,6 +88,12 @@ public:
         // This parameter has effect only for background executions (i.e. executeInBackground()).
         DocumentLoader& setPriorityIdx(int idx) { priorityIdx = idx; return *this; }
 
+        // If true, the documents are opened in background tabs with deferred editors (see
+        // Editor::getDeferredEditor()), and are only read once their tab is first shown or
+        // their content is needed. Until then, they only hold their file path.
+        // This parameter has effect only for background executions (i.e. executeInBackground()).
+        DocumentLoader& setDeferred(bool d) { deferred = d; return *this; }
+
         // Set whether, after an Editor has been created and his content has been loaded,
         // the document loader should take care of things like assigning a file path to the
         // editor, setting the syntax highlighting, enabling monitoring and so on.
@@ -119,6 +138,7 @@ public:
         bool bom                        = false;
         FileSizeAction fileSizeAction   = FileSizeActionAsk;
         int priorityIdx                 = ALL_MAXIMUM_PRIORITY;
+        bool deferred                   = false;
         std::function<void(QSharedPointer<Editor> editor, const QUrl& url)> manualEditorInitialization = nullptr;
 
     private:
@@ -151,9 +171,10 @@ public:
      *                    file name of the document.
      * @param copy If true, do not change the file name of the document to the
      *             new path. Just save a copy.
-     * @return A MainWindow::saveFileResult.
+     * @return A promise resolved with a DocEngine::saveFileResult once the
+     *         document has been written, or the user has given up.
      */
-    int saveDocument(EditorTabWidget *tabWidget, int tab, QUrl outFileName = QUrl(), bool copy = false);
+    QPromise<int> saveDocument(EditorTabWidget *tabWidget, int tab, QUrl outFileName = QUrl(), bool copy = false);
 
     void closeDocument(EditorTabWidget *tabWidget, int tab);
 
@@ -165,21 +186,50 @@ public:
     void unmonitorDocument(QSharedPointer<Editor> editor);
     bool isMonitored(Editor *editor);
 
+    /**
+     * @brief Enables or disables follow mode for a document. While a document
+     *        is followed, data appended to its file on disk is appended to the
+     *        editor and scrolled into view, instead of asking the user to reload.
+     *        If the file gets truncated, the whole document is reloaded.
+     * @param tabWidget
+     * @param tab
+     * @param follow
+     */
+    void setFollowed(EditorTabWidget *tabWidget, int tab, bool follow);
+    bool isFollowed(Editor *editor) const;
+
     int addNewDocument(QString name, bool setFocus, EditorTabWidget *tabWidget);
-    void reinterpretEncoding(QSharedPointer<Editor> editor, QTextCodec *codec, bool bom);
+    QPromise<void> reinterpretEncoding(QSharedPointer<Editor> editor, QTextCodec *codec, bool bom);
     static DocEngine::DecodedText readToString(QFile *file);
     static DocEngine::DecodedText readToString(QFile *file, QTextCodec *codec, bool bom);
     static bool writeFromString(QIODevice *io, const DecodedText &write);
 
     /**
-     * @brief Write the provided Editor content to the specified IO device, using
-     *        the encoding and the BOM settings specified in the Editor.
-     * @param io
+     * @brief Write the provided Editor content to a local file, without ever
+     *        leaving a truncated file behind: the content is written to a
+     *        temporary file that is synced to disk and then renamed over
+     *        the target, which keeps its permissions and owner. The content
+     *        is received from the Editor in chunks, which are encoded and
+     *        written on the I/O thread pool as they arrive.
+     * @param fileName
      * @param editor
-     * @return true if successful, false otherwise
+     * @return A promise resolved with what has been written, or rejected with
+     *         the error message (a QString).
      */
-    bool write(QIODevice *io, QSharedPointer<Editor> editor);
-    bool write(QUrl outFileName, QSharedPointer<Editor> editor);
+    QPromise<WrittenDocument> writeAtomically(const QString &fileName, QSharedPointer<Editor> editor);
+
+    /**
+     * @brief Saves a number of documents concurrently, without user interaction.
+     *        The contents are requested to all the editors at once, then
+     *        converted, encoded and written atomically on the I/O thread pool.
+     *        Every editor must already have a local file name. The editors
+     *        whose tab is closed meanwhile are left untouched.
+     * @param editors
+     * @return A promise resolved when all the documents have been processed,
+     *         with one "file name: error" entry for each document that
+     *         couldn't be saved.
+     */
+    QPromise<QStringList> saveDocumentsInBackground(const QList<QSharedPointer<Editor>> &editors);
 
     /**
      * @brief getNewDocumentName
@@ -187,9 +237,67 @@ public:
      */
     QString getNewDocumentName() const;
 
+    /**
+     * @brief Converts the line endings of the text and encodes it, BOM
+     *        included. Safe to call from any thread.
+     */
+    static QByteArray encodeText(QString text, const QString &endOfLineSequence, QTextCodec *codec, bool bom);
+
+    /**
+     * @brief Replaces a file with the data, atomically where possible.
+     *        Safe to call from any thread.
+     * @return A null string if successful, the error message otherwise.
+     */
+    static QString writeFileAtomically(const QString &fileName, const QByteArray &data);
+
+    /**
+     * @brief Starts reading and decoding a file on the I/O thread pool, so that
+     *        it's ready by the time a document is loaded from it. The next load
+     *        of the file that detects the encoding automatically uses the result,
+     *        once, unless the file has changed in the meantime. Safe to call from
+     *        any thread.
+     */
+    static void prefetchDocument(const QString &fileName);
+
+    /**
+     * @brief Keeps a document that has already been decoded, e.g. the content of an
+     *        unmodified editor that is being closed, so that the next load of the file
+     *        uses it like a prefetched one, instead of reading and decoding it again.
+     */
+    static void retainDocument(const QString &fileName, const DecodedText &decoded);
+
+    /**
+     * @brief Frees a document prefetched by prefetchDocument() that is no longer
+     *        expected to be loaded.
+     */
+    static void discardPrefetchedDocument(const QString &fileName);
+
+    /**
+     * @brief Threads used to read and write documents, so that slow or
+     *        network file systems don't block the UI.
+     */
+    static QThreadPool* ioThreadPool();
+
 private:
     TopEditorContainer *m_topEditorContainer;
-    QFileSystemWatcher *m_fsWatcher;
+    QSet<QString> m_monitoredFiles; // Files registered by this DocEngine in the FileMonitor
+    QHash<Editor*, FileFollower> m_followedDocuments;
+
+    /**
+     * @brief Starts following the file of a followed document after the bytes that
+     *        are already in the editor.
+     * @param offset Number of bytes of the file the editor has been loaded from, or
+     *        that have been saved from it.
+     */
+    void resetFollowState(QSharedPointer<Editor> editor, qint64 offset);
+
+    /**
+     * @brief Appends to a followed document the data that has been appended
+     *        to its file, or reloads it completely if the file has been truncated.
+     * @return false if the document can't be followed anymore, e.g. because
+     *         the file has been removed.
+     */
+    bool followDocument(EditorTabWidget *tabWidget, int tab);
 
     /**
      * @brief Read a file and puts the content into the provided Editor, clearing
@@ -201,7 +309,24 @@ private:
      */
     QPromise<void> read(QFile *file, QSharedPointer<Editor> editor);
     QPromise<void> read(QFile *file, QSharedPointer<Editor> editor, QTextCodec *codec, bool bom);
-    // FIXME Separate from reload
+
+    /**
+     * @brief Read a file into an Editor that already contains a version of it.
+     *        Only the lines that differ from the current content are replaced,
+     *        so the undo history is kept and the reload itself can be undone.
+     *        The Editor is marked as clean afterwards.
+     * @param file
+     * @param editor
+     * @param codec If nullptr, the encoding is detected automatically.
+     * @param bom
+     * @return fulfilled if successful, rejected otherwise
+     */
+    QPromise<void> reload(QFile *file, QSharedPointer<Editor> editor, QTextCodec *codec, bool bom);
+
+    /**
+     * @brief Applies codec, BOM and end of line sequence of the decoded text to the Editor.
+     */
+    static void setEditorFormat(QSharedPointer<Editor> editor, const DecodedText &decoded);
 
     /**
      * @brief loadDocuments Responsible for loading or reloading a number of text files.
@@ -224,9 +349,12 @@ private:
      * @brief Decodes a byte array into a string, trying to guess the best
      *        codec.
      * @param contents
+     * @param directory Absolute path of the directory the contents were read
+     *        from, if any. The encoding detected for a file is remembered per
+     *        directory and tried first on the next file of the same directory.
      * @return
      */
-    static DecodedText decodeText(const QByteArray &contents);
+    static DecodedText decodeText(const QByteArray &contents, const QString &directory = QString());
     /**
      * @brief Decodes a byte array into a string, using the specified codec.
      * @param contents
@@ -238,6 +366,24 @@ private:
 
     static QByteArray getBomForCodec(QTextCodec *codec);
 
+    /**
+     * @brief Returns the BOM that has to be written manually before the text
+     *        encoded with the codec, because the codec doesn't generate it.
+     */
+    static QByteArray getManualBom(QTextCodec *codec);
+
+    /**
+     * @brief Checks whether the data is plain ASCII or well-formed UTF-8.
+     *        A multi-byte sequence cut by the end of the buffer is accepted,
+     *        so that a prefix of a file can be checked.
+     */
+    static bool isValidUtf8(const char *data, int size);
+
+    /**
+     * @brief Sets the icon of the tab of the editor, if it's still in tabWidget.
+     */
+    static void restoreTabIcon(EditorTabWidget *tabWidget, QSharedPointer<Editor> editor, const QIcon &icon);
+
     /**
      * @brief getAvailableSudoProgram Queries the system to find a supported graphical sudo tool.
      * @return Empty string if none found. Else either 'kdesu', 'gksu', or 'pkexec'.
@@ -249,9 +395,26 @@ private:
      * @param sudoProgram Name of the sudo tool to use. Only 'kdesu', 'gksu' and 'pkexec' supported.
      * @param outFileName Target location of file
      * @param editor Editor to be saved
-     * @return True if successful.
+     * @return A promise resolved with what has been written, or rejected with the
+     *         error message (a QString).
+     */
+    QPromise<WrittenDocument> trySudoSave(QString sudoProgram, QUrl outFileName, QSharedPointer<Editor> editor);
+
+    /**
+     * @brief Asks the user what to do if the document couldn't be written: try again,
+     *        as root or not, until it has been written or the user gives up.
+     * @param written The first attempt, see writeAtomically().
+     * @return A promise resolved with what has been written, or rejected if the user
+     *         has given up.
+     */
+    QPromise<WrittenDocument> writeOrAskToRetry(const QUrl &outFileName, QSharedPointer<Editor> editor,
+                                                const QPromise<WrittenDocument> &written);
+
+    /**
+     * @brief Like writeAtomically(), but reads the whole document at once
+     *        through Editor::snapshot() instead of one chunk at a time.
      */
-    bool trySudoSave(QString sudoProgram, QUrl outFileName, QSharedPointer<Editor> editor);
+    QPromise<WrittenDocument> writeSnapshotAtomically(const QString &fileName, QSharedPointer<Editor> editor);
 
 signals:
     /**
@@ -23,6 +23,13 @@ public:
     int indexOf(QWidget *widget) const;
 
     int addEditorTab(bool setFocus, const QString &title);
+
+    /**
+     * @brief Add a new document whose editor is only loaded when the tab is
+     *        first shown. See Editor::getDeferredEditor().
+     * @return Tab index of the new document.
+     */
+    int addDeferredEditorTab(const QString &title);
     /**
      * @brief Add a new document, moving it from another EditorTabWidget
      * @param setFocus True to give focus to the new document
@@ -94,9 +101,11 @@ private:
      * @param title Title of the new tab. It's not used if a tab transfer is occurring
      * @param source Container of the tab to transfer. Set it to 0 to create a new tab.
      * @param sourceTabIndex Tab index, within @param source, of the tab to transfer
+     * @param deferred True to create the new tab with a deferred editor
      * @return Index of the tab
      */
-    int rawAddEditorTab(const bool setFocus, const QString &title, EditorTabWidget *source, const int sourceTabIndex);
+    int rawAddEditorTab(const bool setFocus, const QString &title, EditorTabWidget *source, const int sourceTabIndex,
+                        const bool deferred = false);
 
 private slots:
     void on_cleanChanged(bool isClean); 
@@ -110,6 +119,7 @@ signals:
 
 public slots:
     void setSavedIcon(int index, bool saved);
+    void setSavingIcon(int index);
 
 protected:
     void mouseReleaseEvent(QMouseEvent *ev);
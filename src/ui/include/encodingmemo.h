@@ -0,0 +1,61 @@
+#ifndef ENCODINGMEMO_H
+#define ENCODINGMEMO_H
+
+#include <QString>
+#include <QTextCodec>
+
+/**
+ * @brief Remembers the last encoding detected for each directory. Files of the
+ *        same directory usually share their encoding, so the remembered one is
+ *        tried before detecting it again (see DocEngine::decodeText()).
+ *
+ * A remembered encoding that can reject a file, like the multi-byte ones, is
+ * used if it decodes the file without errors. Single-byte encodings decode
+ * any file, so they're only used if the result looks like text of such an
+ * encoding. UTF-8 is checked before anyway, and UTF-16 and UTF-32 accept
+ * most files, so they're never remembered. Safe to use from any thread:
+ * files are also read by the Find in Files workers.
+ */
+class EncodingMemo {
+public:
+
+    /**
+     * @brief Returns the encoding remembered for a directory, or nullptr.
+     */
+    static QTextCodec* codecForDirectory(const QString& directory);
+
+    /**
+     * @brief Decodes a file of a directory with the encoding remembered for it.
+     * @param detectionSize Size of the prefix of the file that the encoding
+     *        would be detected from.
+     * @param outText The decoded file.
+     * @return The encoding, or nullptr if none is remembered or it doesn't fit
+     *         the file: its encoding must then be detected.
+     */
+    static QTextCodec* decode(const QString& directory, const QByteArray& contents, int detectionSize,
+                              QString& outText);
+
+    /**
+     * @brief Remembers the encoding detected for a file of a directory. Forgets
+     *        the one of the directory instead if this one is UTF-8, UTF-16 or UTF-32.
+     */
+    static void remember(const QString& directory, QTextCodec* codec);
+
+    /**
+     * @brief Returns whether the codec reports invalid characters for some input,
+     *        like multi-byte encodings do. Single-byte encodings decode any byte
+     *        to a character, so they would accept every file of a directory. So
+     *        do UTF-16 and UTF-32 for most files of an even size.
+     */
+    static bool canRejectInput(QTextCodec* codec);
+
+    /**
+     * @brief Returns whether a file decoded with a single-byte encoding looks
+     *        like text of that encoding: a small share of its first bytes are
+     *        not ASCII, and it contains no C1 control characters (U+0080 to
+     *        U+009F) and no replacement characters.
+     */
+    static bool looksLikeSingleByteText(const QByteArray& contents, int detectionSize, const QString& text);
+};
+
+#endif // ENCODINGMEMO_H
@@ -0,0 +1,46 @@
+#ifndef FILEFOLLOWER_H
+#define FILEFOLLOWER_H
+
+#include <QByteArray>
+#include <QSharedPointer>
+#include <QString>
+#include <QTextCodec>
+
+/**
+ * @brief The position of a followed document in its file. Turns the data
+ *        appended to the file into the text to append to the editor.
+ */
+class FileFollower {
+public:
+    FileFollower() = default;
+
+    /**
+     * @param codec Encoding of the file.
+     * @param offset Number of bytes of the file already in the editor.
+     */
+    FileFollower(QTextCodec *codec, qint64 offset);
+
+    qint64 offset() const { return m_offset; }
+
+    /**
+     * @brief Returns true if a file of the given size can't hold the bytes that
+     *        are already in the editor, e.g. a rotated log. The document must
+     *        then be reloaded completely.
+     */
+    bool isTruncated(qint64 fileSize) const { return fileSize < m_offset; }
+
+    /**
+     * @brief Decodes the data read from the file at offset(), and moves past it.
+     *        Multi-byte sequences and \r\n split between two reads are kept
+     *        until the next one.
+     * @return The text to append, with \n line endings. May be empty.
+     */
+    QString append(const QByteArray &data);
+
+private:
+    qint64 m_offset = 0;
+    QSharedPointer<QTextDecoder> m_decoder;
+    bool m_pendingCarriageReturn = false; // The last read ended between \r and a possible \n
+};
+
+#endif // FILEFOLLOWER_H
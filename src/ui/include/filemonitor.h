@@ -0,0 +1,119 @@
+#ifndef FILEMONITOR_H
+#define FILEMONITOR_H
+
+#include <QDateTime>
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QString>
+#include <QTimer>
+
+class QSocketNotifier;
+
+/**
+ * @brief Watches files for changes on behalf of the whole process.
+ *
+ * Files are watched through their parent directory, so that any number
+ * of open files in the same directory costs a single inotify watch.
+ * Where inotify isn't available, or a directory can't be watched (e.g.
+ * because the limit of inotify watches has been reached), the files are
+ * watched one by one with a QFileSystemWatcher.
+ *
+ * Change events are coalesced: fileChanged() is emitted at most once
+ * every DEBOUNCE_INTERVAL milliseconds for each file. Events that report
+ * a write, a creation, a removal or a rename are always notified, since
+ * a rewrite may keep the same size within the resolution of the
+ * modification time. Events that only report changed attributes are
+ * notified if the size or the modification time changed. If the kernel
+ * drops events, every file is checked that way.
+ *
+ * Files are reference counted, so multiple windows can watch the same one.
+ * The monitor belongs to the QCoreApplication and is destroyed with it.
+ */
+class FileMonitor : public QObject
+{
+    Q_OBJECT
+public:
+    static FileMonitor& getInstance();
+
+    ~FileMonitor();
+
+    /**
+     * @brief Starts watching a file. When the file is added for the first time,
+     *        its current state is used as a reference for later changes.
+     * @param filePath Absolute path of a local file.
+     */
+    void addFile(const QString &filePath);
+
+    /**
+     * @brief Stops watching a file, once it has been removed as many times
+     *        as it has been added.
+     */
+    void removeFile(const QString &filePath);
+
+    bool isWatched(const QString &filePath) const;
+
+signals:
+    /**
+     * @brief The file has been modified, replaced or removed.
+     * @param filePath The path as passed to addFile().
+     */
+    void fileChanged(const QString &filePath);
+
+private:
+    static const int DEBOUNCE_INTERVAL = 200;
+
+    struct FileStamp {
+        bool exists = false;
+        qint64 size = 0;
+        QDateTime lastModified;
+
+        bool operator==(const FileStamp &other) const;
+        bool operator!=(const FileStamp &other) const { return !(*this == other); }
+    };
+
+    struct WatchedFile {
+        int refCount = 0;
+        FileStamp stamp;
+    };
+
+    QHash<QString, WatchedFile> m_files;
+    QHash<QString, QHash<QString, QString>> m_directories; // Directory -> file name -> watched path
+    QHash<QString, bool> m_pendingFiles; // Path -> whether the content surely changed
+    QTimer m_debounceTimer;
+
+    // inotify backend
+    int m_inotifyFd = -1;
+    QSocketNotifier *m_inotifyNotifier = nullptr;
+    QHash<int, QString> m_watchDescriptors; // Watch descriptor -> directory
+    QHash<QString, int> m_directoryWatches; // Directory -> watch descriptor
+
+    // Fallback backend, created when it's first needed
+    QFileSystemWatcher *m_fsWatcher = nullptr;
+    QSet<QString> m_fallbackFiles; // Files watched by m_fsWatcher
+
+    explicit FileMonitor(QObject *parent);
+    FileMonitor& operator=(FileMonitor&) = delete;
+
+    static FileStamp stampOf(const QString &filePath);
+
+    /**
+     * @return Whether the directory is watched with inotify.
+     */
+    bool watchDirectory(const QString &directory);
+    void unwatchDirectory(const QString &directory);
+    void readInotifyEvents();
+
+    QFileSystemWatcher *fallbackWatcher();
+    void watchWithFallback(const QString &filePath);
+
+    /**
+     * @param changed Whether the event surely means that the content changed,
+     *        rather than only possibly, e.g. if only the attributes changed.
+     */
+    void scheduleCheck(const QString &filePath, bool changed);
+    void checkPendingFiles();
+};
+
+#endif // FILEMONITOR_H
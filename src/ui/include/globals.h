@@ -1,6 +1,7 @@
 #ifndef GLOBALS_H
 #define GLOBALS_H
 
+#include <QEventLoop>
 #include <QString>
 #include <QtPromise>
 
@@ -29,5 +30,39 @@ namespace PForResult {
  */
 QtPromise::QPromise<PForResult::Enum> pFor(int start, int end, std::function<QtPromise::QPromise<PForResult::Enum>(int i, QtPromise::QPromise<PForResult::Enum> _break, QtPromise::QPromise<PForResult::Enum> _continue)> iteration);
 
+/**
+ * @brief Blocks until the promise is settled and returns its value, or a default-constructed
+ *        value if it has been rejected. Unlike QPromise::wait(), which keeps calling
+ *        processEvents() in a loop, this sleeps in a nested event loop that is woken up by
+ *        the promise itself. That loop is still reentrant: other events, timers and
+ *        replies are handled while waiting.
+ *
+ *        Only use it where the caller's own API is synchronous and can't be chained with
+ *        then() yet: saving sessions, the document loaders, closing tabs, the synchronous
+ *        extension stubs.
+ * @param ok If not null, set to false if the promise has been rejected, true otherwise.
+ */
+template <typename T>
+T waitFor(const QtPromise::QPromise<T> &promise, bool *ok = nullptr)
+{
+    T result{};
+    bool fulfilled = false;
+    QEventLoop loop;
+    promise.then([&result, &fulfilled](const T &value){ result = value; fulfilled = true; })
+           .finally([&loop]{ loop.quit(); });
+    loop.exec();
+
+    if (ok)
+        *ok = fulfilled;
+
+    return result;
+}
+
+/**
+ * @brief Blocks until the promise is settled. See waitFor(const QPromise<T>&, bool*).
+ * @param ok If not null, set to false if the promise has been rejected, true otherwise.
+ */
+void waitFor(const QtPromise::QPromise<void> &promise, bool *ok = nullptr);
+
 #endif // GLOBALS_H
 
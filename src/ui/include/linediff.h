@@ -0,0 +1,26 @@
+#ifndef LINEDIFF_H
+#define LINEDIFF_H
+
+#include <QStringList>
+
+#include <vector>
+
+/**
+ * @brief A range of lines [from, to) of the old text, to be replaced by "lines".
+ */
+struct LineChange {
+    int from;
+    int to;
+    QStringList lines;
+};
+
+/**
+ * @brief Computes the changes that turn oldLines into newLines, using
+ *        Myers' O(ND) algorithm on the region left after stripping the
+ *        common leading and trailing lines. Used to reload a document
+ *        without replacing the lines that didn't change.
+ * @return The changes, sorted by line and non-overlapping.
+ */
+std::vector<LineChange> diffLines(const QStringList &oldLines, const QStringList &newLines);
+
+#endif // LINEDIFF_H
@@ -15,6 +15,7 @@
 #include <QtPromise>
 
 #include <functional>
+#include <memory>
 
 using namespace QtPromise;
 
@@ -22,6 +23,10 @@ namespace Ui {
 class MainWindow;
 }
 
+namespace Sessions {
+struct SessionSnapshot;
+}
+
 class MainWindow : public QMainWindow
 {
     Q_OBJECT
@@ -77,6 +82,18 @@ public:
 
     DocEngine*  getDocEngine() const;
     void generateRunMenu();
+
+    /**
+     * @brief Returns the name of the workspace shown by this window, or an empty
+     *        string if its tabs don't belong to any (see Workspaces).
+     */
+    QString workspace() const;
+
+    /**
+     * @brief Names the workspace shown by this window without changing its tabs,
+     *        e.g. once they've been restored from the cache.
+     */
+    void setWorkspace(const QString &name);
 public slots:
     void refreshEditorUiInfo(QSharedPointer<Editor> editor);
     void refreshEditorUiCursorInfo(QMap<QString, QVariant> data);
@@ -142,6 +159,7 @@ private slots:
     void on_documentReloaded(EditorTabWidget *tabWidget, int tab);
     void on_documentLoaded(EditorTabWidget *tabWidget, int tab, bool wasAlreadyOpened, bool updateRecentDocs);
     void on_actionReload_from_Disk_triggered();
+    void on_actionFollow_File_Changes_triggered(bool on);
     void on_actionFind_Next_triggered();
     void on_actionFind_Previous_triggered();
     void on_actionRename_triggered();
@@ -195,6 +213,8 @@ private slots:
     void on_actionToggle_Smart_Indent_toggled(bool on);
     void on_actionLoad_Session_triggered();
     void on_actionSave_Session_triggered();
+    void on_actionNew_Workspace_triggered();
+    void on_actionDelete_Workspace_triggered();
     void on_actionShow_Menubar_toggled(bool arg1);
     void on_actionShow_Toolbar_toggled(bool arg1);
     void on_actionMath_Rendering_toggled(bool on);
@@ -223,12 +243,30 @@ private:
     bool                  beginSelectPositionSet = false;
 
     AdvancedSearchDock*  m_advSearchDock;
+    QString              m_workspace;
+    bool                 m_savingTabsToCache = false; // See saveTabsToCache()
+    bool                 m_tabsSavedToCache = false;
+
+    /**
+     * @brief saveTabsToCache Saves tabs to cache, then closes the window. The state of all
+     *        the tabs is collected at once, then the session and all unsaved progress are
+     *        written to the cache in the background. The window is disabled meanwhile, and
+     *        stays open if the user chooses to abort because the session can't be written.
+     */
+    void                saveTabsToCache();
+
+    /**
+     * @brief writeTabsToCache Writes a session collected by saveTabsToCache() on the I/O
+     *        threads. Without a session, the tabs are saved the slow way.
+     * @return A promise resolved with whether the session has been written.
+     */
+    QPromise<bool>      writeTabsToCache(const std::shared_ptr<Sessions::SessionSnapshot>& session);
 
     /**
-     * @brief saveTabsToCache Saves tabs to cache. Utilizes the saveSession function and
-     *        saves all unsaved progress in the cache.
+     * @brief finishSavingTabsToCache Closes the window once the session has been written,
+     *        or lets the user retry, abort or ignore the error.
      */
-    bool                saveTabsToCache();
+    void                finishSavingTabsToCache(const std::shared_ptr<Sessions::SessionSnapshot>& session, bool success);
 
     /**
      * @brief Acts like closing all tabs, asking to the user for input before discarding
@@ -265,16 +303,38 @@ private:
      *        open a dialog to ask the user where to save the file.
      * @param tabWidget
      * @param tab
-     * @return a saveFileResult
+     * @return A promise resolved with a saveFileResult once the document
+     *         has been written, or the user has given up.
      */
-    int                 save(EditorTabWidget *tabWidget, int tab);
-    int                 saveAs(EditorTabWidget *tabWidget, int tab, bool copy);
+    QPromise<int>       save(EditorTabWidget *tabWidget, int tab);
+    QPromise<int>       saveAs(EditorTabWidget *tabWidget, int tab, bool copy);
     QUrl                getSaveDialogDefaultFileName(EditorTabWidget *tabWidget, int tab);
     void                setupLanguagesMenu();
     void                transformSelectedText(std::function<QString (const QString &)> func);
     void                restoreWindowSettings();
     void                loadIcons();
     void                updateRecentDocsInMenu();
+    void                updateWorkspacesMenu();
+
+    /**
+     * @brief Suspends the workspace of this window and resumes the specified one in its
+     *        place. Tabs that don't belong to any workspace are closed as usual instead,
+     *        asking the user to save their changes. The workspace is suspended without
+     *        blocking; the window is disabled meanwhile.
+     */
+    void                switchToWorkspace(const QString &name);
+
+    /**
+     * @brief Second half of switchToWorkspace(): restores the specified workspace and
+     *        closes the tabs of the previous one.
+     */
+    void                resumeWorkspace(const QString &name);
+
+    /**
+     * @brief Returns the window that shows the specified workspace, if any.
+     */
+    static MainWindow*  windowOfWorkspace(const QString &name);
+
     void                convertEditorEncoding(QSharedPointer<Editor> editor, QTextCodec *codec, bool bom);
     void                toggleOverwrite();
     void                checkIndentationMode(QSharedPointer<Editor> editor);
@@ -83,6 +83,7 @@ public:
         NQQ_SETTING(AutosaveInterval,               int,        15)      // In seconds
         NQQ_SETTING(LastSelectedDir,                QString,    ".")
         NQQ_SETTING(LastSelectedSessionDir,         QString,    QString())
+        NQQ_SETTING(Workspace,                      QString,    QString())  // Of the tabs remembered on exit
         NQQ_SETTING(RecentDocuments,                QList<QVariant>, QList<QVariant>())
         NQQ_SETTING(WarnIfFileLargerThan,           int,        1)
 
@@ -0,0 +1,64 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <QString>
+#include <QtGlobal>
+
+/**
+ * @brief Records how long the steps of Notepadqq take, e.g. at startup, and writes
+ *        them as a Chrome trace (JSON) when the application exits. The trace can be
+ *        opened with chrome://tracing or https://ui.perfetto.dev.
+ *
+ * Tracing is enabled with the --trace command-line option. Until the command line
+ * has been parsed, the events are kept in memory, so that the first steps of the
+ * startup are traced too. Once tracing is disabled, recording an event costs a
+ * single check. Events can be recorded from any thread.
+ */
+class Tracer
+{
+public:
+    /**
+     * @brief Records a step from its creation until end() is called or it's destroyed.
+     *        The spans of a thread must be nested.
+     */
+    class Span
+    {
+    public:
+        /**
+         * @param name A string literal: it's only copied if the trace is written.
+         */
+        explicit Span(const char *name);
+        ~Span();
+
+        void end();
+
+    private:
+        const char *m_name;
+        qint64 m_start = -1; // In usec, -1 if not recorded
+    };
+
+    /**
+     * @brief Sets the file the trace is written to on exit. If the path is empty,
+     *        tracing is disabled and the events recorded so far are dropped.
+     *        Must be called once the QCoreApplication has been created.
+     */
+    static void setOutputFile(const QString &filePath);
+
+    static bool isEnabled();
+
+    /**
+     * @brief Records the beginning of a step that ends in a different scope, e.g. once
+     *        a message has been received. The id tells apart the steps with the same
+     *        name that overlap.
+     */
+    static void beginAsync(const char *name, const void *id);
+    static void endAsync(const char *name, const void *id);
+
+    /**
+     * @brief Writes the events recorded so far to the output file.
+     * @return Whether the trace has been written.
+     */
+    static bool writeTrace();
+};
+
+#endif // TRACER_H
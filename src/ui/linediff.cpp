@@ -0,0 +1,114 @@
+#include "include/linediff.h"
+
+#include <algorithm>
+
+namespace {
+
+// Above this number of edits the differing region is replaced as a whole.
+// This bounds both time and memory of diffLines().
+constexpr int MAX_DIFF_EDITS = 512;
+
+} // namespace
+
+std::vector<LineChange> diffLines(const QStringList &oldLines, const QStringList &newLines)
+{
+    std::vector<LineChange> changes;
+
+    const int minSize = std::min(oldLines.size(), newLines.size());
+    int prefix = 0;
+    while (prefix < minSize && oldLines[prefix] == newLines[prefix])
+        prefix++;
+
+    int suffix = 0;
+    while (suffix < minSize - prefix &&
+           oldLines[oldLines.size() - 1 - suffix] == newLines[newLines.size() - 1 - suffix])
+        suffix++;
+
+    const int n = oldLines.size() - prefix - suffix;
+    const int m = newLines.size() - prefix - suffix;
+
+    if (n == 0 && m == 0)
+        return changes;
+
+    const LineChange wholeRegion { prefix, prefix + n, newLines.mid(prefix, m) };
+    if (n == 0 || m == 0) {
+        changes.push_back(wholeRegion);
+        return changes;
+    }
+
+    auto a = [&](int i) -> const QString& { return oldLines[prefix + i]; };
+    auto b = [&](int i) -> const QString& { return newLines[prefix + i]; };
+
+    // v[offset + k] is the furthest x reached on diagonal k. A copy is kept
+    // for every d so that the path can be walked back afterwards.
+    const int maxEdits = std::min(n + m, MAX_DIFF_EDITS);
+    const int offset = maxEdits + 1;
+    std::vector<int> v(static_cast<size_t>(2 * offset + 1), 0);
+    std::vector<std::vector<int>> trace;
+    bool found = false;
+
+    for (int d = 0; d <= maxEdits && !found; d++) {
+        trace.push_back(v);
+        for (int k = -d; k <= d; k += 2) {
+            int x = (k == -d || (k != d && v[offset + k - 1] < v[offset + k + 1])) ?
+                        v[offset + k + 1] : v[offset + k - 1] + 1;
+            int y = x - k;
+            while (x < n && y < m && a(x) == b(y)) {
+                x++;
+                y++;
+            }
+            v[offset + k] = x;
+            if (x >= n && y >= m) {
+                found = true;
+                break;
+            }
+        }
+    }
+
+    if (!found) {
+        changes.push_back(wholeRegion);
+        return changes;
+    }
+
+    // Walk back from (n, m) and collect the edits. Insertions are
+    // identified by the new line index, deletions by the old one.
+    struct Edit { bool insertion; int oldIdx; int newIdx; };
+    std::vector<Edit> edits;
+    int x = n;
+    int y = m;
+    for (int d = static_cast<int>(trace.size()) - 1; d > 0; d--) {
+        const std::vector<int>& tv = trace[static_cast<size_t>(d)];
+        const int k = x - y;
+        const int prevK = (k == -d || (k != d && tv[offset + k - 1] < tv[offset + k + 1])) ? k + 1 : k - 1;
+        const int prevX = tv[offset + prevK];
+        const int prevY = prevX - prevK;
+
+        while (x > prevX && y > prevY) {
+            x--;
+            y--;
+        }
+
+        edits.push_back(Edit{ x == prevX, prevX, prevY });
+        x = prevX;
+        y = prevY;
+    }
+    std::reverse(edits.begin(), edits.end());
+
+    // Group adjacent edits into line ranges
+    for (const Edit& e : edits) {
+        LineChange* last = changes.empty() ? nullptr : &changes.back();
+        const bool contiguous = last != nullptr && last->to == prefix + e.oldIdx;
+
+        if (!contiguous) {
+            changes.push_back(LineChange{ prefix + e.oldIdx, prefix + e.oldIdx, QStringList() });
+            last = &changes.back();
+        }
+
+        if (e.insertion)
+            last->lines.append(b(e.newIdx));
+        else
+            last->to++;
+    }
+
+    return changes;
+}
@@ -1,4 +1,5 @@
 #include "include/EditorNS/editor.h"
+#include "include/EditorNS/editorpool.h"
 #include "include/Extensions/extensionsloader.h"
 #include "include/Sessions/backupservice.h"
 #include "include/Sessions/persistentcache.h"
@@ -9,6 +10,7 @@
 #include "include/nqqsettings.h"
 #include "include/singleapplication.h"
 #include "include/stats.h"
+#include "include/tracer.h"
 
 #include <QDateTime>
 #include <QFileInfo>
@@ -25,9 +27,15 @@
 
 void forceDefaultSettings();
 void loadExtensions();
+#ifdef QT_DEBUG
+void benchmarkEditorBridge(QSharedPointer<Editor> editor);
+#endif
 
 int main(int argc, char *argv[])
 {
+    // Until the event loop starts
+    Tracer::Span startupSpan("Startup");
+
     QTranslator translator;
 #ifdef QT_DEBUG
     QElapsedTimer __aet_timer;
@@ -44,7 +52,9 @@ int main(int argc, char *argv[])
     SingleApplication::setAttribute(Qt::AA_EnableHighDpiScaling);
     SingleApplication::setAttribute(Qt::AA_UseHighDpiPixmaps);
 #endif
+    Tracer::Span applicationSpan("Create application");
     SingleApplication a(argc, argv);
+    applicationSpan.end();
 
     QCoreApplication::setOrganizationName("Notepadqq");
     QCoreApplication::setApplicationName("Notepadqq");
@@ -57,6 +67,7 @@ int main(int argc, char *argv[])
     QSettings::setDefaultFormat(QSettings::IniFormat);
 
 
+    Tracer::Span settingsSpan("Load settings");
     NqqSettings::ensureBackwardsCompatibility();
     NqqSettings& settings = NqqSettings::getInstance();
     settings.General.setNotepadqqVersion(POINTVERSION);
@@ -74,7 +85,9 @@ int main(int argc, char *argv[])
             settings.General.setLocalization("en");
         }
     }
+    settingsSpan.end();
 
+    Tracer::Span translatorSpan("Load translator");
     QString langCode = settings.General.getLocalization();
     if (translator.load(QLocale(langCode),
                         QString("%1").arg(qApp->applicationName().toLower()),
@@ -84,9 +97,14 @@ int main(int argc, char *argv[])
     } else {
         settings.General.setLocalization("en");
     }
+    translatorSpan.end();
+
     // Check for "run-and-exit" options like -h or -v
     const auto parser = Notepadqq::getCommandLineArgumentsParser(QApplication::arguments());
 
+    // Drops the events recorded so far if tracing isn't wanted
+    Tracer::setOutputFile(parser->value("trace"));
+
     if (parser->isSet("print-debug-info")) {
         Notepadqq::printEnvironmentInfo();
         return EXIT_SUCCESS;
@@ -101,7 +119,11 @@ int main(int argc, char *argv[])
         return EXIT_SUCCESS;
     }
 
-    if (a.attachToOtherInstance()) {
+    Tracer::Span attachSpan("Attach to other instance");
+    const bool attached = a.attachToOtherInstance();
+    attachSpan.end();
+
+    if (attached) {
         return EXIT_SUCCESS;
     }
 
@@ -138,6 +160,7 @@ int main(int argc, char *argv[])
     }
 
     if (Extensions::ExtensionsLoader::extensionRuntimePresent()) {
+        Tracer::Span extensionsSpan("Start extensions");
         Extensions::ExtensionsLoader::startExtensionsServer();
         Extensions::ExtensionsLoader::loadExtensions(Notepadqq::extensionsPath());
     } else {
@@ -150,16 +173,25 @@ int main(int argc, char *argv[])
     const bool wantToRestore = settings.General.getAutosaveInterval() > 0 && BackupService::detectImproperShutdown();
     if (wantToRestore) {
         // Attempt to restore from backup. Don't forget to handle commandline arguments.
+        Tracer::Span restoreSpan("Restore backup");
         if (BackupService::restoreFromBackup())
             MainWindow::instances().back()->openCommandLineProvidedUrls(QDir::currentPath(), QApplication::arguments());
     }
 
     // If we don't have a window by now (e.g. through restoring backup), we'll create one normally.
     if (MainWindow::instances().isEmpty()) {
+        Tracer::Span windowSpan("Create window");
         MainWindow* wnd = new MainWindow(QStringList(), nullptr);
+        windowSpan.end();
 
         if (settings.General.getRememberTabsOnExit()) {
-            Sessions::loadSession(wnd->getDocEngine(), wnd->topEditorContainer(), PersistentCache::cacheSessionPath());
+            const bool legacySession = !QFileInfo::exists(PersistentCache::cacheSessionPath());
+            Sessions::loadSession(wnd->getDocEngine(), wnd->topEditorContainer(),
+                                  legacySession ? PersistentCache::legacyCacheSessionPath() : PersistentCache::cacheSessionPath());
+
+            // The tabs are those of the workspace the window showed on exit
+            if (!settings.General.getWorkspace().isEmpty())
+                wnd->setWorkspace(settings.General.getWorkspace());
         }
 
         wnd->openCommandLineProvidedUrls(QDir::currentPath(), QApplication::arguments());
@@ -172,6 +204,9 @@ int main(int argc, char *argv[])
 #ifdef QT_DEBUG
     qint64 __aet_elapsed = __aet_timer.nsecsElapsed();
     qDebug() << QString("Started in " + QString::number(__aet_elapsed / 1000 / 1000) + "msec").toStdString().c_str();
+
+    if (parser->isSet("benchmark-editor-bridge"))
+        benchmarkEditorBridge(MainWindow::instances().back()->currentEditor());
 #endif
 
     // Initialize stats, but delay so that we are sure that
@@ -180,8 +215,14 @@ int main(int argc, char *argv[])
         Stats::init();
     });
 
+    startupSpan.end();
+
     auto retVal = a.exec();
 
+#ifdef QT_DEBUG
+    qDebug() << EditorPool::getInstance().statisticsReport().toStdString().c_str();
+#endif
+
     // Properly cleanup cached editors
     Editor::invalidateEditorBuffer();
 
@@ -189,6 +230,62 @@ int main(int argc, char *argv[])
     return retVal;
 }
 
+#ifdef QT_DEBUG
+/**
+ * @brief Measures the round-trip time of requests to the javascript editor and prints it:
+ *        one request at a time, many requests in flight at once, and replies carrying
+ *        a large payload. Only requests that previous versions have are used, so that
+ *        this function can be built against them to get a baseline.
+ */
+void benchmarkEditorBridge(QSharedPointer<Editor> editor)
+{
+    const int iterations = 1000;
+    const int payloadIterations = 10;
+    const QString payload(1024 * 1024, QChar('x'));
+    auto timer = QSharedPointer<QElapsedTimer>::create();
+
+    // The payload goes into an editor of its own, so that the current document is left alone
+    QSharedPointer<Editor> payloadEditor = Editor::getNewEditor();
+
+    auto report = [timer](const QString &name, int count) {
+        const double elapsedMs = timer->nsecsElapsed() / 1000000.0;
+        qDebug() << QString("Editor bridge, %1: %2 requests in %3 msec, %4 usec per request")
+                    .arg(name)
+                    .arg(count)
+                    .arg(elapsedMs, 0, 'f', 1)
+                    .arg(elapsedMs * 1000 / count, 0, 'f', 1)
+                    .toStdString().c_str();
+    };
+
+    auto sendAll = [](QSharedPointer<Editor> editor, const QString &msg, int count) {
+        QVector<QPromise<QVariant>> requests;
+        for (int i = 0; i < count; i++)
+            requests.append(editor->asyncSendMessageWithResultP(msg));
+        return QtPromise::all(requests);
+    };
+
+    // The first requests also wait for the editors to be loaded: keep them out of the measures.
+    payloadEditor->setValue(payload).then([=](){
+        return editor->asyncSendMessageWithResultP("C_FUN_GET_HISTORY_GENERATION");
+    }).then([=](){
+        timer->start();
+        return pFor(0, iterations, [=](int, QPromise<PForResult::Enum>, QPromise<PForResult::Enum> _continue) {
+            return editor->asyncSendMessageWithResultP("C_FUN_GET_HISTORY_GENERATION").then([=](){ return _continue; });
+        });
+    }).then([=](){
+        report("sequential", iterations);
+        timer->restart();
+        return sendAll(editor, "C_FUN_GET_HISTORY_GENERATION", iterations);
+    }).then([=](){
+        report("pipelined", iterations);
+        timer->restart();
+        return sendAll(payloadEditor, "C_FUN_GET_VALUE", payloadIterations);
+    }).then([=](){
+        report("1 MiB payload", payloadIterations);
+    });
+}
+#endif
+
 void forceDefaultSettings()
 {
     NqqSettings& s = NqqSettings::getInstance();
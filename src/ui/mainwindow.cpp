@@ -10,6 +10,7 @@
 #include "include/Sessions/backupservice.h"
 #include "include/Sessions/persistentcache.h"
 #include "include/Sessions/sessions.h"
+#include "include/Sessions/workspaces.h"
 #include "include/clickablelabel.h"
 #include "include/editortabwidget.h"
 #include "include/frmabout.h"
@@ -17,6 +18,7 @@
 #include "include/frmindentationmode.h"
 #include "include/frmlinenumberchooser.h"
 #include "include/frmpreferences.h"
+#include "include/globals.h"
 #include "include/iconprovider.h"
 #include "include/notepadqq.h"
 #include "include/nqqrun.h"
@@ -37,10 +39,14 @@
 #include <QToolBar>
 #include <QToolButton>
 #include <QUrl>
+#include <QtConcurrent/QtConcurrentRun>
 #include <QtPrintSupport/QPrintDialog>
 #include <QtPrintSupport/QPrintPreviewDialog>
 #include <QtPromise>
 
+#include <algorithm>
+#include <map>
+
 using namespace QtPromise;
 
 QList<MainWindow*> MainWindow::m_instances = QList<MainWindow*>();
@@ -56,6 +62,10 @@ MainWindow::MainWindow(const QString &workingDirectory, const QStringList &argum
     ui->setupUi(this);
     setAttribute(Qt::WA_DeleteOnClose);
 
+    // A workspace is shown by a single window: the others start without one
+    if (windowOfWorkspace(Workspaces::defaultWorkspace()) == nullptr)
+        m_workspace = Workspaces::defaultWorkspace();
+
     MainWindow::m_instances.append(this);
 
     // Gets company name from QCoreApplication::setOrganizationName(). Same for app name.
@@ -124,6 +134,8 @@ MainWindow::MainWindow(const QString &workingDirectory, const QStringList &argum
 
     updateRecentDocsInMenu();
 
+    connect(ui->menuWorkspaces, &QMenu::aboutToShow, this, &MainWindow::updateWorkspacesMenu);
+
     setAcceptDrops(true);
 
     generateRunMenu();
@@ -383,10 +395,55 @@ void MainWindow::loadToolBar()
     }
 }
 
-bool MainWindow::saveTabsToCache()
+void MainWindow::saveTabsToCache()
+{
+    // The window has been asked to close again in the meantime
+    if (m_savingTabsToCache)
+        return;
+
+    m_savingTabsToCache = true;
+
+    // The changes made from now on wouldn't be in the session
+    setEnabled(false);
+
+    // The tabs are restored as this workspace
+    m_settings.General.setWorkspace(m_workspace);
+
+    // Ask all the editors for their state at once. Once collected, the session doesn't
+    // need them anymore: it's written without blocking the UI.
+    Sessions::collectSession(m_topEditorContainer, PersistentCache::cacheDirPath(), Sessions::CacheIndex())
+            .fail([]() {
+        return std::shared_ptr<Sessions::SessionSnapshot>();
+    }).then([=](const std::shared_ptr<Sessions::SessionSnapshot>& session) {
+        writeTabsToCache(session).then([=](bool success) {
+            finishSavingTabsToCache(session, success);
+        });
+    });
+}
+
+QPromise<bool> MainWindow::writeTabsToCache(const std::shared_ptr<Sessions::SessionSnapshot>& session)
+{
+    const QString sessionPath = PersistentCache::cacheSessionPath();
+
+    // The editors couldn't all be asked for their state: try again the slow way.
+    // If saveSession() returns false, something went wrong. Most likely writing to the session file.
+    if (!session) {
+        return QPromise<bool>::resolve(Sessions::saveSession(m_topEditorContainer, sessionPath,
+                                                             Sessions::SessionFormat::Binary,
+                                                             PersistentCache::cacheDirPath()));
+    }
+
+    return QtPromise::resolve(QtConcurrent::run(DocEngine::ioThreadPool(), [session, sessionPath]() {
+        return Sessions::writeSession(*session, sessionPath, nullptr, Sessions::SessionFormat::Binary);
+    }));
+}
+
+void MainWindow::finishSavingTabsToCache(const std::shared_ptr<Sessions::SessionSnapshot>& session, bool success)
 {
-    // If saveSession() returns false, something went wrong. Most likely writing to the .xml file.
-    while (!Sessions::saveSession(m_docEngine, m_topEditorContainer, PersistentCache::cacheSessionPath(), PersistentCache::cacheDirPath())) {
+    if (success) {
+        // The session of previous versions has been replaced
+        QFile::remove(PersistentCache::legacyCacheSessionPath());
+    } else {
         QMessageBox msgBox;
         msgBox.setWindowTitle(QCoreApplication::applicationName());
         msgBox.setText(tr("Error while trying to save this session. Please ensure the following directory is accessible:\n\n") +
@@ -397,15 +454,23 @@ bool MainWindow::saveTabsToCache()
         msgBox.setIcon(QMessageBox::Critical);
 
         int result = msgBox.exec();
-        if (result == QMessageBox::Abort) {
-            return false;
-        } else if (result == QMessageBox::Ignore) {
-            // Do as if all went well
-            return true;
+        if (result == QMessageBox::Retry) {
+            writeTabsToCache(session).then([=](bool written) {
+                finishSavingTabsToCache(session, written);
+            });
+            return;
+        } else if (result == QMessageBox::Abort) {
+            // Keep the window open
+            m_savingTabsToCache = false;
+            setEnabled(true);
+            return;
         }
+
+        // Ignore: do as if all went well
     }
 
-    return true;
+    m_tabsSavedToCache = true;
+    close();
 }
 
 bool MainWindow::finalizeAllTabs()
@@ -435,6 +500,16 @@ DocEngine* MainWindow::getDocEngine() const
     return m_docEngine;
 }
 
+QString MainWindow::workspace() const
+{
+    return m_workspace;
+}
+
+void MainWindow::setWorkspace(const QString &name)
+{
+    m_workspace = name;
+}
+
 //Return a list of all available action items in the menu
 QList<QAction*> MainWindow::getActions() const
 {
@@ -542,45 +617,44 @@ void MainWindow::openCommandLineProvidedUrls(const QString &workingDirectory, co
                 .setUrls(files)
                 .setTabWidget(m_topEditorContainer->currentTabWidget())
                 .execute()
-                .wait(); // FIXME Transform to async
-
-    // Handle --line and --column commandline arguments
-    if (!parser->isSet("line") && !parser->isSet("column"))
-        return;
+                .then([this, parser, rawUrls](){
+        // Handle --line and --column commandline arguments
+        if (!parser->isSet("line") && !parser->isSet("column"))
+            return;
 
-    if (rawUrls.size() > 1) {
-        qWarning() << tr("The '--line' and '--column' arguments will be ignored since more than one file is opened.");
-        return;
-    }
+        if (rawUrls.size() > 1) {
+            qWarning() << tr("The '--line' and '--column' arguments will be ignored since more than one file is opened.");
+            return;
+        }
 
-    int l = 0;
-    if (parser->isSet("line")) {
-        bool okay;
-        l = parser->value("line").toInt(&okay);
+        int l = 0;
+        if (parser->isSet("line")) {
+            bool okay;
+            l = parser->value("line").toInt(&okay);
 
-        if(!okay)
-            qWarning() << tr("Invalid value for '--line' argument: %1").arg(parser->value("line"));
-    }
+            if(!okay)
+                qWarning() << tr("Invalid value for '--line' argument: %1").arg(parser->value("line"));
+        }
 
-    int c = 0;
-    if (parser->isSet("column")) {
-        bool okay;
-        c = parser->value("column").toInt(&okay);
+        int c = 0;
+        if (parser->isSet("column")) {
+            bool okay;
+            c = parser->value("column").toInt(&okay);
 
-        if(!okay)
-            qWarning() << tr("Invalid value for '--column' argument: %1").arg(parser->value("column"));
-    }
+            if(!okay)
+                qWarning() << tr("Invalid value for '--column' argument: %1").arg(parser->value("column"));
+        }
 
-    // This needs to sit inside a timer because CodeMirror apparently chokes on receiving a setCursorPosition()
-    // right after construction of the Editor.
-    auto ed = m_topEditorContainer->currentTabWidget()->currentEditor();
-    QTimer* t = new QTimer();
-    connect(t, &QTimer::timeout, [t, l, c, ed](){
-        ed->setCursorPosition(l-1, c-1);
-        t->deleteLater();
+        // This needs to sit inside a timer because CodeMirror apparently chokes on receiving a setCursorPosition()
+        // right after construction of the Editor.
+        auto ed = m_topEditorContainer->currentTabWidget()->currentEditor();
+        QTimer* t = new QTimer();
+        connect(t, &QTimer::timeout, [t, l, c, ed](){
+            ed->setCursorPosition(l-1, c-1);
+            t->deleteLater();
+        });
+        t->start(0);
     });
-    t->start(0);
-
 }
 
 void MainWindow::dragEnterEvent(QDragEnterEvent *e)
@@ -935,10 +1009,16 @@ int MainWindow::closeTab(EditorTabWidget *tabWidget, int tab, bool remove, bool
     int result = MainWindow::tabCloseResult_AlreadySaved;
     auto editor = tabWidget->editor(tab);
 
+    // Send both requests before waiting, so that we only wait for a single round-trip.
+    // The contents are only needed to tell whether a document without a file is empty.
+    const bool isOrphan = editor->filePath().isEmpty();
+    auto isCleanP = editor->isCleanP();
+    auto valueP = isOrphan ? editor->valueP() : QPromise<QString>::resolve(QString());
+    const bool isEmptyOrphan = isOrphan && waitFor(valueP).isEmpty();
+
     // If the tab is the only existing one, is not associated with a file, and has no contents,
     // we'll not close it.
-    if ( m_topEditorContainer->count()==1 && tabWidget->count()==1 &&
-         editor->filePath().isEmpty() && editor->value().isEmpty()) {
+    if ( m_topEditorContainer->count()==1 && tabWidget->count()==1 && isEmptyOrphan) {
 
         // If user tried to close last open (clean) tab, check if Nqq should just quit.
         if(m_settings.General.getExitOnLastTabClose())
@@ -947,7 +1027,7 @@ int MainWindow::closeTab(EditorTabWidget *tabWidget, int tab, bool remove, bool
         goto cleanup;
     }
 
-    if (force || editor->isClean() || (editor->filePath().isEmpty() && editor->value().isEmpty())) {
+    if (force || waitFor(isCleanP) || isEmptyOrphan) {
         if (remove) m_docEngine->closeDocument(tabWidget, tab);
         goto cleanup;
     }
@@ -956,7 +1036,7 @@ int MainWindow::closeTab(EditorTabWidget *tabWidget, int tab, bool remove, bool
     tabWidget->setCurrentIndex(tab);
     switch(askIfWantToSave(tabWidget, tab, askToSaveChangesReason_tabClosing)) {
     case QMessageBox::Save: {
-        switch(save(tabWidget, tab)) {
+        switch(waitFor(save(tabWidget, tab))) {
         case DocEngine::saveFileResult_Canceled:
             result = MainWindow::tabCloseResult_Canceled;
             break;
@@ -1009,7 +1089,7 @@ int MainWindow::closeTab(EditorTabWidget *tabWidget, int tab)
     return closeTab(tabWidget, tab, true, false);
 }
 
-int MainWindow::save(EditorTabWidget *tabWidget, int tab)
+QPromise<int> MainWindow::save(EditorTabWidget *tabWidget, int tab)
 {
     auto editor = tabWidget->editor(tab);
 
@@ -1040,14 +1120,14 @@ int MainWindow::save(EditorTabWidget *tabWidget, int tab)
             msgBox.setDefaultButton(QMessageBox::Cancel);
             int ret = msgBox.exec();
             if (ret == QMessageBox::Cancel)
-                return DocEngine::saveFileResult_Canceled;
+                return QPromise<int>::resolve(DocEngine::saveFileResult_Canceled);
         }
 
         return m_docEngine->saveDocument(tabWidget, tab, editor->filePath());
     }
 }
 
-int MainWindow::saveAs(EditorTabWidget *tabWidget, int tab, bool copy)
+QPromise<int> MainWindow::saveAs(EditorTabWidget *tabWidget, int tab, bool copy)
 {
     // See https://github.com/notepadqq/notepadqq/issues/654
     BackupServicePauser bsp; bsp.pause();
@@ -1068,7 +1148,7 @@ int MainWindow::saveAs(EditorTabWidget *tabWidget, int tab, bool copy)
         // Write
         return m_docEngine->saveDocument(tabWidget, tab, QUrl::fromLocalFile(filename), copy);
     } else {
-        return DocEngine::saveFileResult_Canceled;
+        return QPromise<int>::resolve(DocEngine::saveFileResult_Canceled);
     }
 }
 
@@ -1166,14 +1246,19 @@ void MainWindow::on_actionCut_triggered()
 
 void MainWindow::on_actionBegin_End_Select_triggered()
 {
+    auto editor = currentEditor();
+
     if (!beginSelectPositionSet) {
-        beginSelectPosition = currentEditor()->cursorPosition();
         beginSelectPositionSet = true;
+        editor->cursorPositionP().then([this](QPair<int, int> position){
+            beginSelectPosition = position;
+        });
     } else {
-        QPair<int, int> endSelectPosition = currentEditor()->cursorPosition();
-        currentEditor()->setSelection(
-            beginSelectPosition.first, beginSelectPosition.second, endSelectPosition.first, endSelectPosition.second);
         beginSelectPositionSet = false;
+        editor->cursorPositionP().then([this, editor](QPair<int, int> endSelectPosition){
+            editor->setSelection(
+                beginSelectPosition.first, beginSelectPosition.second, endSelectPosition.first, endSelectPosition.second);
+        });
     }
 }
 
@@ -1209,7 +1294,8 @@ void MainWindow::on_editorAdded(EditorTabWidget *tabWidget, int tab)
     });
     connect(editor.data(), &Editor::urlsDropped, this, &MainWindow::on_editorUrlsDropped);
 
-    // Initialize editor with UI settings
+    // Initialize editor with UI settings, all in a single message
+    Editor::Transaction transaction(editor);
     editor->setLineWrap(ui->actionWord_wrap->isChecked());
     editor->setTabsVisible(ui->actionShow_Tabs->isChecked());
     editor->setEOLVisible(ui->actionShow_End_of_Line->isChecked());
@@ -1239,6 +1325,11 @@ void MainWindow::refreshEditorUiCursorInfo(QMap<QString, QVariant> data)
     auto curData = data["cursor"].toList();
     auto selData = data["selections"].toList();
     auto conData = data["content"].toList();
+
+    // Incomplete information, e.g. the first changes received by a reused editor
+    if (curData.size() < 2 || selData.size() < 2 || conData.size() < 2)
+        return;
+
     QString msg = tr("Ln %1, Col %2").arg(curData[0].toInt() + 1).arg(curData[1].toInt() + 1);
     msg += tr("    Sel %1 (%2)").arg(selData[1].toInt()).arg(selData[0].toInt());
     msg += tr("    %1 chars, %2 lines").arg(conData[1].toInt()).arg(conData[0].toInt());
@@ -1292,24 +1383,28 @@ void MainWindow::searchDockItemInteracted(const DocResult& doc, const MatchResul
 
         QUrl url = stringToUrl(doc.fileName);
 
+        // The search results may change while the document is being loaded
+        const bool hasResult = result != nullptr;
+        const MatchResult match = hasResult ? *result : MatchResult();
+
         m_docEngine->getDocumentLoader()
                 .setUrl(url)
                 .setTabWidget(m_topEditorContainer->currentTabWidget())
                 .execute()
-                .wait(); // FIXME Transform to async
+                .then([this, url, hasResult, match](){
+            QPair<int, int> pos = m_docEngine->findOpenEditorByUrl(url);
 
-        QPair<int, int> pos = m_docEngine->findOpenEditorByUrl(url);
+            if (pos.first == -1 || pos.second == -1)
+                return;
 
-        if (pos.first == -1 || pos.second == -1)
-            return;
-
-        auto editor = m_topEditorContainer->tabWidget(pos.first)->editor(pos.second);
+            auto editor = m_topEditorContainer->tabWidget(pos.first)->editor(pos.second);
 
-        if (result) {
-            editor->setSelection(result->lineNumber-1, result->positionInLine, //selection start
-                                result->lineNumber-1, result->positionInLine + result->matchLength); //selection end
-        }
-        editor->setFocus();
+            if (hasResult) {
+                editor->setSelection(match.lineNumber-1, match.positionInLine, //selection start
+                                    match.lineNumber-1, match.positionInLine + match.matchLength); //selection end
+            }
+            editor->setFocus();
+        });
     }
 }
 
@@ -1319,48 +1414,48 @@ void MainWindow::refreshEditorUiInfo(QSharedPointer<Editor> editor)
     QString name = editor->getLanguage()->name;
     m_sbFileFormatBtn->setText(name);
 
-    // Update MainWindow title
-    QString newTitle;
-    if (editor->filePath().isEmpty()) {
+    editor->isCleanP().then([=](bool isClean){
+        // Update MainWindow title
+        QString newTitle;
+        if (editor->filePath().isEmpty()) {
+
+            EditorTabWidget *tabWidget = m_topEditorContainer->tabWidgetFromEditor(editor);
+            if (tabWidget != 0) {
+                int tab = tabWidget->indexOf(editor.data());
+                if (tab != -1) {
+                    newTitle = QString("%1 - %2")
+                               .arg(tabWidget->tabText(tab))
+                               .arg(QApplication::applicationName());
+                }
+            }
 
-        EditorTabWidget *tabWidget = m_topEditorContainer->tabWidgetFromEditor(editor);
-        if (tabWidget != 0) {
-            int tab = tabWidget->indexOf(editor.data());
-            if (tab != -1) {
-                newTitle = QString("%1 - %2")
-                           .arg(tabWidget->tabText(tab))
+        } else {
+            QUrl url = editor->filePath();
+
+            QString path = url.toDisplayString(QUrl::RemovePassword |
+                                               QUrl::RemoveUserInfo |
+                                               QUrl::RemovePort |
+                                               QUrl::RemoveAuthority |
+                                               QUrl::RemoveQuery |
+                                               QUrl::RemoveFragment |
+                                               QUrl::PreferLocalFile |
+                                               QUrl::RemoveFilename |
+                                               QUrl::NormalizePathSegments |
+                                               QUrl::StripTrailingSlash
+                                               );
+
+            newTitle = QString("%1%2 (%3) - %4")
+                           .arg(Notepadqq::fileNameFromUrl(editor->filePath()))
+                           .arg(isClean ? "" : "*")
+                           .arg(path)
                            .arg(QApplication::applicationName());
-            }
         }
 
-    } else {
-        QUrl url = editor->filePath();
-
-        QString path = url.toDisplayString(QUrl::RemovePassword |
-                                           QUrl::RemoveUserInfo |
-                                           QUrl::RemovePort |
-                                           QUrl::RemoveAuthority |
-                                           QUrl::RemoveQuery |
-                                           QUrl::RemoveFragment |
-                                           QUrl::PreferLocalFile |
-                                           QUrl::RemoveFilename |
-                                           QUrl::NormalizePathSegments |
-                                           QUrl::StripTrailingSlash
-                                           );
-
-        newTitle = QString("%1%2 (%3) - %4")
-                       .arg(Notepadqq::fileNameFromUrl(editor->filePath()))
-                       .arg(editor->isClean() ? "" : "*")
-                       .arg(path)
-                       .arg(QApplication::applicationName());
-    }
-
-    if (newTitle != windowTitle()) {
-        setWindowTitle(newTitle.isNull() ? QApplication::applicationName() : newTitle);
-    }
+        if (newTitle != windowTitle()) {
+            setWindowTitle(newTitle.isNull() ? QApplication::applicationName() : newTitle);
+        }
 
-    // Enable / disable menus
-    editor->isCleanP().then([=](bool isClean){
+        // Enable / disable menus
         QUrl fileName = editor->filePath();
         ui->actionRename->setEnabled(!fileName.isEmpty());
         ui->actionMove_to_New_Window->setEnabled(isClean);
@@ -1370,6 +1465,8 @@ void MainWindow::refreshEditorUiInfo(QSharedPointer<Editor> editor)
     bool allowReloading = !editor->filePath().isEmpty();
     ui->actionReload_File_Interpreted_As->setEnabled(allowReloading);
     ui->actionReload_from_Disk->setEnabled(allowReloading);
+    ui->actionFollow_File_Changes->setEnabled(allowReloading);
+    ui->actionFollow_File_Changes->setChecked(m_docEngine->isFollowed(editor.data()));
 
     // EOL
     QString eol = editor->endOfLineSequence();
@@ -1442,11 +1539,14 @@ void MainWindow::closeEvent(QCloseEvent *event)
     QMainWindow::closeEvent(event);
 
     // Only save tabs to cache if the closing window is the last one in the process.
-    bool followThrough = m_instances.size()==1 && m_settings.General.getRememberTabsOnExit() ?
-                             saveTabsToCache() :
-                             finalizeAllTabs();
-
-    if (!followThrough) {
+    if (m_instances.size()==1 && m_settings.General.getRememberTabsOnExit()) {
+        // The window is closed again once the session has been written
+        if (!m_tabsSavedToCache) {
+            event->ignore();
+            saveTabsToCache();
+            return;
+        }
+    } else if (!finalizeAllTabs()) {
         event->ignore();
         return;
     }
@@ -1771,15 +1871,57 @@ void MainWindow::on_actionCloseRight_triggered()
 
 void MainWindow::on_actionSave_All_triggered()
 {
-    // No tab must get closed (or added) while we're iterating!!
-    m_topEditorContainer->forEachEditor([&](const int /*tabWidgetId*/, const int editorId, EditorTabWidget *tabWidget, QSharedPointer<Editor> editor) {
-        if (editor->isClean()) {
-            return true;
-        } else {
-            tabWidget->setCurrentIndex(editorId);
-            int result = save(tabWidget, editorId);
-            return (result != DocEngine::saveFileResult_Canceled);
+    // Ask all the editors whether they're dirty at once, keeping the tab order
+    auto dirty = std::make_shared<std::map<std::pair<int, int>, QSharedPointer<Editor>>>();
+
+    m_topEditorContainer->forEachEditorConcurrent([=](const int tabWidgetId, const int editorId, EditorTabWidget */*tabWidget*/, QSharedPointer<Editor> editor, std::function<void()> done) {
+        editor->isCleanP().then([=](bool isClean) {
+            if (!isClean)
+                (*dirty)[std::make_pair(tabWidgetId, editorId)] = editor;
+            done();
+        });
+    }).then([=]() {
+        QList<QSharedPointer<Editor>> background;
+        auto interactive = std::make_shared<QList<QSharedPointer<Editor>>>();
+
+        // Documents without a file name, or changed on disk, need the user: save them one by one.
+        for (const auto &item : *dirty) {
+            QSharedPointer<Editor> editor = item.second;
+
+            if (editor->filePath().isLocalFile() && !editor->fileOnDiskChanged())
+                background.append(editor);
+            else
+                interactive->append(editor);
         }
+
+        pFor(0, interactive->size(), [=](int i, QPromise<PForResult::Enum> _break, QPromise<PForResult::Enum> _continue) {
+            QSharedPointer<Editor> editor = interactive->at(i);
+
+            EditorTabWidget *tabWidget = m_topEditorContainer->tabWidgetFromEditor(editor);
+            if (!tabWidget)
+                return _continue;
+
+            const int tab = tabWidget->indexOf(editor.data());
+            tabWidget->setCurrentIndex(tab);
+            return save(tabWidget, tab).then([=](int result) {
+                return result == DocEngine::saveFileResult_Canceled ? _break : _continue;
+            });
+        }).then([=](PForResult::Enum result) {
+            if (result == PForResult::Break)
+                return;
+
+            m_docEngine->saveDocumentsInBackground(background).then([=](const QStringList &errors) {
+                if (errors.isEmpty())
+                    return;
+
+                QMessageBox msgBox(this);
+                msgBox.setWindowTitle(QCoreApplication::applicationName());
+                msgBox.setIcon(QMessageBox::Critical);
+                msgBox.setText(tr("%n document(s) could not be saved.", "", errors.size()));
+                msgBox.setDetailedText(errors.join("\n"));
+                msgBox.exec();
+            });
+        });
     });
 }
 
@@ -1920,6 +2062,136 @@ void MainWindow::updateRecentDocsInMenu()
     }
 }
 
+void MainWindow::updateWorkspacesMenu()
+{
+    ui->menuWorkspaces->clear();
+
+    QStringList names = Workspaces::suspendedWorkspaces();
+    for (MainWindow *window : m_instances) {
+        if (!window->m_workspace.isEmpty() && !names.contains(window->m_workspace))
+            names.append(window->m_workspace);
+    }
+    names.sort(Qt::CaseInsensitive);
+
+    bool anyDeletable = false;
+    for (const QString &name : names) {
+        MainWindow *window = windowOfWorkspace(name);
+
+        QAction *action = new QAction(name, ui->menuWorkspaces);
+        action->setCheckable(true);
+        action->setChecked(window == this);
+        action->setEnabled(window == nullptr || window == this);
+        connect(action, &QAction::triggered, this, [this, name]() {
+            switchToWorkspace(name);
+        });
+
+        ui->menuWorkspaces->addAction(action);
+        anyDeletable |= window == nullptr;
+    }
+
+    if (!names.isEmpty())
+        ui->menuWorkspaces->addSeparator();
+
+    ui->actionDelete_Workspace->setEnabled(anyDeletable);
+    ui->menuWorkspaces->addActions({ui->actionNew_Workspace,
+                                    ui->actionDelete_Workspace});
+}
+
+void MainWindow::switchToWorkspace(const QString &name)
+{
+    if (name == m_workspace || windowOfWorkspace(name) != nullptr)
+        return;
+
+    if (m_workspace.isEmpty()) {
+        // See https://github.com/notepadqq/notepadqq/issues/654
+        BackupServicePauser bsp; bsp.pause();
+
+        // Tabs that don't belong to a workspace are closed as usual. A lone empty tab has
+        // nothing to ask about, and closeTab() would take it as a request to exit.
+        const std::vector<QSharedPointer<Editor>> editors = m_topEditorContainer->getOpenEditors();
+        const bool loneEmptyTab = editors.size() == 1 && editors.front()->filePath().isEmpty() &&
+                waitFor(editors.front()->valueP()).isEmpty();
+
+        if (!loneEmptyTab && !finalizeAllTabs())
+            return;
+
+        resumeWorkspace(name);
+        return;
+    }
+
+    auto bsp = std::make_shared<BackupServicePauser>();
+    bsp->pause();
+
+    // The changes made from now on wouldn't be in the suspended workspace
+    setEnabled(false);
+
+    Workspaces::suspend(m_topEditorContainer, m_workspace).then([=](bool suspended) {
+        setEnabled(true);
+
+        if (!suspended) {
+            QMessageBox msgBox;
+            msgBox.setWindowTitle(QCoreApplication::applicationName());
+            msgBox.setText(tr("Error while trying to save this workspace. Please ensure the following directory is accessible:\n\n") +
+                           PersistentCache::workspacesDirPath());
+            msgBox.setStandardButtons(QMessageBox::Ok);
+            msgBox.setIcon(QMessageBox::Critical);
+            msgBox.exec();
+            return;
+        }
+
+        // Another window may have taken it in the meantime
+        if (windowOfWorkspace(name) == nullptr)
+            resumeWorkspace(name);
+
+        // The backups are resumed once bsp is released
+        Q_UNUSED(bsp);
+    });
+}
+
+void MainWindow::resumeWorkspace(const QString &name)
+{
+    // See https://github.com/notepadqq/notepadqq/issues/654
+    BackupServicePauser bsp; bsp.pause();
+
+    // The tabs of the previous workspace are closed once the new one has been restored,
+    // so that the window is never left without tabs.
+    const std::vector<QSharedPointer<Editor>> previousEditors = m_topEditorContainer->getOpenEditors();
+
+    Workspaces::resume(m_docEngine, m_topEditorContainer, name);
+
+    const std::vector<QSharedPointer<Editor>> openEditors = m_topEditorContainer->getOpenEditors();
+    const bool anyRestored = std::any_of(openEditors.begin(), openEditors.end(), [&](const QSharedPointer<Editor> &editor) {
+        return std::find(previousEditors.begin(), previousEditors.end(), editor) == previousEditors.end();
+    });
+
+    if (!anyRestored)
+        ui->actionNew->trigger();
+
+    // Their content is in the workspace, or has been dealt with by finalizeAllTabs()
+    for (const auto &editor : previousEditors) {
+        EditorTabWidget *tabWidget = m_topEditorContainer->tabWidgetFromEditor(editor);
+        if (tabWidget != nullptr)
+            m_docEngine->closeDocument(tabWidget, tabWidget->indexOf(editor));
+    }
+
+    for (int i = m_topEditorContainer->count() - 1; i >= 0; i--)
+        removeTabWidgetIfEmpty(m_topEditorContainer->tabWidget(i));
+
+    m_topEditorContainer->tabWidget(0)->currentEditor()->setFocus();
+
+    m_workspace = name;
+}
+
+MainWindow* MainWindow::windowOfWorkspace(const QString &name)
+{
+    for (MainWindow *window : m_instances) {
+        if (window->m_workspace == name)
+            return window;
+    }
+
+    return nullptr;
+}
+
 void MainWindow::on_actionReload_from_Disk_triggered()
 {
     EditorTabWidget *tabWidget = m_topEditorContainer->currentTabWidget();
@@ -1936,6 +2208,17 @@ void MainWindow::on_actionReload_from_Disk_triggered()
             .execute();
 }
 
+void MainWindow::on_actionFollow_File_Changes_triggered(bool on)
+{
+    EditorTabWidget *tabWidget = m_topEditorContainer->currentTabWidget();
+    auto editor = tabWidget->currentEditor();
+
+    if (editor->filePath().isEmpty())
+        return;
+
+    m_docEngine->setFollowed(tabWidget, tabWidget->currentIndex(), on);
+}
+
 void MainWindow::on_actionFind_Next_triggered()
 {
     if (m_frmSearchReplace)
@@ -1951,25 +2234,27 @@ void MainWindow::on_actionFind_Previous_triggered()
 void MainWindow::on_actionRename_triggered()
 {
     EditorTabWidget *tabW = m_topEditorContainer->currentTabWidget();
-    QUrl oldFilename = tabW->currentEditor()->filePath();
-    int result = saveAs(tabW, tabW->currentIndex(), false);
-
-    if (result == DocEngine::saveFileResult_Saved && !oldFilename.isEmpty()) {
-
-        if (QFileInfo(oldFilename.toLocalFile()) != QFileInfo(tabW->currentEditor()->filePath().toLocalFile())) {
-
-            // Remove the old file
-            QString filename = oldFilename.toLocalFile();
-            if (QFile::exists(filename)) {
-                if(!QFile::remove(filename)) {
-                    QMessageBox::warning(this, QApplication::applicationName(),
-                                         QString("Error: unable to remove file %1")
-                                         .arg(filename));
+    QSharedPointer<Editor> editor = tabW->currentEditor();
+    QUrl oldFilename = editor->filePath();
+
+    saveAs(tabW, tabW->currentIndex(), false).then([=](int result) {
+        if (result == DocEngine::saveFileResult_Saved && !oldFilename.isEmpty()) {
+
+            if (QFileInfo(oldFilename.toLocalFile()) != QFileInfo(editor->filePath().toLocalFile())) {
+
+                // Remove the old file
+                QString filename = oldFilename.toLocalFile();
+                if (QFile::exists(filename)) {
+                    if(!QFile::remove(filename)) {
+                        QMessageBox::warning(this, QApplication::applicationName(),
+                                             QString("Error: unable to remove file %1")
+                                             .arg(filename));
+                    }
                 }
             }
-        }
 
-    }
+        }
+    });
 }
 
 void MainWindow::on_actionWord_wrap_toggled(bool on)
@@ -2156,22 +2441,24 @@ void MainWindow::on_actionIndentation_Custom_triggered()
 {
     auto editor = currentEditor();
 
-    frmIndentationMode *dialog = new frmIndentationMode(this);
-    dialog->populateWidgets(editor->indentationMode());
+    editor->indentationModeP().then([=](Editor::IndentationMode currentIndent){
+        frmIndentationMode *dialog = new frmIndentationMode(this);
+        dialog->populateWidgets(currentIndent);
 
-    if (dialog->exec() == QDialog::Accepted) {
-        Editor::IndentationMode indent = dialog->indentationMode();
-        editor->setCustomIndentationMode(indent.useTabs, indent.size);
-    }
+        if (dialog->exec() == QDialog::Accepted) {
+            Editor::IndentationMode indent = dialog->indentationMode();
+            editor->setCustomIndentationMode(indent.useTabs, indent.size);
+        }
 
-    // Make sure the UI is consistent even if the user canceled the dialog.
-    if (editor->isUsingCustomIndentationMode()) {
-        ui->actionIndentation_Custom->setChecked(true);
-    } else {
-        ui->actionIndentation_Default_Settings->setChecked(true);
-    }
+        // Make sure the UI is consistent even if the user canceled the dialog.
+        if (editor->isUsingCustomIndentationMode()) {
+            ui->actionIndentation_Custom->setChecked(true);
+        } else {
+            ui->actionIndentation_Default_Settings->setChecked(true);
+        }
 
-    dialog->deleteLater();
+        dialog->deleteLater();
+    });
 }
 
 void MainWindow::on_actionInterpret_As_triggered()
@@ -2506,13 +2793,16 @@ void MainWindow::on_actionSpace_to_TAB_Leading_triggered()
 void MainWindow::on_actionGo_to_Line_triggered()
 {
     auto editor = currentEditor();
-    int currentLine = editor->cursorPosition().first;
+    auto cursorPositionP = editor->cursorPositionP();
     editor->lineCount().then([=](int lines){
-        frmLineNumberChooser *frm = new frmLineNumberChooser(1, lines, currentLine + 1, this);
-        if (frm->exec() == QDialog::Accepted) {
-            int line = frm->value();
-            editor->setSelection(line - 1, 0, line - 1, 0);
-        }
+        return cursorPositionP.then([=](QPair<int, int> cursorPosition){
+            const int currentLine = cursorPosition.first;
+            frmLineNumberChooser *frm = new frmLineNumberChooser(1, lines, currentLine + 1, this);
+            if (frm->exec() == QDialog::Accepted) {
+                int line = frm->value();
+                editor->setSelection(line - 1, 0, line - 1, 0);
+            }
+        });
     });
 }
 
@@ -2648,7 +2938,7 @@ void MainWindow::on_actionSave_Session_triggered()
 
     m_settings.General.setLastSelectedSessionDir(QFileInfo(filePath).dir().absolutePath());
 
-    if (Sessions::saveSession(m_docEngine, m_topEditorContainer, filePath)) {
+    if (Sessions::saveSession(m_topEditorContainer, filePath, Sessions::SessionFormat::Xml)) {
         QMessageBox msgBox;
         msgBox.setWindowTitle(QCoreApplication::applicationName());
         msgBox.setText(tr("Error while trying to save this session. Please try a different file name."));
@@ -2657,6 +2947,71 @@ void MainWindow::on_actionSave_Session_triggered()
     }
 }
 
+void MainWindow::on_actionNew_Workspace_triggered()
+{
+    bool ok;
+    const QString name = QInputDialog::getText(this,
+                                               tr("New Workspace"),
+                                               tr("Name of the new workspace:"),
+                                               QLineEdit::Normal,
+                                               QString(),
+                                               &ok);
+    if (!ok)
+        return;
+
+    QString error;
+    if (!Workspaces::isValidName(name))
+        error = tr("A workspace can't be named \"%1\".").arg(name);
+    else if (Workspaces::suspendedWorkspaces().contains(name) || windowOfWorkspace(name) != nullptr)
+        error = tr("A workspace named \"%1\" already exists.").arg(name);
+
+    if (!error.isEmpty()) {
+        QMessageBox msgBox;
+        msgBox.setWindowTitle(QCoreApplication::applicationName());
+        msgBox.setText(error);
+        msgBox.setStandardButtons(QMessageBox::Ok);
+        msgBox.setIcon(QMessageBox::Warning);
+        msgBox.exec();
+        return;
+    }
+
+    switchToWorkspace(name);
+}
+
+void MainWindow::on_actionDelete_Workspace_triggered()
+{
+    // The workspaces shown by a window can't be deleted
+    QStringList names;
+    for (const QString &name : Workspaces::suspendedWorkspaces()) {
+        if (windowOfWorkspace(name) == nullptr)
+            names.append(name);
+    }
+
+    if (names.isEmpty())
+        return;
+
+    bool ok;
+    const QString name = QInputDialog::getItem(this,
+                                               tr("Delete Workspace"),
+                                               tr("Workspace to delete:"),
+                                               names,
+                                               0,
+                                               false,
+                                               &ok);
+    if (!ok)
+        return;
+
+    QMessageBox msgBox;
+    msgBox.setWindowTitle(QCoreApplication::applicationName());
+    msgBox.setText(tr("Do you want to delete the workspace \"%1\"? Its unsaved changes will be lost.").arg(name));
+    msgBox.setStandardButtons(QMessageBox::Yes | QMessageBox::No);
+    msgBox.setDefaultButton(QMessageBox::No);
+    msgBox.setIcon(QMessageBox::Warning);
+
+    if (msgBox.exec() == QMessageBox::Yes)
+        Workspaces::remove(name);
+}
+
 void MainWindow::on_actionShow_Menubar_toggled(bool arg1)
 {
     ui->menuBar->setVisible(arg1);
@@ -106,6 +106,17 @@ QSharedPointer<QCommandLineParser> Notepadqq::getCommandLineArgumentsParser(cons
     QCommandLineOption printDebugOption("print-debug-info", QObject::tr("Print system information for debugging."));
     parser->addOption(printDebugOption);
 
+    QCommandLineOption traceOption("trace",
+                                   QObject::tr("On exit, write a trace of the startup and of the editors loaded since to the specified file, in the Chrome trace format."),
+                                   "file");
+    parser->addOption(traceOption);
+
+#ifdef QT_DEBUG
+    QCommandLineOption benchmarkBridgeOption("benchmark-editor-bridge",
+                                             QObject::tr("Measure the round-trip latency of editor requests."));
+    parser->addOption(benchmarkBridgeOption);
+#endif
+
     parser->addPositionalArgument("urls",
                                  QObject::tr("Files to open."),
                                  "[urls...]");
@@ -0,0 +1,194 @@
+#include "include/tracer.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QSaveFile>
+#include <QStringList>
+#include <QThread>
+
+#include <atomic>
+#include <vector>
+
+namespace {
+    enum class State {
+        Undecided, // The command line hasn't been parsed yet: keep the events
+        Enabled,
+        Disabled
+    };
+
+    struct Event {
+        const char *name;
+        char phase;       // 'X' for a span, 'b' and 'e' for the beginning and end of an async step
+        qint64 timestamp; // In usec since the start of the trace
+        qint64 duration;  // In usec, for spans
+        quintptr id;      // For async steps
+        int thread;
+    };
+
+    std::atomic<State> s_state(State::Undecided);
+    QString s_outputFile;
+
+    // Protects the events and the threads
+    QMutex s_mutex;
+    std::vector<Event> s_events;
+    QHash<QThread*, int> s_threads;
+    QStringList s_threadNames;
+
+    qint64 now()
+    {
+        // The trace starts with the first event
+        static const QElapsedTimer clock = []() {
+            QElapsedTimer timer;
+            timer.start();
+            return timer;
+        }();
+
+        return clock.nsecsElapsed() / 1000;
+    }
+
+    int currentThreadIndex()
+    {
+        QThread *thread = QThread::currentThread();
+
+        auto it = s_threads.constFind(thread);
+        if (it != s_threads.constEnd())
+            return it.value();
+
+        // Before the application is created, only the main thread is running
+        const bool isMainThread = QCoreApplication::instance() == nullptr ||
+                                  QCoreApplication::instance()->thread() == thread;
+
+        const int index = s_threadNames.size();
+        s_threadNames.append(isMainThread ? QString("Main thread") : QString("Thread %1").arg(index));
+        s_threads.insert(thread, index);
+        return index;
+    }
+
+    void record(Event event)
+    {
+        if (s_state == State::Disabled)
+            return;
+
+        QMutexLocker locker(&s_mutex);
+        event.thread = currentThreadIndex();
+        s_events.push_back(event);
+    }
+
+    void writeTraceOnExit()
+    {
+        if (!Tracer::writeTrace())
+            qWarning() << "Can't write the trace to" << s_outputFile;
+    }
+}
+
+Tracer::Span::Span(const char *name)
+    : m_name(name)
+{
+    if (Tracer::isEnabled())
+        m_start = now();
+}
+
+Tracer::Span::~Span()
+{
+    end();
+}
+
+void Tracer::Span::end()
+{
+    if (m_start < 0)
+        return;
+
+    record(Event{m_name, 'X', m_start, now() - m_start, 0, 0});
+    m_start = -1;
+}
+
+void Tracer::setOutputFile(const QString &filePath)
+{
+    if (filePath.isEmpty()) {
+        s_state = State::Disabled;
+
+        QMutexLocker locker(&s_mutex);
+        s_events.clear();
+        return;
+    }
+
+    s_outputFile = filePath;
+    s_state = State::Enabled;
+
+    // Run when the application is destroyed, whichever way main() returns
+    qAddPostRoutine(writeTraceOnExit);
+}
+
+bool Tracer::isEnabled()
+{
+    return s_state != State::Disabled;
+}
+
+void Tracer::beginAsync(const char *name, const void *id)
+{
+    record(Event{name, 'b', now(), 0, reinterpret_cast<quintptr>(id), 0});
+}
+
+void Tracer::endAsync(const char *name, const void *id)
+{
+    record(Event{name, 'e', now(), 0, reinterpret_cast<quintptr>(id), 0});
+}
+
+bool Tracer::writeTrace()
+{
+    if (s_state != State::Enabled)
+        return false;
+
+    const qint64 pid = QCoreApplication::applicationPid();
+    QJsonArray traceEvents;
+
+    QMutexLocker locker(&s_mutex);
+
+    for (int i = 0; i < s_threadNames.size(); i++) {
+        traceEvents.append(QJsonObject{
+            {"name", "thread_name"},
+            {"ph", "M"},
+            {"pid", pid},
+            {"tid", i},
+            {"args", QJsonObject{{"name", s_threadNames[i]}}}
+        });
+    }
+
+    for (const Event &event : s_events) {
+        QJsonObject e{
+            {"name", QString::fromUtf8(event.name)},
+            {"cat", "notepadqq"},
+            {"ph", QString(QChar::fromLatin1(event.phase))},
+            {"ts", event.timestamp},
+            {"pid", pid},
+            {"tid", event.thread}
+        };
+
+        if (event.phase == 'X')
+            e.insert("dur", event.duration);
+        else
+            e.insert("id", QString("0x%1").arg(event.id, 0, 16));
+
+        traceEvents.append(e);
+    }
+
+    locker.unlock();
+
+    QSaveFile file(s_outputFile);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    const QJsonObject trace{
+        {"traceEvents", traceEvents},
+        {"displayTimeUnit", "ms"}
+    };
+
+    file.write(QJsonDocument(trace).toJson(QJsonDocument::Compact));
+    return file.commit();
+}
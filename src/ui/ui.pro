@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui svg widgets printsupport network webenginewidgets webchannel websockets dbus
+QT       += core gui svg widgets printsupport network webenginewidgets webchannel websockets dbus concurrent
 CONFIG += c++14 link_pkgconfig
 PKGCONFIG += uchardet
 
@@ -67,6 +67,7 @@ SOURCES += main.cpp\
     topeditorcontainer.cpp \
     editortabwidget.cpp \
     docengine.cpp \
+    filemonitor.cpp \
     frmabout.cpp \
     notepadqq.cpp \
     frmpreferences.cpp \
@@ -77,6 +78,9 @@ SOURCES += main.cpp\
     EditorNS/bannerfileremoved.cpp \
     EditorNS/customqwebview.cpp \
     EditorNS/languageservice.cpp \
+    EditorNS/bulktextchannel.cpp \
+    EditorNS/editorpool.cpp \
+    EditorNS/snapshotcache.cpp \
     clickablelabel.cpp \
     frmencodingchooser.cpp \
     EditorNS/bannerindentationdetected.cpp \
@@ -99,7 +103,12 @@ SOURCES += main.cpp\
     Extensions/Stubs/menuitemstub.cpp \
     Extensions/installextension.cpp \
     keygrabber.cpp \
+    chunkedfilewriter.cpp \
+    encodingmemo.cpp \
+    filefollower.cpp \
+    linediff.cpp \
     Sessions/sessions.cpp \
+    Sessions/sessionfile.cpp \
     Sessions/persistentcache.cpp \
     nqqsettings.cpp \  
     nqqrun.cpp \
@@ -108,13 +117,19 @@ SOURCES += main.cpp\
     Search/searchobjects.cpp \
     Search/searchinstance.cpp \
     stats.cpp \
+    tracer.cpp \
     Sessions/backupservice.cpp \
+    Sessions/editjournal.cpp \
+    Sessions/editjournalfile.cpp \
+    Sessions/sessionprefetcher.cpp \
+    Sessions/workspaces.cpp \
     svgiconengine.cpp
 
 HEADERS  += include/mainwindow.h \
     include/topeditorcontainer.h \
     include/editortabwidget.h \
     include/docengine.h \
+    include/filemonitor.h \
     include/frmabout.h \
     include/notepadqq.h \
     include/frmpreferences.h \
@@ -128,6 +143,9 @@ HEADERS  += include/mainwindow.h \
     include/frmencodingchooser.h \
     include/EditorNS/bannerindentationdetected.h \
     include/EditorNS/languageservice.h \
+    include/EditorNS/bulktextchannel.h \
+    include/EditorNS/editorpool.h \
+    include/EditorNS/snapshotcache.h \
     include/frmindentationmode.h \
     include/singleapplication.h \
     include/localcommunication.h \
@@ -148,7 +166,12 @@ HEADERS  += include/mainwindow.h \
     include/Extensions/Stubs/menuitemstub.h \
     include/Extensions/installextension.h \
     include/keygrabber.h \
+    include/chunkedfilewriter.h \
+    include/encodingmemo.h \
+    include/filefollower.h \
+    include/linediff.h \
     include/Sessions/sessions.h \
+    include/Sessions/sessionfile.h \
     include/Sessions/persistentcache.h \
     include/nqqsettings.h \
     include/nqqrun.h \
@@ -157,7 +180,12 @@ HEADERS  += include/mainwindow.h \
     include/Search/filereplacer.h \
     include/Search/searchinstance.h \
     include/stats.h \
+    include/tracer.h \
     include/Sessions/backupservice.h \
+    include/Sessions/editjournal.h \
+    include/Sessions/editjournalfile.h \
+    include/Sessions/sessionprefetcher.h \
+    include/Sessions/workspaces.h \
     include/svgiconengine.h
 
 FORMS    += mainwindow.ui \